@@ -21,6 +21,80 @@ namespace lit
         return m_constants.m_count - 1;
     }
 
+    void Chunk::allocCaches()
+    {
+        m_caches = LIT_ALLOCATE(m_state, InlineCache, m_cachecount);
+        memset(m_caches, 0, sizeof(InlineCache) * m_cachecount);
+    }
+
+    size_t Chunk::instructionLength(size_t offset)
+    {
+        uint16_t constant;
+        switch(m_code[offset])
+        {
+            case OP_CONSTANT:
+            case OP_SET_LOCAL:
+            case OP_GET_LOCAL:
+            case OP_SET_PRIVATE:
+            case OP_GET_PRIVATE:
+            case OP_SET_UPVALUE:
+            case OP_GET_UPVALUE:
+            case OP_CALL:
+            case OP_VARARG:
+            case OP_REFERENCE_UPVALUE:
+            /* superinstructions stand in for their GET_LOCAL; the rest of the sequence follows */
+            case OP_INC_LOCAL:
+            case OP_ADD_LOCAL_CONST:
+            case OP_SUBTRACT_LOCAL_CONST:
+            case OP_LESS_LOCAL_CONST_JUMP:
+            case OP_LESS_LOCAL_LOCAL_JUMP:
+            case OP_GET_LOCAL_FIELD:
+                return 2;
+            case OP_CONSTANT_LONG:
+            case OP_SET_GLOBAL:
+            case OP_GET_GLOBAL:
+            case OP_SET_LOCAL_LONG:
+            case OP_GET_LOCAL_LONG:
+            case OP_SET_PRIVATE_LONG:
+            case OP_GET_PRIVATE_LONG:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_NULL:
+            case OP_JUMP_IF_NULL_POPPING:
+            case OP_JUMP:
+            case OP_JUMP_BACK:
+            case OP_AND:
+            case OP_OR:
+            case OP_NULL_OR:
+            case OP_CLASS:
+            case OP_GET_FIELD:
+            case OP_SET_FIELD:
+            case OP_METHOD:
+            case OP_STATIC_FIELD:
+            case OP_DEFINE_FIELD:
+            case OP_GET_SUPER_METHOD:
+            case OP_POP_LOCALS:
+            case OP_REFERENCE_GLOBAL:
+            case OP_REFERENCE_PRIVATE:
+            case OP_REFERENCE_LOCAL:
+                return 3;
+            case OP_INVOKE:
+            case OP_INVOKE_SUPER:
+            case OP_INVOKE_IGNORING:
+            case OP_INVOKE_SUPER_IGNORING:
+                return 6;
+            case OP_CLOSURE:
+                {
+                    /* followed by (is_local, index) for each upvalue */
+                    constant = (uint16_t)((m_code[offset + 1] << 8) | m_code[offset + 2]);
+                    return 3 + (Object::as<Function>(m_constants.m_values[constant])->upvalue_count * 3);
+                }
+                break;
+            default:
+                break;
+        }
+        return 1;
+    }
+
     void BinaryData::storeModule(Module* module, FILE* file)
     {
         size_t i;
@@ -33,7 +107,7 @@ namespace lit
         if(!disabled)
         {
             privates = &module->private_names->m_values;
-            for(i = 0; i < module->private_count; i++)
+            for(i = 0; i < privates->capacity(); i++)
             {
                 if(privates->at(i)->key != nullptr)
                 {
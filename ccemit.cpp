@@ -229,6 +229,30 @@ namespace lit
             }
         }
 
+        void Emitter::emit_cache(uint16_t line)
+        {
+            size_t index;
+            index = m_chunk->addCache();
+            if(index >= UINT16_MAX)
+            {
+                error(line, Error::LITERROR_TOO_MANY_CACHE_SITES);
+            }
+            emit_short(line, (uint16_t)index);
+        }
+
+        void Emitter::emit_global(uint16_t line, OpCode op, String* name)
+        {
+            size_t slot;
+            slot = m_state->vm->globalSlot(name);
+            if(slot >= UINT16_MAX)
+            {
+                error(line, Error::LITERROR_TOO_MANY_GLOBALS);
+            }
+            emit_op(line, op);
+            m_chunk->m_globalsites.push((uint32_t)m_chunk->m_count);
+            emit_short(line, (uint16_t)slot);
+        }
+
         void Emitter::init_compiler(Compiler* compiler, FunctionType type)
         {
             compiler->locals.init(m_state);
@@ -236,6 +260,7 @@ namespace lit
             compiler->scope_depth = 0;
             compiler->enclosing = (Compiler*)m_compiler;
             compiler->skip_return = false;
+            compiler->upvalues_full = false;
             compiler->function = Function::make(m_state, m_module);
             compiler->loop_depth = 0;
             m_compiler = compiler;
@@ -279,6 +304,76 @@ namespace lit
             }
         }
 
+        /*
+        * tries to fuse the sequence starting with the GET_LOCAL at $at, returning how many bytes it
+        * covers. only the first opcode is replaced: the rest of the sequence stays in place, so
+        * jump offsets and line info hold as they are, and a jump into the middle of a sequence
+        * still lands on a whole instruction.
+        */
+        static size_t emitter_fuseat(Chunk* chunk, size_t at)
+        {
+            size_t avail;
+            uint8_t* code;
+            Value constant;
+            code = &chunk->m_code[at];
+            avail = chunk->m_count - at;
+            if(avail >= 5 && code[2] == OP_CONSTANT)
+            {
+                constant = chunk->m_constants.m_values[code[3]];
+                if(Object::isNumber(constant))
+                {
+                    if(avail >= 8 && code[4] == OP_ADD && code[5] == OP_SET_LOCAL && code[6] == code[1] && code[7] == OP_POP)
+                    {
+                        code[0] = OP_INC_LOCAL;
+                        return 8;
+                    }
+                    if(avail >= 8 && code[4] == OP_LESS && code[5] == OP_JUMP_IF_FALSE)
+                    {
+                        code[0] = OP_LESS_LOCAL_CONST_JUMP;
+                        return 8;
+                    }
+                    if(code[4] == OP_ADD)
+                    {
+                        code[0] = OP_ADD_LOCAL_CONST;
+                        return 5;
+                    }
+                    if(code[4] == OP_SUBTRACT)
+                    {
+                        code[0] = OP_SUBTRACT_LOCAL_CONST;
+                        return 5;
+                    }
+                }
+                else if(Object::isString(constant) && avail >= 7 && code[4] == OP_GET_FIELD)
+                {
+                    code[0] = OP_GET_LOCAL_FIELD;
+                    return 7;
+                }
+            }
+            if(avail >= 8 && code[2] == OP_GET_LOCAL && code[4] == OP_LESS && code[5] == OP_JUMP_IF_FALSE)
+            {
+                code[0] = OP_LESS_LOCAL_LOCAL_JUMP;
+                return 8;
+            }
+            return 2;
+        }
+
+        static void emitter_fusechunk(Chunk* chunk)
+        {
+            size_t at;
+            at = 0;
+            while(at < chunk->m_count)
+            {
+                if(chunk->m_code[at] == OP_GET_LOCAL)
+                {
+                    at += emitter_fuseat(chunk, at);
+                }
+                else
+                {
+                    at += chunk->instructionLength(at);
+                }
+            }
+        }
+
         Function* Emitter::end_compiler(String* name)
         {
             if(!m_compiler->skip_return)
@@ -286,6 +381,10 @@ namespace lit
                 emit_return(m_lastline);
                 m_compiler->skip_return = true;
             }
+            if(Optimizer::is_enabled(LITOPTSTATE_SUPERINSTRUCTIONS))
+            {
+                emitter_fusechunk(m_chunk);
+            }
             auto function = m_compiler->function;
             m_compiler->locals.release();
             m_compiler = (Compiler*)m_compiler->enclosing;
@@ -443,7 +542,7 @@ namespace lit
             return -1;
         }
 
-        int Emitter::add_upvalue(Compiler* compiler, uint8_t index, size_t line, bool is_local)
+        int Emitter::add_upvalue(Compiler* compiler, uint16_t index, size_t line, bool is_local)
         {
             size_t upvalue_count = compiler->function->upvalue_count;
             for(size_t i = 0; i < upvalue_count; i++)
@@ -454,9 +553,13 @@ namespace lit
                     return i;
                 }
             }
-            if(upvalue_count == UINT16_COUNT)
+            if(upvalue_count == UINT8_COUNT)
             {
-                error(line, Error::LITERROR_TOO_MANY_UPVALUES);
+                if(!compiler->upvalues_full)
+                {
+                    error(line, Error::LITERROR_TOO_MANY_UPVALUES);
+                    compiler->upvalues_full = true;
+                }
                 return 0;
             }
             compiler->upvalues[upvalue_count].isLocal = is_local;
@@ -474,12 +577,12 @@ namespace lit
             if(local != -1)
             {
                 ((Compiler*)compiler->enclosing)->locals.m_values[local].captured = true;
-                return add_upvalue(compiler, (uint8_t)local, line, true);
+                return add_upvalue(compiler, (uint16_t)local, line, true);
             }
             int upvalue = resolve_upvalue((Compiler*)compiler->enclosing, name, length, line);
             if(upvalue != -1)
             {
-                return add_upvalue(compiler, (uint8_t)upvalue, line, false);
+                return add_upvalue(compiler, (uint16_t)upvalue, line, false);
             }
             return -1;
         }
@@ -796,10 +899,8 @@ namespace lit
                                 index = resolve_private(expr->name, expr->length, expression->line);
                                 if(index == -1)
                                 {
-                                    emit_op(expression->line, ref ? OP_REFERENCE_GLOBAL : OP_GET_GLOBAL);
-                                    emit_short(expression->line,
-                                               addConstant(expression->line,
-                                                            String::copy(m_state, expr->name, expr->length)->asValue()));
+                                    emit_global(expression->line, ref ? OP_REFERENCE_GLOBAL : OP_GET_GLOBAL,
+                                                String::copy(m_state, expr->name, expr->length));
                                 }
                                 else
                                 {
@@ -849,11 +950,7 @@ namespace lit
                                     index = resolve_private(e->name, e->length, expr->to->line);
                                     if(index == -1)
                                     {
-                                        //emit_op(expression->line, OP_SET_GLOBAL);
-                                        emit_op(expression->line, OP_SET_LOCAL);
-                                        emit_short(expression->line,
-                                                   addConstant(expression->line,
-                                                                String::copy(m_state, e->name, e->length)->asValue()));
+                                        emit_global(expression->line, OP_SET_GLOBAL, String::copy(m_state, e->name, e->length));
                                     }
                                     else
                                     {
@@ -887,7 +984,9 @@ namespace lit
                             emit_expression(e->where);
                             emit_expression(expr->value);
                             emit_constant(m_lastline, String::copy(m_state, e->name, e->length)->asValue());
-                            emit_ops(m_lastline, OP_SET_FIELD, OP_POP);
+                            emit_op(m_lastline, OP_SET_FIELD);
+                            emit_cache(m_lastline);
+                            emit_op(m_lastline, OP_POP);
                         }
                         else if(expr->to->type == Expression::Type::Subscript)
                         {
@@ -954,6 +1053,7 @@ namespace lit
                                 emit_short(m_lastline,
                                            addConstant(m_lastline,
                                                         String::copy(m_state, e->name, e->length)->asValue()));
+                                emit_cache(m_lastline);
                             }
                             else
                             {
@@ -964,6 +1064,7 @@ namespace lit
                                                 ((ExprSuper*)expr->callee)->ignore_result ? OP_INVOKE_SUPER_IGNORING : OP_INVOKE_SUPER,
                                                 (uint8_t)expr->args.m_count);
                                 emit_short(m_lastline, addConstant(m_lastline, e->method->asValue()));
+                                emit_cache(m_lastline);
                             }
                         }
                         else
@@ -1025,14 +1126,30 @@ namespace lit
                             {
                                 emit_constant(m_lastline,
                                               String::copy(m_state, expr->name, expr->length)->asValue());
-                                emit_op(m_lastline, ref ? OP_REFERENCE_FIELD : OP_GET_FIELD);
+                                if(ref)
+                                {
+                                    emit_op(m_lastline, OP_REFERENCE_FIELD);
+                                }
+                                else
+                                {
+                                    emit_op(m_lastline, OP_GET_FIELD);
+                                    emit_cache(m_lastline);
+                                }
                             }
                             patch_jump(expr->jump, m_lastline);
                         }
                         else if(!expr->ignore_emit)
                         {
                             emit_constant(m_lastline, String::copy(m_state, expr->name, expr->length)->asValue());
-                            emit_op(m_lastline, ref ? OP_REFERENCE_FIELD : OP_GET_FIELD);
+                            if(ref)
+                            {
+                                emit_op(m_lastline, OP_REFERENCE_FIELD);
+                            }
+                            else
+                            {
+                                emit_op(m_lastline, OP_GET_FIELD);
+                                emit_cache(m_lastline);
+                            }
                         }
                     }
                     break;
@@ -1043,6 +1160,7 @@ namespace lit
                         emit_expression(expr->value);
                         emit_constant(m_lastline, String::copy(m_state, expr->name, expr->length)->asValue());
                         emit_op(m_lastline, OP_SET_FIELD);
+                        emit_cache(m_lastline);
                     }
                     break;
                 case Expression::Type::Lambda:
@@ -1079,7 +1197,8 @@ namespace lit
                             emit_short(m_lastline, addConstant(m_lastline, function->asValue()));
                             for(size_t i = 0; i < function->upvalue_count; i++)
                             {
-                                emit_bytes(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+                                emit_byte(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0);
+                                emit_short(m_lastline, compiler.upvalues[i].index);
                             }
                         }
                         else
@@ -1122,7 +1241,8 @@ namespace lit
                             emit_short(m_lastline, addConstant(m_lastline, function->asValue()));
                             for(size_t i = 0; i < function->upvalue_count; i++)
                             {
-                                emit_bytes(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+                                emit_byte(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0);
+                                emit_short(m_lastline, compiler.upvalues[i].index);
                             }
                         }
                         else
@@ -1181,9 +1301,16 @@ namespace lit
                             }
                             else
                             {
-                                int local = resolve_local((Compiler*)m_compiler->enclosing, "this", 4, expression->line);
-                                emit_arged_op(expression->line, OP_GET_UPVALUE,
-                                              add_upvalue(m_compiler, local, expression->line, true));
+                                int upvalue = resolve_upvalue(m_compiler, "this", 4, expression->line);
+                                if(upvalue == -1)
+                                {
+                                    /* not inside a method: the receiver, if any, is in slot 0 */
+                                    emit_arged_op(expression->line, OP_GET_LOCAL, 0);
+                                }
+                                else
+                                {
+                                    emit_arged_op(expression->line, OP_GET_UPVALUE, (uint8_t)upvalue);
+                                }
                             }
                         }
                     }
@@ -1242,6 +1369,7 @@ namespace lit
                         emit_varying_op(m_lastline, OP_INVOKE, 0);
                         emit_short(m_lastline,
                                    addConstant(m_lastline, String::internValue(m_state, "join")));
+                        emit_cache(m_lastline);
                     }
                     break;
                 case Expression::Type::Reference:
@@ -1288,6 +1416,7 @@ namespace lit
             String* name;
             StmtVar* var;
             StmtVar* varstmt;
+            RegEmitter regemitter;
             StmtForLoop* forstmt;
             StmtWhileLoop* whilestmt;
             StmtIfClause* ifstmt;
@@ -1532,7 +1661,8 @@ namespace lit
                             emit_byte_or_short(m_lastline, OP_GET_LOCAL, OP_GET_LOCAL_LONG, iterator);
                             emit_varying_op(m_lastline, OP_INVOKE, 1);
                             emit_short(m_lastline,
-                                       addConstant(m_lastline, String::internValue(m_state, "iterator")));
+                                       addConstant(m_lastline, m_state->symbol(LITSYM_ITERATOR)->asValue()));
+                            emit_cache(m_lastline);
                             emit_byte_or_short(m_lastline, OP_SET_LOCAL, OP_SET_LOCAL_LONG, iterator);
                             // If iter is null, just get out of the loop
                             exit_jump = emit_jump(OP_JUMP_IF_NULL_POPPING, m_lastline);
@@ -1545,7 +1675,8 @@ namespace lit
                             emit_byte_or_short(m_lastline, OP_GET_LOCAL, OP_GET_LOCAL_LONG, iterator);
                             emit_varying_op(m_lastline, OP_INVOKE, 1);
                             emit_short(m_lastline,
-                                       addConstant(m_lastline, String::internValue(m_state, "iteratorValue")));
+                                       addConstant(m_lastline, m_state->symbol(LITSYM_ITERATOR_VALUE)->asValue()));
+                            emit_cache(m_lastline);
                             emit_byte_or_short(m_lastline, OP_SET_LOCAL, OP_SET_LOCAL_LONG, localcnt);
                             if(forstmt->body != nullptr)
                             {
@@ -1631,22 +1762,33 @@ namespace lit
                         {
                             mark_private_initialized(index);
                         }
-                        init_compiler(&compiler, LITFUNC_REGULAR);
-                        begin_scope();
-                        vararg = emit_parameters(&funcstmt->parameters, statement->line);
-                        emit_statement(funcstmt->body);
-                        end_scope(m_lastline);
-                        function = end_compiler(name);
-                        function->arg_count = funcstmt->parameters.m_count;
-                        function->max_slots += function->arg_count;
-                        function->vararg = vararg;
+                        function = nullptr;
+                        if(Optimizer::is_enabled(LITOPTSTATE_REGISTERS))
+                        {
+                            regemitter.init(m_state, this);
+                            function = regemitter.compile(funcstmt, name);
+                            regemitter.release();
+                        }
+                        if(function == nullptr)
+                        {
+                            init_compiler(&compiler, LITFUNC_REGULAR);
+                            begin_scope();
+                            vararg = emit_parameters(&funcstmt->parameters, statement->line);
+                            emit_statement(funcstmt->body);
+                            end_scope(m_lastline);
+                            function = end_compiler(name);
+                            function->arg_count = funcstmt->parameters.m_count;
+                            function->max_slots += function->arg_count;
+                            function->vararg = vararg;
+                        }
                         if(function->upvalue_count > 0)
                         {
                             emit_op(m_lastline, OP_CLOSURE);
                             emit_short(m_lastline, addConstant(m_lastline, function->asValue()));
                             for(i = 0; i < function->upvalue_count; i++)
                             {
-                                emit_bytes(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+                                emit_byte(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0);
+                                emit_short(m_lastline, compiler.upvalues[i].index);
                             }
                         }
                         else
@@ -1655,8 +1797,7 @@ namespace lit
                         }
                         if(isexport)
                         {
-                            emit_op(m_lastline, OP_SET_GLOBAL);
-                            emit_short(m_lastline, addConstant(m_lastline, name->asValue()));
+                            emit_global(m_lastline, OP_SET_GLOBAL, name);
                         }
                         else if(isprivate)
                         {
@@ -1664,9 +1805,13 @@ namespace lit
                         }
                         else
                         {
+                            /* the closure stays on the stack, as the local's slot */
                             emit_byte_or_short(m_lastline, OP_SET_LOCAL, OP_SET_LOCAL_LONG, index);
                         }
-                        emit_op(m_lastline, OP_POP);
+                        if(!islocal)
+                        {
+                            emit_op(m_lastline, OP_POP);
+                        }
                     }
                     break;
                 case Expression::Type::ReturnClause:
@@ -1695,7 +1840,7 @@ namespace lit
                 case Expression::Type::MethodDecl:
                     {
                         mthstmt = (StmtMethod*)statement;
-                        constructor = mthstmt->name->length() == (sizeof(LIT_NAME_CONSTRUCTOR)-1) && memcmp(mthstmt->name->data(), LIT_NAME_CONSTRUCTOR, strlen(LIT_NAME_CONSTRUCTOR)-1) == 0;
+                        constructor = (mthstmt->name == m_state->symbol(LITSYM_CONSTRUCTOR));
                         if(constructor && mthstmt->is_static)
                         {
                             error(statement->line, Error::LITERROR_STATIC_CONSTRUCTOR);
@@ -1716,7 +1861,8 @@ namespace lit
                             emit_short(m_lastline, addConstant(m_lastline, function->asValue()));
                             for(i = 0; i < function->upvalue_count; i++)
                             {
-                                emit_bytes(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+                                emit_byte(m_lastline, compiler.upvalues[i].isLocal ? 1 : 0);
+                                emit_short(m_lastline, compiler.upvalues[i].index);
                             }
                         }
                         else
@@ -1734,8 +1880,7 @@ namespace lit
                         m_classname = clstmt->name;
                         if(clstmt->parent != nullptr)
                         {
-                            emit_op(m_lastline, OP_GET_GLOBAL);
-                            emit_short(m_lastline, addConstant(m_lastline, clstmt->parent->asValue()));
+                            emit_global(m_lastline, OP_GET_GLOBAL, clstmt->parent);
                         }
                         emit_op(statement->line, OP_CLASS);
                         emit_short(m_lastline, addConstant(m_lastline, clstmt->name->asValue()));
@@ -39,7 +39,8 @@ namespace lit
 
         static const char* optimization_names[LITOPTSTATE_TOTAL]
         = { "constant-folding", "literal-folding", "unused-var",    "unreachable-code",
-            "empty-body",       "line-info",       "private-names", "c-for" };
+            "empty-body",       "line-info",       "private-names", "c-for",
+            "superinstructions", "registers" };
 
         static const char* optimization_descriptions[LITOPTSTATE_TOTAL]
         = { "Replaces constants in code with their values.",
@@ -49,7 +50,9 @@ namespace lit
             "Removes loops with empty bodies.",
             "Removes line information from chunks to save on space.",
             "Removes names of the private locals from modules (they are indexed by id at runtime).",
-            "Replaces for-in loops with c-style for loops where it can." };
+            "Replaces for-in loops with c-style for loops where it can.",
+            "Fuses common instruction sequences into single instructions.",
+            "Compiles simple functions to register-based code instead of bytecode." };
 
         static bool optimization_states[LITOPTSTATE_TOTAL];
 
@@ -58,6 +61,12 @@ namespace lit
 
         void Optimizer::set_level(OptimizationLevel level)
         {
+            bool registers;
+            /*
+            * register code is opt-in (-Oregisters), so that it can be benchmarked against bytecode;
+            * the levels leave it as it was, so that it also applies to -o.
+            */
+            registers = optimization_states_setup && optimization_states[(int)LITOPTSTATE_REGISTERS];
             switch(level)
             {
                 case LITOPTLEVEL_NONE:
@@ -73,6 +82,7 @@ namespace lit
                         Optimizer::set_enabled(LITOPTSTATE_EMPTY_BODY, false);
                         Optimizer::set_enabled(LITOPTSTATE_LINE_INFO, false);
                         Optimizer::set_enabled(LITOPTSTATE_PRIVATE_NAMES, false);
+                        Optimizer::set_enabled(LITOPTSTATE_REGISTERS, registers);
                     }
                     break;
                 case LITOPTLEVEL_DEBUG:
@@ -81,17 +91,20 @@ namespace lit
                         Optimizer::set_enabled(LITOPTSTATE_UNUSED_VAR, false);
                         Optimizer::set_enabled(LITOPTSTATE_LINE_INFO, false);
                         Optimizer::set_enabled(LITOPTSTATE_PRIVATE_NAMES, false);
+                        Optimizer::set_enabled(LITOPTSTATE_REGISTERS, registers);
                     }
                     break;
                 case LITOPTLEVEL_RELEASE:
                     {
                         Optimizer::set_all_enabled(true);
                         Optimizer::set_enabled(LITOPTSTATE_LINE_INFO, false);
+                        Optimizer::set_enabled(LITOPTSTATE_REGISTERS, registers);
                     }
                     break;
                 case LITOPTLEVEL_EXTREME:
                     {
                         Optimizer::set_all_enabled(true);
+                        Optimizer::set_enabled(LITOPTSTATE_REGISTERS, registers);
                     }
                     break;
                 case LITOPTLEVEL_TOTAL:
@@ -976,7 +976,7 @@ namespace lit
             if(!(parser->match(LITTOK_DOT) || parser->match(LITTOK_SMALL_ARROW)))
             {
                 expression = (Expression*)ExprSuper::make(
-                parser->m_state, line, String::copy(parser->m_state, LIT_NAME_CONSTRUCTOR, sizeof(LIT_NAME_CONSTRUCTOR)-1), false);
+                parser->m_state, line, parser->m_state->symbol(LITSYM_CONSTRUCTOR), false);
                 parser->consume(LITTOK_LEFT_PAREN, "'(' after 'super'");
                 return parse_call(parser, expression, false);
             }
@@ -0,0 +1,1152 @@
+#include "lit.h"
+#include "priv.h"
+
+namespace lit
+{
+    namespace AST
+    {
+        /* whether $expression assigns to anything, which may change a local read before it */
+        static bool regemit_assigns(Expression* expression)
+        {
+            size_t i;
+            ExprCall* call;
+            ExprIfClause* ifclause;
+            if(expression == nullptr)
+            {
+                return false;
+            }
+            switch(expression->type)
+            {
+                case Expression::Type::Assign:
+                    {
+                        return true;
+                    }
+                    break;
+                case Expression::Type::Binary:
+                    {
+                        return regemit_assigns(((ExprBinary*)expression)->left) || regemit_assigns(((ExprBinary*)expression)->right);
+                    }
+                    break;
+                case Expression::Type::Unary:
+                    {
+                        return regemit_assigns(((ExprUnary*)expression)->right);
+                    }
+                    break;
+                case Expression::Type::Call:
+                    {
+                        call = (ExprCall*)expression;
+                        for(i = 0; i < call->args.m_count; i++)
+                        {
+                            if(regemit_assigns(call->args.m_values[i]))
+                            {
+                                return true;
+                            }
+                        }
+                        return regemit_assigns(call->callee);
+                    }
+                    break;
+                case Expression::Type::IfClause:
+                    {
+                        ifclause = (ExprIfClause*)expression;
+                        return regemit_assigns(ifclause->condition) || regemit_assigns(ifclause->if_branch)
+                               || regemit_assigns(ifclause->else_branch);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            return false;
+        }
+
+        static bool regemit_iscomparison(TokenType op)
+        {
+            return op == LITTOK_EQUAL_EQUAL || op == LITTOK_BANG_EQUAL || op == LITTOK_LESS || op == LITTOK_LESS_EQUAL
+                   || op == LITTOK_GREATER || op == LITTOK_GREATER_EQUAL;
+        }
+
+        void RegEmitter::init(State* state, Emitter* emitter)
+        {
+            m_state = state;
+            m_emitter = emitter;
+            m_function = nullptr;
+            m_chunk = nullptr;
+            m_locals.init(state);
+            m_breaks.init(state);
+            m_continues.init(state);
+            m_freereg = 1;
+            m_maxreg = 1;
+            m_lastline = emitter->m_lastline;
+            m_depth = 0;
+            m_loopdepth = 0;
+        }
+
+        void RegEmitter::release()
+        {
+            m_locals.release();
+            m_breaks.release();
+            m_continues.release();
+        }
+
+        size_t RegEmitter::here()
+        {
+            return m_chunk->m_count / sizeof(uint32_t);
+        }
+
+        /* appends one word of code, in host byte order */
+        size_t RegEmitter::emit(size_t line, uint32_t instruction)
+        {
+            size_t i;
+            size_t at;
+            uint8_t bytes[sizeof(uint32_t)];
+            at = here();
+            if(line < m_lastline)
+            {
+                line = m_lastline;
+            }
+            memcpy(bytes, &instruction, sizeof(uint32_t));
+            for(i = 0; i < sizeof(uint32_t); i++)
+            {
+                m_chunk->putChunk(bytes[i], line);
+            }
+            m_lastline = line;
+            return at;
+        }
+
+        size_t RegEmitter::emit_abc(size_t line, RegOpCode op, int a, int b, int c)
+        {
+            return emit(line, LIT_FORM_ABC_INSTRUCTION((uint32_t)op, (uint32_t)a, (uint32_t)b, (uint32_t)c));
+        }
+
+        size_t RegEmitter::emit_abx(size_t line, RegOpCode op, int a, size_t bx)
+        {
+            return emit(line, LIT_FORM_ABX_INSTRUCTION((uint32_t)op, (uint32_t)a, (uint32_t)bx));
+        }
+
+        size_t RegEmitter::emit_jump(size_t line, RegOpCode op, int a)
+        {
+            uint32_t instruction;
+            instruction = LIT_FORM_ASBX_INSTRUCTION((uint32_t)op, (uint32_t)a, 0);
+            return emit(line, instruction);
+        }
+
+        /*
+        * the global's slot goes into the word after the instruction, as the big-endian short
+        * that BinaryData relocates through m_globalsites, same as in bytecode.
+        */
+        bool RegEmitter::emit_global(size_t line, RegOpCode op, int a, const char* name, size_t length)
+        {
+            size_t slot;
+            slot = m_state->vm->globalSlot(String::copy(m_state, name, length));
+            if(slot >= UINT16_MAX)
+            {
+                return false;
+            }
+            emit_abc(line, op, a, 0, 0);
+            m_chunk->m_globalsites.push((uint32_t)m_chunk->m_count);
+            m_chunk->putChunk((uint8_t)((slot >> 8) & 0xff), m_lastline);
+            m_chunk->putChunk((uint8_t)(slot & 0xff), m_lastline);
+            m_chunk->putChunk(0, m_lastline);
+            m_chunk->putChunk(0, m_lastline);
+            return true;
+        }
+
+        /* points the jump at word $at to word $target */
+        bool RegEmitter::patch_jump(size_t at, size_t target)
+        {
+            long sbx;
+            uint32_t instruction;
+            uint32_t patched;
+            sbx = (long)target - (long)(at + 1);
+            if(labs(sbx) > LIT_SBX_ARG_SIZE)
+            {
+                return false;
+            }
+            memcpy(&instruction, &m_chunk->m_code[at * sizeof(uint32_t)], sizeof(uint32_t));
+            patched = LIT_FORM_ASBX_INSTRUCTION(LIT_INSTRUCTION_OPCODE(instruction), LIT_INSTRUCTION_A(instruction), sbx);
+            memcpy(&m_chunk->m_code[at * sizeof(uint32_t)], &patched, sizeof(uint32_t));
+            return true;
+        }
+
+        /* patches the jumps of $jumps from index $from on, and drops them */
+        bool RegEmitter::patch_jumps(PCGenericArray<size_t>* jumps, size_t from, size_t target)
+        {
+            size_t i;
+            for(i = from; i < jumps->m_count; i++)
+            {
+                if(!patch_jump(jumps->m_values[i], target))
+                {
+                    return false;
+                }
+            }
+            jumps->m_count = from;
+            return true;
+        }
+
+        int RegEmitter::alloc_register()
+        {
+            if(m_freereg > LIT_RK_MAX_INDEX)
+            {
+                return -1;
+            }
+            m_freereg++;
+            if(m_freereg > m_maxreg)
+            {
+                m_maxreg = m_freereg;
+            }
+            return (int)m_freereg - 1;
+        }
+
+        /* the first register past the locals */
+        size_t RegEmitter::local_top()
+        {
+            return m_locals.m_count + 1;
+        }
+
+        /* whether $reg may be written before an expression is done with it: a temporary, or a local still being declared */
+        bool RegEmitter::is_scratch(int reg)
+        {
+            return (size_t)reg >= local_top() || m_locals.m_values[reg - 1].depth == UINT16_MAX;
+        }
+
+        void RegEmitter::begin_scope()
+        {
+            m_depth++;
+        }
+
+        void RegEmitter::end_scope()
+        {
+            m_depth--;
+            while(m_locals.m_count > 0 && m_locals.m_values[m_locals.m_count - 1].depth > m_depth)
+            {
+                m_locals.m_count--;
+            }
+            m_freereg = local_top();
+        }
+
+        /* returns the register of the new local, or -1 */
+        int RegEmitter::add_local(const char* name, size_t length, bool constant)
+        {
+            int i;
+            int reg;
+            Local* local;
+            for(i = (int)m_locals.m_count - 1; i >= 0; i--)
+            {
+                local = &m_locals.m_values[i];
+                if(local->depth != UINT16_MAX && local->depth < m_depth)
+                {
+                    break;
+                }
+                if(length == local->length && memcmp(local->name, name, length) == 0)
+                {
+                    return -1;
+                }
+            }
+            m_locals.push(Local{ name, length, UINT16_MAX, false, constant });
+            reg = alloc_register();
+            if(reg != (int)m_locals.m_count)
+            {
+                return -1;
+            }
+            return reg;
+        }
+
+        /* returns the register of the local, -1 if there is none, or -2 if it can't be used yet */
+        int RegEmitter::resolve_local(const char* name, size_t length)
+        {
+            int i;
+            Local* local;
+            for(i = (int)m_locals.m_count - 1; i >= 0; i--)
+            {
+                local = &m_locals.m_values[i];
+                if(local->length == length && memcmp(local->name, name, length) == 0)
+                {
+                    if(local->depth == UINT16_MAX)
+                    {
+                        return -2;
+                    }
+                    return i + 1;
+                }
+            }
+            return -1;
+        }
+
+        /* whether $name is a local of an enclosing function, which register code can't capture */
+        bool RegEmitter::is_upvalue(const char* name, size_t length)
+        {
+            size_t i;
+            Compiler* compiler;
+            Local* local;
+            for(compiler = m_emitter->m_compiler; compiler != nullptr; compiler = (Compiler*)compiler->enclosing)
+            {
+                for(i = 0; i < compiler->locals.m_count; i++)
+                {
+                    local = &compiler->locals.m_values[i];
+                    if(local->length == length && memcmp(local->name, name, length) == 0)
+                    {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        /* returns the index of the private, -1 if there is none, or -2 if it can't be used here */
+        int RegEmitter::resolve_private(const char* name, size_t length, bool assigning)
+        {
+            int index;
+            Value value;
+            String* key;
+            Emitter::Private* priv;
+            auto private_names = &m_emitter->m_module->private_names->m_values;
+            key = private_names->find(name, length, String::makeHash(name, length));
+            if(key == nullptr || !private_names->get(key, &value))
+            {
+                return -1;
+            }
+            index = Object::toNumber(value);
+            priv = &m_emitter->m_privates.m_values[index];
+            if(!priv->initialized || (assigning && priv->constant))
+            {
+                return -2;
+            }
+            return index;
+        }
+
+        int RegEmitter::constant_index(Value value)
+        {
+            size_t index;
+            index = m_chunk->addConstant(value);
+            if(index >= LIT_BX_ARG_SIZE)
+            {
+                return -1;
+            }
+            return (int)index;
+        }
+
+        /* a B or C operand: small number and string literals are read from the constants directly */
+        int RegEmitter::emit_rk(Expression* expression)
+        {
+            int index;
+            Value value;
+            if(expression->type == Expression::Type::Literal)
+            {
+                value = ((ExprLiteral*)expression)->value;
+                if(Object::isNumber(value) || Object::isString(value))
+                {
+                    index = constant_index(value);
+                    if(index >= 0 && index <= LIT_RK_MAX_INDEX)
+                    {
+                        return index | LIT_RK_CONSTANT;
+                    }
+                }
+            }
+            return emit_expression(expression, -1);
+        }
+
+        bool RegEmitter::emit_operands(ExprBinary* expression, int* b, int* c)
+        {
+            int reg;
+            *b = emit_rk(expression->left);
+            if(*b < 0)
+            {
+                return false;
+            }
+            /* the right operand may assign to a local the left one reads, which the stack would have read first */
+            if(*b < (int)local_top() && regemit_assigns(expression->right))
+            {
+                reg = alloc_register();
+                if(reg < 0)
+                {
+                    return false;
+                }
+                emit_abc(expression->line, ROP_MOVE, reg, *b, 0);
+                *b = reg;
+            }
+            *c = emit_rk(expression->right);
+            return *c >= 0;
+        }
+
+        int RegEmitter::emit_variable(ExprVar* expression, int dest)
+        {
+            int reg;
+            int index;
+            reg = resolve_local(expression->name, expression->length);
+            if(reg == -2)
+            {
+                return -1;
+            }
+            if(reg > 0)
+            {
+                if(dest >= 0 && dest != reg)
+                {
+                    emit_abc(expression->line, ROP_MOVE, dest, reg, 0);
+                    return dest;
+                }
+                return reg;
+            }
+            if(is_upvalue(expression->name, expression->length))
+            {
+                return -1;
+            }
+            index = resolve_private(expression->name, expression->length, false);
+            if(index == -2)
+            {
+                return -1;
+            }
+            reg = dest >= 0 ? dest : alloc_register();
+            if(reg < 0)
+            {
+                return -1;
+            }
+            if(index >= 0)
+            {
+                emit_abx(expression->line, ROP_GETPRIVATE, reg, index);
+            }
+            else if(!emit_global(expression->line, ROP_GETGLOBAL, reg, expression->name, expression->length))
+            {
+                return -1;
+            }
+            return reg;
+        }
+
+        int RegEmitter::emit_assign(ExprAssign* expression, int dest)
+        {
+            int reg;
+            int index;
+            ExprVar* to;
+            if(expression->to->type != Expression::Type::Variable)
+            {
+                return -1;
+            }
+            to = (ExprVar*)expression->to;
+            reg = resolve_local(to->name, to->length);
+            if(reg == -2 || (reg > 0 && m_locals.m_values[reg - 1].constant))
+            {
+                return -1;
+            }
+            if(reg > 0)
+            {
+                if(emit_expression(expression->value, reg) < 0)
+                {
+                    return -1;
+                }
+                if(dest >= 0 && dest != reg)
+                {
+                    emit_abc(expression->line, ROP_MOVE, dest, reg, 0);
+                    return dest;
+                }
+                return reg;
+            }
+            if(is_upvalue(to->name, to->length))
+            {
+                return -1;
+            }
+            index = resolve_private(to->name, to->length, true);
+            if(index == -2)
+            {
+                return -1;
+            }
+            reg = emit_expression(expression->value, dest);
+            if(reg < 0)
+            {
+                return -1;
+            }
+            if(index >= 0)
+            {
+                emit_abx(expression->line, ROP_SETPRIVATE, reg, index);
+            }
+            else if(!emit_global(expression->line, ROP_SETGLOBAL, reg, to->name, to->length))
+            {
+                return -1;
+            }
+            return reg;
+        }
+
+        int RegEmitter::emit_binary(ExprBinary* expression, int dest)
+        {
+            int b;
+            int c;
+            int reg;
+            size_t save;
+            RegOpCode op;
+            switch(expression->op)
+            {
+                case LITTOK_PLUS: op = ROP_ADD; break;
+                case LITTOK_MINUS: op = ROP_SUB; break;
+                case LITTOK_STAR: op = ROP_MUL; break;
+                case LITTOK_SLASH: op = ROP_DIV; break;
+                case LITTOK_PERCENT: op = ROP_MOD; break;
+                case LITTOK_EQUAL_EQUAL: op = ROP_EQ; break;
+                case LITTOK_BANG_EQUAL: op = ROP_EQ; break;
+                case LITTOK_LESS: op = ROP_LT; break;
+                case LITTOK_LESS_EQUAL: op = ROP_LE; break;
+                case LITTOK_GREATER: op = ROP_GT; break;
+                case LITTOK_GREATER_EQUAL: op = ROP_GE; break;
+                default:
+                    {
+                        return -1;
+                    }
+                    break;
+            }
+            save = m_freereg;
+            if(!emit_operands(expression, &b, &c))
+            {
+                return -1;
+            }
+            /* the operands are read before the result is written, so the result may reuse their registers */
+            m_freereg = save;
+            reg = dest >= 0 ? dest : alloc_register();
+            if(reg < 0)
+            {
+                return -1;
+            }
+            emit_abc(expression->line, op, reg, b, c);
+            if(expression->op == LITTOK_BANG_EQUAL)
+            {
+                emit_abc(expression->line, ROP_NOT, reg, reg, 0);
+            }
+            return reg;
+        }
+
+        /* a && b and a || b: the result is whichever operand decided it */
+        int RegEmitter::emit_logical(ExprBinary* expression, int dest)
+        {
+            int reg;
+            size_t jump;
+            reg = (dest >= 0 && is_scratch(dest)) ? dest : alloc_register();
+            if(reg < 0 || emit_expression(expression->left, reg) < 0)
+            {
+                return -1;
+            }
+            jump = emit_jump(m_lastline, expression->op == LITTOK_BAR_BAR ? ROP_JMPIF : ROP_JMPIFNOT, reg);
+            if(emit_expression(expression->right, reg) < 0 || !patch_jump(jump, here()))
+            {
+                return -1;
+            }
+            if(dest >= 0 && dest != reg)
+            {
+                emit_abc(m_lastline, ROP_MOVE, dest, reg, 0);
+                return dest;
+            }
+            return reg;
+        }
+
+        int RegEmitter::emit_call(ExprCall* expression, int dest)
+        {
+            size_t i;
+            int reg;
+            int base;
+            Expression* arg;
+            if(expression->callee->type != Expression::Type::Variable || expression->objexpr != nullptr
+               || expression->args.m_count > UINT8_MAX)
+            {
+                return -1;
+            }
+            /* the callee and its arguments take the registers on top; the result lands where the callee was */
+            if(dest >= 0 && (size_t)dest + 1 == m_freereg && is_scratch(dest))
+            {
+                base = dest;
+            }
+            else
+            {
+                base = alloc_register();
+            }
+            if(base < 0 || emit_expression(expression->callee, base) < 0)
+            {
+                return -1;
+            }
+            for(i = 0; i < expression->args.m_count; i++)
+            {
+                arg = expression->args.m_values[i];
+                if(arg->type == Expression::Type::Variable && ((ExprVar*)arg)->length == 3
+                   && memcmp(((ExprVar*)arg)->name, "...", 3) == 0)
+                {
+                    return -1;
+                }
+                reg = alloc_register();
+                if(reg < 0 || emit_expression(arg, reg) < 0)
+                {
+                    return -1;
+                }
+            }
+            emit_abc(expression->line, ROP_CALL, base, (int)expression->args.m_count, 0);
+            if(dest >= 0 && dest != base)
+            {
+                emit_abc(expression->line, ROP_MOVE, dest, base, 0);
+                return dest;
+            }
+            return base;
+        }
+
+        int RegEmitter::emit_ternary(ExprIfClause* expression, int dest)
+        {
+            int reg;
+            long else_jump;
+            size_t end_jump;
+            if(expression->else_branch == nullptr)
+            {
+                return -1;
+            }
+            reg = (dest >= 0 && is_scratch(dest)) ? dest : alloc_register();
+            if(reg < 0)
+            {
+                return -1;
+            }
+            else_jump = emit_condjump(expression->condition, false);
+            if(else_jump < 0 || emit_expression(expression->if_branch, reg) < 0)
+            {
+                return -1;
+            }
+            end_jump = emit_jump(m_lastline, ROP_JMP, 0);
+            if(!patch_jump((size_t)else_jump, here()) || emit_expression(expression->else_branch, reg) < 0
+               || !patch_jump(end_jump, here()))
+            {
+                return -1;
+            }
+            if(dest >= 0 && dest != reg)
+            {
+                emit_abc(m_lastline, ROP_MOVE, dest, reg, 0);
+                return dest;
+            }
+            return reg;
+        }
+
+        int RegEmitter::emit_expression_inner(Expression* expression, int dest)
+        {
+            int b;
+            int reg;
+            int index;
+            size_t save;
+            Value value;
+            ExprBinary* binary;
+            ExprUnary* unary;
+            switch(expression->type)
+            {
+                case Expression::Type::Literal:
+                    {
+                        value = ((ExprLiteral*)expression)->value;
+                        reg = dest >= 0 ? dest : alloc_register();
+                        if(reg < 0)
+                        {
+                            return -1;
+                        }
+                        if(Object::isNumber(value) || Object::isString(value))
+                        {
+                            index = constant_index(value);
+                            if(index < 0)
+                            {
+                                return -1;
+                            }
+                            emit_abx(expression->line, ROP_LOADK, reg, index);
+                        }
+                        else if(Object::isBool(value))
+                        {
+                            emit_abc(expression->line, ROP_LOADBOOL, reg, Object::asBool(value) ? 1 : 0, 0);
+                        }
+                        else
+                        {
+                            emit_abc(expression->line, ROP_LOADNULL, reg, 0, 0);
+                        }
+                        return reg;
+                    }
+                    break;
+                case Expression::Type::Variable:
+                    {
+                        return emit_variable((ExprVar*)expression, dest);
+                    }
+                    break;
+                case Expression::Type::Assign:
+                    {
+                        return emit_assign((ExprAssign*)expression, dest);
+                    }
+                    break;
+                case Expression::Type::Binary:
+                    {
+                        binary = (ExprBinary*)expression;
+                        if(binary->right == nullptr)
+                        {
+                            return emit_expression(binary->left, dest);
+                        }
+                        if(binary->op == LITTOK_AMPERSAND_AMPERSAND || binary->op == LITTOK_BAR_BAR)
+                        {
+                            return emit_logical(binary, dest);
+                        }
+                        return emit_binary(binary, dest);
+                    }
+                    break;
+                case Expression::Type::Unary:
+                    {
+                        unary = (ExprUnary*)expression;
+                        if(unary->op != LITTOK_MINUS && unary->op != LITTOK_BANG)
+                        {
+                            return -1;
+                        }
+                        save = m_freereg;
+                        b = emit_expression(unary->right, -1);
+                        if(b < 0)
+                        {
+                            return -1;
+                        }
+                        m_freereg = save;
+                        reg = dest >= 0 ? dest : alloc_register();
+                        if(reg < 0)
+                        {
+                            return -1;
+                        }
+                        emit_abc(expression->line, unary->op == LITTOK_MINUS ? ROP_NEG : ROP_NOT, reg, b, 0);
+                        return reg;
+                    }
+                    break;
+                case Expression::Type::Call:
+                    {
+                        return emit_call((ExprCall*)expression, dest);
+                    }
+                    break;
+                case Expression::Type::IfClause:
+                    {
+                        return emit_ternary((ExprIfClause*)expression, dest);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            return -1;
+        }
+
+        /*
+        * compiles $expression into $dest, or, if $dest is -1, into whichever register suits it
+        * (a local is used as it is). returns the register, or -1 if the expression is not supported.
+        * temporaries are released again, except for the result.
+        */
+        int RegEmitter::emit_expression(Expression* expression, int dest)
+        {
+            int reg;
+            size_t save;
+            save = m_freereg;
+            reg = emit_expression_inner(expression, dest);
+            if(reg < 0)
+            {
+                return -1;
+            }
+            if(dest >= 0 || (size_t)reg < save)
+            {
+                m_freereg = save;
+            }
+            else
+            {
+                m_freereg = reg + 1;
+            }
+            return reg;
+        }
+
+        /*
+        * emits a jump that is taken if $condition is as truthy as $when, and returns its word,
+        * to be patched; -1 if the condition is not supported. comparisons jump on their own.
+        */
+        long RegEmitter::emit_condjump(Expression* condition, bool when)
+        {
+            int b;
+            int c;
+            int reg;
+            size_t save;
+            RegOpCode op;
+            ExprBinary* binary;
+            save = m_freereg;
+            if(condition->type == Expression::Type::Binary)
+            {
+                binary = (ExprBinary*)condition;
+                if(binary->right != nullptr && regemit_iscomparison(binary->op))
+                {
+                    switch(binary->op)
+                    {
+                        case LITTOK_LESS: op = ROP_JLT; break;
+                        case LITTOK_LESS_EQUAL: op = ROP_JLE; break;
+                        case LITTOK_GREATER: op = ROP_JGT; break;
+                        case LITTOK_GREATER_EQUAL: op = ROP_JGE; break;
+                        default: op = ROP_JEQ; break;
+                    }
+                    if(!emit_operands(binary, &b, &c))
+                    {
+                        return -1;
+                    }
+                    m_freereg = save;
+                    emit_abc(condition->line, op, (binary->op == LITTOK_BANG_EQUAL) ? !when : when, b, c);
+                    return (long)emit_jump(condition->line, ROP_JMP, 0);
+                }
+            }
+            reg = emit_expression(condition, -1);
+            if(reg < 0)
+            {
+                return -1;
+            }
+            m_freereg = save;
+            return (long)emit_jump(condition->line, when ? ROP_JMPIF : ROP_JMPIFNOT, reg);
+        }
+
+        bool RegEmitter::emit_if(StmtIfClause* statement)
+        {
+            bool ok;
+            long jump;
+            size_t i;
+            size_t else_jump;
+            size_t end_jump;
+            bool has_end;
+            Expression* condition;
+            PCGenericArray<size_t> end_jumps;
+            has_end = false;
+            end_jump = 0;
+            if(statement->condition == nullptr)
+            {
+                else_jump = emit_jump(statement->line, ROP_JMP, 0);
+            }
+            else
+            {
+                jump = emit_condjump(statement->condition, false);
+                if(jump < 0 || !emit_statement(statement->if_branch))
+                {
+                    return false;
+                }
+                else_jump = (size_t)jump;
+                end_jump = emit_jump(m_lastline, ROP_JMP, 0);
+                has_end = true;
+            }
+            ok = true;
+            end_jumps.init(m_state);
+            if(statement->elseif_branches != nullptr)
+            {
+                for(i = 0; ok && i < statement->elseif_branches->m_count; i++)
+                {
+                    condition = statement->elseif_conditions->m_values[i];
+                    if(condition == nullptr)
+                    {
+                        continue;
+                    }
+                    ok = patch_jump(else_jump, here());
+                    jump = emit_condjump(condition, false);
+                    if(!ok || jump < 0 || !emit_statement(statement->elseif_branches->m_values[i]))
+                    {
+                        ok = false;
+                        break;
+                    }
+                    else_jump = (size_t)jump;
+                    end_jumps.push(emit_jump(m_lastline, ROP_JMP, 0));
+                }
+            }
+            if(ok)
+            {
+                ok = patch_jump(else_jump, here()) && emit_statement(statement->else_branch);
+            }
+            if(ok && has_end)
+            {
+                ok = patch_jump(end_jump, here());
+            }
+            if(ok)
+            {
+                ok = patch_jumps(&end_jumps, 0, here());
+            }
+            end_jumps.release();
+            return ok;
+        }
+
+        /* loops are laid out with the condition at the bottom, so that each iteration takes a single jump */
+        bool RegEmitter::emit_while(StmtWhileLoop* statement)
+        {
+            long jump;
+            size_t top;
+            size_t entry;
+            size_t breaks;
+            size_t continues;
+            if(statement->condition == nullptr)
+            {
+                return false;
+            }
+            breaks = m_breaks.m_count;
+            continues = m_continues.m_count;
+            m_loopdepth++;
+            entry = emit_jump(statement->line, ROP_JMP, 0);
+            top = here();
+            if(!emit_statement(statement->body) || !patch_jumps(&m_continues, continues, here()) || !patch_jump(entry, here()))
+            {
+                return false;
+            }
+            jump = emit_condjump(statement->condition, true);
+            if(jump < 0 || !patch_jump((size_t)jump, top) || !patch_jumps(&m_breaks, breaks, here()))
+            {
+                return false;
+            }
+            m_loopdepth--;
+            return true;
+        }
+
+        bool RegEmitter::emit_for(StmtForLoop* statement)
+        {
+            long jump;
+            size_t i;
+            size_t top;
+            size_t entry;
+            size_t save;
+            size_t breaks;
+            size_t continues;
+            Expression::List* statements;
+            if(!statement->c_style)
+            {
+                return false;
+            }
+            breaks = m_breaks.m_count;
+            continues = m_continues.m_count;
+            begin_scope();
+            m_loopdepth++;
+            if(statement->var != nullptr)
+            {
+                if(!emit_statement(statement->var))
+                {
+                    return false;
+                }
+            }
+            else if(statement->exprinit != nullptr)
+            {
+                save = m_freereg;
+                if(emit_expression(statement->exprinit, -1) < 0)
+                {
+                    return false;
+                }
+                m_freereg = save;
+            }
+            entry = emit_jump(m_lastline, ROP_JMP, 0);
+            top = here();
+            begin_scope();
+            if(statement->body != nullptr && statement->body->type == Expression::Type::Block)
+            {
+                statements = &((StmtBlock*)statement->body)->statements;
+                for(i = 0; i < statements->m_count; i++)
+                {
+                    if(!emit_statement(statements->m_values[i]))
+                    {
+                        return false;
+                    }
+                }
+            }
+            else if(!emit_statement(statement->body))
+            {
+                return false;
+            }
+            end_scope();
+            if(!patch_jumps(&m_continues, continues, here()))
+            {
+                return false;
+            }
+            if(statement->increment != nullptr)
+            {
+                save = m_freereg;
+                if(emit_expression(statement->increment, -1) < 0)
+                {
+                    return false;
+                }
+                m_freereg = save;
+            }
+            if(!patch_jump(entry, here()))
+            {
+                return false;
+            }
+            if(statement->condition != nullptr)
+            {
+                jump = emit_condjump(statement->condition, true);
+            }
+            else
+            {
+                jump = (long)emit_jump(m_lastline, ROP_JMP, 0);
+            }
+            if(jump < 0 || !patch_jump((size_t)jump, top) || !patch_jumps(&m_breaks, breaks, here()))
+            {
+                return false;
+            }
+            m_loopdepth--;
+            end_scope();
+            return true;
+        }
+
+        /* returns false if the statement is not supported */
+        bool RegEmitter::emit_statement(Expression* statement)
+        {
+            size_t i;
+            int reg;
+            size_t save;
+            StmtVar* var;
+            Expression* expression;
+            Expression::List* statements;
+            if(statement == nullptr)
+            {
+                return true;
+            }
+            save = m_freereg;
+            switch(statement->type)
+            {
+                case Expression::Type::Expression:
+                    {
+                        if(emit_expression(((ExprStatement*)statement)->expression, -1) < 0)
+                        {
+                            return false;
+                        }
+                        m_freereg = save;
+                    }
+                    break;
+                case Expression::Type::Block:
+                    {
+                        statements = &((StmtBlock*)statement)->statements;
+                        begin_scope();
+                        for(i = 0; i < statements->m_count; i++)
+                        {
+                            if(!emit_statement(statements->m_values[i]))
+                            {
+                                return false;
+                            }
+                            if(statements->m_values[i] != nullptr && statements->m_values[i]->type == Expression::Type::ReturnClause)
+                            {
+                                break;
+                            }
+                        }
+                        end_scope();
+                    }
+                    break;
+                case Expression::Type::VarDecl:
+                    {
+                        var = (StmtVar*)statement;
+                        reg = add_local(var->name, var->length, var->constant);
+                        if(reg < 0)
+                        {
+                            return false;
+                        }
+                        if(var->valexpr == nullptr)
+                        {
+                            emit_abc(statement->line, ROP_LOADNULL, reg, 0, 0);
+                        }
+                        else if(emit_expression(var->valexpr, reg) < 0)
+                        {
+                            return false;
+                        }
+                        m_locals.m_values[reg - 1].depth = m_depth;
+                    }
+                    break;
+                case Expression::Type::IfClause:
+                    {
+                        return emit_if((StmtIfClause*)statement);
+                    }
+                    break;
+                case Expression::Type::WhileLoop:
+                    {
+                        return emit_while((StmtWhileLoop*)statement);
+                    }
+                    break;
+                case Expression::Type::ForLoop:
+                    {
+                        return emit_for((StmtForLoop*)statement);
+                    }
+                    break;
+                case Expression::Type::ContinueClause:
+                    {
+                        if(m_loopdepth == 0)
+                        {
+                            return false;
+                        }
+                        m_continues.push(emit_jump(statement->line, ROP_JMP, 0));
+                    }
+                    break;
+                case Expression::Type::BreakClause:
+                    {
+                        if(m_loopdepth == 0)
+                        {
+                            return false;
+                        }
+                        m_breaks.push(emit_jump(statement->line, ROP_JMP, 0));
+                    }
+                    break;
+                case Expression::Type::ReturnClause:
+                    {
+                        expression = ((StmtReturn*)statement)->expression;
+                        if(expression == nullptr)
+                        {
+                            reg = alloc_register();
+                            if(reg < 0)
+                            {
+                                return false;
+                            }
+                            emit_abc(m_lastline, ROP_LOADNULL, reg, 0, 0);
+                        }
+                        else
+                        {
+                            reg = emit_expression(expression, -1);
+                            if(reg < 0)
+                            {
+                                return false;
+                            }
+                        }
+                        emit_abc(m_lastline, ROP_RETURN, reg, 0, 0);
+                        m_freereg = save;
+                    }
+                    break;
+                default:
+                    {
+                        return false;
+                    }
+                    break;
+            }
+            return true;
+        }
+
+        /* returns nullptr if $statement uses anything register code does not cover */
+        Function* RegEmitter::compile(StmtFunction* statement, String* name)
+        {
+            size_t i;
+            int reg;
+            ExprFuncParam* parameter;
+            /* a body that is a lone expression is left to the Emitter, which has its own rules for what it returns */
+            if(statement->body == nullptr || statement->body->type != Expression::Type::Block
+               || statement->parameters.m_count > UINT8_MAX)
+            {
+                return nullptr;
+            }
+            m_function = Function::make(m_state, m_emitter->m_module);
+            m_chunk = &m_function->chunk;
+            if(Optimizer::is_enabled(LITOPTSTATE_LINE_INFO))
+            {
+                m_chunk->m_haslineinfo = false;
+            }
+            begin_scope();
+            for(i = 0; i < statement->parameters.m_count; i++)
+            {
+                parameter = &statement->parameters.m_values[i];
+                if(parameter->default_value != nullptr || (parameter->length == 3 && memcmp(parameter->name, "...", 3) == 0))
+                {
+                    return nullptr;
+                }
+                reg = add_local(parameter->name, parameter->length, false);
+                if(reg < 0)
+                {
+                    return nullptr;
+                }
+                m_locals.m_values[reg - 1].depth = m_depth;
+            }
+            if(!emit_statement(statement->body))
+            {
+                return nullptr;
+            }
+            reg = alloc_register();
+            if(reg < 0)
+            {
+                return nullptr;
+            }
+            emit_abc(m_lastline, ROP_LOADNULL, reg, 0, 0);
+            emit_abc(m_lastline, ROP_RETURN, reg, 0, 0);
+            end_scope();
+            m_function->m_registers = m_maxreg;
+            m_function->max_slots = m_maxreg + LIT_REG_SCRATCH_SLOTS;
+            m_function->arg_count = statement->parameters.m_count;
+            m_function->name = name;
+            m_emitter->m_lastline = m_lastline;
+        #ifdef LIT_TRACE_CHUNK
+            lit_disassemble_regchunk(m_chunk, name->data(), nullptr);
+        #endif
+            return m_function;
+        }
+    }
+}
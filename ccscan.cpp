@@ -448,25 +448,26 @@ namespace lit
 
         Token Scanner::make_number_token(bool is_hex, bool is_binary)
         {
+            int64_t integer;
+            double number;
             Token token;
             Value value;
-            errno = 0;
-            if(is_hex)
+            std::from_chars_result res;
+            /* the token is exactly the digits scan_number() accepted, so there is nothing to skip or check */
+            if(is_hex || is_binary)
             {
-                value = Object::toValue((double)strtoll(m_startsrc, nullptr, 16));
-            }
-            else if(is_binary)
-            {
-                value = Object::toValue(strtoll(m_startsrc + 2, nullptr, 2));
+                integer = 0;
+                res = std::from_chars(m_startsrc + 2, m_currsrc, integer, is_hex ? 16 : 2);
+                value = Object::toValue((double)integer);
             }
             else
             {
-                value = Object::toValue(strtod(m_startsrc, nullptr));
+                number = 0;
+                res = std::from_chars(m_startsrc, m_currsrc, number, std::chars_format::fixed);
+                value = Object::toValue(number);
             }
-
-            if(errno == ERANGE)
+            if(res.ec == std::errc::result_out_of_range)
             {
-                errno = 0;
                 return make_error_token(Error::LITERROR_NUMBER_IS_TOO_BIG);
             }
             token = make_token(LITTOK_NUMBER);
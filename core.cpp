@@ -32,32 +32,123 @@ namespace lit
     {
         initDefault(state, this);
         this->stringmode = true;
-        this->uptr = String::allocEmpty(state, 0);
+        this->buffer.init(state);
     }
 
-    void Writer::stringAppend(String* ds, int byte)
+    String* Writer::asString()
     {
-        ds->append(byte);
+        if(this->stringmode)
+        {
+            return this->buffer.toString();
+        }
+        return nullptr;
     }
 
-    void Writer::stringAppend(String* ds, const char* str, size_t len)
+    void Writer::initBufferedFile(State* state, FILE* fh, bool linebuffered)
     {
-        ds->append(str, len);
+        initDefault(state, this);
+        this->uptr = fh;
+        this->m_linebuffered = linebuffered;
+        this->m_outcapacity = LIT_WRITER_BUFFER_SIZE;
+        /* not counted towards the gc heap; like the state's other fixed parts, it's plain malloc */
+        this->m_outbuf = (char*)malloc(this->m_outcapacity);
+        this->fnbyte = cb_bufwritebyte;
+        this->fnstring = cb_bufwritestring;
+        this->fnformat = cb_bufwriteformat;
     }
 
-    // todo: this would have been done via sds - so needs to be reimplemented
-    void Writer::stringAppendFormat(String* ds, const char* fmt, va_list va)
+    void Writer::flush()
     {
-        size_t actual;
-        size_t needed;
-        char* buffer;
-        needed = vsnprintf(nullptr, 0, fmt, va);
-        buffer = LIT_ALLOCATE(ds->m_state, char, needed+1);
-        actual = vsnprintf(buffer, needed, fmt, va);
-        ds->append(buffer, actual);
-        LIT_FREE(ds->m_state, char, buffer);
+        if(this->stringmode)
+        {
+            return;
+        }
+        if(this->m_outlength > 0)
+        {
+            /* through stdio, so that anything else written to the same FILE stays in order */
+            fwrite(this->m_outbuf, sizeof(char), this->m_outlength, (FILE*)this->uptr);
+            this->m_outlength = 0;
+        }
+        fflush((FILE*)this->uptr);
+    }
+
+    void Writer::release()
+    {
+        if(this->m_outbuf != nullptr)
+        {
+            flush();
+            free(this->m_outbuf);
+            this->m_outbuf = nullptr;
+            this->m_outcapacity = 0;
+        }
+    }
+
+    void Writer::cb_bufwritebyte(Writer* wr, int byte)
+    {
+        if(wr->m_outlength == wr->m_outcapacity)
+        {
+            wr->flush();
+        }
+        wr->m_outbuf[wr->m_outlength++] = (char)byte;
+        wr->m_written++;
+        if(byte == '\n' && wr->m_linebuffered)
+        {
+            wr->flush();
+        }
     }
 
+    void Writer::cb_bufwritestring(Writer* wr, const char* string, size_t len)
+    {
+        if(len > (wr->m_outcapacity - wr->m_outlength))
+        {
+            wr->flush();
+        }
+        if(len >= wr->m_outcapacity)
+        {
+            /* too large to be worth copying; the buffer is empty at this point */
+            fwrite(string, sizeof(char), len, (FILE*)wr->uptr);
+        }
+        else
+        {
+            memcpy(wr->m_outbuf + wr->m_outlength, string, len);
+            wr->m_outlength += len;
+        }
+        wr->m_written += len;
+        if(wr->m_linebuffered && memchr(string, '\n', len) != nullptr)
+        {
+            wr->flush();
+        }
+    }
+
+    void Writer::cb_bufwriteformat(Writer* wr, const char* fmt, va_list va)
+    {
+        int needed;
+        va_list copy;
+        va_copy(copy, va);
+        needed = vsnprintf(nullptr, 0, fmt, copy);
+        va_end(copy);
+        if(needed <= 0)
+        {
+            return;
+        }
+        if((size_t)needed >= (wr->m_outcapacity - wr->m_outlength))
+        {
+            wr->flush();
+        }
+        wr->m_written += needed;
+        if((size_t)needed >= wr->m_outcapacity)
+        {
+            vfprintf((FILE*)wr->uptr, fmt, va);
+            return;
+        }
+        /* +1 for the NUL that vsnprintf always writes, which the check above leaves room for */
+        vsnprintf(wr->m_outbuf + wr->m_outlength, needed + 1, fmt, va);
+        wr->m_outlength += needed;
+        if(wr->m_linebuffered && memchr(wr->m_outbuf + wr->m_outlength - needed, '\n', needed) != nullptr)
+        {
+            wr->flush();
+        }
+    }
 
     Closure* Closure::make(State* state, Function* function)
     {
@@ -65,6 +156,10 @@ namespace lit
         Closure* closure;
         Upvalue** upvalues;
         closure = Object::make<Closure>(state, Object::Type::Closure);
+        /* the GC may look at this closure while its upvalues are being allocated */
+        closure->function = function;
+        closure->upvalues = nullptr;
+        closure->upvalue_count = 0;
         state->pushRoot((Object*)closure);
         upvalues = LIT_ALLOCATE(state, Upvalue*, function->upvalue_count);
         state->popRoot();
@@ -130,7 +225,7 @@ namespace lit
                                       id >= arg_count ? "null" : Object::valueName(args[id]));
         }
 
-        return Object::as<String>(args[id])->data();
+        return Object::as<String>(args[id])->cstr();
     }
 
     const char* lit_get_string(VM* vm, Value* args, uint8_t arg_count, uint8_t id, const char* def)
@@ -141,7 +236,7 @@ namespace lit
             return def;
         }
 
-        return Object::as<String>(args[id])->data();
+        return Object::as<String>(args[id])->cstr();
     }
 
     String* lit_check_object_string(VM* vm, Value* args, uint8_t arg_count, uint8_t id)
@@ -251,7 +346,7 @@ namespace lit
         slot = (uint16_t)(chunk->m_code[offset + 1] << 8);
         slot |= chunk->m_code[offset + 2];
         wr->format("%s%-16s%s %4d\n", COLOR_YELLOW, name, COLOR_RESET, slot);
-        return offset + 2;
+        return offset + 3;
     }
 
     static size_t print_jump_op(State* state, Writer* wr, const char* name, int sign, Chunk* chunk, size_t offset)
@@ -264,37 +359,55 @@ namespace lit
         return offset + 3;
     }
 
+    static size_t print_global_op(State* state, Writer* wr, const char* name, Chunk* chunk, size_t offset)
+    {
+        uint16_t slot;
+        slot = (uint16_t)(chunk->m_code[offset + 1] << 8);
+        slot |= chunk->m_code[offset + 2];
+        wr->format("%s%-16s%s %4d '", COLOR_YELLOW, name, COLOR_RESET, slot);
+        Object::print(state, wr, state->vm->globalnames.m_values[slot]->asValue());
+        wr->format("'\n");
+        return offset + 3;
+    }
+
+    static size_t print_cached_op(State* state, Writer* wr, const char* name, Chunk* chunk, size_t offset)
+    {
+        uint16_t cache;
+        (void)state;
+        cache = (uint16_t)(chunk->m_code[offset + 1] << 8);
+        cache |= chunk->m_code[offset + 2];
+        wr->format("%s%-16s%s [ic %d]\n", COLOR_YELLOW, name, COLOR_RESET, cache);
+        return offset + 3;
+    }
+
     static size_t print_invoke_op(State* state, Writer* wr, const char* name, Chunk* chunk, size_t offset)
     {
         uint8_t arg_count;
-        uint8_t constant;
+        uint16_t constant;
+        uint16_t cache;
         (void)state;
         arg_count = chunk->m_code[offset + 1];
-        constant = chunk->m_code[offset + 2];
+        constant = (uint16_t)(chunk->m_code[offset + 2] << 8);
         constant |= chunk->m_code[offset + 3];
+        cache = (uint16_t)(chunk->m_code[offset + 4] << 8);
+        cache |= chunk->m_code[offset + 5];
         wr->format("%s%-16s%s (%d args) %4d '", COLOR_YELLOW, name, COLOR_RESET, arg_count, constant);
         Object::print(state, wr, chunk->m_constants.m_values[constant]);
-        wr->format("'\n");
-        return offset + 4;
+        wr->format("' [ic %d]\n", cache);
+        return offset + 6;
     }
 
-    size_t lit_disassemble_instruction(State* state, Chunk* chunk, size_t offset, const char* source)
+    /* the offset of an instruction, and its line (with the source of that line, if there is $source) where it changes */
+    static void print_line_info(Writer* wr, Chunk* chunk, size_t offset, const char* source)
     {
         bool same;
-        int is_local;
-        size_t j;
         size_t line;
         size_t index;
-        int16_t constant;
-        uint8_t instruction;
         char c;
         char* next_line;
         char* prev_line;
         char* output_line;
         char* current_line;
-        Writer* wr;
-        Function* function;
-        wr = &state->debugwriter;
         line = chunk->get_line(offset);
         same = !chunk->m_haslineinfo || (offset > 0 && line == chunk->get_line(offset - 1));
         if(!same && source != nullptr)
@@ -328,6 +441,19 @@ namespace lit
         {
             wr->format("%s%4d%s ", COLOR_BLUE, (int)line, COLOR_RESET);
         }
+    }
+
+    size_t lit_disassemble_instruction(State* state, Chunk* chunk, size_t offset, const char* source)
+    {
+        int is_local;
+        size_t j;
+        size_t index;
+        int16_t constant;
+        uint8_t instruction;
+        Writer* wr;
+        Function* function;
+        wr = &state->debugwriter;
+        print_line_info(wr, chunk, offset, source);
         instruction = chunk->m_code[offset];
         switch(instruction)
         {
@@ -388,9 +514,9 @@ namespace lit
             case OP_LESS_EQUAL:
                 return print_simple_op(state, wr, "OP_LESS_EQUAL", offset);
             case OP_SET_GLOBAL:
-                return print_constant_op(state, wr, "OP_SET_GLOBAL", chunk, offset, true);
+                return print_global_op(state, wr, "OP_SET_GLOBAL", chunk, offset);
             case OP_GET_GLOBAL:
-                return print_constant_op(state, wr, "OP_GET_GLOBAL", chunk, offset, true);
+                return print_global_op(state, wr, "OP_GET_GLOBAL", chunk, offset);
             case OP_SET_LOCAL:
                 return print_byte_op(state, wr, "OP_SET_LOCAL", chunk, offset);
             case OP_GET_LOCAL:
@@ -435,6 +561,7 @@ namespace lit
                     constant = (uint16_t)(chunk->m_code[offset] << 8);
                     offset++;
                     constant |= chunk->m_code[offset];
+                    offset++;
                     wr->format("%-16s %4d ", "OP_CLOSURE", constant);
                     Object::print(state, wr, chunk->m_constants.m_values[constant]);
                     wr->format("\n");
@@ -442,8 +569,9 @@ namespace lit
                     for(j = 0; j < function->upvalue_count; j++)
                     {
                         is_local = chunk->m_code[offset++];
-                        index = chunk->m_code[offset++];
-                        wr->format("%04d      |                     %s %d\n", (int)(offset - 2), is_local ? "local" : "upvalue", (int)index);
+                        index = (uint16_t)(chunk->m_code[offset++] << 8);
+                        index |= chunk->m_code[offset++];
+                        wr->format("%04d      |                     %s %d\n", (int)(offset - 3), is_local ? "local" : "upvalue", (int)index);
                     }
                     return offset;
                 }
@@ -454,9 +582,9 @@ namespace lit
                 return print_constant_op(state, wr, "OP_CLASS", chunk, offset, true);
 
             case OP_GET_FIELD:
-                return print_simple_op(state, wr, "OP_GET_FIELD", offset);
+                return print_cached_op(state, wr, "OP_GET_FIELD", chunk, offset);
             case OP_SET_FIELD:
-                return print_simple_op(state, wr, "OP_SET_FIELD", offset);
+                return print_cached_op(state, wr, "OP_SET_FIELD", chunk, offset);
 
             case OP_SUBSCRIPT_GET:
                 return print_simple_op(state, wr, "OP_SUBSCRIPT_GET", offset);
@@ -503,9 +631,46 @@ namespace lit
             case OP_REFERENCE_LOCAL:
                 return print_short_op(state, wr, "OP_REFERENCE_LOCAL", chunk, offset);
             case OP_REFERENCE_GLOBAL:
-                return print_constant_op(state, wr, "OP_REFERENCE_GLOBAL", chunk, offset, true);
+                return print_global_op(state, wr, "OP_REFERENCE_GLOBAL", chunk, offset);
             case OP_SET_REFERENCE:
                 return print_simple_op(state, wr, "OP_SET_REFERENCE", offset);
+            case OP_ADD_NUM:
+                return print_simple_op(state, wr, "OP_ADD_NUM", offset);
+            case OP_SUBTRACT_NUM:
+                return print_simple_op(state, wr, "OP_SUBTRACT_NUM", offset);
+            case OP_MULTIPLY_NUM:
+                return print_simple_op(state, wr, "OP_MULTIPLY_NUM", offset);
+            case OP_DIVIDE_NUM:
+                return print_simple_op(state, wr, "OP_DIVIDE_NUM", offset);
+            case OP_EQUAL_NUM:
+                return print_simple_op(state, wr, "OP_EQUAL_NUM", offset);
+            case OP_GREATER_NUM:
+                return print_simple_op(state, wr, "OP_GREATER_NUM", offset);
+            case OP_GREATER_EQUAL_NUM:
+                return print_simple_op(state, wr, "OP_GREATER_EQUAL_NUM", offset);
+            case OP_LESS_NUM:
+                return print_simple_op(state, wr, "OP_LESS_NUM", offset);
+            case OP_LESS_EQUAL_NUM:
+                return print_simple_op(state, wr, "OP_LESS_EQUAL_NUM", offset);
+            case OP_EQUAL_STR:
+                return print_simple_op(state, wr, "OP_EQUAL_STR", offset);
+            case OP_ARRAY_GET:
+                return print_simple_op(state, wr, "OP_ARRAY_GET", offset);
+            case OP_ARRAY_SET:
+                return print_simple_op(state, wr, "OP_ARRAY_SET", offset);
+            /* superinstructions are followed by the rest of their sequence, which is shown as is */
+            case OP_INC_LOCAL:
+                return print_byte_op(state, wr, "OP_INC_LOCAL", chunk, offset);
+            case OP_ADD_LOCAL_CONST:
+                return print_byte_op(state, wr, "OP_ADD_LOCAL_CONST", chunk, offset);
+            case OP_SUBTRACT_LOCAL_CONST:
+                return print_byte_op(state, wr, "OP_SUBTRACT_LOCAL_CONST", chunk, offset);
+            case OP_LESS_LOCAL_CONST_JUMP:
+                return print_byte_op(state, wr, "OP_LESS_LOCAL_CONST_JUMP", chunk, offset);
+            case OP_LESS_LOCAL_LOCAL_JUMP:
+                return print_byte_op(state, wr, "OP_LESS_LOCAL_LOCAL_JUMP", chunk, offset);
+            case OP_GET_LOCAL_FIELD:
+                return print_byte_op(state, wr, "OP_GET_LOCAL_FIELD", chunk, offset);
             default:
                 {
                     wr->format("Unknown opcode %d\n", instruction);
@@ -515,7 +680,137 @@ namespace lit
         }
     }
 
-    void lit_disassemble_chunk(Chunk* chunk, const char* name, const char* source)
+    static const char* reg_op_names[] =
+    {
+        #define REGOP(name, type) "ROP_" #name,
+        #include "regopcode.inc"
+        #undef REGOP
+    };
+
+    static void print_rk_operand(State* state, Writer* wr, Chunk* chunk, uint32_t operand)
+    {
+        if(operand & LIT_RK_CONSTANT)
+        {
+            wr->put(" '");
+            Object::print(state, wr, chunk->m_constants.m_values[operand & LIT_RK_MAX_INDEX]);
+            wr->put("'");
+        }
+        else
+        {
+            wr->format(" r%d", (int)operand);
+        }
+    }
+
+    /* like lit_disassemble_instruction(), for a word of register code */
+    size_t lit_disassemble_reginstruction(State* state, Chunk* chunk, size_t offset, const char* source)
+    {
+        uint32_t op;
+        uint32_t instruction;
+        uint16_t slot;
+        Writer* wr;
+        wr = &state->debugwriter;
+        print_line_info(wr, chunk, offset, source);
+        memcpy(&instruction, &chunk->m_code[offset], sizeof(uint32_t));
+        op = LIT_INSTRUCTION_OPCODE(instruction);
+        if(op >= sizeof(reg_op_names) / sizeof(reg_op_names[0]))
+        {
+            wr->format("Unknown register opcode %d\n", (int)op);
+            return offset + sizeof(uint32_t);
+        }
+        wr->format("%s%-16s%s", COLOR_YELLOW, reg_op_names[op], COLOR_RESET);
+        switch(op)
+        {
+            case ROP_LOADK:
+                {
+                    wr->format(" r%d '", (int)LIT_INSTRUCTION_A(instruction));
+                    Object::print(state, wr, chunk->m_constants.m_values[LIT_INSTRUCTION_BX(instruction)]);
+                    wr->put("'");
+                }
+                break;
+            case ROP_LOADBOOL:
+                {
+                    wr->format(" r%d %s", (int)LIT_INSTRUCTION_A(instruction), LIT_INSTRUCTION_B(instruction) ? "true" : "false");
+                }
+                break;
+            case ROP_GETGLOBAL:
+            case ROP_SETGLOBAL:
+                {
+                    slot = (uint16_t)(chunk->m_code[offset + 4] << 8);
+                    slot |= chunk->m_code[offset + 5];
+                    wr->format(" r%d %d '", (int)LIT_INSTRUCTION_A(instruction), (int)slot);
+                    Object::print(state, wr, state->vm->globalnames.m_values[slot]->asValue());
+                    wr->put("'\n");
+                    return offset + 2 * sizeof(uint32_t);
+                }
+                break;
+            case ROP_GETPRIVATE:
+            case ROP_SETPRIVATE:
+                {
+                    wr->format(" r%d %d", (int)LIT_INSTRUCTION_A(instruction), (int)LIT_INSTRUCTION_BX(instruction));
+                }
+                break;
+            case ROP_ADD:
+            case ROP_SUB:
+            case ROP_MUL:
+            case ROP_DIV:
+            case ROP_MOD:
+            case ROP_EQ:
+            case ROP_LT:
+            case ROP_LE:
+            case ROP_GT:
+            case ROP_GE:
+                {
+                    wr->format(" r%d", (int)LIT_INSTRUCTION_A(instruction));
+                    print_rk_operand(state, wr, chunk, LIT_INSTRUCTION_B(instruction));
+                    print_rk_operand(state, wr, chunk, LIT_INSTRUCTION_C(instruction));
+                }
+                break;
+            case ROP_JEQ:
+            case ROP_JLT:
+            case ROP_JLE:
+            case ROP_JGT:
+            case ROP_JGE:
+                {
+                    wr->format(" %s", LIT_INSTRUCTION_A(instruction) ? "true" : "false");
+                    print_rk_operand(state, wr, chunk, LIT_INSTRUCTION_B(instruction));
+                    print_rk_operand(state, wr, chunk, LIT_INSTRUCTION_C(instruction));
+                }
+                break;
+            case ROP_JMP:
+                {
+                    wr->format(" -> %d", (int)(offset + sizeof(uint32_t) * (1 + (int32_t)LIT_INSTRUCTION_SBX(instruction))));
+                }
+                break;
+            case ROP_JMPIF:
+            case ROP_JMPIFNOT:
+                {
+                    wr->format(" r%d -> %d", (int)LIT_INSTRUCTION_A(instruction),
+                               (int)(offset + sizeof(uint32_t) * (1 + (int32_t)LIT_INSTRUCTION_SBX(instruction))));
+                }
+                break;
+            case ROP_CALL:
+                {
+                    wr->format(" r%d (%d args)", (int)LIT_INSTRUCTION_A(instruction), (int)LIT_INSTRUCTION_B(instruction));
+                }
+                break;
+            case ROP_MOVE:
+            case ROP_NEG:
+            case ROP_NOT:
+                {
+                    wr->format(" r%d r%d", (int)LIT_INSTRUCTION_A(instruction), (int)LIT_INSTRUCTION_B(instruction));
+                }
+                break;
+            default:
+                {
+                    wr->format(" r%d", (int)LIT_INSTRUCTION_A(instruction));
+                }
+                break;
+        }
+        wr->put("\n");
+        return offset + sizeof(uint32_t);
+    }
+
+    static void disassemble_code(Chunk* chunk, const char* name, const char* source, bool registers)
     {
         size_t i;
         size_t offset;
@@ -530,16 +825,33 @@ namespace lit
             if(Object::isFunction(value))
             {
                 function = Object::as<Function>(value);
-                lit_disassemble_chunk(&function->chunk, function->name->data(), source);
+                disassemble_code(&function->chunk, function->name->data(), source, function->m_registers != 0);
             }
         }
         chunk->m_state->debugwriter.format("== %s ==\n", name);
         for(offset = 0; offset < chunk->m_count;)
         {
-            offset = lit_disassemble_instruction(chunk->m_state, chunk, offset, source);
+            if(registers)
+            {
+                offset = lit_disassemble_reginstruction(chunk->m_state, chunk, offset, source);
+            }
+            else
+            {
+                offset = lit_disassemble_instruction(chunk->m_state, chunk, offset, source);
+            }
         }
     }
 
+    void lit_disassemble_chunk(Chunk* chunk, const char* name, const char* source)
+    {
+        disassemble_code(chunk, name, source, false);
+    }
+
+    void lit_disassemble_regchunk(Chunk* chunk, const char* name, const char* source)
+    {
+        disassemble_code(chunk, name, source, true);
+    }
+
     void lit_disassemble_module(State* state, Module* module, const char* source)
     {
         (void)state;
@@ -610,6 +922,10 @@ namespace lit
                 return "default arguments must always be in the end of the argument list.";
             case Error::LITERROR_TOO_MANY_CONSTANTS:
                 return "too many constants for one chunk";
+            case Error::LITERROR_TOO_MANY_CACHE_SITES:
+                return "too many field accesses and method calls for one chunk";
+            case Error::LITERROR_TOO_MANY_GLOBALS:
+                return "too many global variables";
             case Error::LITERROR_TOO_MANY_PRIVATES:
                 return "too many private locals for one module";
             case Error::LITERROR_VAR_REDEFINED:
@@ -839,7 +1155,7 @@ namespace lit
         va_end(args_copy);
         buffer = (char*)malloc(buffer_size+1);
         vsnprintf(buffer, buffer_size, format, args);
-        return lit_handle_runtime_error(vm, String::take(vm->m_state, buffer, buffer_size));
+        return lit_handle_runtime_error(vm, String::take(vm->m_state, buffer, buffer_size - 1));
     }
 
     bool lit_runtime_error(VM* vm, const char* format, ...)
@@ -1017,7 +1333,7 @@ namespace lit
             return Object::toNumber(a) < Object::toNumber(b);
         }
         argv[0] = b;
-        return !Object::isFalsey(state->findAndCallMethod(a, String::intern(state, "<"), argv, 1).result);
+        return !Object::isFalsey(state->findAndCallMethod(a, state->symbol(LITSYM_LESS), argv, 1).result);
     }
 
     void util_basic_quick_sort(State* state, Value* clist, int length)
@@ -1312,7 +1628,7 @@ namespace lit
 
             Value data;
 
-            if(!Object::as<Instance>(instance)->fields.get(String::intern(state, "_data"), &data))
+            if(!Object::as<Instance>(instance)->getField(String::intern(state, "_data"), &data))
             {
                 return 0;
             }
@@ -1323,7 +1639,7 @@ namespace lit
         static Value random_constructor(VM* vm, Value instance, size_t argc, Value* argv)
         {
             Userdata* userdata = Userdata::make(vm->m_state, sizeof(size_t), false);
-            Object::as<Instance>(instance)->fields.set(String::intern(vm->m_state, "_data"), userdata->asValue());
+            Object::as<Instance>(instance)->setField(String::intern(vm->m_state, "_data"), userdata->asValue());
 
             size_t* data = (size_t*)userdata->data;
 
@@ -1464,7 +1780,7 @@ namespace lit
                         {
                             if(index == target)
                             {
-                                return map->m_values.m_inner.m_values[i]->value;
+                                return map->at(i)->value;
                             }
 
                             index++;
@@ -1490,8 +1806,8 @@ namespace lit
             {
                 Class* klass = Class::make(state, "Math");
                 {
-                    klass->static_fields.setField("Pi", Object::toValue(M_PI));
-                    klass->static_fields.setField("Tau", Object::toValue(M_PI * 2));
+                    klass->setField("Pi", Object::toValue(M_PI));
+                    klass->setField("Tau", Object::toValue(M_PI * 2));
                     klass->setStaticMethod("abs", math_abs);
                     klass->setStaticMethod("sin", math_sin);
                     klass->setStaticMethod("cos", math_cos);
@@ -1559,7 +1875,7 @@ namespace lit
             }
             module = Object::as<Module>(value);
 
-            if(id == name)
+            if(String::equal(vm->m_state, id, name))
             {
                 return module->asValue();
             }
@@ -1628,7 +1944,7 @@ namespace lit
             {
                 klass->inheritFrom(state->objectvalue_class);
                 klass->bindConstructor(util_invalid_constructor);
-                klass->static_fields.setField("loaded", state->vm->modules->asValue());
+                klass->setField("loaded", state->vm->modules->asValue());
                 klass->setStaticGetter("privates", objfn_module_privates);
                 klass->setStaticGetter("current", objfn_module_current);
                 klass->bindMethod("toString", objfn_module_tostring);
@@ -1678,7 +1994,7 @@ namespace lit
                 return Object::NullVal;
             }
             m = Map::make(vm->m_state);
-            for(i=0; i<selfclass->methods.size(); i++)
+            for(i=0; i<selfclass->methods.capacity(); i++)
             {
                 key = selfclass->methods.at(i)->key;
                 if(key != nullptr)
@@ -1696,7 +2012,7 @@ namespace lit
             Value val;
             (void)state;
             (void)includenullkeys;
-            for(i=0; i<fromtbl->size(); i++)
+            for(i=0; i<fromtbl->capacity(); i++)
             {
                 key = fromtbl->at(i)->key;
                 if(key != nullptr)
@@ -1738,7 +2054,10 @@ namespace lit
             if(inst != nullptr)
             {
                 minst = Map::make(vm->m_state);
-                fillmap(vm->m_state, minst, &(inst->fields), true);
+                inst->eachField([&](String* key, Value val)
+                {
+                    minst->set(key, val);
+                });
             }
             if(klass != nullptr)
             {
@@ -1839,14 +2158,14 @@ namespace lit
                 {
                     lit_runtime_error_exiting(vm, "object index must be a string");
                 }
-                inst->fields.set(Object::as<String>(argv[0]), argv[1]);
+                inst->setField(Object::as<String>(argv[0]), argv[1]);
                 return argv[1];
             }
             if(!Object::isString(argv[0]))
             {
                 lit_runtime_error_exiting(vm, "object index must be a string");
             }
-            if(inst->fields.get(Object::as<String>(argv[0]), &value))
+            if(inst->getField(Object::as<String>(argv[0]), &value))
             {
                 return value;
             }
@@ -1872,7 +2191,7 @@ namespace lit
             LIT_ENSURE_ARGS(1);
             self = Object::as<Instance>(instance);
             index = argv[0] == Object::NullVal ? -1 : Object::toNumber(argv[0]);
-            value = self->fields.iterator(index);
+            value = self->fieldIterator(index);
             return value == -1 ? Object::NullVal : Object::toValue(value);
         }
 
@@ -1883,7 +2202,7 @@ namespace lit
             Instance* self;
             index = lit_check_number(vm, argv, argc, 0);
             self = Object::as<Instance>(instance);
-            return self->fields.iterKey(index);
+            return self->fieldIterKey(index);
         }
 
         void lit_open_object_library(State* state)
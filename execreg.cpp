@@ -0,0 +1,547 @@
+#include "lit.h"
+#include "priv.h"
+
+namespace lit
+{
+    /*
+    * the interpreter loop for register code (see regopcode.inc and AST::RegEmitter).
+    * a register frame keeps the fiber's stack top just past its registers, so that the collector
+    * sees all of them; whatever it calls (the callee of CALL, or an operator method, from the two
+    * scratch slots past the registers) gets its frame on top of that, like any other call, and its
+    * result ends up at the stack top. when the frame is entered again, the instruction it was in is
+    * finished off with that result; see reg_finish().
+    */
+
+    #ifdef LIT_USE_COMPUTEDGOTO
+        #define reg_default()
+        #define reg_case(name) \
+            ROP_##name:
+    #else
+        #define reg_default() default:
+        #define reg_case(name) \
+            case ROP_##name:
+    #endif
+
+    #define reg_pushgc(state, allow) \
+        bool was_allowed = state->allow_gc; \
+        state->allow_gc = allow;
+
+    #define reg_popgc(state) \
+        state->allow_gc = was_allowed;
+
+    #define reg_a() LIT_INSTRUCTION_A(instruction)
+    #define reg_b() LIT_INSTRUCTION_B(instruction)
+    #define reg_c() LIT_INSTRUCTION_C(instruction)
+    #define reg_bx() LIT_INSTRUCTION_BX(instruction)
+    #define reg_sbx() ((int32_t)LIT_INSTRUCTION_SBX(instruction))
+
+    static inline Value reg_rk(Value* slots, Value* constants, uint32_t operand)
+    {
+        if(operand & LIT_RK_CONSTANT)
+        {
+            return constants[operand & LIT_RK_MAX_INDEX];
+        }
+        return slots[operand];
+    }
+
+    /* the slot of a global, kept as a big-endian short in the word after the instruction */
+    static inline uint16_t reg_globalslot(uint32_t* ip)
+    {
+        uint8_t* bytes;
+        bytes = (uint8_t*)ip;
+        return (uint16_t)((bytes[0] << 8) | bytes[1]);
+    }
+
+    /*
+    * finishes the instruction before $ip, whose call returned $result: a conditional jump takes
+    * the JMP after it or skips it, and anything else stores $result.
+    */
+    static inline uint32_t* reg_finish(Value* slots, uint32_t* ip, Value result)
+    {
+        uint32_t instruction;
+        instruction = ip[-1];
+        switch(LIT_INSTRUCTION_OPCODE(instruction))
+        {
+            case ROP_JEQ:
+            case ROP_JLT:
+            case ROP_JLE:
+            case ROP_JGT:
+            case ROP_JGE:
+                {
+                    if(!Object::isFalsey(result) != (reg_a() != 0))
+                    {
+                        ip++;
+                    }
+                }
+                break;
+            default:
+                {
+                    slots[reg_a()] = result;
+                }
+                break;
+        }
+        return ip;
+    }
+
+    /* hands the fiber back to runFiber(), for a frame that is not register code */
+    #define reg_switchloop() \
+        reg_popgc(this); \
+        return Result{ LITRESULT_SWITCH, Object::NullVal };
+
+    #define reg_returnerror() \
+        reg_popgc(this); \
+        return Result{ LITRESULT_RUNTIME_ERROR, Object::NullVal };
+
+    #define reg_writeframe() \
+        frame->ip = (uint8_t*)ip;
+
+    /*
+    * enters the frame on top of the fiber: either at its start, or back from a call, in which case
+    * the instruction that made it is finished first. registers past the stack top are dead, and
+    * are cleared before the collector gets to see them.
+    */
+    #define reg_readframe() \
+        frame = &fiber->m_allframes[fiber->m_framecount - 1]; \
+        if(frame->function->m_registers == 0) \
+        { \
+            reg_switchloop(); \
+        } \
+        ip = (uint32_t*)frame->ip; \
+        slots = frame->slots; \
+        if(frame->ip != frame->function->chunk.m_code) \
+        { \
+            ip = reg_finish(slots, ip, fiber->m_stacktop[-1]); \
+        } \
+        reg_enterframe();
+
+    /* the rest of reg_readframe(), for a frame known to be register code */
+    #define reg_enterframe() \
+        constants = frame->function->chunk.m_constants.m_values; \
+        fiber->m_module = frame->function->module; \
+        privates = fiber->m_module->privates; \
+        for(pval = fiber->m_stacktop; pval < slots + frame->function->m_registers; pval++) \
+        { \
+            *pval = Object::NullVal; \
+        } \
+        fiber->m_stacktop = slots + frame->function->m_registers;
+
+    #define reg_recoverstate() \
+        fiber = vm->fiber; \
+        if(fiber == nullptr) \
+        { \
+            reg_popgc(this); \
+            return Result{ LITRESULT_OK, Object::NullVal }; \
+        } \
+        if(fiber->m_isaborting) \
+        { \
+            reg_returnerror(); \
+        } \
+        reg_readframe();
+
+    /* calls $callee with the $arg_count values past $base; the frame must have been written */
+    #define reg_callvalue(name, callee, arg_count) \
+        if(vm->callValue(name, callee, arg_count)) \
+        { \
+            reg_recoverstate(); \
+        } \
+        else \
+        { \
+            reg_readframe(); \
+        }
+
+    #define reg_rterror(format) \
+        reg_writeframe(); \
+        if(lit_runtime_error(vm, format)) \
+        { \
+            reg_recoverstate(); \
+            continue; \
+        } \
+        reg_returnerror();
+
+    #define reg_rterrorvarg(format, ...) \
+        reg_writeframe(); \
+        if(lit_runtime_error(vm, format, __VA_ARGS__)) \
+        { \
+            reg_recoverstate(); \
+            continue; \
+        } \
+        reg_returnerror();
+
+    /*
+    * calls operator method $sym of $receiver, with $arg if $arg_count is 1, from the scratch slots.
+    * a missing method is an error if $must_exist, and leaves $receiver as the result otherwise.
+    */
+    #define reg_invokeop(opname, receiver, arg, arg_count, sym, must_exist) \
+        klass = Class::getClassFor(this, receiver); \
+        if(klass == nullptr) \
+        { \
+            reg_rterrorvarg("invokemethod(%s -> %s): cannot get class object for a '%s'", opname, this->symbol(sym)->data(), Object::valueName(receiver)); \
+        } \
+        method_name = this->symbol(sym); \
+        if(!((Object::isInstance(receiver) && Object::as<Instance>(receiver)->getField(method_name, &method)) \
+           || klass->methods.get(method_name, &method))) \
+        { \
+            if(must_exist) \
+            { \
+                reg_rterrorvarg("Attempt to call method '%s', that is not defined in class %s", method_name->data(), klass->name->data()); \
+            } \
+            slots[reg_a()] = receiver; \
+            continue; \
+        } \
+        scratch = slots + frame->function->m_registers; \
+        scratch[0] = receiver; \
+        scratch[1] = arg; \
+        fiber->m_stacktop = scratch + 1 + arg_count; \
+        reg_writeframe(); \
+        reg_callvalue(method_name->data(), method, arg_count); \
+        continue;
+
+    /* the operands of anything but two numbers (or a number and null), as in the bytecode loop */
+    #define reg_binaryslow(type, op, op_sym) \
+        if(Object::isNumber(a)) \
+        { \
+            if(!Object::isNumber(b) && !Object::isNull(b)) \
+            { \
+                reg_rterrorvarg("Attempt to use op %s with a number and a %s", this->symbol(op_sym)->data(), Object::valueName(b)); \
+            } \
+            result = (type(Object::toNumber(a) op Object::toNumber(b))); \
+        } \
+        else if(Object::isNull(a)) \
+        { \
+            result = Object::TrueVal; \
+        } \
+        else \
+        { \
+            reg_invokeop("vm_binaryop", a, b, 1, op_sym, true); \
+        }
+
+    #define reg_binaryop(type, op, op_sym) \
+        a = reg_rk(slots, constants, reg_b()); \
+        b = reg_rk(slots, constants, reg_c()); \
+        if(Object::isNumber(a) && Object::isNumber(b)) \
+        { \
+            slots[reg_a()] = (type(Object::toNumber(a) op Object::toNumber(b))); \
+            continue; \
+        } \
+        reg_binaryslow(type, op, op_sym); \
+        slots[reg_a()] = result; \
+        continue;
+
+    /* a comparison that takes the JMP after it if its result is as truthy as A, and skips it otherwise */
+    #define reg_compareop(type, op, op_sym) \
+        a = reg_rk(slots, constants, reg_b()); \
+        b = reg_rk(slots, constants, reg_c()); \
+        if(Object::isNumber(a) && Object::isNumber(b)) \
+        { \
+            if((Object::toNumber(a) op Object::toNumber(b)) == (reg_a() != 0)) \
+            { \
+                instruction = *ip++; \
+                ip += reg_sbx(); \
+            } \
+            else \
+            { \
+                ip++; \
+            } \
+            continue; \
+        } \
+        reg_binaryslow(type, op, op_sym); \
+        if(!Object::isFalsey(result) != (reg_a() != 0)) \
+        { \
+            ip++; \
+        } \
+        continue;
+
+    Result State::runRegisters(Fiber* fiber)
+    {
+        uint32_t instruction;
+        uint32_t* ip;
+        Fiber::CallFrame* frame;
+        Class* klass;
+        Fiber* parent;
+        String* method_name;
+        size_t arg_count;
+        Value a;
+        Value b;
+        Value method;
+        Value result;
+        Value* constants;
+        Value* privates;
+        Value* pval;
+        Value* scratch;
+        Value* slots;
+        VM* vm;
+        vm = this->vm;
+        #ifdef LIT_USE_COMPUTEDGOTO
+            static void* dispatch_table[] =
+            {
+                #define REGOP(name, type) &&ROP_##name,
+                #include "regopcode.inc"
+                #undef REGOP
+            };
+        #endif
+        reg_pushgc(this, true);
+        vm->fiber = fiber;
+        fiber->m_isaborting = false;
+        reg_readframe();
+        while(true)
+        {
+            instruction = *ip++;
+            #ifdef LIT_TRACE_EXECUTION
+                lit_disassemble_reginstruction(this, &frame->function->chunk, (size_t)((uint8_t*)(ip - 1) - frame->function->chunk.m_code), nullptr);
+            #endif
+            #ifdef LIT_USE_COMPUTEDGOTO
+                goto* dispatch_table[LIT_INSTRUCTION_OPCODE(instruction)];
+            #else
+                switch(LIT_INSTRUCTION_OPCODE(instruction))
+            #endif
+            /* as in runCode(), each case must end with continue or return */
+            {
+                reg_case(MOVE)
+                {
+                    slots[reg_a()] = slots[reg_b()];
+                    continue;
+                }
+                reg_case(LOADK)
+                {
+                    slots[reg_a()] = constants[reg_bx()];
+                    continue;
+                }
+                reg_case(LOADNULL)
+                {
+                    slots[reg_a()] = Object::NullVal;
+                    continue;
+                }
+                reg_case(LOADBOOL)
+                {
+                    slots[reg_a()] = Object::fromBool(reg_b() != 0);
+                    continue;
+                }
+                reg_case(GETGLOBAL)
+                {
+                    slots[reg_a()] = vm->globalvalues.m_values[reg_globalslot(ip)];
+                    ip++;
+                    continue;
+                }
+                reg_case(SETGLOBAL)
+                {
+                    vm->globalvalues.m_values[reg_globalslot(ip)] = slots[reg_a()];
+                    ip++;
+                    continue;
+                }
+                reg_case(GETPRIVATE)
+                {
+                    slots[reg_a()] = privates[reg_bx()];
+                    continue;
+                }
+                reg_case(SETPRIVATE)
+                {
+                    privates[reg_bx()] = slots[reg_a()];
+                    continue;
+                }
+                reg_case(ADD)
+                {
+                    reg_binaryop(Object::toValue, +, LITSYM_PLUS);
+                }
+                reg_case(SUB)
+                {
+                    reg_binaryop(Object::toValue, -, LITSYM_MINUS);
+                }
+                reg_case(MUL)
+                {
+                    reg_binaryop(Object::toValue, *, LITSYM_MULTIPLY);
+                }
+                reg_case(DIV)
+                {
+                    reg_binaryop(Object::toValue, /, LITSYM_DIVIDE);
+                }
+                reg_case(MOD)
+                {
+                    a = reg_rk(slots, constants, reg_b());
+                    b = reg_rk(slots, constants, reg_c());
+                    if(Object::isNumber(a) && Object::isNumber(b))
+                    {
+                        slots[reg_a()] = Object::toValue(fmod(Object::toNumber(a), Object::toNumber(b)));
+                        continue;
+                    }
+                    reg_invokeop("MOD", a, b, 1, LITSYM_MOD, true);
+                }
+                reg_case(EQ)
+                {
+                    reg_binaryop(Object::toValue, ==, LITSYM_EQUAL);
+                }
+                reg_case(LT)
+                {
+                    reg_binaryop(Object::fromBool, <, LITSYM_LESS);
+                }
+                reg_case(LE)
+                {
+                    reg_binaryop(Object::fromBool, <=, LITSYM_LESS_EQUAL);
+                }
+                reg_case(GT)
+                {
+                    reg_binaryop(Object::fromBool, >, LITSYM_GREATER);
+                }
+                reg_case(GE)
+                {
+                    reg_binaryop(Object::fromBool, >=, LITSYM_GREATER_EQUAL);
+                }
+                reg_case(JEQ)
+                {
+                    reg_compareop(Object::toValue, ==, LITSYM_EQUAL);
+                }
+                reg_case(JLT)
+                {
+                    reg_compareop(Object::fromBool, <, LITSYM_LESS);
+                }
+                reg_case(JLE)
+                {
+                    reg_compareop(Object::fromBool, <=, LITSYM_LESS_EQUAL);
+                }
+                reg_case(JGT)
+                {
+                    reg_compareop(Object::fromBool, >, LITSYM_GREATER);
+                }
+                reg_case(JGE)
+                {
+                    reg_compareop(Object::fromBool, >=, LITSYM_GREATER_EQUAL);
+                }
+                reg_case(NEG)
+                {
+                    a = slots[reg_b()];
+                    if(!Object::isNumber(a))
+                    {
+                        if(Object::isString(a) && strcmp(Object::asString(a)->cstr(), "muffin") == 0)
+                        {
+                            reg_rterror("Idk, can you negate a muffin?");
+                        }
+                        reg_rterror("Operand must be a number");
+                    }
+                    slots[reg_a()] = Object::toValue(-Object::toNumber(a));
+                    continue;
+                }
+                reg_case(NOT)
+                {
+                    a = slots[reg_b()];
+                    if(Object::isInstance(a))
+                    {
+                        reg_invokeop("NOT", a, Object::NullVal, 0, LITSYM_NOT, false);
+                    }
+                    slots[reg_a()] = Object::fromBool(Object::isFalsey(a));
+                    continue;
+                }
+                reg_case(JMP)
+                {
+                    ip += reg_sbx();
+                    continue;
+                }
+                reg_case(JMPIF)
+                {
+                    if(!Object::isFalsey(slots[reg_a()]))
+                    {
+                        ip += reg_sbx();
+                    }
+                    continue;
+                }
+                reg_case(JMPIFNOT)
+                {
+                    if(Object::isFalsey(slots[reg_a()]))
+                    {
+                        ip += reg_sbx();
+                    }
+                    continue;
+                }
+                reg_case(CALL)
+                {
+                    /* the callee and its arguments are on top of the stack, as the call expects */
+                    fiber->m_stacktop = slots + reg_a() + 1 + reg_b();
+                    reg_writeframe();
+                    method = slots[reg_a()];
+                    if(Object::isFunction(method) && Object::as<Function>(method)->m_registers != 0)
+                    {
+                        /* register code calling register code stays in this loop, so the new frame needs no checks */
+                        vm->dispatchCall(Object::as<Function>(method), nullptr, reg_b());
+                        frame = &fiber->m_allframes[fiber->m_framecount - 1];
+                        ip = (uint32_t*)frame->ip;
+                        slots = frame->slots;
+                        reg_enterframe();
+                        continue;
+                    }
+                    reg_callvalue("unknown", method, reg_b());
+                    continue;
+                }
+                reg_case(RETURN)
+                {
+                    result = slots[reg_a()];
+                    reg_writeframe();
+                    fiber->m_framecount--;
+                    if(frame->return_to_c)
+                    {
+                        frame->return_to_c = false;
+                        fiber->m_module->return_value = result;
+                        fiber->m_stacktop = frame->slots;
+                        reg_popgc(this);
+                        return Result{ LITRESULT_OK, result };
+                    }
+                    if(fiber->m_framecount == 0)
+                    {
+                        fiber->m_module->return_value = result;
+                        if(fiber->m_parent == nullptr)
+                        {
+                            fiber->m_stacktop = frame->slots;
+                            reg_popgc(this);
+                            return Result{ LITRESULT_OK, result };
+                        }
+                        arg_count = fiber->m_argcount;
+                        parent = fiber->m_parent;
+                        fiber->m_parent = nullptr;
+                        vm->fiber = fiber = parent;
+                        fiber->m_stacktop -= arg_count;
+                        fiber->m_stacktop[-1] = result;
+                        reg_readframe();
+                        continue;
+                    }
+                    fiber->m_stacktop = frame->slots;
+                    if(frame->result_ignored)
+                    {
+                        fiber->m_stacktop++;
+                        frame->result_ignored = false;
+                    }
+                    else
+                    {
+                        *fiber->m_stacktop++ = result;
+                    }
+                    reg_readframe();
+                    continue;
+                }
+                reg_default()
+                {
+                    reg_rterrorvarg("Unknown register op code '%d'", (int)LIT_INSTRUCTION_OPCODE(instruction));
+                }
+            }
+        }
+        reg_returnerror();
+    }
+
+    #undef reg_compareop
+    #undef reg_binaryop
+    #undef reg_binaryslow
+    #undef reg_invokeop
+    #undef reg_rterrorvarg
+    #undef reg_rterror
+    #undef reg_callvalue
+    #undef reg_recoverstate
+    #undef reg_enterframe
+    #undef reg_readframe
+    #undef reg_writeframe
+    #undef reg_returnerror
+    #undef reg_switchloop
+    #undef reg_sbx
+    #undef reg_bx
+    #undef reg_c
+    #undef reg_b
+    #undef reg_a
+    #undef reg_popgc
+    #undef reg_pushgc
+    #undef reg_case
+    #undef reg_default
+}
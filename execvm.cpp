@@ -1,5 +1,6 @@
 
 #include "lit.h"
+#include "priv.h"
 
 namespace lit
 {
@@ -7,14 +8,6 @@ namespace lit
 
     //#define LIT_TRACE_EXECUTION
 
-    /*
-    * visual studio doesn't support computed gotos, so
-    * instead a switch-case is used. 
-    */
-    #if !defined(_MSC_VER)
-        #define LIT_USE_COMPUTEDGOTO
-    #endif
-
     #ifdef LIT_TRACE_EXECUTION
         #define vm_traceframe(fiber)\
             lit_trace_frame(fiber);
@@ -29,10 +22,12 @@ namespace lit
         #define vm_default()
         #define op_case(name) \
             OP_##name:
+        #define vm_dispatchtable dispatch_table
     #else
         #define vm_default() default:
         #define op_case(name) \
             case OP_##name:
+        #define vm_dispatchtable nullptr
     #endif
 
     #define vm_pushgc(state, allow) \
@@ -54,17 +49,279 @@ namespace lit
     #define vm_dropn(fiber, amount) \
         (fiber->m_stacktop -= amount)
 
-    #define vm_readbyte(ip) \
-        (*ip++)
+    /*
+    * the interpreter loop is compiled twice: once over the bytes of a chunk, and once over threaded
+    * code (see vm_translate()), whose words line up with those bytes. everything that looks at the
+    * code goes through these pairs, so that the handlers themselves are shared.
+    */
+    static inline uint8_t vm_readbyte(uint8_t*& ip)
+    {
+        return *ip++;
+    }
+
+    static inline uint8_t vm_readbyte(CodeWord*& ip)
+    {
+        return (uint8_t)(ip++)->operand;
+    }
+
+    static inline uint16_t vm_readshort(uint8_t*& ip)
+    {
+        ip += 2u;
+        return (uint16_t)((ip[-2] << 8u) | ip[-1]);
+    }
+
+    static inline uint16_t vm_readshort(CodeWord*& ip)
+    {
+        ip += 2u;
+        return (uint16_t)ip[-2].operand;
+    }
+
+    static inline Value vm_readvalue(Chunk* chunk, uint8_t*& ip)
+    {
+        return chunk->m_constants.m_values[*ip++];
+    }
+
+    static inline Value vm_readvalue(Chunk* chunk, CodeWord*& ip)
+    {
+        (void)chunk;
+        return (ip++)->value;
+    }
+
+    static inline Value vm_readvaluelong(Chunk* chunk, uint8_t*& ip)
+    {
+        return chunk->m_constants.m_values[vm_readshort(ip)];
+    }
+
+    static inline Value vm_readvaluelong(Chunk* chunk, CodeWord*& ip)
+    {
+        (void)chunk;
+        ip += 2u;
+        return ip[-2].value;
+    }
+
+    /* operands further along a fused sequence, $at bytes past ip, which is left where it is */
+    static inline uint8_t vm_byteat(uint8_t* ip, size_t at)
+    {
+        return ip[at];
+    }
+
+    static inline uint8_t vm_byteat(CodeWord* ip, size_t at)
+    {
+        return (uint8_t)ip[at].operand;
+    }
+
+    static inline uint16_t vm_shortat(uint8_t* ip, size_t at)
+    {
+        return (uint16_t)((ip[at] << 8u) | ip[at + 1]);
+    }
+
+    static inline uint16_t vm_shortat(CodeWord* ip, size_t at)
+    {
+        return (uint16_t)ip[at].operand;
+    }
+
+    static inline Value vm_valueat(Chunk* chunk, uint8_t* ip, size_t at)
+    {
+        return chunk->m_constants.m_values[ip[at]];
+    }
+
+    static inline Value vm_valueat(Chunk* chunk, CodeWord* ip, size_t at)
+    {
+        (void)chunk;
+        return ip[at].value;
+    }
+
+    /* rewrites the byte operand $at bytes past ip */
+    static inline void vm_patchbyte(uint8_t* ip, size_t at, uint8_t value)
+    {
+        ip[at] = value;
+    }
+
+    static inline void vm_patchbyte(CodeWord* ip, size_t at, uint8_t value)
+    {
+        ip[at].operand = value;
+    }
+
+    /* rewrites the opcode at $at, for quickening */
+    static inline void vm_setop(uint8_t* at, uint8_t op, void* const* table)
+    {
+        (void)table;
+        *at = op;
+    }
+
+    static inline void vm_setop(CodeWord* at, uint8_t op, void* const* table)
+    {
+        at->handler = table[op];
+    }
+
+    /* the byte that $ip stands for, which is what frames keep */
+    static inline uint8_t* vm_codeptr(Fiber::CallFrame* frame, uint8_t* ip)
+    {
+        (void)frame;
+        return ip;
+    }
+
+    static inline uint8_t* vm_codeptr(Fiber::CallFrame* frame, CodeWord* ip)
+    {
+        return frame->function->chunk.m_code + (ip - frame->function->m_threaded);
+    }
+
+    static inline bool vm_wantsthreaded(Function* function)
+    {
+    #ifdef LIT_USE_COMPUTEDGOTO
+        return (function->m_threaded != nullptr) || (function->m_registers == 0 && function->m_hotness >= LIT_THREADED_HOTNESS);
+    #else
+        (void)function;
+        return false;
+    #endif
+    }
+
+    /*
+    * pre-decodes $function for the threaded loop, whose handlers are in $table. jump offsets need no
+    * rewriting, since each word stands for the byte at the same index; the words in between
+    * (the second byte of a short operand, say) are never read.
+    * this relies on Chunk::instructionLength() giving a superinstruction the length of the GET_LOCAL
+    * it replaced, so that the plain sequence after it is decoded as well: a superinstruction that
+    * deoptimizes turns back into that GET_LOCAL, and the rest of the sequence then runs from here.
+    */
+    static void vm_translate(State* state, Function* function, void* const* table)
+    {
+        size_t at;
+        size_t j;
+        size_t length;
+        uint8_t* code;
+        Chunk* chunk;
+        CodeWord* words;
+        Value* constants;
+        chunk = &function->chunk;
+        constants = chunk->m_constants.m_values;
+        words = LIT_ALLOCATE(state, CodeWord, chunk->m_count);
+        memset(words, 0, sizeof(CodeWord) * chunk->m_count);
+        at = 0;
+        while(at < chunk->m_count)
+        {
+            code = &chunk->m_code[at];
+            length = chunk->instructionLength(at);
+            words[at].handler = table[code[0]];
+            switch(code[0])
+            {
+                case OP_CONSTANT:
+                    {
+                        words[at + 1].value = constants[code[1]];
+                    }
+                    break;
+                case OP_CONSTANT_LONG:
+                case OP_CLASS:
+                case OP_METHOD:
+                case OP_STATIC_FIELD:
+                case OP_DEFINE_FIELD:
+                case OP_GET_SUPER_METHOD:
+                    {
+                        words[at + 1].value = constants[vm_shortat(code, 1)];
+                    }
+                    break;
+                case OP_INVOKE:
+                case OP_INVOKE_SUPER:
+                case OP_INVOKE_IGNORING:
+                case OP_INVOKE_SUPER_IGNORING:
+                    {
+                        words[at + 1].operand = code[1];
+                        words[at + 2].value = constants[vm_shortat(code, 2)];
+                        words[at + 4].operand = vm_shortat(code, 4);
+                    }
+                    break;
+                case OP_CLOSURE:
+                    {
+                        words[at + 1].value = constants[vm_shortat(code, 1)];
+                        for(j = 3; j < length; j += 3)
+                        {
+                            words[at + j].operand = code[j];
+                            words[at + j + 1].operand = vm_shortat(code, j + 1);
+                        }
+                    }
+                    break;
+                default:
+                    {
+                        if(length == 2)
+                        {
+                            words[at + 1].operand = code[1];
+                        }
+                        else if(length == 3)
+                        {
+                            words[at + 1].operand = vm_shortat(code, 1);
+                        }
+                    }
+                    break;
+            }
+            at += length;
+        }
+        function->m_threaded = words;
+    }
+
+    /*
+    * points $ip at where $frame left off. returns false if the frame belongs to another loop:
+    * functions get threaded code once they are hot, and the threaded loop only runs those;
+    * register code runs in runRegisters().
+    */
+    static inline bool vm_enterframe(State* state, Fiber::CallFrame* frame, uint8_t*& ip, void* const* table)
+    {
+        (void)state;
+        (void)table;
+        if(frame->function->m_registers != 0 || vm_wantsthreaded(frame->function))
+        {
+            return false;
+        }
+        ip = frame->ip;
+        return true;
+    }
+
+    static inline bool vm_enterframe(State* state, Fiber::CallFrame* frame, CodeWord*& ip, void* const* table)
+    {
+        Function* function;
+        function = frame->function;
+        if(!vm_wantsthreaded(function))
+        {
+            return false;
+        }
+        if(function->m_threaded == nullptr)
+        {
+            vm_translate(state, function, table);
+        }
+        ip = function->m_threaded + (frame->ip - function->chunk.m_code);
+        return true;
+    }
+
+    /* counts a loop iteration; the bytecode loop hands over once the function turns hot */
+    static inline bool vm_heatloop(Fiber::CallFrame* frame, uint8_t* ip)
+    {
+        (void)ip;
+        frame->function->m_hotness++;
+        return vm_wantsthreaded(frame->function);
+    }
+
+    static inline bool vm_heatloop(Fiber::CallFrame* frame, CodeWord* ip)
+    {
+        (void)frame;
+        (void)ip;
+        return false;
+    }
+
+    static inline void* vm_nexthandler(uint8_t*& ip, void* const* table)
+    {
+        return table[*ip++];
+    }
 
-    #define vm_readshort(ip) \
-        (ip += 2u, (uint16_t)((ip[-2] << 8u) | ip[-1]))
+    static inline void* vm_nexthandler(CodeWord*& ip, void* const* table)
+    {
+        (void)table;
+        return (ip++)->handler;
+    }
 
     #define vm_readconstant(current_chunk) \
-        (current_chunk->m_constants.m_values[vm_readbyte(ip)])
+        vm_readvalue(current_chunk, ip)
 
     #define vm_readconstantlong(current_chunk, ip) \
-        (current_chunk->m_constants.m_values[vm_readshort(ip)])
+        vm_readvaluelong(current_chunk, ip)
 
     #define vm_readstring(current_chunk) \
         Object::as<String>(vm_readconstant(current_chunk))
@@ -80,20 +337,28 @@ namespace lit
 
     #define vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues) \
         frame = &fiber->m_allframes[fiber->m_framecount - 1]; \
+        if(!vm_enterframe(this, frame, ip, vm_dispatchtable)) \
+        { \
+            vm_switchloop(); \
+        } \
         current_chunk = &frame->function->chunk; \
-        ip = frame->ip; \
         slots = frame->slots; \
         fiber->m_module = frame->function->module; \
         privates = fiber->m_module->privates; \
         upvalues = frame->closure == nullptr ? nullptr : frame->closure->upvalues;
 
     #define vm_writeframe(frame, ip) \
-        frame->ip = ip;
+        frame->ip = vm_codeptr(frame, ip);
 
     #define vm_returnerror() \
         vm_popgc(this); \
         return Result{ LITRESULT_RUNTIME_ERROR, Object::NullVal };
 
+    /* leaves the current frame to the other loop; the frame must have been written */
+    #define vm_switchloop() \
+        vm_popgc(this); \
+        return Result{ LITRESULT_SWITCH, Object::NullVal };
+
     #define vm_recoverstate(fiber, frame, ip, current_chunk, slots, privates, upvalues) \
         vm_writeframe(frame, ip); \
         fiber = vm->fiber; \
@@ -136,29 +401,32 @@ namespace lit
             vm_returnerror(); \
         }
 
-    #define vm_invoke_from_class_advanced(zklass, method_name, arg_count, error, stat, ignoring, callee) \
-        Value mthval; \
-        if((Object::isInstance(callee) && (Object::as<Instance>(callee)->fields.get(method_name, &mthval))) \
-           || zklass->stat.get(method_name, &mthval)) \
+    #define vm_callmethod(method_name, mthval, arg_count, ignoring, callee) \
+        if(ignoring) \
         { \
-            if(ignoring) \
+            if(vm->callValue(method_name->data(), mthval, arg_count)) \
             { \
-                if(vm->callValue(method_name->data(), mthval, arg_count)) \
-                { \
-                    vm_recoverstate(fiber, frame, ip, current_chunk, slots, privates, upvalues); \
-                    frame->result_ignored = true; \
-                } \
-                else \
-                { \
-                    fiber->m_stacktop[-1] = callee; \
-                } \
+                vm_recoverstate(fiber, frame, ip, current_chunk, slots, privates, upvalues); \
+                frame->result_ignored = true; \
             } \
             else \
             { \
-                vm_callvalue(method_name->data(), mthval, arg_count); \
+                fiber->m_stacktop[-1] = callee; \
             } \
         } \
         else \
+        { \
+            vm_callvalue(method_name->data(), mthval, arg_count); \
+        }
+
+    #define vm_invoke_from_class_advanced(zklass, method_name, arg_count, error, stat, ignoring, callee) \
+        Value mthval; \
+        if((Object::isInstance(callee) && (Object::as<Instance>(callee)->getField(method_name, &mthval))) \
+           || zklass->stat.get(method_name, &mthval)) \
+        { \
+            vm_callmethod(method_name, mthval, arg_count, ignoring, callee); \
+        } \
+        else \
         { \
             if(error) \
             { \
@@ -174,17 +442,27 @@ namespace lit
     #define vm_invoke_from_class(klass, method_name, arg_count, error, stat, ignoring) \
         vm_invoke_from_class_advanced(klass, method_name, arg_count, error, stat, ignoring, vm_peek(fiber, arg_count))
 
-    #define vm_invokemethod(opname, instance, method_name, arg_count) \
+    #define vm_invokemethod(opname, instance, method_sym, arg_count) \
         Class* klass = Class::getClassFor(this, instance); \
         if(klass == nullptr) \
         { \
-            vm_rterrorvarg("invokemethod(%s -> %s): cannot get class object for a '%s'", opname, method_name, Object::valueName(instance)); \
+            vm_rterrorvarg("invokemethod(%s -> %s): cannot get class object for a '%s'", opname, this->symbol(method_sym)->data(), Object::valueName(instance)); \
         } \
         vm_writeframe(frame, ip); \
-        vm_invoke_from_class_advanced(klass, String::intern(this, method_name), arg_count, true, methods, false, instance); \
+        vm_invoke_from_class_advanced(klass, this->symbol(method_sym), arg_count, true, methods, false, instance); \
         vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues)
 
-    #define vm_binaryop(type, op, op_string) \
+    /* rewrites the instruction just read, which has no operands */
+    #define vm_quicken(ip, name) \
+        vm_setop(ip - 1, OP_##name, vm_dispatchtable);
+
+    /* turns a quickened instruction back into its generic form, and has that run instead */
+    #define vm_deoptimize(ip, name) \
+        ip--; \
+        vm_setop(ip, OP_##name, vm_dispatchtable); \
+        continue;
+
+    #define vm_binaryop(type, op, op_sym, quickname) \
         Value a = vm_peek(fiber, 1); \
         Value b = vm_peek(fiber, 0); \
         if(Object::isNumber(a)) \
@@ -193,24 +471,39 @@ namespace lit
             { \
                 if(!Object::isNull(b)) \
                 { \
-                    vm_rterrorvarg("Attempt to use op %s with a number and a %s", op_string, Object::valueName(b)); \
+                    vm_rterrorvarg("Attempt to use op %s with a number and a %s", this->symbol(op_sym)->data(), Object::valueName(b)); \
                 } \
             } \
+            else \
+            { \
+                vm_quicken(ip, quickname); \
+            } \
             vm_drop(fiber); \
             *(fiber->m_stacktop - 1) = (type(Object::toNumber(a) op Object::toNumber(b))); \
             continue; \
         } \
         if(Object::isNull(a)) \
         { \
-        /* vm_rterrorvarg("Attempt to use op %s on a null value", op_string); */ \
+        /* vm_rterrorvarg("Attempt to use op %s on a null value", this->symbol(op_sym)->data()); */ \
             vm_drop(fiber); \
             *(fiber->m_stacktop - 1) = Object::TrueVal; \
         } \
         else \
         { \
-            vm_invokemethod("vm_binaryop", a, op_string, 1); \
+            vm_invokemethod("vm_binaryop", a, op_sym, 1); \
         }
 
+    /* the quickened form of vm_binaryop(), for two numbers */
+    #define vm_binaryop_num(type, op, name) \
+        Value a = vm_peek(fiber, 1); \
+        Value b = vm_peek(fiber, 0); \
+        if(!Object::isNumber(a) || !Object::isNumber(b)) \
+        { \
+            vm_deoptimize(ip, name); \
+        } \
+        vm_drop(fiber); \
+        *(fiber->m_stacktop - 1) = (type(Object::toNumber(a) op Object::toNumber(b)));
+
     /*
     * for operators where both float and fixed work (+, -, etc)
     */
@@ -242,6 +535,7 @@ namespace lit
     #define vm_invokeoperation(ignoring) \
         uint8_t arg_count = vm_readbyte(ip); \
         String* method_name = vm_readstringlong(current_chunk, ip); \
+        cache = current_chunk->cacheAt(vm_readshort(ip)); \
         Value receiver = vm_peek(fiber, arg_count); \
         if(Object::isNull(receiver)) \
         { \
@@ -250,14 +544,57 @@ namespace lit
         vm_writeframe(frame, ip); \
         if(Object::isClass(receiver)) \
         { \
-            vm_invoke_from_class_advanced(Object::as<Class>(receiver), method_name, arg_count, true, static_fields, ignoring, receiver); \
+            Class* rcvclass = Object::as<Class>(receiver); \
+            /* keyed on the static table, so it can't be mistaken for a lookup on the class itself */ \
+            centry = cache->find(&rcvclass->static_fields, rcvclass->m_staticversion); \
+            if(centry == nullptr) \
+            { \
+                Value mthval; \
+                if(rcvclass->static_fields.get(method_name, &mthval)) \
+                { \
+                    centry = cache->fill(&rcvclass->static_fields, rcvclass->m_staticversion); \
+                    centry->value = mthval; \
+                } \
+            } \
+            if(centry != nullptr) \
+            { \
+                vm_callmethod(method_name, centry->value, arg_count, ignoring, receiver); \
+                continue; \
+            } \
+            vm_invoke_from_class_advanced(rcvclass, method_name, arg_count, true, static_fields, ignoring, receiver); \
             continue; \
         } \
         else if(Object::isInstance(receiver)) \
         { \
             Instance* instance = Object::as<Instance>(receiver); \
             Value value; \
-            if(instance->fields.get(method_name, &value)) \
+            if(instance->m_shape != nullptr) \
+            { \
+                centry = cache->find(instance->m_shape, instance->klass->m_version); \
+                if(centry == nullptr) \
+                { \
+                    centry = cache->fill(instance->m_shape, instance->klass->m_version); \
+                    centry->slot = instance->m_shape->lookup(method_name); \
+                    if(centry->slot == -1 && !instance->klass->methods.get(method_name, &centry->value)) \
+                    { \
+                        centry->value = Object::NullVal; \
+                    } \
+                } \
+                if(centry->slot != -1) \
+                { \
+                    value = instance->m_slots[centry->slot]; \
+                    fiber->m_stacktop[-arg_count - 1] = value; \
+                    vm_callvalue(method_name->data(), value, arg_count); \
+                    vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues); \
+                    continue; \
+                } \
+                if(!Object::isNull(centry->value)) \
+                { \
+                    vm_callmethod(method_name, centry->value, arg_count, ignoring, receiver); \
+                    continue; \
+                } \
+            } \
+            else if(instance->getField(method_name, &value)) \
             { \
                 fiber->m_stacktop[-arg_count - 1] = value; \
                 vm_callvalue(method_name->data(), value, arg_count); \
@@ -273,17 +610,69 @@ namespace lit
             { \
                 vm_rterror("invokeoperation: only instances and classes have methods"); \
             } \
+            centry = cache->find(type, type->m_version); \
+            if(centry == nullptr) \
+            { \
+                Value mthval; \
+                if(type->methods.get(method_name, &mthval)) \
+                { \
+                    centry = cache->fill(type, type->m_version); \
+                    centry->value = mthval; \
+                } \
+            } \
+            if(centry != nullptr) \
+            { \
+                vm_callmethod(method_name, centry->value, arg_count, ignoring, receiver); \
+                continue; \
+            } \
             vm_invoke_from_class_advanced(type, method_name, arg_count, true, methods, ignoring, receiver); \
         }
 
+    /*
+    * super calls are keyed on the receiver's shape, since a field of the same
+    * name shadows the method; such sites are left to the uncached path.
+    */
+    #define vm_invokesuper(ignoring) \
+        arg_count = vm_readbyte(ip); \
+        method_name = vm_readstringlong(current_chunk, ip); \
+        cache = current_chunk->cacheAt(vm_readshort(ip)); \
+        klassobj = Object::as<Class>(vm_pop(fiber)); \
+        vm_writeframe(frame, ip); \
+        instval = vm_peek(fiber, arg_count); \
+        if(Object::isInstance(instval) && Object::as<Instance>(instval)->m_shape != nullptr) \
+        { \
+            instobj = Object::as<Instance>(instval); \
+            centry = cache->find(instobj->m_shape, klassobj->m_version); \
+            if(centry == nullptr && instobj->m_shape->lookup(method_name) == -1 && klassobj->methods.get(method_name, &value)) \
+            { \
+                centry = cache->fill(instobj->m_shape, klassobj->m_version); \
+                centry->value = value; \
+            } \
+            if(centry != nullptr) \
+            { \
+                vm_callmethod(method_name, centry->value, arg_count, ignoring, instval); \
+                continue; \
+            } \
+        } \
+        vm_invoke_from_class(klassobj, method_name, arg_count, true, methods, ignoring);
+
     void State::setVMGlobal(String* name, Value val)
     {
-        this->vm->globals->m_values.set(name, val);
+        size_t slot;
+        slot = this->vm->globalSlot(name);
+        this->vm->globalvalues.m_values[slot] = val;
     }
 
+    /* a slot that was only ever referenced, never assigned, does not count as defined */
     bool State::getVMGlobal(String* name, Value* dest)
     {
-        return this->vm->globals->m_values.get(name, dest);
+        size_t slot;
+        if(!this->vm->findGlobalSlot(name, &slot) || Object::isNull(this->vm->globalvalues.m_values[slot]))
+        {
+            return false;
+        }
+        *dest = this->vm->globalvalues.m_values[slot];
+        return true;
     }
 
     static void reset_stack(VM* vm)
@@ -333,7 +722,7 @@ namespace lit
         }
         // Maan, formatting c strings is hard...
         count = (int)fiber->m_framecount - 1;
-        length = snprintf(nullptr, 0, "%s%s\n", COLOR_RED, error_string->data());
+        length = snprintf(nullptr, 0, "%s%s\n", COLOR_RED, error_string->cstr());
         for(i = count; i >= 0; i--)
         {
             frame = &fiber->m_allframes[i];
@@ -353,7 +742,7 @@ namespace lit
         length += snprintf(nullptr, 0, "%s", COLOR_RESET);
         buffer = (char*)malloc(length + 1);
         buffer[length] = '\0';
-        start = buffer + sprintf(buffer, "%s%s\n", COLOR_RED, error_string->data());
+        start = buffer + sprintf(buffer, "%s%s\n", COLOR_RED, error_string->cstr());
         for(i = count; i >= 0; i--)
         {
             frame = &fiber->m_allframes[i];
@@ -370,24 +759,100 @@ namespace lit
             }
         }
         start += sprintf(start, "%s", COLOR_RESET);
-        vm->m_state->raiseError(RUNTIME_ERROR, buffer);
+        vm->m_state->raiseError(RUNTIME_ERROR, "%s", buffer);
         free(buffer);
         reset_stack(vm);
         return false;
     }
 
 
-    Result State::execFiber(Fiber* fiber)
+    /*
+    * whether $klass still has the native operator method it was set up with, in which case the
+    * quickened instructions may do its work inline. remembers the version this was checked for in
+    * $version, so the quickened forms only compare versions.
+    */
+    static bool vm_hasnativeop(State* state, Class* klass, SymbolID sym, uint64_t* version)
+    {
+        Value method;
+        if(klass->m_version == *version)
+        {
+            return true;
+        }
+        if(!klass->methods.get(state->symbol(sym), &method) || !Object::isNativeMethod(method))
+        {
+            return false;
+        }
+        *version = klass->m_version;
+        return true;
+    }
+
+    /*
+    * the element $index refers to, if $array is an Array and $index is within it. anything else,
+    * like negative indices, ranges, appending, or errors, is left to the Array's '[]' method.
+    */
+    static inline Value* vm_arrayslot(State* state, Value array, Value index)
+    {
+        double num;
+        PCGenericArray<Value>* values;
+        (void)state;
+        if(!Object::isArray(array) || !Object::isNumber(index))
+        {
+            return nullptr;
+        }
+        values = &Object::as<Array>(array)->m_actualarray;
+        num = Object::toNumber(index);
+        if(!(num >= 0) || num >= (double)values->m_count)
+        {
+            return nullptr;
+        }
+        return &values->m_values[(size_t)num];
+    }
+
+    /*
+    * resolves a field store on a shaped instance, and caches the result.
+    * returns nullptr if the store can't be cached, i.e., when the shape has
+    * run out of transitions.
+    */
+    static InlineCache::Entry* vm_resolvefieldstore(State* state, InlineCache* cache, Instance* instance, String* name)
+    {
+        int slot;
+        Shape* target;
+        Value setter;
+        InlineCache::Entry* centry;
+        target = nullptr;
+        slot = -1;
+        if(!(instance->klass->methods.get(name, &setter) && Object::isField(setter)))
+        {
+            setter = Object::NullVal;
+            slot = instance->m_shape->lookup(name);
+            if(slot == -1)
+            {
+                target = instance->m_shape->transition(state, name);
+                if(target == nullptr)
+                {
+                    return nullptr;
+                }
+            }
+        }
+        centry = cache->fill(instance->m_shape, instance->klass->m_version);
+        centry->slot = slot;
+        centry->target = target;
+        centry->value = setter;
+        return centry;
+    }
+
+    template<typename CodeT>
+    Result State::runCode(Fiber* fiber)
     {
         bool found;
         size_t arg_count;
         size_t arindex;
         size_t i;
         uint16_t offset;
-        uint8_t index;
+        uint16_t index;
         uint8_t is_local;
         uint8_t instruction;
-        uint8_t* ip;
+        CodeT* ip;
         Fiber::CallFrame* frame;
         Chunk* current_chunk;
         Class* instance_klass;
@@ -398,6 +863,8 @@ namespace lit
         Fiber* parent;
         Field* field;
         Function* function;
+        InlineCache* cache;
+        InlineCache::Entry* centry;
         Instance* instobj;
         String* field_name;
         String* method_name;
@@ -414,7 +881,6 @@ namespace lit
         Value reference;
         Value result;
         Value setter;
-        Value setval;
         Value slot;
         Value super;
         Value tmpval;
@@ -426,17 +892,6 @@ namespace lit
         VM* vm;
         (void)instruction;
         vm = this->vm;
-        vm_pushgc(this, true);
-        vm->fiber = fiber;
-        fiber->m_isaborting = false;
-        frame = &fiber->m_allframes[fiber->m_framecount - 1];
-        current_chunk = &frame->function->chunk;
-        fiber->m_module = frame->function->module;
-        ip = frame->ip;
-        slots = frame->slots;
-        privates = fiber->m_module->privates;
-        upvalues = frame->closure == nullptr ? nullptr : frame->closure->upvalues;
-
         // Has to be inside of the function in order for goto to work
         #ifdef LIT_USE_COMPUTEDGOTO
             static void* dispatch_table[] =
@@ -446,6 +901,10 @@ namespace lit
                 #undef OPCODE
             };
         #endif
+        vm_pushgc(this, true);
+        vm->fiber = fiber;
+        fiber->m_isaborting = false;
+        vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
     #ifdef LIT_TRACE_EXECUTION
         vm_traceframe(fiber);
     #endif
@@ -466,12 +925,9 @@ namespace lit
 
             #ifdef LIT_USE_COMPUTEDGOTO
                 #ifdef LIT_TRACE_EXECUTION
-                    instruction = *ip++;
-                    lit_disassemble_instruction(this, current_chunk, (size_t)(ip - current_chunk->m_code - 1), nullptr);
-                    goto* dispatch_table[instruction];
-                #else
-                    goto* dispatch_table[*ip++];
+                    lit_disassemble_instruction(this, current_chunk, (size_t)(vm_codeptr(frame, ip) - current_chunk->m_code), nullptr);
                 #endif
+                goto* vm_nexthandler(ip, dispatch_table);
             #else
                 instruction = *ip++;
                 #ifdef LIT_TRACE_EXECUTION
@@ -520,10 +976,10 @@ namespace lit
                         parent = fiber->m_parent;
                         fiber->m_parent = nullptr;
                         vm->fiber = fiber = parent;
-                        vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
-                        vm_traceframe(fiber);
                         fiber->m_stacktop -= arg_count;
                         fiber->m_stacktop[-1] = result;
+                        vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
+                        vm_traceframe(fiber);
                         continue;
                     }
                     fiber->m_stacktop = frame->slots;
@@ -597,7 +1053,7 @@ namespace lit
                         arg = vm_peek(fiber, 0);
                         // Don't even ask me why
                         // This doesn't kill our performance, since it's a error anyway
-                        if(Object::isString(arg) && strcmp(Object::asString(arg)->data(), "muffin") == 0)
+                        if(Object::isString(arg) && strcmp(Object::asString(arg)->cstr(), "muffin") == 0)
                         {
                             vm_rterror("Idk, can you negate a muffin?");
                         }
@@ -615,7 +1071,7 @@ namespace lit
                     if(Object::isInstance(vm_peek(fiber, 0)))
                     {
                         vm_writeframe(frame, ip);
-                        vm_invoke_from_class(Object::as<Instance>(vm_peek(fiber, 0))->klass, String::intern(this, "!"), 0, false, methods, false);
+                        vm_invoke_from_class(Object::as<Instance>(vm_peek(fiber, 0))->klass, this->symbol(LITSYM_NOT), 0, false, methods, false);
                         continue;
                     }
                     tmpval = Object::fromBool(Object::isFalsey(vm_pop(fiber)));
@@ -635,17 +1091,17 @@ namespace lit
                 }
                 op_case(ADD)
                 {
-                    vm_binaryop(Object::toValue, +, "+");
+                    vm_binaryop(Object::toValue, +, LITSYM_PLUS, ADD_NUM);
                     continue;
                 }
                 op_case(SUBTRACT)
                 {
-                    vm_binaryop(Object::toValue, -, "-");
+                    vm_binaryop(Object::toValue, -, LITSYM_MINUS, SUBTRACT_NUM);
                     continue;
                 }
                 op_case(MULTIPLY)
                 {
-                    vm_binaryop(Object::toValue, *, "*");
+                    vm_binaryop(Object::toValue, *, LITSYM_MULTIPLY, MULTIPLY_NUM);
                     continue;
                 }
                 // todo: this is broken, methinks
@@ -659,12 +1115,12 @@ namespace lit
                         *(fiber->m_stacktop - 1) = (Object::toValue(pow(Object::toNumber(a), Object::toNumber(b))));
                         continue;
                     }
-                    vm_invokemethod("POWER", a, "**", 1);
+                    vm_invokemethod("POWER", a, LITSYM_POWER, 1);
                     continue;
                 }
                 op_case(DIVIDE)
                 {
-                    vm_binaryop(Object::toValue, /, "/");
+                    vm_binaryop(Object::toValue, /, LITSYM_DIVIDE, DIVIDE_NUM);
                     continue;
                 }
                 op_case(FLOOR_DIVIDE)
@@ -679,7 +1135,7 @@ namespace lit
                         continue;
                     }
 
-                    vm_invokemethod("FLOOR_DIVIDE", a, "#", 1);
+                    vm_invokemethod("FLOOR_DIVIDE", a, LITSYM_FLOOR_DIVIDE, 1);
                     continue;
                 }
                 op_case(MOD)
@@ -692,7 +1148,7 @@ namespace lit
                         *(fiber->m_stacktop - 1) = Object::toValue(fmod(Object::toNumber(a), Object::toNumber(b)));
                         continue;
                     }
-                    vm_invokemethod("MOD", a, "%", 1);
+                    vm_invokemethod("MOD", a, LITSYM_MOD, 1);
                     continue;
                 }
                 op_case(BAND)
@@ -727,56 +1183,54 @@ namespace lit
                     {
                         vm_writeframe(frame, ip);
                         fprintf(stderr, "OP_EQUAL: trying to invoke '==' ...\n");
-                        vm_invoke_from_class(Object::as<Instance>(vm_peek(fiber, 1))->klass, String::intern(state, "=="), 1, false, methods, false);
+                        vm_invoke_from_class(Object::as<Instance>(vm_peek(fiber, 1))->klass, this->symbol(LITSYM_EQUAL), 1, false, methods, false);
                         continue;
                     }
                     a = vm_pop(fiber);
                     b = vm_pop(fiber);
                     vm_push(fiber, Object::fromBool(a == b));
                     */
-                    vm_binaryop(Object::toValue, ==, "==");
+                    if(Object::isString(vm_peek(fiber, 1)) && Object::isString(vm_peek(fiber, 0))
+                    && vm_hasnativeop(this, this->stringvalue_class, LITSYM_EQUAL, &this->m_quickstringversion))
+                    {
+                        vm_quicken(ip, EQUAL_STR);
+                        ip--;
+                        continue;
+                    }
+                    vm_binaryop(Object::toValue, ==, LITSYM_EQUAL, EQUAL_NUM);
                     continue;
                 }
 
                 op_case(GREATER)
                 {
-                    vm_binaryop(Object::fromBool, >, ">");
+                    vm_binaryop(Object::fromBool, >, LITSYM_GREATER, GREATER_NUM);
                     continue;
                 }
                 op_case(GREATER_EQUAL)
                 {
-                    vm_binaryop(Object::fromBool, >=, ">=");
+                    vm_binaryop(Object::fromBool, >=, LITSYM_GREATER_EQUAL, GREATER_EQUAL_NUM);
                     continue;
                 }
                 op_case(LESS)
                 {
-                    vm_binaryop(Object::fromBool, <, "<");
+                    vm_binaryop(Object::fromBool, <, LITSYM_LESS, LESS_NUM);
                     continue;
                 }
                 op_case(LESS_EQUAL)
                 {
-                    vm_binaryop(Object::fromBool, <=, "<=");
+                    vm_binaryop(Object::fromBool, <=, LITSYM_LESS_EQUAL, LESS_EQUAL_NUM);
                     continue;
                 }
 
                 op_case(SET_GLOBAL)
                 {
-                    name = vm_readstringlong(current_chunk, ip);
-                    vm->globals->m_values.set(name, vm_peek(fiber, 0));
+                    vm->globalvalues.m_values[vm_readshort(ip)] = vm_peek(fiber, 0);
                     continue;
                 }
 
                 op_case(GET_GLOBAL)
                 {
-                    name = vm_readstringlong(current_chunk, ip);
-                    if(!vm->globals->m_values.get(name, &setval))
-                    {
-                        vm_push(fiber, Object::NullVal);
-                    }
-                    else
-                    {
-                        vm_push(fiber, setval);
-                    }
+                    vm_push(fiber, vm->globalvalues.m_values[vm_readshort(ip)]);
                     continue;
                 }
                 op_case(SET_LOCAL)
@@ -872,6 +1326,11 @@ namespace lit
                 {
                     offset = vm_readshort(ip);
                     ip -= offset;
+                    if(vm_heatloop(frame, ip))
+                    {
+                        vm_writeframe(frame, ip);
+                        vm_switchloop();
+                    }
                     continue;
                 }
                 op_case(AND)
@@ -933,7 +1392,7 @@ namespace lit
                     for(i = 0; i < closure->upvalue_count; i++)
                     {
                         is_local = vm_readbyte(ip);
-                        index = vm_readbyte(ip);
+                        index = vm_readshort(ip);
                         if(is_local)
                         {
                             closure->upvalues[i] = this->captureUpvalue(frame->slots + index);
@@ -956,14 +1415,13 @@ namespace lit
                     name = vm_readstringlong(current_chunk, ip);
                     klassobj = Class::make(this, name);
                     vm_push(fiber, klassobj->asValue());
-                    klassobj->super = this->objectvalue_class;
-                    klassobj->super->methods.addAll(&klassobj->methods);
-                    klassobj->super->static_fields.addAll(&klassobj->static_fields);
-                    vm->globals->m_values.set(name, klassobj->asValue());
+                    klassobj->inheritFrom(this->objectvalue_class);
+                    this->setVMGlobal(name, klassobj->asValue());
                     continue;
                 }
                 op_case(GET_FIELD)
                 {
+                    cache = current_chunk->cacheAt(vm_readshort(ip));
                     vobj = vm_peek(fiber, 1);
                     if(Object::isNull(vobj))
                     {
@@ -974,63 +1432,85 @@ namespace lit
                     if(Object::isInstance(vobj))
                     {
                         instobj = Object::as<Instance>(vobj);
-
-                        if(!instobj->fields.get(name, &getval))
+                        if(instobj->m_shape != nullptr)
                         {
-                            if(instobj->klass->methods.get(name, &getval))
+                            centry = cache->find(instobj->m_shape, instobj->klass->m_version);
+                            if(centry == nullptr)
                             {
-                                if(Object::isField(getval))
-                                {
-                                    field = Object::as<Field>(getval);
-                                    if(field->getter == nullptr)
-                                    {
-                                        vm_rterrorvarg("Class %s does not have a getter for the field %s",
-                                                           instobj->klass->name->data(), name->data());
-                                    }
-                                    vm_drop(fiber);
-                                    vm_writeframe(frame, ip);
-                                    vm_callvalue(name->data(), Object::as<Field>(getval)->getter->asValue(), 0);
-                                    vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
-                                    continue;
-                                }
-                                else
+                                centry = cache->fill(instobj->m_shape, instobj->klass->m_version);
+                                centry->slot = instobj->m_shape->lookup(name);
+                                if(centry->slot == -1 && !instobj->klass->methods.get(name, &centry->value))
                                 {
-                                    getval = BoundMethod::make(this, instobj->asValue(), getval)->asValue();
+                                    centry->value = Object::NullVal;
                                 }
                             }
-                            else
+                            if(centry->slot != -1)
+                            {
+                                vm_drop(fiber);
+                                fiber->m_stacktop[-1] = instobj->m_slots[centry->slot];
+                                continue;
+                            }
+                            getval = centry->value;
+                        }
+                        else if(instobj->getField(name, &getval))
+                        {
+                            vm_drop(fiber);
+                            fiber->m_stacktop[-1] = getval;
+                            continue;
+                        }
+                        else if(!instobj->klass->methods.get(name, &getval))
+                        {
+                            getval = Object::NullVal;
+                        }
+                        if(Object::isField(getval))
+                        {
+                            field = Object::as<Field>(getval);
+                            if(field->getter == nullptr)
                             {
-                                getval = Object::NullVal;
+                                vm_rterrorvarg("Class %s does not have a getter for the field %s",
+                                                   instobj->klass->name->data(), name->data());
                             }
+                            vm_drop(fiber);
+                            vm_writeframe(frame, ip);
+                            vm_callvalue(name->data(), field->getter->asValue(), 0);
+                            vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
+                            continue;
+                        }
+                        else if(!Object::isNull(getval))
+                        {
+                            getval = BoundMethod::make(this, instobj->asValue(), getval)->asValue();
                         }
                     }
                     else if(Object::isClass(vobj))
                     {
                         klassobj = Object::as<Class>(vobj);
-                        if(klassobj->static_fields.get(name, &getval))
+                        centry = cache->find(&klassobj->static_fields, klassobj->m_staticversion);
+                        if(centry == nullptr)
                         {
-                            if(Object::isNativeMethod(getval) || Object::isPrimitiveMethod(getval))
+                            centry = cache->fill(&klassobj->static_fields, klassobj->m_staticversion);
+                            if(!klassobj->static_fields.get(name, &centry->value))
                             {
-                                getval = BoundMethod::make(this, klassobj->asValue(), getval)->asValue();
-                            }
-                            else if(Object::isField(getval))
-                            {
-                                field = Object::as<Field>(getval);
-                                if(field->getter == nullptr)
-                                {
-                                    vm_rterrorvarg("Class %s does not have a getter for the field %s", klassobj->name->data(),
-                                                       name->data());
-                                }
-                                vm_drop(fiber);
-                                vm_writeframe(frame, ip);
-                                vm_callvalue(name->data(), field->getter->asValue(), 0);
-                                vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
-                                continue;
+                                centry->value = Object::NullVal;
                             }
                         }
-                        else
+                        getval = centry->value;
+                        if(Object::isNativeMethod(getval) || Object::isPrimitiveMethod(getval))
                         {
-                            getval = Object::NullVal;
+                            getval = BoundMethod::make(this, klassobj->asValue(), getval)->asValue();
+                        }
+                        else if(Object::isField(getval))
+                        {
+                            field = Object::as<Field>(getval);
+                            if(field->getter == nullptr)
+                            {
+                                vm_rterrorvarg("Class %s does not have a getter for the field %s", klassobj->name->data(),
+                                                   name->data());
+                            }
+                            vm_drop(fiber);
+                            vm_writeframe(frame, ip);
+                            vm_callvalue(name->data(), field->getter->asValue(), 0);
+                            vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
+                            continue;
                         }
                     }
                     else
@@ -1040,30 +1520,33 @@ namespace lit
                         {
                             vm_rterror("GET_FIELD: only instances and classes have fields");
                         }
-                        if(klassobj->methods.get(name, &getval))
+                        centry = cache->find(klassobj, klassobj->m_version);
+                        if(centry == nullptr)
                         {
-                            if(Object::isField(getval))
+                            centry = cache->fill(klassobj, klassobj->m_version);
+                            if(!klassobj->methods.get(name, &centry->value))
                             {
-                                field = Object::as<Field>(getval);
-                                if(field->getter == nullptr)
-                                {
-                                    vm_rterrorvarg("Class %s does not have a getter for the field %s", klassobj->name->data(),
-                                                       name->data());
-                                }
-                                vm_drop(fiber);
-                                vm_writeframe(frame, ip);
-                                vm_callvalue(name->data(), Object::as<Field>(getval)->getter->asValue(), 0);
-                                vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
-                                continue;
+                                centry->value = Object::NullVal;
                             }
-                            else if(Object::isNativeMethod(getval) || Object::isPrimitiveMethod(getval))
+                        }
+                        getval = centry->value;
+                        if(Object::isField(getval))
+                        {
+                            field = Object::as<Field>(getval);
+                            if(field->getter == nullptr)
                             {
-                                getval = BoundMethod::make(this, vobj, getval)->asValue();
+                                vm_rterrorvarg("Class %s does not have a getter for the field %s", klassobj->name->data(),
+                                                   name->data());
                             }
+                            vm_drop(fiber);
+                            vm_writeframe(frame, ip);
+                            vm_callvalue(name->data(), field->getter->asValue(), 0);
+                            vm_readframe(fiber, frame, current_chunk, ip, slots, privates, upvalues);
+                            continue;
                         }
-                        else
+                        else if(Object::isNativeMethod(getval) || Object::isPrimitiveMethod(getval))
                         {
-                            getval = Object::NullVal;
+                            getval = BoundMethod::make(this, vobj, getval)->asValue();
                         }
                     }
                     vm_drop(fiber);// Pop field name
@@ -1072,6 +1555,7 @@ namespace lit
                 }
                 op_case(SET_FIELD)
                 {
+                    cache = current_chunk->cacheAt(vm_readshort(ip));
                     instval = vm_peek(fiber, 2);
                     if(Object::isNull(instval))
                     {
@@ -1106,12 +1590,36 @@ namespace lit
                         {
                             klassobj->static_fields.set(field_name, value);
                         }
+                        klassobj->invalidateStatics();
                         vm_dropn(fiber, 2);// Pop field name and the value
                         fiber->m_stacktop[-1] = value;
                     }
                     else if(Object::isInstance(instval))
                     {
                         instobj = Object::as<Instance>(instval);
+                        if(instobj->m_shape != nullptr && !Object::isNull(value))
+                        {
+                            centry = cache->find(instobj->m_shape, instobj->klass->m_version);
+                            if(centry == nullptr)
+                            {
+                                centry = vm_resolvefieldstore(this, cache, instobj, field_name);
+                            }
+                            /* a non-null value means the class has a setter for this name */
+                            if(centry != nullptr && Object::isNull(centry->value))
+                            {
+                                if(centry->slot != -1)
+                                {
+                                    instobj->m_slots[centry->slot] = value;
+                                }
+                                else
+                                {
+                                    instobj->addField(centry->target, value);
+                                }
+                                vm_dropn(fiber, 2);// Pop field name and the value
+                                fiber->m_stacktop[-1] = value;
+                                continue;
+                            }
+                        }
                         if(instobj->klass->methods.get(field_name, &setter) && Object::isField(setter))
                         {
                             field = Object::as<Field>(setter);
@@ -1129,11 +1637,11 @@ namespace lit
                         }
                         if(Object::isNull(value))
                         {
-                            instobj->fields.remove(field_name);
+                            instobj->removeField(field_name);
                         }
                         else
                         {
-                            instobj->fields.set(field_name, value);
+                            instobj->setField(field_name, value);
                         }
                         vm_dropn(fiber, 2);// Pop field name and the value
                         fiber->m_stacktop[-1] = value;
@@ -1170,13 +1678,27 @@ namespace lit
                 op_case(SUBSCRIPT_GET)
                 {
                     Value tmp = vm_peek(fiber, 1);
-                    vm_invokemethod("SUBSCRIPT_GET", tmp, "[]", 1);
+                    if(vm_arrayslot(this, tmp, vm_peek(fiber, 0)) != nullptr
+                    && vm_hasnativeop(this, this->arrayvalue_class, LITSYM_SUBSCRIPT, &this->m_quickarrayversion))
+                    {
+                        vm_quicken(ip, ARRAY_GET);
+                        ip--;
+                        continue;
+                    }
+                    vm_invokemethod("SUBSCRIPT_GET", tmp, LITSYM_SUBSCRIPT, 1);
                     continue;
                 }
                 op_case(SUBSCRIPT_SET)
                 {
                     Value tmp = vm_peek(fiber, 2);
-                    vm_invokemethod("SUBSCRIPT_SET", tmp, "[]", 2);
+                    if(vm_arrayslot(this, tmp, vm_peek(fiber, 1)) != nullptr
+                    && vm_hasnativeop(this, this->arrayvalue_class, LITSYM_SUBSCRIPT, &this->m_quickarrayversion))
+                    {
+                        vm_quicken(ip, ARRAY_SET);
+                        ip--;
+                        continue;
+                    }
+                    vm_invokemethod("SUBSCRIPT_SET", tmp, LITSYM_SUBSCRIPT, 2);
                     continue;
                 }
                 op_case(PUSH_ARRAY_ELEMENT)
@@ -1197,7 +1719,7 @@ namespace lit
                     }
                     else if(Object::isInstance(operand))
                     {
-                        Object::as<Instance>(operand)->fields.set(Object::as<String>(vm_peek(fiber, 1)), vm_peek(fiber, 0));
+                        Object::as<Instance>(operand)->setField(Object::as<String>(vm_peek(fiber, 1)), vm_peek(fiber, 0));
                     }
                     else
                     {
@@ -1208,7 +1730,9 @@ namespace lit
                 }
                 op_case(STATIC_FIELD)
                 {
-                    Object::as<Class>(vm_peek(fiber, 1))->static_fields.set(vm_readstringlong(current_chunk, ip), vm_peek(fiber, 0));
+                    klassobj = Object::as<Class>(vm_peek(fiber, 1));
+                    klassobj->static_fields.set(vm_readstringlong(current_chunk, ip), vm_peek(fiber, 0));
+                    klassobj->invalidateStatics();
                     vm_drop(fiber);
                     continue;
                 }
@@ -1217,17 +1741,20 @@ namespace lit
                     klassobj = Object::as<Class>(vm_peek(fiber, 1));
                     name = vm_readstringlong(current_chunk, ip);
                     if((klassobj->init_method == nullptr || (klassobj->super != nullptr && klassobj->init_method == ((Class*)klassobj->super)->init_method))
-                       && name->length() == 11 && memcmp(name->data(), LIT_NAME_CONSTRUCTOR, sizeof(LIT_NAME_CONSTRUCTOR)-1) == 0)
+                       && name == this->symbol(LITSYM_CONSTRUCTOR))
                     {
                         klassobj->init_method = Object::asObject(vm_peek(fiber, 0));
                     }
                     klassobj->methods.set(name, vm_peek(fiber, 0));
+                    klassobj->invalidate();
                     vm_drop(fiber);
                     continue;
                 }
                 op_case(DEFINE_FIELD)
                 {
-                    Object::as<Class>(vm_peek(fiber, 1))->methods.set(vm_readstringlong(current_chunk, ip), vm_peek(fiber, 0));
+                    klassobj = Object::as<Class>(vm_peek(fiber, 1));
+                    klassobj->methods.set(vm_readstringlong(current_chunk, ip), vm_peek(fiber, 0));
+                    klassobj->invalidate();
                     vm_drop(fiber);
                     continue;
                 }
@@ -1243,20 +1770,12 @@ namespace lit
                 }
                 op_case(INVOKE_SUPER)
                 {
-                    arg_count = vm_readbyte(ip);
-                    method_name = vm_readstringlong(current_chunk, ip);
-                    klassobj = Object::as<Class>(vm_pop(fiber));
-                    vm_writeframe(frame, ip);
-                    vm_invoke_from_class(klassobj, method_name, arg_count, true, methods, false);
+                    vm_invokesuper(false);
                     continue;
                 }
                 op_case(INVOKE_SUPER_IGNORING)
                 {
-                    arg_count = vm_readbyte(ip);
-                    method_name = vm_readstringlong(current_chunk, ip);
-                    klassobj = Object::as<Class>(vm_pop(fiber));
-                    vm_writeframe(frame, ip);
-                    vm_invoke_from_class(klassobj, method_name, arg_count, true, methods, true);
+                    vm_invokesuper(true);
                     continue;
                 }
                 op_case(GET_SUPER_METHOD)
@@ -1284,10 +1803,8 @@ namespace lit
                     }
                     klassobj = Object::as<Class>(vm_peek(fiber, 0));
                     super_klass = Object::as<Class>(super);
-                    klassobj->super = super_klass;
                     klassobj->init_method = super_klass->init_method;
-                    super_klass->methods.addAll(&klassobj->methods);
-                    klassobj->super->static_fields.addAll(&klassobj->static_fields);
+                    klassobj->inheritFrom(super_klass);
                     continue;
                 }
                 op_case(IS)
@@ -1340,23 +1857,19 @@ namespace lit
                         vm_push(fiber, values->m_values[i]);
                     }
                     // Hot-bytecode patching, increment the amount of arguments to OP_CALL
-                    ip[1] = ip[1] + values->m_count - 1;
+                    vm_patchbyte(ip, 1, vm_byteat(ip, 1) + values->m_count - 1);
                     continue;
                 }
 
                 op_case(REFERENCE_GLOBAL)
                 {
-                    name = vm_readstringlong(current_chunk, ip);
                     /*
-                    if(vm->globals->m_values.getSlot(name, &pval))
-                    {
-                        vm_push(fiber, Reference::make(this, pval)->asValue());
-                    }
-                    else
+                    * the global value array may be reallocated when new globals are
+                    * added, so there is nothing stable to point a Reference at.
                     */
-                    {
-                        vm_rterror("Attempt to reference a null value");
-                    }
+                    offset = vm_readshort(ip);
+                    (void)offset;
+                    vm_rterror("Attempt to reference a null value");
                     continue;
                 }
                 op_case(REFERENCE_PRIVATE)
@@ -1409,9 +1922,186 @@ namespace lit
                     *Object::as<Reference>(reference)->slot = vm_peek(fiber, 0);
                     continue;
                 }
+                op_case(ADD_NUM)
+                {
+                    vm_binaryop_num(Object::toValue, +, ADD);
+                    continue;
+                }
+                op_case(SUBTRACT_NUM)
+                {
+                    vm_binaryop_num(Object::toValue, -, SUBTRACT);
+                    continue;
+                }
+                op_case(MULTIPLY_NUM)
+                {
+                    vm_binaryop_num(Object::toValue, *, MULTIPLY);
+                    continue;
+                }
+                op_case(DIVIDE_NUM)
+                {
+                    vm_binaryop_num(Object::toValue, /, DIVIDE);
+                    continue;
+                }
+                op_case(EQUAL_NUM)
+                {
+                    vm_binaryop_num(Object::toValue, ==, EQUAL);
+                    continue;
+                }
+                op_case(GREATER_NUM)
+                {
+                    vm_binaryop_num(Object::fromBool, >, GREATER);
+                    continue;
+                }
+                op_case(GREATER_EQUAL_NUM)
+                {
+                    vm_binaryop_num(Object::fromBool, >=, GREATER_EQUAL);
+                    continue;
+                }
+                op_case(LESS_NUM)
+                {
+                    vm_binaryop_num(Object::fromBool, <, LESS);
+                    continue;
+                }
+                op_case(LESS_EQUAL_NUM)
+                {
+                    vm_binaryop_num(Object::fromBool, <=, LESS_EQUAL);
+                    continue;
+                }
+                op_case(EQUAL_STR)
+                {
+                    a = vm_peek(fiber, 1);
+                    b = vm_peek(fiber, 0);
+                    if(!Object::isString(a) || !Object::isString(b) || this->stringvalue_class->m_version != this->m_quickstringversion)
+                    {
+                        vm_deoptimize(ip, EQUAL);
+                    }
+                    vm_drop(fiber);
+                    *(fiber->m_stacktop - 1) = Object::fromBool(String::equal(this, Object::as<String>(a), Object::as<String>(b)));
+                    continue;
+                }
+                op_case(ARRAY_GET)
+                {
+                    pval = vm_arrayslot(this, vm_peek(fiber, 1), vm_peek(fiber, 0));
+                    if(pval == nullptr || this->arrayvalue_class->m_version != this->m_quickarrayversion)
+                    {
+                        vm_deoptimize(ip, SUBSCRIPT_GET);
+                    }
+                    vm_drop(fiber);
+                    *(fiber->m_stacktop - 1) = *pval;
+                    continue;
+                }
+                op_case(ARRAY_SET)
+                {
+                    pval = vm_arrayslot(this, vm_peek(fiber, 2), vm_peek(fiber, 1));
+                    if(pval == nullptr || this->arrayvalue_class->m_version != this->m_quickarrayversion)
+                    {
+                        vm_deoptimize(ip, SUBSCRIPT_SET);
+                    }
+                    value = vm_pop(fiber);
+                    *pval = value;
+                    vm_drop(fiber);
+                    *(fiber->m_stacktop - 1) = value;
+                    continue;
+                }
+                /*
+                * superinstructions: ip is at the GET_LOCAL operand, with the rest of the original
+                * sequence after it.
+                */
+                op_case(INC_LOCAL)
+                {
+                    a = slots[vm_byteat(ip, 0)];
+                    if(!Object::isNumber(a))
+                    {
+                        vm_deoptimize(ip, GET_LOCAL);
+                    }
+                    b = vm_valueat(current_chunk, ip, 2);
+                    slots[vm_byteat(ip, 0)] = Object::toValue(Object::toNumber(a) + Object::toNumber(b));
+                    ip += 7;
+                    continue;
+                }
+                op_case(ADD_LOCAL_CONST)
+                {
+                    a = slots[vm_byteat(ip, 0)];
+                    if(!Object::isNumber(a))
+                    {
+                        vm_deoptimize(ip, GET_LOCAL);
+                    }
+                    b = vm_valueat(current_chunk, ip, 2);
+                    vm_push(fiber, Object::toValue(Object::toNumber(a) + Object::toNumber(b)));
+                    ip += 4;
+                    continue;
+                }
+                op_case(SUBTRACT_LOCAL_CONST)
+                {
+                    a = slots[vm_byteat(ip, 0)];
+                    if(!Object::isNumber(a))
+                    {
+                        vm_deoptimize(ip, GET_LOCAL);
+                    }
+                    b = vm_valueat(current_chunk, ip, 2);
+                    vm_push(fiber, Object::toValue(Object::toNumber(a) - Object::toNumber(b)));
+                    ip += 4;
+                    continue;
+                }
+                op_case(LESS_LOCAL_CONST_JUMP)
+                {
+                    a = slots[vm_byteat(ip, 0)];
+                    if(!Object::isNumber(a))
+                    {
+                        vm_deoptimize(ip, GET_LOCAL);
+                    }
+                    b = vm_valueat(current_chunk, ip, 2);
+                    offset = vm_shortat(ip, 5);
+                    ip += 7;
+                    if(!(Object::toNumber(a) < Object::toNumber(b)))
+                    {
+                        ip += offset;
+                    }
+                    continue;
+                }
+                op_case(LESS_LOCAL_LOCAL_JUMP)
+                {
+                    a = slots[vm_byteat(ip, 0)];
+                    b = slots[vm_byteat(ip, 2)];
+                    if(!Object::isNumber(a) || !Object::isNumber(b))
+                    {
+                        vm_deoptimize(ip, GET_LOCAL);
+                    }
+                    offset = vm_shortat(ip, 5);
+                    ip += 7;
+                    if(!(Object::toNumber(a) < Object::toNumber(b)))
+                    {
+                        ip += offset;
+                    }
+                    continue;
+                }
+                op_case(GET_LOCAL_FIELD)
+                {
+                    vobj = slots[vm_byteat(ip, 0)];
+                    if(Object::isInstance(vobj))
+                    {
+                        instobj = Object::as<Instance>(vobj);
+                        if(instobj->m_shape != nullptr)
+                        {
+                            cache = current_chunk->cacheAt(vm_shortat(ip, 4));
+                            centry = cache->find(instobj->m_shape, instobj->klass->m_version);
+                            if(centry != nullptr && centry->slot != -1)
+                            {
+                                vm_push(fiber, instobj->m_slots[centry->slot]);
+                                ip += 6;
+                                continue;
+                            }
+                        }
+                    }
+                    /* anything else is left to GET_FIELD itself, which also fills the cache */
+                    vm_push(fiber, vobj);
+                    vm_push(fiber, vm_valueat(current_chunk, ip, 2));
+                    ip += 3;
+                    continue;
+                }
                 vm_default()
                 {
-                    vm_rterrorvarg("Unknown op code '%d'", *ip);
+                    vm_rterrorvarg("Unknown op code '%d'", *vm_codeptr(frame, ip));
                     break;
                 }
             }
@@ -1420,6 +2110,99 @@ namespace lit
         vm_returnerror();
     }
 
+    /*
+    * functions run from their bytecode until they turn hot, and from threaded code after that;
+    * functions compiled to register code always run from it.
+    * whenever a fiber enters a frame of another kind, the loop it was in hands it over to this one.
+    */
+    Result State::runFiber(Fiber* fiber)
+    {
+        Result result;
+        Fiber::CallFrame* frame;
+        while(true)
+        {
+            frame = &fiber->m_allframes[fiber->m_framecount - 1];
+            if(frame->function->m_registers != 0)
+            {
+                result = this->runRegisters(fiber);
+            }
+        #ifdef LIT_USE_COMPUTEDGOTO
+            else if(vm_wantsthreaded(frame->function))
+            {
+                result = this->runCode<CodeWord>(fiber);
+            }
+        #endif
+            else
+            {
+                result = this->runCode<uint8_t>(fiber);
+            }
+            if(result.type != LITRESULT_SWITCH)
+            {
+                return result;
+            }
+            fiber = this->vm->fiber;
+        }
+    }
+
+    /* whether $fiber was already running (further up the C stack) when $entry started */
+    static bool vm_isoutside(Fiber* fiber, Fiber* entry)
+    {
+        Fiber* parent;
+        for(parent = entry->m_parent; parent != nullptr; parent = parent->m_parent)
+        {
+            if(parent == fiber)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+    * natives report errors with lit_runtime_error_exiting(), which longjmps back here rather than
+    * to every call site, so that calls themselves don't pay for a setjmp. by then the error has been
+    * handled: either a catching fiber was made current, and running resumes there, or the fiber is
+    * aborting, and the error is returned.
+    * a catcher that belongs to an outer execFiber() is left to that one: the error is returned, and
+    * the native that called in here sees it pending once it returns.
+    */
+    Result State::execFiber(Fiber* fiber)
+    {
+        bool was_allowed;
+        jmp_buf landing;
+        jmp_buf* previous;
+        Result result;
+        previous = this->m_nativejump;
+        was_allowed = this->allow_gc;
+        this->m_nativejump = &landing;
+        if(setjmp(landing))
+        {
+            /* the native's own vm_pushgc was never popped */
+            this->allow_gc = was_allowed;
+            if(this->vm->fiber == nullptr || this->vm->fiber->m_isaborting || vm_isoutside(this->vm->fiber, fiber))
+            {
+                this->m_nativejump = previous;
+                return Result{LITRESULT_RUNTIME_ERROR, Object::NullVal};
+            }
+            result = this->runFiber(this->vm->fiber);
+        }
+        else
+        {
+            result = this->runFiber(fiber);
+        }
+        this->m_nativejump = previous;
+        return result;
+    }
+
+    /*
+    * a native that reported an error and returned (instead of exiting) leaves it pending:
+    * either its fiber is aborting, or the error was caught and a parent fiber made current.
+    */
+    static inline bool vm_nativefailed(VM* vm, Fiber* fiber)
+    {
+        return (vm->fiber != fiber) || fiber->m_isaborting;
+    }
+
     bool VM::callValue(std::string_view name, Value callee, uint8_t arg_count)
     {
         size_t i;
@@ -1435,10 +2218,6 @@ namespace lit
         (void)fiber;
         if(Object::isObject(callee))
         {
-            if(m_state->set_native_exit_jump())
-            {
-                return true;
-            }
             switch(Object::asObject(callee)->type)
             {
                 case Object::Type::Function:
@@ -1458,10 +2237,15 @@ namespace lit
                         auto fn = Object::as<NativeFunction>(callee);
                         if(fn != nullptr)
                         {
-                            result = fn->function(this, arg_count, this->fiber->m_stacktop - arg_count);
-                            this->fiber->m_stacktop -= arg_count + 1;
-                            this->push(result);
+                            fiber = this->fiber;
+                            result = fn->function(this, arg_count, fiber->m_stacktop - arg_count);
                             vm_popgc(m_state);
+                            if(vm_nativefailed(this, fiber))
+                            {
+                                return true;
+                            }
+                            fiber->m_stacktop -= arg_count + 1;
+                            this->push(result);
                             return false;
                         }
                     }
@@ -1484,16 +2268,14 @@ namespace lit
                         vm_pushgc(m_state, false);
                         mthobj = Object::as<NativeMethod>(callee);
                         fiber = this->fiber;
-                        result = mthobj->method(this, *(this->fiber->m_stacktop - arg_count - 1), arg_count, this->fiber->m_stacktop - arg_count);
-                        this->fiber->m_stacktop -= arg_count + 1;
-                        //if(!Object::isNull(result))
+                        result = mthobj->method(this, *(fiber->m_stacktop - arg_count - 1), arg_count, fiber->m_stacktop - arg_count);
+                        vm_popgc(m_state);
+                        if(vm_nativefailed(this, fiber))
                         {
-                            if(!this->fiber->m_isaborting)
-                            {
-                                this->push(result);
-                            }
+                            return true;
                         }
-                        vm_popgc(m_state);
+                        fiber->m_stacktop -= arg_count + 1;
+                        this->push(result);
                         return false;
                     }
                     break;
@@ -1535,10 +2317,15 @@ namespace lit
                         if(Object::isNativeMethod(mthval))
                         {
                             vm_pushgc(m_state, false);
-                            result = Object::as<NativeMethod>(mthval)->method(this, bound_method->receiver, arg_count, this->fiber->m_stacktop - arg_count);
-                            this->fiber->m_stacktop -= arg_count + 1;
-                            this->push(result);
+                            fiber = this->fiber;
+                            result = Object::as<NativeMethod>(mthval)->method(this, bound_method->receiver, arg_count, fiber->m_stacktop - arg_count);
                             vm_popgc(m_state);
+                            if(vm_nativefailed(this, fiber))
+                            {
+                                return true;
+                            }
+                            fiber->m_stacktop -= arg_count + 1;
+                            this->push(result);
                             return false;
                         }
                         else if(Object::isPrimitiveMethod(mthval))
@@ -1600,9 +2387,9 @@ namespace lit
     #undef vm_readconstant
     #undef op_case
     #undef vm_readstring
-    #undef vm_readshort
-    #undef vm_readbyte
     #undef vm_returnerror
+    #undef vm_switchloop
+    #undef vm_dispatchtable
 
 
 
@@ -0,0 +1,674 @@
+#include "lit.h"
+
+/*
+* the printf-style formatter behind String.format and printf.
+* a format string is parsed once into a list of Specs, which are then replayed for each call:
+* the literal text is copied by byte range, and each conversion writes straight into the
+* destination buffer, which is sized once up front.
+*/
+
+/* float precisions are clamped to this, which keeps the digits of any double within format_float's buffer */
+#define LIT_FORMAT_MAX_FLOAT_PRECISION 100
+
+namespace lit
+{
+    static void* format_realloc(State* state, void* ptr, size_t oldsize, size_t newsize)
+    {
+        /* formatting happens in the middle of native calls holding unrooted values */
+        return Memory::reallocateNoCollect(state, ptr, oldsize, newsize);
+    }
+
+    static bool format_isconversion(char ch)
+    {
+        return (strchr("sdiucxXobfFeEgG%", ch) != nullptr);
+    }
+
+    /* reads a width or precision: digits, or '*'. returns false if it's too large. */
+    static bool format_readnumber(const char* fmt, size_t length, size_t* i, int* dest)
+    {
+        int value;
+        if(*i < length && fmt[*i] == '*')
+        {
+            (*i)++;
+            *dest = Format::FromArgs;
+            return true;
+        }
+        value = 0;
+        while(*i < length && fmt[*i] >= '0' && fmt[*i] <= '9')
+        {
+            value = (value * 10) + (fmt[*i] - '0');
+            if(value > LIT_FORMAT_MAX_WIDTH)
+            {
+                return false;
+            }
+            (*i)++;
+        }
+        *dest = value;
+        return true;
+    }
+
+    Format* Format::make(State* state, const char* fmt, size_t length, const char** error)
+    {
+        bool flag;
+        size_t i;
+        size_t litstart;
+        Spec spec;
+        Format* format;
+        format = (Format*)format_realloc(state, nullptr, 0, sizeof(Format));
+        format->m_state = state;
+        format->m_specs.init(state);
+        format->m_literallength = 0;
+        format->m_argcount = 0;
+        litstart = 0;
+        i = 0;
+        while(i < length)
+        {
+            if(fmt[i] != '%')
+            {
+                i++;
+                continue;
+            }
+            memset(&spec, 0, sizeof(Spec));
+            spec.litstart = litstart;
+            spec.litlength = i - litstart;
+            spec.width = -1;
+            spec.precision = -1;
+            i++;
+            flag = true;
+            while(flag && i < length)
+            {
+                switch(fmt[i])
+                {
+                    case '-':
+                        spec.leftalign = true;
+                        break;
+                    case '0':
+                        spec.zeropad = true;
+                        break;
+                    case '+':
+                        spec.plus = true;
+                        break;
+                    case ' ':
+                        spec.space = true;
+                        break;
+                    case '#':
+                        spec.alternate = true;
+                        break;
+                    default:
+                        flag = false;
+                        continue;
+                }
+                i++;
+            }
+            if(!format_readnumber(fmt, length, &i, &spec.width))
+            {
+                *error = "width is too large";
+                destroy(state, format);
+                return nullptr;
+            }
+            if(i < length && fmt[i] == '.')
+            {
+                i++;
+                if(!format_readnumber(fmt, length, &i, &spec.precision))
+                {
+                    *error = "precision is too large";
+                    destroy(state, format);
+                    return nullptr;
+                }
+            }
+            /* C length modifiers mean nothing here, but are accepted so that C formats can be reused */
+            while(i < length && strchr("hlLjzt", fmt[i]) != nullptr)
+            {
+                i++;
+            }
+            if(i >= length)
+            {
+                *error = "incomplete format specifier at end of string";
+                destroy(state, format);
+                return nullptr;
+            }
+            if(!format_isconversion(fmt[i]))
+            {
+                *error = "unknown conversion";
+                destroy(state, format);
+                return nullptr;
+            }
+            spec.conversion = fmt[i];
+            i++;
+            if(spec.width == FromArgs)
+            {
+                format->m_argcount++;
+            }
+            if(spec.precision == FromArgs)
+            {
+                format->m_argcount++;
+            }
+            if(spec.conversion != '%')
+            {
+                format->m_argcount++;
+            }
+            format->m_literallength += spec.litlength;
+            format->m_specs.push(spec);
+            litstart = i;
+        }
+        memset(&spec, 0, sizeof(Spec));
+        spec.litstart = litstart;
+        spec.litlength = length - litstart;
+        format->m_literallength += spec.litlength;
+        format->m_specs.push(spec);
+        return format;
+    }
+
+    static void format_cleanup(State* state, Userdata* data, bool mark)
+    {
+        if(!mark)
+        {
+            Format::destroy(state, (Format*)data->data);
+        }
+    }
+
+    Format* Format::fromCache(State* state, String* fmt, const char** error)
+    {
+        Value value;
+        Format* format;
+        Userdata* userdata;
+        if(state->formatcache.get(fmt, &value))
+        {
+            return (Format*)Object::as<Userdata>(value)->data;
+        }
+        format = make(state, fmt->data(), fmt->length(), error);
+        if(format == nullptr)
+        {
+            return nullptr;
+        }
+        if(state->formatcache.size() >= LIT_FORMAT_CACHE_MAX)
+        {
+            state->formatcache.clear();
+        }
+        userdata = Userdata::make(state, 0, true);
+        userdata->data = format;
+        userdata->cleanup_fn = format_cleanup;
+        state->pushRoot((Object*)userdata);
+        state->formatcache.set(fmt, userdata->asValue());
+        state->popRoot();
+        return format;
+    }
+
+    void Format::destroy(State* state, Format* format)
+    {
+        format->m_specs.release();
+        format_realloc(state, format, sizeof(Format), 0);
+    }
+
+    /* writes the digits of $value right-aligned, ending at $end. returns how many were written. */
+    static size_t format_digits(char* end, uint64_t value, unsigned int base, bool upper)
+    {
+        char* p;
+        const char* alphabet;
+        alphabet = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+        p = end;
+        if(base == 10)
+        {
+            do
+            {
+                *--p = (char)('0' + (value % 10));
+                value /= 10;
+            } while(value != 0);
+        }
+        else
+        {
+            /* the other bases are all powers of two */
+            do
+            {
+                *--p = alphabet[value & (base - 1)];
+                value >>= __builtin_ctz(base);
+            } while(value != 0);
+        }
+        return end - p;
+    }
+
+    /*
+    * lays out a converted number: [sign][prefix][zeros]digits, padded to $width.
+    * $zeros are the leading zeros a precision asks for; the 0 flag adds more, up to the width.
+    */
+    static void format_emitnumber(StringBuffer* dest, const Format::Spec& spec, int width, const char* sign, const char* prefix, size_t zeros, const char* digits, size_t digitslen, bool canzeropad)
+    {
+        size_t signlen;
+        size_t prefixlen;
+        size_t total;
+        size_t pad;
+        signlen = strlen(sign);
+        prefixlen = strlen(prefix);
+        total = signlen + prefixlen + zeros + digitslen;
+        pad = 0;
+        if(width > 0 && (size_t)width > total)
+        {
+            pad = (size_t)width - total;
+        }
+        if(pad > 0 && !spec.leftalign && spec.zeropad && canzeropad)
+        {
+            zeros += pad;
+            pad = 0;
+        }
+        if(!spec.leftalign)
+        {
+            dest->appendRepeat(' ', pad);
+        }
+        dest->append(sign, signlen);
+        dest->append(prefix, prefixlen);
+        dest->appendRepeat('0', zeros);
+        dest->append(digits, digitslen);
+        if(spec.leftalign)
+        {
+            dest->appendRepeat(' ', pad);
+        }
+    }
+
+    static const char* format_sign(const Format::Spec& spec, bool negative)
+    {
+        if(negative)
+        {
+            return "-";
+        }
+        if(spec.plus)
+        {
+            return "+";
+        }
+        if(spec.space)
+        {
+            return " ";
+        }
+        return "";
+    }
+
+    /*
+    * NaN prints no '-', whatever its sign bit, as it does in toString.
+    * integer conversions spell infinity out as toString does; float ones use C's "inf".
+    */
+    static void format_nonfinite(StringBuffer* dest, const Format::Spec& spec, int width, double value, bool upper, bool integer)
+    {
+        const char* text;
+        if(std::isnan(value))
+        {
+            text = upper ? "NAN" : "nan";
+            format_emitnumber(dest, spec, width, format_sign(spec, false), "", 0, text, 3, false);
+            return;
+        }
+        if(integer)
+        {
+            text = "infinity";
+        }
+        else
+        {
+            text = upper ? "INF" : "inf";
+        }
+        format_emitnumber(dest, spec, width, format_sign(spec, std::signbit(value)), "", 0, text, strlen(text), false);
+    }
+
+    static void format_integer(StringBuffer* dest, const Format::Spec& spec, int width, int precision, double value)
+    {
+        bool negative;
+        bool upper;
+        size_t len;
+        size_t zeros;
+        unsigned int base;
+        uint64_t bits;
+        const char* prefix;
+        char buf[72];
+        if(!std::isfinite(value))
+        {
+            format_nonfinite(dest, spec, width, value, false, true);
+            return;
+        }
+        /* doubles beyond the int64 range saturate, instead of the undefined behaviour of a plain cast */
+        if(value >= 9223372036854775807.0)
+        {
+            bits = (uint64_t)INT64_MAX;
+        }
+        else if(value <= -9223372036854775808.0)
+        {
+            bits = (uint64_t)INT64_MIN;
+        }
+        else
+        {
+            bits = (uint64_t)(int64_t)value;
+        }
+        negative = false;
+        upper = false;
+        prefix = "";
+        switch(spec.conversion)
+        {
+            case 'd':
+            case 'i':
+                base = 10;
+                negative = ((int64_t)bits < 0);
+                if(negative)
+                {
+                    bits = (uint64_t)0 - bits;
+                }
+                break;
+            case 'x':
+            case 'X':
+                base = 16;
+                upper = (spec.conversion == 'X');
+                if(spec.alternate && bits != 0)
+                {
+                    prefix = upper ? "0X" : "0x";
+                }
+                break;
+            case 'o':
+                base = 8;
+                break;
+            case 'b':
+                base = 2;
+                if(spec.alternate && bits != 0)
+                {
+                    prefix = "0b";
+                }
+                break;
+            default:
+                base = 10;
+                break;
+        }
+        /* an explicit precision of 0 prints nothing at all for 0 */
+        if(precision == 0 && bits == 0)
+        {
+            len = 0;
+        }
+        else
+        {
+            len = format_digits(buf + sizeof(buf), bits, base, upper);
+        }
+        zeros = 0;
+        if(precision > 0 && (size_t)precision > len)
+        {
+            zeros = (size_t)precision - len;
+        }
+        if(base == 8 && spec.alternate && zeros == 0 && (len == 0 || buf[sizeof(buf) - len] != '0'))
+        {
+            zeros = 1;
+        }
+        format_emitnumber(dest, spec, width, (spec.conversion == 'd' || spec.conversion == 'i') ? format_sign(spec, negative) : "", prefix, zeros, buf + sizeof(buf) - len, len, precision < 0);
+    }
+
+    static void format_float(StringBuffer* dest, const Format::Spec& spec, int width, int precision, double value)
+    {
+        int len;
+        char cfmt[8];
+        char* p;
+        char buf[512];
+        if(!std::isfinite(value))
+        {
+            format_nonfinite(dest, spec, width, value, (spec.conversion >= 'A' && spec.conversion <= 'Z'), false);
+            return;
+        }
+        if(precision < 0)
+        {
+            precision = 6;
+        }
+        else if(precision > LIT_FORMAT_MAX_FLOAT_PRECISION)
+        {
+            precision = LIT_FORMAT_MAX_FLOAT_PRECISION;
+        }
+        /* the digits come from the C library; sign, padding and alignment are done here, as for integers */
+        p = cfmt;
+        *p++ = '%';
+        if(spec.alternate)
+        {
+            *p++ = '#';
+        }
+        *p++ = '.';
+        *p++ = '*';
+        *p++ = spec.conversion;
+        *p = '\0';
+        len = snprintf(buf, sizeof(buf), cfmt, precision, std::fabs(value));
+        if(len < 0)
+        {
+            len = 0;
+        }
+        else if((size_t)len >= sizeof(buf))
+        {
+            len = sizeof(buf) - 1;
+        }
+        format_emitnumber(dest, spec, width, format_sign(spec, std::signbit(value)), "", 0, buf, len, true);
+    }
+
+    /* appends $text (of $cplength code points), cut to $precision code points and padded to $width */
+    static void format_text(StringBuffer* dest, const Format::Spec& spec, int width, int precision, const char* text, size_t length, size_t cplength, String* string)
+    {
+        size_t pad;
+        if(precision >= 0 && (size_t)precision < cplength)
+        {
+            cplength = (size_t)precision;
+            if(string != nullptr)
+            {
+                length = string->utfOffset(cplength);
+            }
+            else
+            {
+                length = cplength;
+            }
+        }
+        pad = 0;
+        if(width > 0 && (size_t)width > cplength)
+        {
+            pad = (size_t)width - cplength;
+        }
+        if(!spec.leftalign)
+        {
+            dest->appendRepeat(' ', pad);
+        }
+        dest->append(text, length);
+        if(spec.leftalign)
+        {
+            dest->appendRepeat(' ', pad);
+        }
+    }
+
+    static void format_string(StringBuffer* dest, const Format::Spec& spec, int width, int precision, Value value)
+    {
+        int len;
+        String* string;
+        const char* text;
+        char buf[LIT_NUMBER_BUFFER_SIZE];
+        if(Object::isString(value))
+        {
+            string = Object::as<String>(value);
+            format_text(dest, spec, width, precision, string->data(), string->length(), string->utfLength(), string);
+            return;
+        }
+        /* the same text toString() gives, without allocating a String for it */
+        if(Object::isNumber(value))
+        {
+            text = buf;
+            len = String::formatNumber(buf, Object::toNumber(value));
+        }
+        else if(Object::isBool(value))
+        {
+            text = Object::asBool(value) ? "true" : "false";
+            len = strlen(text);
+        }
+        else
+        {
+            text = "null";
+            len = 4;
+        }
+        format_text(dest, spec, width, precision, text, len, len, nullptr);
+    }
+
+    static void format_char(StringBuffer* dest, const Format::Spec& spec, int width, Value value)
+    {
+        int len;
+        String* string;
+        uint8_t buf[8];
+        if(Object::isString(value))
+        {
+            string = Object::as<String>(value);
+            len = (int)string->utfOffset(1);
+            format_text(dest, spec, width, -1, string->data(), len, (len > 0) ? 1 : 0, nullptr);
+            return;
+        }
+        len = String::utfstringEncode((int)Object::toNumber(value), buf);
+        format_text(dest, spec, width, -1, (const char*)buf, len, 1, nullptr);
+    }
+
+    const char* Format::apply(StringBuffer* dest, const char* fmt, const Value* argv, size_t argc)
+    {
+        int width;
+        int precision;
+        size_t i;
+        size_t ai;
+        size_t estimate;
+        Value arg;
+        Spec current;
+        if(argc < m_argcount)
+        {
+            snprintf(m_error, sizeof(m_error), "format expects %d argument(s), but got %d", (int)m_argcount, (int)argc);
+            return m_error;
+        }
+        /* size the buffer once: the literal text, every string argument, and a guess for the rest */
+        estimate = m_literallength;
+        ai = 0;
+        for(i = 0; i < m_specs.size(); i++)
+        {
+            const Spec& spec = m_specs.at(i);
+            if(spec.conversion == 0 || spec.conversion == '%')
+            {
+                estimate += (spec.conversion == '%');
+                continue;
+            }
+            ai += (spec.width == FromArgs) + (spec.precision == FromArgs);
+            if(spec.conversion == 's' && Object::isString(argv[ai]))
+            {
+                estimate += Object::as<String>(argv[ai])->length();
+            }
+            else
+            {
+                estimate += 24;
+            }
+            if(spec.width > 0)
+            {
+                estimate += spec.width;
+            }
+            ai++;
+        }
+        dest->reserve(estimate);
+        ai = 0;
+        for(i = 0; i < m_specs.size(); i++)
+        {
+            const Spec& spec = m_specs.at(i);
+            dest->append(fmt + spec.litstart, spec.litlength);
+            if(spec.conversion == 0)
+            {
+                continue;
+            }
+            if(spec.conversion == '%')
+            {
+                dest->append('%');
+                continue;
+            }
+            current = spec;
+            width = spec.width;
+            precision = spec.precision;
+            if(width == FromArgs)
+            {
+                if(!Object::isNumber(argv[ai]))
+                {
+                    snprintf(m_error, sizeof(m_error), "'*' width of '%%%c' expects a number", spec.conversion);
+                    return m_error;
+                }
+                width = (int)Object::toNumber(argv[ai++]);
+                /* as in C, a negative width means left alignment */
+                if(width < 0)
+                {
+                    current.leftalign = true;
+                    width = -width;
+                }
+            }
+            if(precision == FromArgs)
+            {
+                if(!Object::isNumber(argv[ai]))
+                {
+                    snprintf(m_error, sizeof(m_error), "'*' precision of '%%%c' expects a number", spec.conversion);
+                    return m_error;
+                }
+                /* and a negative precision counts as none */
+                precision = (int)Object::toNumber(argv[ai++]);
+                if(precision < 0)
+                {
+                    precision = -1;
+                }
+            }
+            if(width > LIT_FORMAT_MAX_WIDTH || precision > LIT_FORMAT_MAX_WIDTH)
+            {
+                snprintf(m_error, sizeof(m_error), "width or precision of '%%%c' is too large", spec.conversion);
+                return m_error;
+            }
+            arg = argv[ai++];
+            switch(spec.conversion)
+            {
+                case 's':
+                    format_string(dest, current, width, precision, arg);
+                    break;
+                case 'c':
+                    if(!Object::isNumber(arg) && !Object::isString(arg))
+                    {
+                        snprintf(m_error, sizeof(m_error), "'%%c' expects a number or a string, but got %s", Object::valueName(arg));
+                        return m_error;
+                    }
+                    format_char(dest, current, width, arg);
+                    break;
+                default:
+                    if(!Object::isNumber(arg))
+                    {
+                        snprintf(m_error, sizeof(m_error), "'%%%c' expects a number, but got %s", spec.conversion, Object::valueName(arg));
+                        return m_error;
+                    }
+                    if(strchr("fFeEgG", spec.conversion) != nullptr)
+                    {
+                        format_float(dest, current, width, precision, Object::toNumber(arg));
+                    }
+                    else
+                    {
+                        format_integer(dest, current, width, precision, Object::toNumber(arg));
+                    }
+                    break;
+            }
+        }
+        return nullptr;
+    }
+
+    void lit_format_into(VM* vm, StringBuffer* dest, String* fmt, Value* argv, size_t argc)
+    {
+        size_t i;
+        const char* error;
+        String* string;
+        Format* format;
+        StackRef args(vm->fiber, argv);
+        /*
+        * stringify objects first: their toString() may run script code, which may empty the format cache,
+        * and may also grow the fiber's stack, which moves the arguments.
+        */
+        for(i = 0; i < argc; i++)
+        {
+            if(Object::isObject(argv[i]) && !Object::isString(argv[i]))
+            {
+                string = Object::toString(vm->m_state, argv[i]);
+                argv = args.get();
+                argv[i] = string->asValue();
+            }
+        }
+        format = Format::fromCache(vm->m_state, fmt, &error);
+        if(format == nullptr)
+        {
+            dest->release();
+            lit_runtime_error_exiting(vm, "invalid format string: %s", error);
+        }
+        error = format->apply(dest, fmt->data(), argv, argc);
+        if(error != nullptr)
+        {
+            dest->release();
+            lit_runtime_error_exiting(vm, "%s", error);
+        }
+    }
+}
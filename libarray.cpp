@@ -6,9 +6,16 @@ namespace lit
     int Array::indexOf(Value value)
     {
         size_t i;
+        Value elem;
         for(i = 0; i < m_actualarray.m_count; i++)
         {
-            if(m_actualarray.m_values[i] == value)
+            elem = m_actualarray.m_values[i];
+            if(elem == value)
+            {
+                return (int)i;
+            }
+            /* strings built by concatenation are not interned */
+            if(Object::isString(elem) && Object::isString(value) && String::equal(m_state, Object::as<String>(elem), Object::as<String>(value)))
             {
                 return (int)i;
             }
@@ -341,65 +348,25 @@ namespace lit
         static Value objfn_array_join(VM* vm, Value instance, size_t argc, Value* argv)
         {
             size_t i;
-            size_t jlen;
-            size_t index;
-            size_t length;
-
-            String* chars;
+            Writer wr;
             PCGenericArray<Value>* values;
-            String* string;
             String* joinee;
-            String** strings;
-            (void)argc;
-            (void)argv;
             joinee = nullptr;
-            length = 0;
             if(argc > 0)
             {
                 joinee = Object::as<String>(argv[0]);
             }
             values = &Object::as<Array>(instance)->m_actualarray;
-            //String* strings[values.m_count];
-            strings = LIT_ALLOCATE(vm->m_state, String*, values->m_count+1);
+            wr.initString(vm->m_state);
             for(i = 0; i < values->m_count; i++)
             {
-                string = Object::toString(vm->m_state, values->m_values[i]);
-                strings[i] = string;
-                length += string->length();
-                if(joinee != nullptr)
+                if(i > 0 && joinee != nullptr)
                 {
-                    length += joinee->length();
+                    wr.put(joinee->data(), joinee->length());
                 }
+                Object::writeValue(vm->m_state, &wr, values->m_values[i]);
             }
-            jlen = 0;
-            index = 0;
-            //chars = sdsempty();
-            chars = String::make(vm->m_state);
-            //chars = sdsMakeRoomFor(chars, length + 1);
-            if(joinee != nullptr)
-            {
-                jlen = joinee->length();
-            }
-            for(i = 0; i < values->m_count; i++)
-            {
-                string = strings[i];
-                //memcpy(chars + index, string->data(), string->length());
-                //chars = sdscatlen(chars, string->data(), string->length());
-                chars->append(string);
-                index += string->length();
-                if(joinee != nullptr)
-                {
-                    if((i+1) != values->m_count)
-                    {
-                        //chars = sdscatlen(chars, joinee->data(), jlen);
-                        chars->append(joinee);
-                    }
-                    index += jlen;
-                }
-            }
-            LIT_FREE(vm->m_state, String*, strings);
-            //return String::take(vm->m_state, chars, length)->asValue();
-            return chars->asValue();
+            return wr.asString()->asValue();
         }
 
         static Value objfn_array_sort(VM* vm, Value instance, size_t argc, Value* argv)
@@ -440,88 +407,14 @@ namespace lit
             return array->asValue();
         }
 
-        // todo:
-        // CONTAINER_OUTPUT_MAX is a terrible solution.
-        // rather, implement lazy range, and then dynamically print (0 ... N)
         static Value objfn_array_tostring(VM* vm, Value instance, size_t argc, Value* argv)
         {
+            Writer wr;
             (void)argc;
             (void)argv;
-            bool has_more;
-            size_t i;
-            size_t value_amount;
-            size_t olength;
-            //char* buffer;
-            String* buffer;
-            Array* self;
-            PCGenericArray<Value>* values;
-            Value val;
-            State* state;
-            String* part;
-            String* stringified;
-            String** values_converted;
-            static const char* recstring = "(recursion)";
-            self = Object::as<Array>(instance);
-            values = &self->m_actualarray;
-            state = vm->m_state;
-            if(values->m_count == 0)
-            {
-                return String::internValue(state, "[]");
-            }
-            has_more = values->m_count > LIT_CONTAINER_OUTPUT_MAX;
-            //value_amount = has_more ? LIT_CONTAINER_OUTPUT_MAX : values->m_count;
-            value_amount = values->m_count;
-            values_converted = LIT_ALLOCATE(vm->m_state, String*, value_amount+1);
-            // "[ ]"
-            olength = 3;
-            if(has_more)
-            {
-                olength += 3;
-            }
-            //buffer = sdsempty();
-            buffer = String::make(vm->m_state);
-            //buffer = sdsMakeRoomFor(buffer, olength+1);
-            //buffer = sdscat(buffer, "[");
-            buffer->append("[");
-            for(i = 0; i < value_amount; i++)
-            {
-                val = values->m_values[(has_more && i == value_amount - 1) ? values->m_count - 1 : i];
-                if(Object::isArray(val) && (Object::as<Array>(val) == self))
-                {
-                    stringified = String::copy(state, recstring, strlen(recstring));
-                }
-                else
-                {
-                    stringified = Object::toString(state, val);
-                }
-                part = stringified;
-                //buffer = sdscatlen(buffer, part->data(), part->length());
-                buffer->append(part);
-                /*if(has_more && i == value_amount - 2)
-                {
-                    //buffer = sdscat(buffer, " ... ");
-                    buffer->append(" ... ");
-                }
-                else
-                */
-                {
-                    if(i == (value_amount - 1))
-                    {
-                        //buffer = sdscat(buffer, " ]");
-                        buffer->append(" ]");
-                    }
-                    else
-                    {
-                        //buffer = sdscat(buffer, ", ");
-                        buffer->append(", ");
-                    }
-                }
-            }
-            LIT_FREE(vm->m_state, String*, values_converted);
-            // should be String::take, but it doesn't get picked up by the GC for some reason
-            //rt = String::take(vm->m_state, buffer, olength);
-            //rt = String::take(vm->m_state, buffer, olength);
-            return buffer->asValue();
+            wr.initString(vm->m_state);
+            Object::writeValue(vm->m_state, &wr, instance);
+            return wr.asString()->asValue();
         }
 
         static Value objfn_array_length(VM* vm, Value instance, size_t argc, Value* argv)
@@ -3,6 +3,20 @@
 
 namespace lit
 {
+    /* shared by all states, so that versions stay unique even across them */
+    static uint64_t class_version_counter = 0;
+
+    void Class::invalidate()
+    {
+        m_version = ++class_version_counter;
+        m_staticversion = ++class_version_counter;
+    }
+
+    void Class::invalidateStatics()
+    {
+        m_staticversion = ++class_version_counter;
+    }
+
     Class* Class::fromInstance(Value instance)
     {
         return Object::as<Instance>(instance)->klass;
@@ -109,7 +123,326 @@ namespace lit
         return nullptr;
     }
 
+    // impl::shape
+    Class* Class::make(State* state, String* name)
+    {
+        Class* klass;
+        klass = Object::make<Class>(state, Object::Type::Class);
+        klass->name = name;
+        klass->init_method = nullptr;
+        klass->super = nullptr;
+        klass->methods.init(state);
+        klass->static_fields.init(state);
+        klass->m_rootshape = nullptr;
+        klass->m_fieldhint = 0;
+        state->pushRoot((Object*)klass);
+        klass->m_rootshape = Shape::make(state, nullptr, nullptr);
+        klass->invalidate();
+        klass->bindMethod("toString", defaultfn_tostring);
+        klass->setStaticMethod("toString", defaultfn_tostring);
+        state->popRoot();
+        return klass;
+    }
+
+    Shape* Shape::make(State* state, Shape* parent, String* key)
+    {
+        size_t i;
+        Shape* shape;
+        Table::Entry* entry;
+        shape = LIT_ALLOCATE(state, Shape, 1);
+        shape->parent = parent;
+        shape->key = key;
+        shape->count = 0;
+        shape->slots = nullptr;
+        shape->ownstable = false;
+        shape->transitions.init(state);
+        if(parent != nullptr && parent->slots->size() == parent->count)
+        {
+            /* nothing extended the parent's table yet */
+            shape->slots = parent->slots;
+        }
+        else
+        {
+            shape->slots = LIT_ALLOCATE(state, Table, 1);
+            shape->slots->init(state);
+            shape->ownstable = true;
+            if(parent != nullptr)
+            {
+                for(i = 0; i < parent->slots->capacity(); i++)
+                {
+                    entry = parent->slots->at(i);
+                    if(entry->key != nullptr && ((size_t)Object::toNumber(entry->value) < parent->count))
+                    {
+                        shape->slots->set(entry->key, entry->value);
+                    }
+                }
+            }
+        }
+        if(parent != nullptr)
+        {
+            shape->slots->set(key, Object::toValue(parent->count));
+            shape->count = parent->count + 1;
+        }
+        return shape;
+    }
+
+    void Shape::release(State* state, Shape* shape)
+    {
+        size_t i;
+        if(shape == nullptr)
+        {
+            return;
+        }
+        for(i = 0; i < shape->transitions.m_count; i++)
+        {
+            Shape::release(state, shape->transitions.m_values[i]);
+        }
+        shape->transitions.release();
+        if(shape->ownstable)
+        {
+            shape->slots->release();
+            LIT_FREE(state, Table, shape->slots);
+        }
+        LIT_FREE(state, Shape, shape);
+    }
+
+    Shape* Shape::transition(State* state, String* key)
+    {
+        size_t i;
+        Shape* shape;
+        key = String::intern(state, key);
+        for(i = 0; i < transitions.m_count; i++)
+        {
+            if(transitions.m_values[i]->key == key)
+            {
+                return transitions.m_values[i];
+            }
+        }
+        if((transitions.m_count >= LIT_SHAPE_MAX_TRANSITIONS) || (count >= LIT_SHAPE_MAX_FIELDS))
+        {
+            return nullptr;
+        }
+        shape = Shape::make(state, this, key);
+        transitions.push(shape);
+        return shape;
+    }
+
+    String* Shape::keyAt(size_t slot) const
+    {
+        const Shape* shape;
+        for(shape = this; shape->parent != nullptr; shape = shape->parent)
+        {
+            if(shape->count == (slot + 1))
+            {
+                return shape->key;
+            }
+        }
+        return nullptr;
+    }
+
+    void Shape::markForGC(VM* vm)
+    {
+        size_t i;
+        vm->markObject((Object*)key);
+        for(i = 0; i < transitions.m_count; i++)
+        {
+            transitions.m_values[i]->markForGC(vm);
+        }
+    }
+
     // impl::instance
+    Instance* Instance::make(State* state, Class* klass)
+    {
+        size_t inlinecap;
+        Instance* instance;
+        inlinecap = klass->m_fieldhint;
+        instance = (Instance*)Object::make(state, sizeof(Instance) + (inlinecap * sizeof(Value)), Object::Type::Instance);
+        instance->klass = klass;
+        instance->m_shape = klass->m_rootshape;
+        instance->m_slots = instance->inlineSlots();
+        instance->m_slotcapacity = inlinecap;
+        instance->m_inlinecapacity = inlinecap;
+        instance->m_dictionary.init(state);
+        return instance;
+    }
+
+    void Instance::growSlots(size_t needed)
+    {
+        size_t i;
+        size_t newcap;
+        Value* newslots;
+        newcap = LIT_GROW_CAPACITY(m_slotcapacity);
+        while(newcap < needed)
+        {
+            newcap *= 2;
+        }
+        newslots = LIT_ALLOCATE(m_state, Value, newcap);
+        /* allocating may have collected, which only ever reads the first m_shape->count slots */
+        for(i = 0; i < m_shape->count; i++)
+        {
+            newslots[i] = m_slots[i];
+        }
+        if(m_slots != inlineSlots())
+        {
+            LIT_FREE_ARRAY(m_state, Value, m_slots, m_slotcapacity);
+        }
+        m_slots = newslots;
+        m_slotcapacity = newcap;
+    }
+
+    void Instance::toDictionary()
+    {
+        Shape* shape;
+        for(shape = m_shape; shape->parent != nullptr; shape = shape->parent)
+        {
+            m_dictionary.set(shape->key, m_slots[shape->count - 1]);
+        }
+        if(m_slots != inlineSlots())
+        {
+            LIT_FREE_ARRAY(m_state, Value, m_slots, m_slotcapacity);
+        }
+        m_slots = inlineSlots();
+        m_slotcapacity = m_inlinecapacity;
+        m_shape = nullptr;
+    }
+
+    void Instance::setField(String* name, Value value)
+    {
+        int slot;
+        Shape* next;
+        if(m_shape == nullptr)
+        {
+            m_dictionary.set(name, value);
+            return;
+        }
+        slot = m_shape->lookup(name);
+        if(slot != -1)
+        {
+            m_slots[slot] = value;
+            return;
+        }
+        next = m_shape->transition(m_state, name);
+        if(next == nullptr)
+        {
+            toDictionary();
+            m_dictionary.set(name, value);
+            return;
+        }
+        addField(next, value);
+    }
+
+    void Instance::addField(Shape* next, Value value)
+    {
+        if(next->count > m_slotcapacity)
+        {
+            growSlots(next->count);
+        }
+        m_slots[next->count - 1] = value;
+        m_shape = next;
+        if(next->count > klass->m_fieldhint)
+        {
+            klass->m_fieldhint = next->count;
+        }
+    }
+
+    bool Instance::removeField(String* name)
+    {
+        int slot;
+        size_t i;
+        size_t count;
+        Shape* shape;
+        Shape* next;
+        String* keys[LIT_SHAPE_MAX_FIELDS];
+        if(m_shape == nullptr)
+        {
+            return m_dictionary.remove(name);
+        }
+        slot = m_shape->lookup(name);
+        if(slot == -1)
+        {
+            return false;
+        }
+        count = m_shape->count;
+        for(shape = m_shape; shape->parent != nullptr; shape = shape->parent)
+        {
+            keys[shape->count - 1] = shape->key;
+        }
+        /* the remaining fields, in the same order, from the root */
+        next = klass->m_rootshape;
+        for(i = 0; (i < count) && (next != nullptr); i++)
+        {
+            if(i != (size_t)slot)
+            {
+                next = next->transition(m_state, keys[i]);
+            }
+        }
+        if(next == nullptr)
+        {
+            toDictionary();
+            return m_dictionary.remove(name);
+        }
+        for(i = (size_t)slot + 1; i < count; i++)
+        {
+            m_slots[i - 1] = m_slots[i];
+        }
+        m_shape = next;
+        return true;
+    }
+
+    int64_t Instance::fieldIterator(int64_t index) const
+    {
+        if(m_shape == nullptr)
+        {
+            return m_dictionary.iterator(index);
+        }
+        index++;
+        if(index < 0 || index >= int64_t(m_shape->count))
+        {
+            return -1;
+        }
+        return index;
+    }
+
+    Value Instance::fieldIterKey(int64_t index) const
+    {
+        String* key;
+        if(m_shape == nullptr)
+        {
+            return m_dictionary.iterKey(index);
+        }
+        if(index < 0 || index >= int64_t(m_shape->count))
+        {
+            return Object::NullVal;
+        }
+        key = m_shape->keyAt(index);
+        return (key == nullptr) ? Object::NullVal : key->asValue();
+    }
+
+    void Instance::markForGC(VM* vm)
+    {
+        size_t i;
+        vm->markObject((Object*)klass);
+        if(m_shape != nullptr)
+        {
+            for(i = 0; i < m_shape->count; i++)
+            {
+                vm->markValue(m_slots[i]);
+            }
+        }
+        /* also marked while toDictionary() is still filling it */
+        m_dictionary.markForGC(vm);
+    }
+
+    void Instance::release()
+    {
+        if(m_slots != inlineSlots())
+        {
+            LIT_FREE_ARRAY(m_state, Value, m_slots, m_slotcapacity);
+        }
+        m_dictionary.release();
+        Memory::reallocate(m_state, this, sizeof(Instance) + (m_inlinecapacity * sizeof(Value)), 0);
+    }
+
     Result Instance::callMethod(State* state, Value callee, String* mthname, Value* argv, size_t argc)
     {
         Value mthval;
@@ -230,10 +563,12 @@ namespace lit
                 {
                     fprintf(stderr, "setting method ...\n");
                     klass->methods.set(name, setval);
+                    klass->invalidate();
                 }
                 else
                 {
                     klass->static_fields.set(name, setval);
+                    klass->invalidateStatics();
                 }
                 return setval;
             }
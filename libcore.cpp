@@ -286,57 +286,78 @@ namespace lit
             return Object::toValue(time(nullptr));
         }
 
-        static Value cfn_print(VM* vm, size_t argc, Value* argv)
+        /* globals live in slots, so this returns a snapshot of the defined ones */
+        static Value cfn_globals(VM* vm, size_t argc, Value* argv)
         {
             size_t i;
-            size_t written = 0;
-            String* sv;
-            written = 0;
-            if(argc == 0)
+            Map* map;
+            (void)argc;
+            (void)argv;
+            map = Map::make(vm->m_state);
+            vm->m_state->pushRoot((Object*)map);
+            for(i = 0; i < vm->globalvalues.m_count; i++)
             {
-                return Object::toValue(0);
+                if(!Object::isNull(vm->globalvalues.m_values[i]))
+                {
+                    map->m_values.set(vm->globalnames.m_values[i], vm->globalvalues.m_values[i]);
+                }
             }
+            vm->m_state->popRoot();
+            return map->asValue();
+        }
+
+        /* writes each argument as toString() would */
+        static void core_writeargs(VM* vm, Writer* wr, Value* argv, size_t argc)
+        {
+            size_t i;
+            /* a toString() written in script may grow the fiber's stack, which moves the arguments */
+            StackRef args(vm->fiber, argv);
             for(i = 0; i < argc; i++)
             {
-                sv = Object::toString(vm->m_state, argv[i]);
-                written += FileIO::write_string(stdout, sv->data(), sv->length());
+                Object::writeValue(vm->m_state, wr, args.get()[i]);
             }
-            return Object::toValue(written);
+        }
+
+        static Value cfn_print(VM* vm, size_t argc, Value* argv)
+        {
+            size_t before;
+            Writer* wr;
+            wr = &vm->m_state->stdoutwriter;
+            before = wr->m_written;
+            core_writeargs(vm, wr, argv, argc);
+            return Object::toValue(wr->m_written - before);
         }
 
         static Value cfn_println(VM* vm, size_t argc, Value* argv)
         {
-            size_t i;
-            size_t wr;
-            String* stringified;
-            wr = 0;
+            size_t before;
+            Writer* wr;
             if(argc == 0)
             {
-                return Object::toValue(wr);
-            }
-            for(i = 0; i < argc; i++)
-            {
-                stringified = Object::toString(vm->m_state, argv[i]);
-                wr += FileIO::write_string(stdout, stringified->data(), stringified->size());
+                return Object::toValue(0);
             }
-            wr += FileIO::write_string(stdout, "\n");
-            return Object::toValue(wr);
+            wr = &vm->m_state->stdoutwriter;
+            before = wr->m_written;
+            core_writeargs(vm, wr, argv, argc);
+            wr->put('\n');
+            return Object::toValue(wr->m_written - before);
         }
 
-        Value objfn_string_format(VM* vm, Value instance, size_t argc, Value* argv);
-
         static Value cfn_printf(VM* vm, size_t argc, Value* argv)
         {
-            Value vres;
-            Value firstarg;
-            String* res;
-            (void)res;
-            firstarg = argv[0];
-            vres = objfn_string_format(vm, firstarg, argc-1, argv+1);
-            res = Object::as<String>(vres);
-            
-            lit_runtime_error_exiting(vm, "printf() is currently broken");
-            return Object::NullVal;
+            size_t wr;
+            StringBuffer buf;
+            LIT_ENSURE_MIN_ARGS(1);
+            if(!Object::isString(argv[0]))
+            {
+                lit_runtime_error_exiting(vm, "printf() expects a format string as the first argument");
+            }
+            buf.init(vm->m_state);
+            lit_format_into(vm, &buf, Object::as<String>(argv[0]), argv + 1, argc - 1);
+            vm->m_state->stdoutwriter.put(buf.data(), buf.length());
+            wr = buf.length();
+            buf.release();
+            return Object::toValue(wr);
         }
 
         static bool cfn_eval(VM* vm, size_t argc, Value* argv)
@@ -362,14 +383,14 @@ namespace lit
             name = lit_check_object_string(vm, argv, argc, 0);
             ignore_previous = argc > 1 && Object::isBool(argv[1]) && Object::asBool(argv[1]);
             // First check, if a file with this name exists in the local path
-            if(util_attempt_to_require(vm, argv, argc, name->data(), ignore_previous, false))
+            if(util_attempt_to_require(vm, argv, argc, name->cstr(), ignore_previous, false))
             {
                 return should_update_locals;
             }
             // If not, we join the path of the current module to it (the path goes all the way from the root)
             modname = vm->fiber->m_module->name;
             // We need to get rid of the module name (test.folder.module -> test.folder)
-            index = strrchr(modname->data(), '.');
+            index = strrchr(modname->cstr(), '.');
             if(index != nullptr)
             {
                 length = index - modname->data();
@@ -377,7 +398,7 @@ namespace lit
                 //char buffer[length + 1];
                 memcpy((void*)buffer, modname->data(), length);
                 buffer[length] = '\0';
-                if(util_attempt_to_require_combined(vm, argv, argc, (const char*)&buffer, name->data(), ignore_previous))
+                if(util_attempt_to_require_combined(vm, argv, argc, (const char*)&buffer, name->cstr(), ignore_previous))
                 {
                     free(buffer);
                     return should_update_locals;
@@ -387,7 +408,7 @@ namespace lit
                     free(buffer);
                 }
             }
-            lit_runtime_error_exiting(vm, "failed to require module '%s'", name->data());
+            lit_runtime_error_exiting(vm, "failed to require module '%s'", name->cstr());
             return false;
         }
         #endif
@@ -454,7 +475,7 @@ namespace lit
                 state->defineNative("printf", cfn_printf);
                 //state->defineNativePrimitive("require", cfn_require);
                 state->defineNativePrimitive("eval", cfn_eval);
-                state->setGlobal(String::intern(state, "globals"), state->vm->globals->asValue());
+                state->defineNative("globals", cfn_globals);
             }
         }
     }
@@ -3,39 +3,130 @@
 
 namespace lit
 {
+    static inline bool tableKeysEqual(const String* a, const String* b)
+    {
+        /*
+        * keys are interned, so identity is the common case; fall back to
+        * comparing contents when looking up with a transient string.
+        */
+        if(a == b)
+        {
+            return true;
+        }
+        if(a->m_interned && b->m_interned)
+        {
+            return false;
+        }
+        if((a->hash() != b->hash()) || (a->length() != b->length()))
+        {
+            return false;
+        }
+        return (memcmp(a->data(), b->data(), a->length()) == 0);
+    }
+
     void Table::release()
+    {
+        LIT_FREE_ARRAY(m_state, Entry, m_entries, m_capacity);
+        m_entries = nullptr;
+        m_capacity = 0;
+        m_count = 0;
+        m_used = 0;
+    }
+
+    void Table::clear()
     {
         size_t i;
-        Entry* ent;
-        for(i=0; i<size(); i++)
+        for(i = 0; i < m_capacity; i++)
         {
-            ent = m_inner.m_values[i];
-            delete ent;
-            m_inner.m_values[i] = nullptr;
+            m_entries[i].key = nullptr;
+            m_entries[i].value = Object::NullVal;
         }
-        m_inner.release();
+        m_count = 0;
+        m_used = 0;
     }
 
-    void Table::removeWhite()
+    Table::Entry* Table::findEntry(String* key) const
     {
-        size_t i;
+        size_t index;
+        size_t mask;
         Entry* entry;
-        if(m_inner.m_values != nullptr)
+        Entry* tombstone;
+        mask = m_capacity - 1;
+        index = key->hash() & mask;
+        tombstone = nullptr;
+        while(true)
         {
-            if(m_inner.m_count > 0)
+            entry = &m_entries[index];
+            if(entry->key == nullptr)
             {
-                for(i = 0; i < m_inner.m_count; i++)
+                if(entry->value == Object::NullVal)
+                {
+                    /* truly empty; reuse an earlier tombstone if there was one */
+                    return (tombstone != nullptr) ? tombstone : entry;
+                }
+                if(tombstone == nullptr)
                 {
-                    entry = m_inner.m_values[i];
-                    if(entry != nullptr)
-                    {
-                        if(entry->key != nullptr && !entry->key->marked)
-                        {
-                            this->remove(entry->key);
-                        }
-                    }
+                    tombstone = entry;
                 }
             }
+            else if(tableKeysEqual(entry->key, key))
+            {
+                return entry;
+            }
+            index = (index + 1) & mask;
+        }
+    }
+
+    void Table::adjustCapacity(size_t newcap)
+    {
+        size_t i;
+        size_t oldcap;
+        Entry* dest;
+        Entry* entries;
+        Entry* oldentries;
+        /*
+        * growing must not run the collector: callers routinely pass a value
+        * they just created (and have not rooted) straight to set().
+        */
+        entries = (Entry*)Memory::reallocateNoCollect(m_state, nullptr, 0, sizeof(Entry) * newcap);
+        for(i = 0; i < newcap; i++)
+        {
+            entries[i].key = nullptr;
+            entries[i].value = Object::NullVal;
+        }
+        /* tombstones are dropped here, so a rehash always compacts. */
+        oldentries = m_entries;
+        oldcap = m_capacity;
+        m_entries = entries;
+        m_capacity = newcap;
+        m_count = 0;
+        for(i = 0; i < oldcap; i++)
+        {
+            if(oldentries[i].key != nullptr)
+            {
+                dest = findEntry(oldentries[i].key);
+                dest->key = oldentries[i].key;
+                dest->value = oldentries[i].value;
+                m_count++;
+            }
+        }
+        m_used = m_count;
+        LIT_FREE_ARRAY(m_state, Entry, oldentries, oldcap);
+    }
+
+    void Table::removeWhite()
+    {
+        size_t i;
+        Entry* entry;
+        for(i = 0; i < m_capacity; i++)
+        {
+            entry = &m_entries[i];
+            if(entry->key != nullptr && !entry->key->marked)
+            {
+                entry->key = nullptr;
+                entry->value = Object::TrueVal;
+                m_count--;
+            }
         }
     }
 
@@ -53,133 +144,141 @@ namespace lit
     {
         size_t i;
         Table::Entry* entry;
-        if(m_inner.m_values != nullptr)
+        for(i = 0; i < m_capacity; i++)
         {
-            if(m_inner.m_count > 0)
+            entry = &m_entries[i];
+            if(entry->key != nullptr)
             {
-                for(i = 0; i < m_inner.m_count; i++)
-                {
-                    entry = m_inner.m_values[i];
-                    if(entry != nullptr)
-                    {
-                        vmMarkObject(vm, (Object*)entry->key);
-                        vmMarkValue(vm, entry->value);
-                    }
-                }
+                vmMarkObject(vm, (Object*)entry->key);
+                vmMarkValue(vm, entry->value);
             }
         }
     }
 
-
     bool Table::set(String* key, Value value)
     {
-        size_t i;
-        if(m_inner.size() > 0)
+        bool isnew;
+        Entry* entry;
+        if((m_used + 1) > (m_capacity * TABLE_MAX_LOAD))
         {
-            for(i=0; i<m_inner.size(); i++)
+            /* if most of the used slots are tombstones, rehashing in place is enough */
+            if((m_count + 1) <= ((m_capacity / 2) * TABLE_MAX_LOAD))
             {
-                if(m_inner.at(i) != nullptr)
-                {
-                    if(m_inner.at(i)->key != nullptr)
-                    {
-                        if((m_inner.at(i)->key->m_chars == key->m_chars))
-                        {
-                            m_inner.at(i)->value = value;
-                            return false;
-                        }
-                    }
-                }
+                adjustCapacity(m_capacity);
+            }
+            else
+            {
+                adjustCapacity(LIT_GROW_CAPACITY(m_capacity));
             }
         }
-        m_inner.push(new Entry{key, value});
-        return true;
+        entry = findEntry(key);
+        isnew = (entry->key == nullptr);
+        if(isnew)
+        {
+            /* reusing a tombstone does not add to the load */
+            if(entry->value == Object::NullVal)
+            {
+                m_used++;
+            }
+            m_count++;
+            /* keys are interned on insertion, so lookups with interned strings hit by identity */
+            entry->key = String::intern(m_state, key);
+        }
+        entry->value = value;
+        return isnew;
     }
 
     bool Table::get(String* key, Value* value) const
     {
-        size_t i;
-        for(i=0; i<m_inner.size(); i++)
+        Entry* entry;
+        if(m_count == 0)
         {
-            if((m_inner.at(i)->key->m_chars == key->m_chars) && (m_inner.at(i)->key->m_hash == key->m_hash))
-            {
-                *value = m_inner.at(i)->value;
-                return true;
-            }
+            return false;
+        }
+        entry = findEntry(key);
+        if(entry->key == nullptr)
+        {
+            return false;
         }
-        return false;
+        *value = entry->value;
+        return true;
     }
 
     bool Table::remove(String* key)
     {
-        size_t i;
-        for(i=0; i<m_inner.size(); i++)
+        Entry* entry;
+        if(m_count == 0)
         {
-            if(m_inner.at(i)->key && ((m_inner.at(i)->key->m_chars == key->m_chars) && (m_inner.at(i)->key->m_hash == key->m_hash)))
-            {
-                m_inner.at(i)->key = nullptr;
-                return true;
-            }
+            return false;
         }
-        return false;
+        entry = findEntry(key);
+        if(entry->key == nullptr)
+        {
+            return false;
+        }
+        entry->key = nullptr;
+        entry->value = Object::TrueVal;
+        m_count--;
+        return true;
     }
 
     String* Table::find(const char* str, size_t length, uint32_t hs) const
     {
-        size_t i;
-        if(m_inner.size() > 0)
+        size_t index;
+        size_t mask;
+        Entry* entry;
+        if(m_count == 0)
+        {
+            return nullptr;
+        }
+        mask = m_capacity - 1;
+        index = hs & mask;
+        while(true)
         {
-            for(i=0; i<m_inner.size(); i++)
+            entry = &m_entries[index];
+            if(entry->key == nullptr)
             {
-                if(m_inner.at(i)->key)
+                if(entry->value == Object::NullVal)
                 {
-                    if(*(m_inner.at(i)->key->m_chars) == std::string_view(str, length))
-                    {
-                        if(m_inner.at(i)->key->m_hash == hs)
-                        {
-                            return m_inner.at(i)->key;
-                        }
-                    }
+                    return nullptr;
                 }
             }
+            else if((entry->key->hash() == hs) && (entry->key->length() == length) && (memcmp(entry->key->data(), str, length) == 0))
+            {
+                return entry->key;
+            }
+            index = (index + 1) & mask;
         }
-        return nullptr;
     }
 
     void Table::addAll(const Table& from)
     {
-        //fprintf(stderr, "addAll: from=%p (%d)\n", &from, from.size());
         size_t i;
-        if(from.size() > 0)
+        const Entry* entry;
+        for(i = 0; i < from.m_capacity; i++)
         {
-            for(i = 0; i < from.size(); i++)
+            entry = &from.m_entries[i];
+            if(entry->key != nullptr)
             {
-                const auto* entry = from.at(i);
-                if(entry != nullptr)
-                {
-                    if(entry->key != nullptr)
-                    {
-                        //fprintf(stderr, "Table::addAll: %s\n", entry->key->data());
-                        set(entry->key, entry->value);
-                    }
-                }
+                set(entry->key, entry->value);
             }
         }
     }
 
     int64_t Table::iterator(int64_t number) const
     {
-        if(m_inner.m_count == 0)
+        if(m_count == 0)
         {
             return -1;
         }
-        if(number >= int64_t(m_inner.m_capacity))
+        if(number >= int64_t(m_capacity))
         {
             return -1;
         }
         number++;
-        for(; number < int64_t(m_inner.m_capacity); number++)
+        for(; number < int64_t(m_capacity); number++)
         {
-            if(m_inner.m_values[number]->key != nullptr)
+            if(m_entries[number].key != nullptr)
             {
                 return number;
             }
@@ -189,11 +288,11 @@ namespace lit
 
     Value Table::iterKey(int64_t index) const
     {
-        if(int64_t(m_inner.m_capacity) <= index)
+        if((index < 0) || (int64_t(m_capacity) <= index) || (m_entries[index].key == nullptr))
         {
             return Object::NullVal;
         }
-        return m_inner.m_values[index]->key->asValue();
+        return m_entries[index].key->asValue();
     }
 
     namespace Builtins
@@ -256,7 +355,7 @@ namespace lit
             (void)vm;
             (void)argv;
             (void)argc;
-            Object::as<Map>(instance)->m_values.m_inner.m_count = 0;
+            Object::as<Map>(instance)->m_values.clear();
             return Object::NullVal;
         }
 
@@ -286,122 +385,18 @@ namespace lit
             Map* map;
             state = vm->m_state;
             map = Map::make(state);
-            Object::as<Map>(instance)->m_values.addAll(map->m_values);
+            map->m_values.addAll(Object::as<Map>(instance)->m_values);
             return map->asValue();
         }
 
         static Value objfn_map_tostring(VM* vm, Value instance, size_t argc, Value* argv)
         {
+            Writer wr;
             (void)argc;
             (void)argv;
-            bool has_wrapper;
-            bool has_more;
-            size_t i;
-            size_t index;
-            size_t value_amount;
-            size_t olength;
-            size_t buffer_index;
-            String* buffer;
-            State* state;
-            Map* map;
-            Table* values;
-            Table::Entry* entry;
-            Value field;
-            String* strobval;
-            String* key;
-            String* value;
-            String** values_converted;
-            String** keys;
-            state = vm->m_state;
-            map = Object::as<Map>(instance);
-            values = &map->m_values;
-            if(values->size() == 0)
-            {
-                return String::internValue(state, "{}");
-            }
-            has_wrapper = map->m_indexfn != nullptr;
-            has_more = values->size() > LIT_CONTAINER_OUTPUT_MAX;
-            value_amount = has_more ? LIT_CONTAINER_OUTPUT_MAX : values->size();
-            values_converted = LIT_ALLOCATE(vm->m_state, String*, value_amount+1);
-            keys = LIT_ALLOCATE(vm->m_state, String*, value_amount+1);
-            olength = 3;
-            if(has_more)
-            {
-                olength += SINGLE_LINE_MAPS_ENABLED ? 5 : 6;
-            }
-            i = 0;
-            index = 0;
-            do
-            {
-                entry = values->m_inner.m_values[index++];
-                if(entry)
-                {
-                    if(entry->key != nullptr)
-                    {
-                        // Special hidden key
-                        field = has_wrapper ? map->m_indexfn(vm, map, entry->key, nullptr) : entry->value;
-                        // This check is required to prevent infinite loops when playing with Module.privates and such
-                        strobval = (Object::isMap(field) && Object::as<Map>(field)->m_indexfn != nullptr) ? String::intern(state, "map") : Object::toString(state, field);
-                        state->pushRoot((Object*)strobval);
-                        values_converted[i] = strobval;
-                        keys[i] = entry->key;
-                        olength += (
-                            entry->key->length() + 3 + strobval->length() +
-                            #ifdef SINGLE_LINE_MAPS
-                                (i == value_amount - 1 ? 1 : 2)
-                            #else
-                                (i == value_amount - 1 ? 2 : 3)
-                            #endif
-                        );
-                    }
-                }
-                i++;
-            } while(i < value_amount);
-            buffer = String::allocEmpty(vm->m_state, olength+1);
-            #ifdef SINGLE_LINE_MAPS
-            buffer->append("{ ");
-            #else
-            buffer->append("{\n");
-            #endif
-            buffer_index = 2;
-            for(i = 0; i < value_amount; i++)
-            {
-                key = keys[i];
-                value = values_converted[i];
-                #ifndef SINGLE_LINE_MAPS
-                buffer->append('\t');
-                #endif
-                buffer->append(key->data(), key->length());
-                buffer_index += key->length();
-                buffer->append(": ");
-                buffer_index += 3;
-                buffer->append(value->data(), value->length());
-                buffer_index += value->length();
-                /*
-                if(has_more && i == value_amount - 1)
-                {
-                    #ifdef SINGLE_LINE_MAPS
-                    memcpy(&buffer->append(", ... }");
-                    #else
-                    buffer->append(",\n\t...\n}");
-                    #endif
-                    buffer_index += 8;
-                }
-                else
-                */
-                {
-                    #ifdef SINGLE_LINE_MAPS
-                    buffer->append((i == value_amount - 1) ? " }" : ", ");
-                    #else
-                    buffer->append((i == value_amount - 1) ? "\n}" : ",\n");
-                    #endif
-                    buffer_index += 2;
-                }
-                state->popRoot();
-            }
-            LIT_FREE(vm->m_state, String*, keys);
-            LIT_FREE(vm->m_state, String*, values_converted);
-            return buffer->asValue();
+            wr.initString(vm->m_state);
+            Object::writeValue(vm->m_state, &wr, instance);
+            return wr.asString()->asValue();
         }
 
         static Value objfn_map_length(VM* vm, Value instance, size_t argc, Value* argv)
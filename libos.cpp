@@ -1,5 +1,6 @@
 
 #include <sys/stat.h>
+#include <limits.h>
 #include "lit.h"
 
 namespace lit
@@ -11,6 +12,8 @@ namespace lit
         #endif
 
         #define LITDIR_PATHSIZE 1024
+        /* stdio buffer size for files opened by path; pipes and files are read in chunks this big */
+        #define LIT_FILE_BUFFER_SIZE (64 * 1024)
         #if defined(__unix__) || defined(__linux__)
             #define LITDIR_ISUNIX
         #endif
@@ -90,6 +93,10 @@ namespace lit
                 char* path;
                 FILE* handle;
                 bool isopen;
+                char* iobuffer;
+                /* grown by getline, and reused by every readLine and lines() step */
+                char* line;
+                size_t linecapacity;
         };
 
         class StdioHandle
@@ -105,14 +112,14 @@ namespace lit
         {
             Userdata* userdata = Userdata::make(vm->m_state, typsz, false);
             userdata->cleanup_fn = cleanup;
-            Object::as<Instance>(instance)->fields.set(String::intern(vm->m_state, "_data"), userdata->asValue());
+            Object::as<Instance>(instance)->setField(String::intern(vm->m_state, "_data"), userdata->asValue());
             return userdata->data;
         }
 
         static void* LIT_EXTRACT_DATA(VM* vm, Value instance)
         {
             Value _d;
-            if(!Object::as<Instance>(instance)->fields.get(String::intern(vm->m_state, "_data"), &_d))
+            if(!Object::as<Instance>(instance)->getField(String::intern(vm->m_state, "_data"), &_d))
             {
                 lit_runtime_error_exiting(vm, "failed to extract userdata");
                 return nullptr;
@@ -123,6 +130,15 @@ namespace lit
         /*
          * File
          */
+        static void file_releasebuffers(FileData* fd)
+        {
+            free(fd->iobuffer);
+            fd->iobuffer = nullptr;
+            free(fd->line);
+            fd->line = nullptr;
+            fd->linecapacity = 0;
+        }
+
         void cleanup_file(State* state, Userdata* data, bool mark)
         {
             (void)state;
@@ -136,12 +152,14 @@ namespace lit
                 fd = ((FileData*)data->data);
                 if(fd != nullptr)
                 {
-                    if((fd->handle != nullptr) && (fd->isopen == true))
+                    /* the std handles have no path, and stay open */
+                    if((fd->handle != nullptr) && (fd->isopen == true) && (fd->path != nullptr))
                     {
                         fclose(fd->handle);
                         fd->handle = nullptr;
                         fd->isopen = false;
                     }
+                    file_releasebuffers(fd);
                 }
             }
         }
@@ -162,10 +180,13 @@ namespace lit
                     hstd = (StdioHandle*)(Object::as<Userdata>(argv[0])->data);
                     hnd = hstd->handle;
                     //fprintf(stderr, "FILE: hnd=%p name=%s\n", hstd->handle, hstd->name);
-                    data = (FileData*)LIT_INSERT_DATA(vm, instance, sizeof(FileData), nullptr);
+                    data = (FileData*)LIT_INSERT_DATA(vm, instance, sizeof(FileData), cleanup_file);
                     data->path = nullptr;
                     data->handle = hnd;
                     data->isopen = true;
+                    data->iobuffer = nullptr;
+                    data->line = nullptr;
+                    data->linecapacity = 0;
                 }
                 else
                 {
@@ -180,6 +201,13 @@ namespace lit
                     data->path = (char*)path;
                     data->handle = hnd;
                     data->isopen = true;
+                    data->iobuffer = (char*)malloc(LIT_FILE_BUFFER_SIZE);
+                    data->line = nullptr;
+                    data->linecapacity = 0;
+                    if(data->iobuffer != nullptr)
+                    {
+                        setvbuf(hnd, data->iobuffer, _IOFBF, LIT_FILE_BUFFER_SIZE);
+                    }
                 }
             }
             else
@@ -191,6 +219,44 @@ namespace lit
         }
 
 
+        /*
+        * stdout and stderr are buffered by the state's writers; whatever they still hold is
+        * flushed before a File touches the FILE directly, and reading stdin flushes stdout,
+        * so that a prompt shows up before the read blocks.
+        */
+        static Writer* file_stdwriter(VM* vm, FILE* hnd)
+        {
+            if(hnd == stdout)
+            {
+                return &vm->m_state->stdoutwriter;
+            }
+            if(hnd == stderr)
+            {
+                return &vm->m_state->stderrwriter;
+            }
+            return nullptr;
+        }
+
+        static void file_syncstd(VM* vm, FILE* hnd)
+        {
+            if(hnd == stdin)
+            {
+                vm->m_state->stdoutwriter.flush();
+            }
+            else if(hnd == stdout || hnd == stderr)
+            {
+                file_stdwriter(vm, hnd)->flush();
+            }
+        }
+
+        static FILE* file_gethandle(VM* vm, Value instance)
+        {
+            FILE* hnd;
+            hnd = ((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle;
+            file_syncstd(vm, hnd);
+            return hnd;
+        }
+
         static Value objmethod_file_close(VM* vm, Value instance, size_t argc, Value* argv)
         {
             (void)vm;
@@ -198,7 +264,13 @@ namespace lit
             (void)argv;
             FileData* data;
             data = (FileData*)LIT_EXTRACT_DATA(vm, instance);
-            fclose(data->handle);
+            file_syncstd(vm, data->handle);
+            /* the state's writers keep using stdout and stderr until it is released */
+            if(file_stdwriter(vm, data->handle) == nullptr)
+            {
+                fclose(data->handle);
+            }
+            file_releasebuffers(data);
             data->handle = nullptr;
             data->isopen = false;
             return Object::NullVal;
@@ -228,18 +300,49 @@ namespace lit
         {
             LIT_ENSURE_ARGS(1)
             size_t rt;
+            FILE* hnd;
+            Writer* wr;
             String* value;
+            hnd = ((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle;
+            wr = file_stdwriter(vm, hnd);
+            if(wr != nullptr)
+            {
+                /* diagnostics go out right away, after anything already printed */
+                if(hnd == stderr)
+                {
+                    vm->m_state->stdoutwriter.flush();
+                }
+                Object::writeValue(vm->m_state, wr, argv[0]);
+                if(hnd == stderr)
+                {
+                    wr->flush();
+                }
+                return Object::toValue(1);
+            }
             value = Object::toString(vm->m_state, argv[0]);
-            rt = fwrite(value->data(), value->length(), 1, ((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle);
+            rt = fwrite(value->data(), value->length(), 1, hnd);
             return Object::toValue(rt);
         }
 
+        static Value objmethod_file_flush(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            (void)argc;
+            (void)argv;
+            FILE* hnd;
+            hnd = file_gethandle(vm, instance);
+            if(hnd != nullptr && hnd != stdin)
+            {
+                fflush(hnd);
+            }
+            return Object::NullVal;
+        }
+
         static Value objmethod_file_writebyte(VM* vm, Value instance, size_t argc, Value* argv)
         {
             uint8_t rt;
             uint8_t byte;
             byte = (uint8_t)lit_check_number(vm, argv, argc, 0);
-            rt = FileIO::binwrite_uint8_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle, byte);
+            rt = FileIO::binwrite_uint8_t(file_gethandle(vm, instance), byte);
             return Object::toValue(rt);
         }
 
@@ -248,7 +351,7 @@ namespace lit
             uint16_t rt;
             uint16_t shrt;
             shrt = (uint16_t)lit_check_number(vm, argv, argc, 0);
-            rt = FileIO::binwrite_uint16_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle, shrt);
+            rt = FileIO::binwrite_uint16_t(file_gethandle(vm, instance), shrt);
             return Object::toValue(rt);
         }
 
@@ -257,7 +360,7 @@ namespace lit
             uint32_t rt;
             float num;
             num = (float)lit_check_number(vm, argv, argc, 0);
-            rt = FileIO::binwrite_uint32_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle, num);
+            rt = FileIO::binwrite_uint32_t(file_gethandle(vm, instance), num);
             return Object::toValue(rt);
         }
 
@@ -266,7 +369,7 @@ namespace lit
             bool value;
             uint8_t rt;
             value = lit_check_bool(vm, argv, argc, 0);
-            rt = FileIO::binwrite_uint8_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle, (uint8_t)value ? '1' : '0');
+            rt = FileIO::binwrite_uint8_t(file_gethandle(vm, instance), (uint8_t)value ? '1' : '0');
             return Object::toValue(rt);
         }
 
@@ -280,6 +383,7 @@ namespace lit
             }
             string = Object::as<String>(argv[0]);
             data = (FileData*)LIT_EXTRACT_DATA(vm, instance);
+            file_syncstd(vm, data->handle);
             FileIO::binwrite_string(data->handle, string);
             return Object::NullVal;
         }
@@ -300,7 +404,7 @@ namespace lit
             {
                 path = "stdio";
             }
-            return String::format(vm->m_state, "[file @ ($)]", Object::as<Instance>(instance), data->path)->asValue();
+            return String::format(vm->m_state, "[file $]", path)->asValue();
         }
 
         static Value objmethod_file_readall(VM* vm, Value instance, size_t argc, Value* argv)
@@ -308,66 +412,155 @@ namespace lit
             (void)instance;
             (void)argc;
             (void)argv;
-            char c;
+            size_t got;
             long length;
             long actuallength;
-            char* buffer;
             FileData* data;
-            String* result;
+            StringBuffer result;
             data = (FileData*)LIT_EXTRACT_DATA(vm, instance);
+            file_syncstd(vm, data->handle);
             if(fseek(data->handle, 0, SEEK_END) == -1)
             {
                 /*
-                * cannot seek, must read each byte.
+                * cannot seek (a pipe, or a terminal), so read chunks until the end.
                 */
-                result = String::allocEmpty(vm->m_state, 0);
-                actuallength = 0;
-                while((c = fgetc(data->handle)) != EOF)
+                result.init(vm->m_state, LIT_FILE_BUFFER_SIZE);
+                do
                 {
-                    //result->m_chars = sdscatlen(result->m_chars, &c, 1);
-                    result->append(c);
-                    actuallength++;
-                }
+                    result.reserve(LIT_FILE_BUFFER_SIZE);
+                    got = fread(result.m_data + result.m_length, sizeof(char), LIT_FILE_BUFFER_SIZE, data->handle);
+                    result.m_length += got;
+                } while(got == LIT_FILE_BUFFER_SIZE);
             }
             else
             {
-                result = String::make(vm->m_state);
                 length = ftell(data->handle);
                 fseek(data->handle, 0, SEEK_SET);
-                buffer = LIT_ALLOCATE(vm->m_state, char, length+1);
-                actuallength = fread(buffer, sizeof(char), length, data->handle);
-                result->append(buffer, actuallength);
-                LIT_FREE(vm->m_state, char, buffer);
-                /*
-                * after reading, THIS actually sets the correct length.
-                * before that, it would be 0.
-                */
-                //sdsIncrLen(result->m_chars, actuallength);
+                result.init(vm->m_state, length);
+                actuallength = fread(result.m_data, sizeof(char), length, data->handle);
+                result.m_length = actuallength;
             }
-            
-            result->m_hash = String::makeHash(*(result->m_chars));
-            String::statePutInterned(vm->m_state, result);
-            return result->asValue();
+            return result.toString()->asValue();
         }
 
-        static Value objmethod_file_readline(VM* vm, Value instance, size_t argc, Value* argv)
+        /*
+        * like POSIX getline: reads a line, newline included, into the malloc'd buffer *line,
+        * growing it as needed. returns its length, or -1 at the end of the file.
+        * windows has no getline, so there this grows the buffer around fgets instead.
+        */
+        static int64_t file_getline(char** line, size_t* capacity, FILE* handle)
+        {
+        #if defined(_WIN32)
+            size_t chunk;
+            size_t length;
+            size_t newcapacity;
+            char* newline;
+            if(*line == nullptr || *capacity < 2)
+            {
+                newline = (char*)realloc(*line, 128);
+                if(newline == nullptr)
+                {
+                    return -1;
+                }
+                *line = newline;
+                *capacity = 128;
+            }
+            length = 0;
+            while(true)
+            {
+                chunk = *capacity - length;
+                if(chunk > INT_MAX)
+                {
+                    chunk = INT_MAX;
+                }
+                if(fgets(*line + length, (int)chunk, handle) == nullptr)
+                {
+                    break;
+                }
+                length += strlen(*line + length);
+                /* fgets only stops short of a full buffer at a newline, or at the end of the file */
+                if((*line)[length - 1] == '\n' || length + 1 < *capacity)
+                {
+                    return (int64_t)length;
+                }
+                newcapacity = *capacity * 2;
+                newline = (char*)realloc(*line, newcapacity);
+                if(newline == nullptr)
+                {
+                    break;
+                }
+                *line = newline;
+                *capacity = newcapacity;
+            }
+            return (length > 0) ? (int64_t)length : -1;
+        #else
+            return getline(line, capacity, handle);
+        #endif
+        }
+
+        /*
+        * reads the next line into the File's line buffer, however long it is.
+        * returns its length without the newline, or -1 once the file is exhausted.
+        */
+        static int64_t file_nextline(VM* vm, Value instance)
         {
-            (void)vm;
-            (void)instance;
-            (void)argc;
-            (void)argv;
-            size_t max_length;
-            char* line;
+            int64_t length;
             FileData* data;
-            max_length = (size_t)lit_get_number(vm, argv, argc, 0, 128);
             data = (FileData*)LIT_EXTRACT_DATA(vm, instance);
-            line = LIT_ALLOCATE(vm->m_state, char, max_length + 1);
-            if(!fgets(line, max_length, data->handle))
+            if(data->handle == nullptr)
+            {
+                return -1;
+            }
+            file_syncstd(vm, data->handle);
+            length = file_getline(&data->line, &data->linecapacity, data->handle);
+            if(length > 0 && data->line[length - 1] == '\n')
+            {
+                length--;
+            }
+            return length;
+        }
+
+        static Value file_linevalue(VM* vm, Value instance, int64_t length)
+        {
+            if(length < 0)
             {
-                LIT_FREE(vm->m_state, char, line);
                 return Object::NullVal;
             }
-            return String::take(vm->m_state, line, strlen(line) - 1)->asValue();
+            return String::makeTransient(vm->m_state, ((FileData*)LIT_EXTRACT_DATA(vm, instance))->line, length)->asValue();
+        }
+
+        static Value objmethod_file_readline(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            (void)argc;
+            (void)argv;
+            return file_linevalue(vm, instance, file_nextline(vm, instance));
+        }
+
+        /*
+        * for(line in file.lines()) { ... }
+        * the file is its own sequence: each iterator step reads a line, and the line is the iterator.
+        */
+        static Value objmethod_file_lines(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            (void)vm;
+            (void)argc;
+            (void)argv;
+            return instance;
+        }
+
+        static Value objmethod_file_iterator(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            (void)argc;
+            (void)argv;
+            return file_linevalue(vm, instance, file_nextline(vm, instance));
+        }
+
+        static Value objmethod_file_iteratorvalue(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            LIT_ENSURE_ARGS(1);
+            (void)vm;
+            (void)instance;
+            return argv[0];
         }
 
         static Value objmethod_file_readbyte(VM* vm, Value instance, size_t argc, Value* argv)
@@ -376,7 +569,7 @@ namespace lit
             (void)instance;
             (void)argc;
             (void)argv;
-            return Object::toValue(FileIO::binread_uint8_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle));
+            return Object::toValue(FileIO::binread_uint8_t(file_gethandle(vm, instance)));
         }
 
         static Value objmethod_file_readshort(VM* vm, Value instance, size_t argc, Value* argv)
@@ -385,7 +578,7 @@ namespace lit
             (void)instance;
             (void)argc;
             (void)argv;
-            return Object::toValue(FileIO::binread_uint16_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle));
+            return Object::toValue(FileIO::binread_uint16_t(file_gethandle(vm, instance)));
         }
 
         static Value objmethod_file_readnumber(VM* vm, Value instance, size_t argc, Value* argv)
@@ -394,7 +587,7 @@ namespace lit
             (void)instance;
             (void)argc;
             (void)argv;
-            return Object::toValue(FileIO::binread_uint32_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle));
+            return Object::toValue(FileIO::binread_uint32_t(file_gethandle(vm, instance)));
         }
 
         static Value objmethod_file_readbool(VM* vm, Value instance, size_t argc, Value* argv)
@@ -403,7 +596,7 @@ namespace lit
             (void)instance;
             (void)argc;
             (void)argv;
-            return Object::fromBool((char)FileIO::binread_uint8_t(((FileData*)LIT_EXTRACT_DATA(vm, instance))->handle) == '1');
+            return Object::fromBool((char)FileIO::binread_uint8_t(file_gethandle(vm, instance)) == '1');
         }
 
         static Value objmethod_file_readstring(VM* vm, Value instance, size_t argc, Value* argv)
@@ -413,6 +606,7 @@ namespace lit
             (void)argc;
             (void)argv;
             FileData* data = (FileData*)LIT_EXTRACT_DATA(vm, instance);
+            file_syncstd(vm, data->handle);
             String* string = FileIO::binread_string(vm->m_state, data->handle);
 
             return string == nullptr ? Object::NullVal : string->asValue();
@@ -576,12 +770,15 @@ namespace lit
             {
                 Class* klass = Class::make(state, "File");
                 {
+                    /* first, so that Object's iterator and toString don't replace File's own */
+                    klass->inheritFrom(state->objectvalue_class);
                     klass->setStaticMethod("exists", objmethod_file_exists);
                     klass->setStaticMethod("getLastModified", objmethod_file_getlastmodified);
                     klass->bindConstructor(objmethod_file_constructor);
                     klass->bindMethod("toString", objmethod_file_tostring);
                     klass->bindMethod("close", objmethod_file_close);
                     klass->bindMethod("write", objmethod_file_write);
+                    klass->bindMethod("flush", objmethod_file_flush);
                     klass->bindMethod("writeByte", objmethod_file_writebyte);
                     klass->bindMethod("writeShort", objmethod_file_writeshort);
                     klass->bindMethod("writeNumber", objmethod_file_writenumber);
@@ -589,6 +786,9 @@ namespace lit
                     klass->bindMethod("writeString", objmethod_file_writestring);
                     klass->bindMethod("readAll", objmethod_file_readall);
                     klass->bindMethod("readLine", objmethod_file_readline);
+                    klass->bindMethod("lines", objmethod_file_lines);
+                    klass->bindMethod("iterator", objmethod_file_iterator);
+                    klass->bindMethod("iteratorValue", objmethod_file_iteratorvalue);
                     klass->bindMethod("readByte", objmethod_file_readbyte);
                     klass->bindMethod("readShort", objmethod_file_readshort);
                     klass->bindMethod("readNumber", objmethod_file_readnumber);
@@ -598,10 +798,6 @@ namespace lit
                     klass->setGetter("exists", objmethod_file_exists);
                 }
                 state->setGlobal(klass->name, klass->asValue());
-                if(klass->super == nullptr)
-                {
-                    klass->inheritFrom(state->objectvalue_class);
-                }
             }
             {
                 Class* klass = Class::make(state, "Directory");
@@ -3,34 +3,116 @@
 
 namespace lit
 {
-    String* String::allocEmpty(State* state, size_t length)
+    void StringBuffer::init(State* state, size_t reserve)
     {
-        String* string;
-        string = Object::make<String>(state, Object::Type::String);
+        m_state = state;
+        m_data = nullptr;
+        m_length = 0;
+        m_capacity = 0;
+        if(reserve > 0)
         {
-            // important: since String is not created via new(), non-primitives and
-            // non-pointers (like std::string) are *not* allocated until they're
-            // explicitly initialized.
-            string->m_chars = new std::string();
-            /* reserving the required space may reduce number of allocations */
-            string->m_chars->reserve(length);
+            this->reserve(reserve);
         }
-        string->m_hash = 0;
-        return string;
     }
 
-    String* String::allocate(State* state, const char* chars, size_t length, uint32_t hs, bool mustfree)
+    void StringBuffer::release()
     {
-        String* string;
-        string = String::allocEmpty(state, length);
+        Memory::reallocateNoCollect(m_state, m_data, m_capacity, 0);
+        m_data = nullptr;
+        m_length = 0;
+        m_capacity = 0;
+    }
+
+    void StringBuffer::reserve(size_t needed)
+    {
+        size_t oldcap;
+        size_t newcap;
+        if((m_length + needed) <= m_capacity)
         {
-            /*
-            * string->m_chars is initialized in String::allocEmpty(),
-            * as an empty string!
-            */
-            string->m_chars->append(chars, length);
+            return;
+        }
+        oldcap = m_capacity;
+        newcap = LIT_GROW_CAPACITY(oldcap);
+        while(newcap < (m_length + needed))
+        {
+            newcap = LIT_GROW_CAPACITY(newcap);
+        }
+        m_data = (char*)Memory::reallocateNoCollect(m_state, m_data, oldcap, newcap);
+        m_capacity = newcap;
+    }
+
+    void StringBuffer::append(const char* s, size_t len)
+    {
+        if(len > 0)
+        {
+            reserve(len);
+            memcpy(m_data + m_length, s, len);
+            m_length += len;
+        }
+    }
+
+    void StringBuffer::appendRepeat(char ch, size_t count)
+    {
+        if(count > 0)
+        {
+            reserve(count);
+            memset(m_data + m_length, ch, count);
+            m_length += count;
+        }
+    }
+
+    void StringBuffer::append(String* other)
+    {
+        if(other != nullptr)
+        {
+            append(other->data(), other->length());
         }
+    }
+
+    void StringBuffer::appendFormat(const char* fmt, va_list va)
+    {
+        int needed;
+        va_list copy;
+        va_copy(copy, va);
+        needed = vsnprintf(nullptr, 0, fmt, copy);
+        va_end(copy);
+        if(needed > 0)
+        {
+            /* +1 for the NUL that vsnprintf always writes */
+            reserve(needed + 1);
+            vsnprintf(m_data + m_length, needed + 1, fmt, va);
+            m_length += needed;
+        }
+    }
+
+    String* StringBuffer::toString()
+    {
+        String* rt;
+        rt = String::makeTransient(m_state, (m_data == nullptr) ? "" : m_data, m_length);
+        release();
+        return rt;
+    }
+
+    String* String::allocate(State* state, const char* chars, size_t length, uint32_t hs, bool mustfree)
+    {
+        String* string;
+        string = (String*)Object::make(state, sizeof(String) + length + 1, Object::Type::String);
+        string->m_length = length;
         string->m_hash = hs;
+        string->m_hashed = true;
+        string->m_interned = false;
+        string->m_utfknown = false;
+        string->m_utfindex = nullptr;
+        string->m_left = nullptr;
+        string->m_right = nullptr;
+        string->m_parent = nullptr;
+        /* chars may be nullptr for an empty string */
+        if(length > 0)
+        {
+            memcpy(string->inlineChars(), chars, length);
+        }
+        string->inlineChars()[length] = '\0';
+        string->m_chars = string->inlineChars();
         if(mustfree)
         {
             LIT_FREE(state, char, chars);
@@ -39,18 +121,124 @@ namespace lit
         return string;
     }
 
-    String* String::take(State* state, char* chars, size_t length)
+    String* String::makeTransient(State* state, const char* chars, size_t length)
+    {
+        String* string;
+        string = (String*)Object::make(state, sizeof(String) + length + 1, Object::Type::String);
+        string->m_length = length;
+        string->m_hash = 0;
+        string->m_hashed = false;
+        string->m_interned = false;
+        string->m_utfknown = false;
+        string->m_utfindex = nullptr;
+        string->m_left = nullptr;
+        string->m_right = nullptr;
+        string->m_parent = nullptr;
+        /* chars may be nullptr for an empty string */
+        if(length > 0)
+        {
+            memcpy(string->inlineChars(), chars, length);
+        }
+        string->inlineChars()[length] = '\0';
+        string->m_chars = string->inlineChars();
+        return string;
+    }
+
+    String* String::intern(State* state, String* string)
     {
-        uint32_t hs;
-        hs = String::makeHash(chars, length);
         String* interned;
-        interned = stateFindInterned(state, chars, length, hs);
+        if(string->m_interned)
+        {
+            return string;
+        }
+        /* interned strings are long-lived, so they shouldn't pin some larger string */
+        if(string->m_parent != nullptr)
+        {
+            string->detach();
+        }
+        interned = stateFindInterned(state, string->data(), string->m_length, string->hash());
         if(interned != nullptr)
         {
-            LIT_FREE(state, char, chars);
             return interned;
         }
-        return String::allocate(state, (char*)chars, length, hs, true);
+        String::statePutInterned(state, string);
+        return string;
+    }
+
+    String* String::concat(State* state, String* left, String* right)
+    {
+        size_t length;
+        String* rope;
+        StringBuffer buf;
+        if(left->m_length == 0)
+        {
+            return right;
+        }
+        if(right->m_length == 0)
+        {
+            return left;
+        }
+        length = left->m_length + right->m_length;
+        if(length < LIT_ROPE_MIN_LENGTH)
+        {
+            buf.init(state, length);
+            buf.append(left);
+            buf.append(right);
+            return buf.toString();
+        }
+        /* flatten() relies on the right side of a rope being flat */
+        right->data();
+        state->pushRoot((Object*)left);
+        state->pushRoot((Object*)right);
+        rope = (String*)Object::make(state, sizeof(String), Object::Type::String);
+        state->popRoot();
+        state->popRoot();
+        rope->m_hash = 0;
+        rope->m_hashed = false;
+        rope->m_interned = false;
+        rope->m_utfknown = false;
+        rope->m_utfindex = nullptr;
+        rope->m_length = length;
+        rope->m_chars = nullptr;
+        rope->m_left = left;
+        rope->m_right = right;
+        rope->m_parent = nullptr;
+        return rope;
+    }
+
+    void String::flatten() const
+    {
+        size_t pos;
+        char* buf;
+        String* self;
+        const String* node;
+        self = const_cast<String*>(this);
+        buf = (char*)Memory::reallocateNoCollect(m_state, nullptr, 0, m_length + 1);
+        buf[m_length] = '\0';
+        pos = m_length;
+        /*
+        * ropes built by repeated `s = s + piece` lean to the left, so walk down the
+        * left spine copying each (flat) right side in from the back.
+        */
+        node = this;
+        while(node->m_chars == nullptr)
+        {
+            pos -= node->m_right->m_length;
+            memcpy(buf + pos, node->m_right->m_chars, node->m_right->m_length);
+            node = node->m_left;
+        }
+        memcpy(buf, node->m_chars, pos);
+        self->m_chars = buf;
+        self->m_left = nullptr;
+        self->m_right = nullptr;
+    }
+
+    String* String::take(State* state, char* chars, size_t length)
+    {
+        String* rt;
+        rt = String::makeTransient(state, chars, length);
+        LIT_FREE(state, char, chars);
+        return rt;
     }
 
     String* String::copy(State* state, const char* chars, size_t length)
@@ -68,25 +256,181 @@ namespace lit
 
     Value String::stringNumberToString(State* state, double value)
     {
+        size_t length;
+        char buffer[LIT_NUMBER_BUFFER_SIZE];
+        length = String::formatNumber(buffer, value);
+        return String::copy(state, buffer, length)->asValue();
+    }
+
+    size_t String::formatNumber(char* dest, double value)
+    {
+        int point;
+        int exponent;
+        int ndigits;
+        double magnitude;
+        uint64_t integer;
+        char* p;
+        char* start;
+        std::to_chars_result res;
+        char digits[32];
         if(std::isnan(value))
         {
-            return String::internValue(state, "nan");
+            memcpy(dest, "nan", 4);
+            return 3;
         }
-
         if(std::isinf(value))
         {
             if(value > 0.0)
             {
-                return String::internValue(state, "infinity");
+                memcpy(dest, "infinity", 9);
+                return 8;
+            }
+            memcpy(dest, "-infinity", 10);
+            return 9;
+        }
+        p = dest;
+        magnitude = std::fabs(value);
+        /* integers that a double holds exactly are by far the most common case, and need no rounding at all */
+        if(magnitude < 9007199254740992.0 && magnitude == (double)(uint64_t)magnitude && (value != 0.0 || !std::signbit(value)))
+        {
+            if(value < 0.0)
+            {
+                *p++ = '-';
+            }
+            integer = (uint64_t)magnitude;
+            start = digits + sizeof(digits);
+            do
+            {
+                *--start = (char)('0' + (integer % 10));
+                integer /= 10;
+            } while(integer != 0);
+            memcpy(p, start, (digits + sizeof(digits)) - start);
+            p += (digits + sizeof(digits)) - start;
+            *p = '\0';
+            return p - dest;
+        }
+        if(magnitude == 0.0)
+        {
+            memcpy(dest, "-0", 3);
+            return 2;
+        }
+        /*
+        * the shortest digits that round-trip (to_chars is Ryu-based), laid out like javascript does.
+        * to_chars' own fixed notation would print every digit of large integers' exact values instead.
+        */
+        res = std::to_chars(digits, digits + sizeof(digits) - 1, magnitude, std::chars_format::scientific);
+        *res.ptr = '\0';
+        ndigits = 0;
+        for(start = digits; start < res.ptr && *start != 'e'; start++)
+        {
+            if(*start != '.')
+            {
+                digits[ndigits++] = *start;
+            }
+        }
+        exponent = atoi(start + 1);
+        if(value < 0.0)
+        {
+            *p++ = '-';
+        }
+        /* the decimal point goes $point digits in; 0 or less means before the first, after zeros */
+        point = exponent + 1;
+        if(magnitude >= 1e-7 && magnitude < 1e21)
+        {
+            if(point <= 0)
+            {
+                *p++ = '0';
+                *p++ = '.';
+                memset(p, '0', -point);
+                p += -point;
+                memcpy(p, digits, ndigits);
+                p += ndigits;
+            }
+            else if(point < ndigits)
+            {
+                memcpy(p, digits, point);
+                p += point;
+                *p++ = '.';
+                memcpy(p, digits + point, ndigits - point);
+                p += ndigits - point;
             }
             else
             {
-                return String::internValue(state, "-infinity");
+                memcpy(p, digits, ndigits);
+                p += ndigits;
+                memset(p, '0', point - ndigits);
+                p += point - ndigits;
             }
         }
-        char buffer[24];
-        int length = sprintf(buffer, "%.14g", value);
-        return String::copy(state, buffer, length)->asValue();
+        else
+        {
+            *p++ = digits[0];
+            if(ndigits > 1)
+            {
+                *p++ = '.';
+                memcpy(p, digits + 1, ndigits - 1);
+                p += ndigits - 1;
+            }
+            p += snprintf(p, LIT_NUMBER_BUFFER_SIZE - (p - dest), "e%+d", exponent);
+        }
+        *p = '\0';
+        return p - dest;
+    }
+
+    size_t String::parseNumber(const char* str, size_t length, double* dest, bool* outofrange)
+    {
+        bool negative;
+        const char* p;
+        const char* end;
+        std::from_chars_result res;
+        p = str;
+        end = str + length;
+        negative = false;
+        *dest = 0;
+        *outofrange = false;
+        while(p < end && isspace((uint8_t)*p))
+        {
+            p++;
+        }
+        /* from_chars takes a '-', but not a '+' */
+        if(p < end && *p == '+')
+        {
+            p++;
+        }
+        else if(p < end && *p == '-')
+        {
+            negative = true;
+            p++;
+        }
+        if((end - p) > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        {
+            res = std::from_chars(p + 2, end, *dest, std::chars_format::hex);
+            if(res.ptr == p + 2)
+            {
+                /* just the "0" then */
+                res.ptr = p + 1;
+                res.ec = std::errc();
+                *dest = 0;
+            }
+        }
+        else
+        {
+            res = std::from_chars(p, end, *dest, std::chars_format::general);
+        }
+        if(res.ec == std::errc::invalid_argument)
+        {
+            *dest = 0;
+            return 0;
+        }
+        if(res.ec == std::errc::result_out_of_range)
+        {
+            *outofrange = true;
+        }
+        if(negative)
+        {
+            *dest = -*dest;
+        }
+        return res.ptr - str;
     }
 
     int String::decodeNumBytes(uint8_t byte)
@@ -145,33 +489,50 @@ namespace lit
         return rt;
     }
 
-    String* String::fromRange(State* state, String* source, int start, uint32_t count)
+    String* String::fromRange(State* state, String* source, size_t start, size_t count)
     {
-        int length;
-        int index;
-        int code_point;
-        uint32_t i;
-        uint8_t* to;
-        uint8_t* from;
-        char* bytes;
-        from = (uint8_t*)source->data();
-        length = 0;
-        for(i = 0; i < count; i++)
-        {
-            length += String::decodeNumBytes(from[start + i]);
-        }
-        bytes = (char*)malloc(length + 1);
-        to = (uint8_t*)bytes;
-        for(i = 0; i < count; i++)
-        {
-            index = start + i;
-            code_point = String::utfstringDecode(from + index, source->length() - index);
-            if(code_point != -1)
-            {
-                to += String::utfstringEncode(code_point, to);
-            }
-        }
-        return String::take(state, bytes, length);
+        String* slice;
+        String* parent;
+        if(count < LIT_SLICE_MIN_LENGTH)
+        {
+            return String::makeTransient(state, source->data() + start, count);
+        }
+        /* slices of slices point at the original string */
+        parent = source;
+        if(source->m_parent != nullptr)
+        {
+            parent = source->m_parent;
+            start += (source->m_chars - parent->m_chars);
+        }
+        state->pushRoot((Object*)parent);
+        slice = (String*)Object::make(state, sizeof(String), Object::Type::String);
+        state->popRoot();
+        slice->m_length = count;
+        slice->m_hash = 0;
+        slice->m_hashed = false;
+        slice->m_interned = false;
+        /* a slice of an ascii string is ascii too */
+        slice->m_utfknown = (parent->m_utfknown && parent->m_ascii);
+        slice->m_ascii = slice->m_utfknown;
+        slice->m_utflength = count;
+        slice->m_utfindex = nullptr;
+        slice->m_left = nullptr;
+        slice->m_right = nullptr;
+        slice->m_parent = parent;
+        slice->m_chars = parent->data() + start;
+        return slice;
+    }
+
+    void String::detach() const
+    {
+        char* buf;
+        String* self;
+        self = const_cast<String*>(this);
+        buf = (char*)Memory::reallocateNoCollect(m_state, nullptr, 0, m_length + 1);
+        memcpy(buf, m_chars, m_length);
+        buf[m_length] = '\0';
+        self->m_chars = buf;
+        self->m_parent = nullptr;
     }
 
     int String::utfstringEncode(int value, uint8_t* bytes)
@@ -288,13 +649,15 @@ namespace lit
         bool was_allowed;
         const char* c;
         const char* strval;
+        char numbuf[24];
         Value val;
         String* string;
-        String* result;
+        StringBuffer result;
+        String* rt;
         was_allowed = stateGetGCAllowed(state);
         stateSetGCAllowed(state, false);
         total_length = strlen(format);
-        result = String::allocEmpty(state, total_length + 1);
+        result.init(state, total_length + 1);
         for(c = format; *c != '\0'; c++)
         {
             switch(*c)
@@ -305,7 +668,7 @@ namespace lit
                         if(strval != nullptr)
                         {
                             length = strlen(strval);
-                            result->m_chars->append(strval, length);
+                            result.append(strval, length);
                         }
                         else
                         {
@@ -328,10 +691,10 @@ namespace lit
                         }
                         if(string != nullptr)
                         {
-                            length = string->m_chars->size();
+                            length = string->length();
                             if(length > 0)
                             {
-                                result->m_chars->append(*(string->m_chars), length);
+                                result.append(string->data(), length);
                             }
                         }
                         else
@@ -344,29 +707,28 @@ namespace lit
                     {
                         /*
                         string = Object::as<String>(String::stringNumberToString(state, va_arg(arg_list, double)));
-                        length = string->m_chars->size();
+                        length = string->length();
                         if(length > 0)
                         {
-                            result->m_chars->append(*(string->m_chars), length);
+                            result.append(string->data(), length);
                         }
                         */
-                        auto d = std::to_string((int64_t)va_arg(arg_list, double));
-                        result->append(d);
+                        length = snprintf(numbuf, sizeof(numbuf), "%lld", (long long)va_arg(arg_list, double));
+                        result.append(numbuf, length);
                     }
                     break;
                 default:
                     {
                         default_ending_copying:
                         ch = *c;
-                        result->m_chars->append(&ch, 1);
+                        result.append(ch);
                     }
                     break;
             }
         }
-        result->m_hash = String::makeHash(*(result->m_chars));
-        String::statePutInterned(state, result);
+        rt = result.toString();
         stateSetGCAllowed(state, was_allowed);
-        return result;
+        return rt;
     }
 
     bool String::equal(State* state, String* a, String* b)
@@ -376,7 +738,16 @@ namespace lit
         {
             return false;
         }
-        return (*(a->m_chars) == *(b->m_chars));
+        if(a == b)
+        {
+            return true;
+        }
+        /* two distinct interned strings can never be equal */
+        if(a->m_interned && b->m_interned)
+        {
+            return false;
+        }
+        return ((a->m_length == b->m_length) && (memcmp(a->data(), b->data(), a->m_length) == 0));
     }
 
     bool String::stateGetGCAllowed(State* state)
@@ -389,64 +760,168 @@ namespace lit
         state->allow_gc = v;
     }
 
-    String* String::stateFindInterned(State* state, const char* str, size_t length, uint32_t hs)
+    void InternTable::release()
     {
-        return state->vm->strings.find(str, length, hs);
+        LIT_FREE_ARRAY(m_state, Entry, m_entries, m_capacity);
+        this->init(m_state);
     }
 
-    void String::statePutInterned(State* state, String* string)
+    void InternTable::adjustCapacity(size_t newcap)
     {
-        if(string->length() > 0)
+        size_t i;
+        size_t index;
+        size_t mask;
+        size_t oldcap;
+        Entry* entries;
+        Entry* oldentries;
+        /* see Table::adjustCapacity(); interning must not run the collector either */
+        entries = (Entry*)Memory::reallocateNoCollect(m_state, nullptr, 0, sizeof(Entry) * newcap);
+        memset(entries, 0, sizeof(Entry) * newcap);
+        oldentries = m_entries;
+        oldcap = m_capacity;
+        mask = newcap - 1;
+        m_count = 0;
+        for(i = 0; i < oldcap; i++)
+        {
+            if(oldentries[i].string != nullptr)
+            {
+                index = oldentries[i].hash & mask;
+                while(entries[index].string != nullptr)
+                {
+                    index = (index + 1) & mask;
+                }
+                entries[index] = oldentries[i];
+                m_count++;
+            }
+        }
+        m_used = m_count;
+        m_entries = entries;
+        m_capacity = newcap;
+        LIT_FREE_ARRAY(m_state, Entry, oldentries, oldcap);
+    }
+
+    String* InternTable::find(const char* str, size_t length, uint32_t hs) const
+    {
+        size_t index;
+        size_t mask;
+        const Entry* entry;
+        if(m_count == 0)
+        {
+            return nullptr;
+        }
+        mask = m_capacity - 1;
+        index = hs & mask;
+        while(true)
         {
-            state->pushRoot((Object*)string);
-            state->vm->strings.set(string, Object::NullVal);
-            state->popRoot();
+            entry = &m_entries[index];
+            if(entry->string == nullptr)
+            {
+                if(entry->length != TOMBSTONE)
+                {
+                    return nullptr;
+                }
+            }
+            else if(entry->hash == hs && entry->length == (uint32_t)length)
+            {
+                /* str may be nullptr for the empty string */
+                if(entry->string->length() == length && (length == 0 || memcmp(entry->string->data(), str, length) == 0))
+                {
+                    return entry->string;
+                }
+            }
+            index = (index + 1) & mask;
         }
     }
 
-    bool String::contains(const char* findme, size_t fmlen, bool icase) const
+    bool InternTable::add(String* string)
     {
-        int selfch;
-        int findch;
-        size_t i;
-        size_t j;
-        size_t slen;
-        size_t found;
-        slen = m_chars->size();
-        found = 0;
-        if(slen >= fmlen)
+        size_t index;
+        size_t mask;
+        size_t length;
+        Entry* entry;
+        Entry* tombstone;
+        if((m_used + 1) > (m_capacity * TABLE_MAX_LOAD))
         {
-            for(i=0, j=0; i<slen; i++)
+            if((m_count + 1) <= ((m_capacity / 2) * TABLE_MAX_LOAD))
             {
-                do
+                adjustCapacity(m_capacity);
+            }
+            else
+            {
+                adjustCapacity(LIT_GROW_CAPACITY(m_capacity));
+            }
+        }
+        length = string->length();
+        mask = m_capacity - 1;
+        index = string->hash() & mask;
+        tombstone = nullptr;
+        while(true)
+        {
+            entry = &m_entries[index];
+            if(entry->string == nullptr)
+            {
+                if(entry->length != TOMBSTONE)
                 {
-                    selfch = (*m_chars)[i];
-                    findch = findme[j];
-                    if(icase)
-                    {
-                        selfch = tolower(selfch);
-                        findch = tolower(findch);
-                    }
-                    if(selfch == findch)
-                    {
-                        if(++found == fmlen)
-                        {
-                            return true;
-                        }
-                        i++;
-                        j++;
-                    }
-                    else
-                    {
-                        i -= found;
-                        found = 0;
-                        j = 0;
-                    }
-                } while(found);
+                    break;
+                }
+                if(tombstone == nullptr)
+                {
+                    tombstone = entry;
+                }
+            }
+            else if(entry->hash == string->hash() && entry->length == (uint32_t)length)
+            {
+                if(entry->string == string || (entry->string->length() == length && memcmp(entry->string->data(), string->data(), length) == 0))
+                {
+                    return false;
+                }
+            }
+            index = (index + 1) & mask;
+        }
+        if(tombstone != nullptr)
+        {
+            entry = tombstone;
+        }
+        else
+        {
+            m_used++;
+        }
+        entry->string = string;
+        entry->hash = string->hash();
+        entry->length = (uint32_t)length;
+        m_count++;
+        return true;
+    }
+
+    void InternTable::removeWhite()
+    {
+        size_t i;
+        Entry* entry;
+        for(i = 0; i < m_capacity; i++)
+        {
+            entry = &m_entries[i];
+            if(entry->string != nullptr && !entry->string->marked)
+            {
+                entry->string = nullptr;
+                entry->length = TOMBSTONE;
+                m_count--;
             }
-            return false;
         }
-        return false;
+    }
+
+    String* String::stateFindInterned(State* state, const char* str, size_t length, uint32_t hs)
+    {
+        return state->vm->strings.find(str, length, hs);
+    }
+
+    void String::statePutInterned(State* state, String* string)
+    {
+        string->m_interned = state->vm->strings.add(string);
+    }
+
+    bool String::contains(const char* findme, size_t fmlen, bool icase) const
+    {
+        return StringSearch::find(data(), m_length, findme, fmlen, icase) != StringSearch::npos;
     }
 
     Array* String::split(std::string_view sep, bool keepblanc) const
@@ -456,10 +931,15 @@ namespace lit
         size_t last;
         size_t next;
         Array* rt;
-        std::string sub;
+        String* self;
+        std::string_view chars;
+        self = const_cast<String*>(this);
+        m_state->pushRoot((Object*)owner());
+        chars = view();
         last = 0;
         next = 0;
         rt = Array::make(m_state);
+        m_state->pushRoot((Object*)rt);
         if(sep.size() == 0)
         {
             for(i=0; i<size(); i++)
@@ -470,35 +950,122 @@ namespace lit
         }
         else
         {
-            while((next = m_chars->find(sep, last)) != std::string::npos)
+            /* the parts are slices of this string, unless they're short */
+            while((next = StringSearch::find(chars.substr(last), sep, false)) != StringSearch::npos)
             {
-                sub = m_chars->substr(last, next-last);
-                last = next + 1;
-                if(!sub.empty() || keepblanc)
+                next += last;
+                if((next > last) || keepblanc)
                 {
-                    rt->push(String::copy(m_state, sub)->asValue());
+                    rt->push(String::fromRange(m_state, self, last, next - last)->asValue());
                 }
+                last = next + sep.size();
             }
-            sub = m_chars->substr(last);
-            if(!sub.empty() || keepblanc)
+            if((last < chars.size()) || keepblanc)
             {
-                rt->push(String::copy(m_state, sub)->asValue());
+                rt->push(String::fromRange(m_state, self, last, chars.size() - last)->asValue());
             }
         }
+        m_state->popRoots(2);
         return rt;
     }
 
-    size_t String::utfLength() const
+    void String::scanUtf() const
     {
-        size_t length;
-        uint32_t i;
-        length = 0;
-        for(i = 0; i < this->length();)
+        size_t i;
+        size_t count;
+        uint64_t word;
+        bool ascii;
+        String* self;
+        const uint8_t* bytes;
+        self = const_cast<String*>(this);
+        bytes = (const uint8_t*)data();
+        ascii = true;
+        /* check eight bytes at a time for any high bit */
+        for(i = 0; (i + 8) <= m_length; i += 8)
         {
-            i += String::decodeNumBytes((*m_chars)[i]);
-            length++;
+            memcpy(&word, bytes + i, 8);
+            if((word & 0x8080808080808080ull) != 0)
+            {
+                ascii = false;
+                break;
+            }
         }
-        return length;
+        for(; ascii && (i < m_length); i++)
+        {
+            if(bytes[i] & 0x80)
+            {
+                ascii = false;
+            }
+        }
+        if(ascii)
+        {
+            count = m_length;
+        }
+        else
+        {
+            /* every byte that isn't a continuation byte starts a code point */
+            count = 0;
+            for(i = 0; i < m_length; i++)
+            {
+                if((bytes[i] & 0xc0) != 0x80)
+                {
+                    count++;
+                }
+            }
+        }
+        self->m_ascii = ascii;
+        self->m_utflength = count;
+        self->m_utfknown = true;
+    }
+
+    size_t String::utfOffset(size_t index) const
+    {
+        size_t i;
+        size_t cp;
+        size_t slots;
+        size_t offset;
+        String* self;
+        const uint8_t* bytes;
+        if(index >= utfLength())
+        {
+            return m_length;
+        }
+        if(m_ascii)
+        {
+            return index;
+        }
+        bytes = (const uint8_t*)data();
+        if(m_utfindex == nullptr)
+        {
+            self = const_cast<String*>(this);
+            slots = (m_utflength / LIT_UTF_INDEX_STRIDE) + 1;
+            self->m_utfindex = (size_t*)Memory::reallocateNoCollect(m_state, nullptr, 0, sizeof(size_t) * slots);
+            cp = 0;
+            for(i = 0; i < m_length; i++)
+            {
+                if((bytes[i] & 0xc0) != 0x80)
+                {
+                    if((cp % LIT_UTF_INDEX_STRIDE) == 0)
+                    {
+                        self->m_utfindex[cp / LIT_UTF_INDEX_STRIDE] = i;
+                    }
+                    cp++;
+                }
+            }
+        }
+        /* jump to the nearest checkpoint, then walk the rest of the way */
+        offset = m_utfindex[index / LIT_UTF_INDEX_STRIDE];
+        cp = index % LIT_UTF_INDEX_STRIDE;
+        while(cp > 0)
+        {
+            offset++;
+            while((offset < m_length) && ((bytes[offset] & 0xc0) == 0x80))
+            {
+                offset++;
+            }
+            cp--;
+        }
+        return offset;
     }
 
     String* String::codePointAt(uint32_t index) const
@@ -509,10 +1076,10 @@ namespace lit
         {
             return nullptr;
         }
-        code_point = String::utfstringDecode((uint8_t*)m_chars->data() + index, this->length() - index);
+        code_point = String::utfstringDecode((uint8_t*)data() + index, this->length() - index);
         if(code_point == -1)
         {
-            bytes[0] = (*m_chars)[index];
+            bytes[0] = data()[index];
             bytes[1] = '\0';
             return String::copy(m_state, bytes, 1);
         }
@@ -608,7 +1175,6 @@ namespace lit
         static Value objfn_string_plus(VM* vm, Value instance, size_t argc, Value* argv)
         {
             String* selfstr;
-            String* result;
             Value value;
             (void)argc;
             selfstr = Object::as<String>(instance);
@@ -622,11 +1188,7 @@ namespace lit
             {
                 strval = Object::toString(vm->m_state, value);
             }
-            result = String::allocEmpty(vm->m_state, selfstr->length() + strval->length());
-            result->append(selfstr);
-            result->append(strval);
-            String::statePutInterned(vm->m_state, result);
-            return result->asValue();
+            return String::concat(vm->m_state, selfstr, strval)->asValue();
         }
 
         static Value objfn_string_splice(VM* vm, String* string, int64_t from, int64_t to)
@@ -654,9 +1216,10 @@ namespace lit
                     lit_runtime_error_exiting(vm, "String.splice argument 'from' (%d) is larger than argument 'to' (%d)", from, to);
                 }
             }
-            from = String::utfcharOffset(string->data(), from);
-            to = String::utfcharOffset(string->data(), to);
-            return String::fromRange(vm->m_state, string, from, to - from + 1)->asValue();
+            /* $to is inclusive, so the slice ends where the code point after it starts */
+            from = string->utfOffset(from);
+            to = string->utfOffset(to + 1);
+            return String::fromRange(vm->m_state, string, from, to - from)->asValue();
         }
 
         static Value objfn_string_subscript(VM* vm, Value instance, size_t argc, Value* argv)
@@ -683,7 +1246,7 @@ namespace lit
                     return Object::NullVal;
                 }
             }
-            c = string->codePointAt(String::utfcharOffset(string->data(), index));
+            c = string->codePointAt(string->utfOffset(index));
             if(c == nullptr)
             {
                 return String::intern(vm->m_state, "")->asValue();
@@ -701,15 +1264,7 @@ namespace lit
             if(Object::isString(argv[0]))
             {
                 other = Object::as<String>(argv[0]);
-                if(self->length() == other->length())
-                {
-                    //fprintf(stderr, "string: same length(self=\"%s\" other=\"%s\")... strncmp=%d\n", self->data(), other->data(), strncmp(self->data(), other->data(), self->length));
-                    if(memcmp(self->data(), other->data(), self->length()) == 0)
-                    {
-                        return Object::TrueVal;
-                    }
-                }
-                return Object::FalseVal;
+                return Object::fromBool(String::equal(vm->m_state, self, other));
             }
             else if(Object::isNull(argv[0]))
             {
@@ -723,19 +1278,25 @@ namespace lit
             return Object::FalseVal;
         }
 
+        /*
+        * strings are immutable, so append() and appendByte() return a new string
+        * rather than modifying the receiver.
+        */
         static Value objfn_string_append(VM* vm, Value instance, size_t argc, Value* argv)
         {
             size_t i;
             String* self;
             String* other;
-            (void)argc;
+            StringBuffer buf;
             self = Object::as<String>(instance);
+            buf.init(vm->m_state, self->length());
+            buf.append(self);
             for(i=0; i<argc; i++)
             {
                 other = Object::toString(vm->m_state, argv[i]);
-                self->append(other);
+                buf.append(other);
             }
-            return self->asValue();
+            return buf.toString()->asValue();
         }
 
         static Value objfn_string_appendbyte(VM* vm, Value instance, size_t argc, Value* argv)
@@ -743,29 +1304,32 @@ namespace lit
             int byte;
             size_t i;
             String* self;
-            (void)argc;
+            StringBuffer buf;
             self = Object::as<String>(instance);
+            buf.init(vm->m_state, self->length() + argc);
+            buf.append(self);
             for(i=0; i<argc; i++)
             {
                 if(!Object::isNumber(argv[i]))
                 {
+                    buf.release();
                     lit_runtime_error_exiting(vm, "appendByte() expects numbers");
                     return Object::NullVal;
                 }
                 byte = Object::toNumber(argv[i]);
-                self->append(byte);
+                buf.append((char)byte);
             }
-            return self->asValue();
+            return buf.toString()->asValue();
         }
 
         static Value objfn_string_less(VM* vm, Value instance, size_t argc, Value* argv)
         {
-            return Object::fromBool(strcmp(Object::as<String>(instance)->data(), lit_check_string(vm, argv, argc, 0)) < 0);
+            return Object::fromBool(strcmp(Object::as<String>(instance)->cstr(), lit_check_string(vm, argv, argc, 0)) < 0);
         }
 
         static Value objfn_string_greater(VM* vm, Value instance, size_t argc, Value* argv)
         {
-            return Object::fromBool(strcmp(Object::as<String>(instance)->data(), lit_check_string(vm, argv, argc, 0)) > 0);
+            return Object::fromBool(strcmp(Object::as<String>(instance)->cstr(), lit_check_string(vm, argv, argc, 0)) > 0);
         }
 
         static Value objfn_string_tostring(VM* vm, Value instance, size_t argc, Value* argv)
@@ -778,14 +1342,16 @@ namespace lit
 
         static Value objfn_string_tonumber(VM* vm, Value instance, size_t argc, Value* argv)
         {
+            bool outofrange;
             double result;
+            String* self;
             (void)vm;
             (void)argc;
             (void)argv;
-            result = strtod(Object::as<String>(instance)->data(), nullptr);
-            if(errno == ERANGE)
+            self = Object::as<String>(instance);
+            String::parseNumber(self->data(), self->length(), &result, &outofrange);
+            if(outofrange)
             {
-                errno = 0;
                 return Object::NullVal;
             }
             return Object::toValue(result);
@@ -879,26 +1445,176 @@ namespace lit
 
         static Value objfn_string_indexof(VM* vm, Value instance, size_t argc, Value* argv)
         {
-            char want;
-            const char* swant;
+            bool icase;
+            size_t i;
             size_t pos;
-            size_t maxlen;
+            size_t index;
+            const char* chars;
             String* self;
+            String* want;
             self = Object::as<String>(instance);
-            swant = lit_check_string(vm, argv, argc, 0);
-            want = swant[0];
-            maxlen = self->size();
-            for(pos=0; pos<maxlen; pos++)
+            want = lit_check_object_string(vm, argv, argc, 0);
+            icase = false;
+            if(argc > 1)
+            {
+                icase = lit_check_bool(vm, argv, argc, 1);
+            }
+            pos = StringSearch::find(self->view(), want->view(), icase);
+            if(pos == StringSearch::npos)
+            {
+                return Object::toValue(-1);
+            }
+            if(self->isAscii())
+            {
+                return Object::toValue(pos);
+            }
+            /* the result is a code point index, like the ones subscripts and substring() take */
+            chars = self->data();
+            index = 0;
+            for(i = 0; i < pos; i++)
+            {
+                if((chars[i] & 0xC0) != 0x80)
+                {
+                    index++;
+                }
+            }
+            return Object::toValue(index);
+        }
+
+
+        /* the regex compiled from $pattern; raises an error if it doesn't compile */
+        static String::Regex* string_getregex(VM* vm, String* pattern)
+        {
+            const char* error;
+            String::Regex* regex;
+            error = nullptr;
+            regex = String::Regex::fromCache(vm->m_state, pattern, &error);
+            if(regex == nullptr)
+            {
+                lit_runtime_error_exiting(vm, "invalid regular expression '%s': %s", pattern->cstr(), error);
+            }
+            return regex;
+        }
+
+        /* the byte length of the code point at $pos, so that empty matches can step over it */
+        static size_t string_utfstep(const char* chars, size_t length, size_t pos)
+        {
+            size_t step;
+            step = 1;
+            while((pos + step) < length && (chars[pos + step] & 0xC0) == 0x80)
+            {
+                step++;
+            }
+            return step;
+        }
+
+        /* a match as an array of the whole match and its groups; groups that didn't take part are null */
+        static Array* string_matchgroups(VM* vm, String* self, String::Regex* regex, int64_t* captures)
+        {
+            size_t i;
+            Array* rt;
+            rt = Array::make(vm->m_state);
+            vm->m_state->pushRoot((Object*)rt);
+            for(i = 0; i < regex->m_groups; i++)
             {
-                if(self->at(pos) == want)
+                if(captures[i * 2] < 0)
+                {
+                    rt->push(Object::NullVal);
+                }
+                else
                 {
-                    return Object::toValue(pos);
+                    rt->push(String::fromRange(vm->m_state, self, captures[i * 2], captures[(i * 2) + 1] - captures[i * 2])->asValue());
                 }
             }
-            return Object::toValue(-1);
+            vm->m_state->popRoot();
+            return rt;
+        }
+
+        static Value objfn_string_match(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            String* self;
+            String::Regex* regex;
+            int64_t captures[(LIT_REGEX_MAX_GROUPS + 1) * 2];
+            self = Object::as<String>(instance);
+            regex = string_getregex(vm, lit_check_object_string(vm, argv, argc, 0));
+            if(!regex->search(self->data(), self->length(), 0, captures))
+            {
+                return Object::NullVal;
+            }
+            return string_matchgroups(vm, self, regex, captures)->asValue();
+        }
 
+        static Value objfn_string_matchall(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            size_t pos;
+            size_t length;
+            const char* chars;
+            Array* rt;
+            String* self;
+            String::Regex* regex;
+            int64_t captures[(LIT_REGEX_MAX_GROUPS + 1) * 2];
+            self = Object::as<String>(instance);
+            regex = string_getregex(vm, lit_check_object_string(vm, argv, argc, 0));
+            rt = Array::make(vm->m_state);
+            vm->m_state->pushRoot((Object*)rt);
+            vm->m_state->pushRoot((Object*)self->owner());
+            chars = self->data();
+            length = self->length();
+            pos = 0;
+            while(pos <= length && regex->search(chars, length, pos, captures))
+            {
+                rt->push(string_matchgroups(vm, self, regex, captures)->asValue());
+                pos = captures[1];
+                if(captures[1] == captures[0])
+                {
+                    pos += string_utfstep(chars, length, pos);
+                }
+            }
+            vm->m_state->popRoots(2);
+            return rt->asValue();
         }
 
+        static Value string_regexsplit(VM* vm, String* self, String* pattern)
+        {
+            size_t pos;
+            size_t last;
+            size_t length;
+            const char* chars;
+            Array* rt;
+            String::Regex* regex;
+            int64_t captures[(LIT_REGEX_MAX_GROUPS + 1) * 2];
+            regex = string_getregex(vm, pattern);
+            rt = Array::make(vm->m_state);
+            vm->m_state->pushRoot((Object*)rt);
+            vm->m_state->pushRoot((Object*)self->owner());
+            chars = self->data();
+            length = self->length();
+            last = 0;
+            pos = 0;
+            while(pos < length && regex->search(chars, length, pos, captures))
+            {
+                if((size_t)captures[0] >= length)
+                {
+                    break;
+                }
+                if((size_t)captures[1] == last)
+                {
+                    /* an empty match right where the last one ended doesn't split anything */
+                    pos = captures[0] + string_utfstep(chars, length, captures[0]);
+                    continue;
+                }
+                rt->push(String::fromRange(vm->m_state, self, last, captures[0] - last)->asValue());
+                last = captures[1];
+                pos = captures[1];
+                if(captures[1] == captures[0])
+                {
+                    pos += string_utfstep(chars, length, pos);
+                }
+            }
+            rt->push(String::fromRange(vm->m_state, self, last, length - last)->asValue());
+            vm->m_state->popRoots(2);
+            return rt->asValue();
+        }
 
         static Value objfn_string_split(VM* vm, Value instance, size_t argc, Value* argv)
         {
@@ -917,8 +1633,14 @@ namespace lit
                     lit_runtime_error_exiting(vm, "split() expects a string argument");
                 }
                 sep = Object::as<String>(argv[0]);
+                if(argc > 1 && lit_check_bool(vm, argv, argc, 1))
+                {
+                    return string_regexsplit(vm, self, sep);
+                }
             }
+            vm->m_state->pushRoot((Object*)sep->owner());
             rt = self->split(sep, true);
+            vm->m_state->popRoot();
             return rt->asValue();
         }
 
@@ -997,16 +1719,89 @@ namespace lit
         }
 
 
-        static Value objfn_string_replace(VM* vm, Value instance, size_t argc, Value* argv)
+        /* appends $with, with $0..$9 replaced by the groups of the match in $captures, and $$ by $ */
+        static void string_expandreplacement(StringBuffer* result, const char* chars, String* with, String::Regex* regex, int64_t* captures)
         {
             size_t i;
-            size_t buffer_length;
-            size_t buffer_index;
-            char* buffer;
+            size_t group;
+            size_t length;
+            const char* wd;
+            wd = with->data();
+            length = with->length();
+            for(i = 0; i < length; i++)
+            {
+                if(wd[i] == '$' && (i + 1) < length)
+                {
+                    if(wd[i + 1] == '$')
+                    {
+                        result->append('$');
+                        i++;
+                        continue;
+                    }
+                    group = wd[i + 1] - '0';
+                    if(isdigit((uint8_t)wd[i + 1]) && group < regex->m_groups)
+                    {
+                        if(captures[group * 2] >= 0)
+                        {
+                            result->append(chars + captures[group * 2], captures[(group * 2) + 1] - captures[group * 2]);
+                        }
+                        i++;
+                        continue;
+                    }
+                }
+                result->append(wd[i]);
+            }
+        }
+
+        static Value string_regexreplace(VM* vm, String* string, String* what, String* with)
+        {
+            size_t pos;
+            size_t last;
+            size_t step;
+            size_t length;
+            const char* chars;
+            StringBuffer result;
+            String::Regex* regex;
+            int64_t captures[(LIT_REGEX_MAX_GROUPS + 1) * 2];
+            regex = string_getregex(vm, what);
+            chars = string->data();
+            length = string->length();
+            last = 0;
+            pos = 0;
+            /* nothing below runs the GC until toString() */
+            result.init(vm->m_state, length);
+            while(pos <= length && regex->search(chars, length, pos, captures))
+            {
+                result.append(chars + last, captures[0] - last);
+                string_expandreplacement(&result, chars, with, regex, captures);
+                last = captures[1];
+                pos = captures[1];
+                if(captures[1] == captures[0])
+                {
+                    if(pos >= length)
+                    {
+                        break;
+                    }
+                    step = string_utfstep(chars, length, pos);
+                    result.append(chars + pos, step);
+                    pos += step;
+                    last = pos;
+                }
+            }
+            result.append(chars + last, length - last);
+            return result.toString()->asValue();
+        }
+
+        static Value objfn_string_replace(VM* vm, Value instance, size_t argc, Value* argv)
+        {
+            size_t last;
+            size_t next;
             String* string;
             String* what;
             String* with;
-            LIT_ENSURE_ARGS(2);
+            std::string_view chars;
+            StringBuffer result;
+            LIT_ENSURE_MIN_ARGS(2);
             if(!Object::isString(argv[0]) || !Object::isString(argv[1]))
             {
                 lit_runtime_error_exiting(vm, "expected 2 string arguments");
@@ -1014,37 +1809,25 @@ namespace lit
             string = Object::as<String>(instance);
             what = Object::as<String>(argv[0]);
             with = Object::as<String>(argv[1]);
-            buffer_length = 0;
-            for(i = 0; i < string->length(); i++)
+            if(argc > 2 && lit_check_bool(vm, argv, argc, 2))
             {
-                if(strncmp(string->data() + i, what->data(), what->length()) == 0)
-                {
-                    i += what->length() - 1;
-                    buffer_length += with->length();
-                }
-                else
-                {
-                    buffer_length++;
-                }
+                return string_regexreplace(vm, string, what, with);
             }
-            buffer_index = 0;
-            buffer = LIT_ALLOCATE(vm->m_state, char, buffer_length+1);
-            for(i = 0; i < string->length(); i++)
+            if(what->length() == 0)
             {
-                if(strncmp(string->data() + i, what->data(), what->length()) == 0)
-                {
-                    memcpy(buffer + buffer_index, with->data(), with->length());
-                    buffer_index += with->length();
-                    i += what->length() - 1;
-                }
-                else
-                {
-                    buffer[buffer_index] = string->at(i);
-                    buffer_index++;
-                }
+                return instance;
             }
-            buffer[buffer_length] = '\0';
-            return String::take(vm->m_state, buffer, buffer_length)->asValue();
+            chars = string->view();
+            last = 0;
+            result.init(vm->m_state, string->length());
+            while((next = StringSearch::find(chars.substr(last), what->view(), false)) != StringSearch::npos)
+            {
+                result.append(chars.data() + last, next);
+                result.append(with);
+                last += next + what->length();
+            }
+            result.append(chars.data() + last, chars.size() - last);
+            return result.toString()->asValue();
         }
 
         static Value objfn_string_substring(VM* vm, Value instance, size_t argc, Value* argv)
@@ -1115,157 +1898,12 @@ namespace lit
         }
 
 
-        bool check_fmt_arg(VM* vm, String* buf, size_t ai, size_t argc, Value* argv, const char* fmttext)
-        {
-            (void)argv;
-            (void)buf;
-            if(ai <= argc)
-            {
-                return true;
-            }
-            //sdsfree(buf);
-            lit_runtime_error_exiting(vm, "too few arguments for format flag '%s' at position %d (argc=%d)", fmttext, ai, argc);
-            return false;
-        }
-
         Value objfn_string_format(VM* vm, Value instance, size_t argc, Value* argv)
         {
-            char ch;
-            char pch;
-            char nch;
-            char tmpch;
-            int iv;
-            size_t i;
-            size_t ai;
-            size_t selflen;
-            bool was_allowed;
-            String* selfstr;
-            //char* buf;
-            String* buf;
-            (void)pch;
-            was_allowed = String::stateGetGCAllowed(vm->m_state);
-            String::stateSetGCAllowed(vm->m_state, false);
-            selfstr = Object::as<String>(instance);
-            selflen = selfstr->length();
-            //buf = sdsempty();
-            //buf = sdsMakeRoomFor(buf, selflen + 10);
-            buf = String::make(vm->m_state);
-            ai = 0;
-            ch = -1;
-            pch = -1;
-            nch = -1;
-            for(i=0; i<selflen; i++)
-            {
-                pch = ch;
-                ch = selfstr->at(i);
-                if(i <= selflen)
-                {
-                    nch = selfstr->at(i + 1);
-                }
-                if(ch == '%')
-                {
-                    if(nch == '%')
-                    {
-                        //buf = sdscatlen(buf, &ch, 1);
-                        buf->append(ch);
-                        i += 1;
-                    }
-                    else
-                    {
-                        i++;
-                        switch(nch)
-                        {
-                            case 's':
-                                {
-                                    if(!check_fmt_arg(vm, buf, ai, argc, argv, "%s"))
-                                    {
-                                        return Object::NullVal;
-                                    }
-                                    //buf = sdscatlen(buf, Object::as<String>(argv[ai])->data(), Object::as<String>(argv[ai])->length());
-                                    if(Object::isString(argv[ai]))
-                                    {
-                                        buf->append(Object::as<String>(argv[ai]));
-                                    }
-                                    else
-                                    {
-                                        buf->append(Object::toString(vm->m_state, argv[ai]));
-                                        //lit_runtime_error_exiting(vm, "format 's' at position %d expected a string", ai);
-                                    }
-                                }
-                                break;
-                            case 'd':
-                            case 'i':
-                                {
-                                    if(!check_fmt_arg(vm, buf, ai, argc, argv, "%d"))
-                                    {
-                                        return Object::NullVal;
-                                    }
-                                    if(Object::isNumber(argv[ai]))
-                                    {
-                                        iv = lit_check_number(vm, argv, argc, ai);
-                                        //buf = sdscatfmt(buf, "%i", iv);
-                                        buf->append(std::to_string(iv));
-                                    }
-                                    break;
-                                }
-                                break;
-                            case 'c':
-                                {
-                                    if(!check_fmt_arg(vm, buf, ai, argc, argv, "%c"))
-                                    {
-                                        return Object::NullVal;
-                                    }
-                                    if(!Object::isNumber(argv[ai]))
-                                    {
-                                        lit_runtime_error_exiting(vm, "flag 'c' expects a number");
-                                    }
-                                    iv = lit_check_number(vm, argv, argc, ai);
-                                    /* TODO: both of these use the same amount of memory. but which is faster? */
-                                    tmpch = iv;
-                                    buf->append(tmpch);
-                                }
-                                break;
-                            case 'x':
-                                {
-                                    size_t rlen;
-                                    char tmpbuf[25];
-                                    if(!check_fmt_arg(vm, buf, ai, argc, argv, "%c"))
-                                    {
-                                        return Object::NullVal;
-                                    }
-                                    if(!Object::isNumber(argv[ai]))
-                                    {
-                                        lit_runtime_error_exiting(vm, "flag 'x' expects a number");
-                                    }
-                                    iv = lit_check_number(vm, argv, argc, ai);
-                                    memset(tmpbuf, 0, 25);
-                                    rlen = sprintf(tmpbuf, "%02x", iv);
-                                    buf->append(tmpbuf, rlen);
-                                }
-                                break;
-                            default:
-                                {
-                                    //sdsfree(buf);
-                                    lit_runtime_error_exiting(vm, "unrecognized formatting flag '%c'", nch);
-                                    return Object::NullVal;
-                                }
-                                break;
-                        }
-                        ai++;
-                    }
-                }
-                else
-                {
-                    //buf = sdscatlen(buf, &ch, 1);
-                    buf->append(ch);
-                }
-            }
-            //rtv = String::copy(vm->m_state, buf, sdslen(buf))->asValue();
-            //sdsfree(buf);
-            //return rtv;
-            String::stateSetGCAllowed(vm->m_state, was_allowed);
-
-            return buf->asValue();
+            StringBuffer buf;
+            buf.init(vm->m_state);
+            lit_format_into(vm, &buf, Object::as<String>(instance), argv, argc);
+            return buf.toString()->asValue();
         }
 
         void lit_open_string_library(State* state)
@@ -1288,7 +1926,8 @@ namespace lit
                 klass->setGetter("to_i", objfn_string_tonumber);
             }
             /*
-            *
+            * String.split([String sep[, bool regex]])
+            * splits $self at every $sep. if $regex is true, $sep is a regular expression.
             */
             {
                 klass->bindMethod("split", objfn_string_split);
@@ -1299,6 +1938,10 @@ namespace lit
             {
                 klass->bindMethod("charCodeAt", objfn_string_byteat);
             }
+            /*
+            * String.indexOf(String str[, bool icase])
+            * returns the index of the first $str in $self, or -1.
+            */
             {
                 klass->bindMethod("indexOf", objfn_string_indexof);
             }
@@ -1344,7 +1987,7 @@ namespace lit
             * returns true if $self contains $str.
             * if optional param $icase is true, then search is case-insensitive.
             * this is faster than, eg, "FOO".lower.contains("BLAH".lower), since
-            * only the characters searched are tolower()'d.
+            * no lowered copies are made.
             */
             klass->bindMethod("contains", objfn_string_contains);
             /*
@@ -1358,10 +2001,23 @@ namespace lit
             */
             klass->bindMethod("endsWith", objfn_string_endswith);
             /*
-            * String.replace(String find, String rep)
-            * replaces every $find with $rep
+            * String.replace(String find, String rep[, bool regex])
+            * replaces every $find with $rep.
+            * if $regex is true, $find is a regular expression, and $rep may use $0..$9 for
+            * the match and its groups ($$ for a plain $).
             */
             klass->bindMethod("replace", objfn_string_replace);
+            /*
+            * String.match(String pattern)
+            * returns the first match of the regular expression $pattern as an array of the whole match
+            * followed by its groups (null for groups that didn't take part), or null if there is none.
+            */
+            klass->bindMethod("match", objfn_string_match);
+            /*
+            * String.matchAll(String pattern)
+            * returns every non-overlapping match of $pattern, each as an array like match() returns.
+            */
+            klass->bindMethod("matchAll", objfn_string_matchall);
             {
                 klass->bindMethod("substring", objfn_string_substring);
                 klass->bindMethod("substr", objfn_string_substring);
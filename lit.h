@@ -13,6 +13,7 @@
 #include <sys/types.h>  // for clock_t
 #include <time.h>       // for clock
 #include <cmath>        // for isinf, isnan
+#include <charconv>     // for to_chars, from_chars
 #include <iosfwd>       // for nullptr_t
 #include <string>       // for string, operator==, to_string, basic_string
 #include <string_view>  // for string_view, operator==, hash
@@ -27,7 +28,7 @@
 #define LIT_VERSION_MAJOR 0
 #define LIT_VERSION_MINOR 1
 #define LIT_VERSION_STRING "0.1"
-#define LIT_BYTECODE_VERSION 0
+#define LIT_BYTECODE_VERSION 4
 
 #define TESTING
 // #define DEBUG
@@ -91,6 +92,34 @@
 #define UINT16_COUNT UINT16_MAX + 1
 
 #define TABLE_MAX_LOAD 0.75
+/* instances with more fields than this are kept in dictionary mode */
+#define LIT_SHAPE_MAX_FIELDS 64
+/* shapes with this many transitions are megamorphic; instances that would branch off them go to dictionary mode */
+#define LIT_SHAPE_MAX_TRANSITIONS 16
+/* receivers remembered per call site before older ones get evicted */
+#define LIT_INLINE_CACHE_ENTRIES 4
+/* concatenations shorter than this are copied right away instead of becoming a rope */
+#define LIT_ROPE_MIN_LENGTH 64
+/* non-ascii strings remember the byte offset of every Nth code point */
+#define LIT_UTF_INDEX_STRIDE 64
+/* substrings shorter than this are copied instead of sharing their parent's bytes */
+#define LIT_SLICE_MIN_LENGTH 32
+/* a slice that is the only thing keeping its parent alive is copied out once the parent is this many times larger */
+#define LIT_SLICE_DETACH_RATIO 8
+/* compiled regular expressions the state keeps around; the cache is emptied when it fills up */
+#define LIT_REGEX_CACHE_MAX 64
+/* capture groups a pattern may have, not counting the whole match */
+#define LIT_REGEX_MAX_GROUPS 32
+/* parsed format strings the state keeps around; emptied when it fills up, like the regex cache */
+#define LIT_FORMAT_CACHE_MAX 64
+/* widths and precisions past this are rejected, so that a typo can't ask for gigabytes of padding */
+#define LIT_FORMAT_MAX_WIDTH 65536
+/* calls and loop iterations a function runs from its bytecode before it is pre-decoded into threaded code; SIZE_MAX never does */
+#define LIT_THREADED_HOTNESS 1000
+/* room for the longest text String::formatNumber writes, with a NUL */
+#define LIT_NUMBER_BUFFER_SIZE 32
+/* size of the userspace buffer behind the state's stdout and stderr Writers */
+#define LIT_WRITER_BUFFER_SIZE (64 * 1024)
 // Do not change these, or old bytecode files will break!
 #define LIT_BYTECODE_MAGIC_NUMBER 6932
 #define LIT_BYTECODE_END_NUMBER 2942
@@ -206,6 +235,8 @@ namespace lit
 
         // Emitter errors
         LITERROR_TOO_MANY_CONSTANTS,
+        LITERROR_TOO_MANY_CACHE_SITES,
+        LITERROR_TOO_MANY_GLOBALS,
         LITERROR_TOO_MANY_PRIVATES,
         LITERROR_VAR_REDEFINED,
         LITERROR_TOO_MANY_LOCALS,
@@ -241,7 +272,9 @@ namespace lit
         LITRESULT_OK,
         LITRESULT_COMPILE_ERROR,
         LITRESULT_RUNTIME_ERROR,
-        LITRESULT_INVALID
+        LITRESULT_INVALID,
+        /* internal: the interpreter loop hands the fiber over to the other loop; see State::runFiber() */
+        LITRESULT_SWITCH
     };
 
     enum ErrorType
@@ -250,11 +283,27 @@ namespace lit
         RUNTIME_ERROR
     };
 
+    /*
+    * names the VM looks up by itself (operators, protocol methods).
+    * they are interned once in State::make, and live in State::symbols.
+    */
+    enum SymbolID
+    {
+        #define SYMBOL(name, str) LITSYM_##name,
+        #include "symbol.inc"
+        #undef SYMBOL
+
+        LITSYM_TOTAL
+    };
+
     class /**/Writer;
     class /**/State;
     class /**/VM;
     class /**/Array;
     class /**/Map;
+    class /**/Instance;
+    class /**/Class;
+    class /**/Shape;
     class /**/Userdata;
     class /**/String;
     class /**/Module;
@@ -285,7 +334,9 @@ namespace lit
 
     void lit_disassemble_module(State* state, Module* module, const char* source);
     void lit_disassemble_chunk(Chunk* chunk, const char* name, const char* source);
+    void lit_disassemble_regchunk(Chunk* chunk, const char* name, const char* source);
     size_t lit_disassemble_instruction(State* state, Chunk* chunk, size_t offset, const char* source);
+    size_t lit_disassemble_reginstruction(State* state, Chunk* chunk, size_t offset, const char* source);
 
     namespace Util
     {
@@ -307,12 +358,28 @@ namespace lit
             /* allocate/reallocate memory. if new_size is 0, frees the pointer, and returns nullptr. */
             static void* reallocate(State* state, void* pointer, size_t oldsize, size_t newsize)
             {
-                void* ptr;
                 setBytesAllocated(state, (int64_t)newsize - (int64_t)oldsize);
                 if(newsize > oldsize)
                 {
                     runGCIfNeeded(state);
                 }
+                return resizeRaw(state, pointer, newsize);
+            }
+
+            /*
+            * like reallocate(), but never runs the GC. for containers (StringBuffer, Table,
+            * PCGenericArray::push) that are commonly filled with freshly created, unrooted objects.
+            */
+            static void* reallocateNoCollect(State* state, void* pointer, size_t oldsize, size_t newsize)
+            {
+                setBytesAllocated(state, (int64_t)newsize - (int64_t)oldsize);
+                return resizeRaw(state, pointer, newsize);
+            }
+
+        private:
+            static void* resizeRaw(State* state, void* pointer, size_t newsize)
+            {
+                void* ptr;
                 if(newsize == 0)
                 {
                     free(pointer);
@@ -326,6 +393,7 @@ namespace lit
                 return ptr;
             }
 
+        public:
             template<typename Type>
             static Type* reallocate(State* state, Type* pointer, size_t oldsize, size_t newsize)
             {
@@ -419,7 +487,8 @@ namespace lit
                         m_capacity = LIT_GROW_CAPACITY(m_capacity + 1) * m_capacity;
                     }
                     //fprintf(stderr, "<%p> push(): new capacity=%d (m_count=%d)\n", this, m_capacity, m_count);
-                    m_values = LIT_GROW_ARRAY(m_state, m_values, ElementT, oldcap, m_capacity);
+                    /* $value is often a freshly made object that nothing else references yet */
+                    m_values = (ElementT*)Memory::reallocateNoCollect(m_state, m_values, sizeof(ElementT) * oldcap, sizeof(ElementT) * m_capacity);
                     if(m_values == nullptr)
                     {
                         raiseError("GenericArray: FAILED to grow array!");
@@ -464,6 +533,138 @@ namespace lit
             }
     };
 
+    /*
+    * a growable byte buffer for building strings piecewise.
+    * String objects are immutable (their bytes live inline after the object header),
+    * so anything that assembles a string appends here first, and then calls toString().
+    */
+    class StringBuffer
+    {
+        public:
+            State* m_state;
+            char* m_data;
+            size_t m_length;
+            size_t m_capacity;
+
+        public:
+            void init(State* state, size_t reserve = 0);
+
+            void release();
+
+            /* makes room for at least $needed more bytes */
+            void reserve(size_t needed);
+
+            void append(const char* s, size_t len);
+
+            void append(std::string_view sv)
+            {
+                append(sv.data(), sv.size());
+            }
+
+            void append(String* other);
+
+            void append(char ch)
+            {
+                append(&ch, 1);
+            }
+
+            /* appends $ch $count times */
+            void appendRepeat(char ch, size_t count);
+
+            void appendFormat(const char* fmt, va_list va);
+
+            inline const char* data() const
+            {
+                return m_data;
+            }
+
+            inline size_t length() const
+            {
+                return m_length;
+            }
+
+            /* interns the contents as a String, and releases the buffer. */
+            String* toString();
+    };
+
+    /*
+    * substring search shared by contains, indexOf, replace and split.
+    * short needles use a SIMD first/last byte filter (SSE2 or AVX2, picked at runtime),
+    * long needles use Two-Way, so that the worst case stays linear.
+    * icase folds ASCII letters only.
+    */
+    class StringSearch
+    {
+        public:
+            static constexpr size_t npos = (size_t)-1;
+
+        public:
+            /* byte offset of the first $needle in $hay, or npos. an empty needle matches at 0. */
+            static size_t find(const char* hay, size_t haylen, const char* needle, size_t needlelen, bool icase);
+
+            static size_t find(std::string_view hay, std::string_view needle, bool icase)
+            {
+                return find(hay.data(), hay.size(), needle.data(), needle.size(), icase);
+            }
+    };
+
+    /*
+    * a printf-style format string, parsed once, and cached by the state keyed by the format string.
+    * conversions: %s %d %i %u %c %x %X %o %b %f %F %e %E %g %G %%, with the flags - + space 0 #,
+    * a width and a precision (either may be *, and is then taken from the arguments).
+    * the width and precision of %s and %c count code points.
+    * NaN and infinity print as toString prints them for the integer conversions, and as "nan"/"inf"
+    * for the float ones; NaN never takes a '-'.
+    */
+    class Format
+    {
+        public:
+            /* width or precision given as '*' */
+            static constexpr int FromArgs = -2;
+
+            struct Spec
+            {
+                /* the literal text before this conversion, as a byte range of the format string */
+                size_t litstart;
+                size_t litlength;
+                /* the conversion character; 0 for the text after the last conversion */
+                char conversion;
+                bool leftalign;
+                bool zeropad;
+                bool plus;
+                bool space;
+                bool alternate;
+                /* -1 if not given */
+                int width;
+                int precision;
+            };
+
+        public:
+            /* returns nullptr, and sets $error, if $fmt isn't a valid format. */
+            static Format* make(State* state, const char* fmt, size_t length, const char** error);
+
+            /* the parsed form of $fmt, from the state's cache if it was parsed before. */
+            static Format* fromCache(State* state, String* fmt, const char** error);
+
+            static void destroy(State* state, Format* format);
+
+        public:
+            State* m_state;
+            PCGenericArray<Spec> m_specs;
+            /* bytes of literal text, and how many arguments (including '*' ones) the format consumes */
+            size_t m_literallength;
+            size_t m_argcount;
+            char m_error[96];
+
+        public:
+            /*
+            * appends the formatted $argv to $dest; $fmt must be the text this was parsed from.
+            * never collects. returns nullptr, or an error message if the arguments don't fit.
+            * objects other than strings must have been turned into strings by the caller.
+            */
+            const char* apply(StringBuffer* dest, const char* fmt, const Value* argv, size_t argc);
+    };
+
     class Writer
     {
         public:
@@ -472,57 +673,68 @@ namespace lit
             using WriteFormatFuncType = void(*)(Writer*, const char*, va_list);
 
         public:
-            static void stringAppend(String* ds, int byte);
-            static void stringAppend(String* ds, const char* str, size_t len);
-            static void stringAppendFormat(String* ds, const char* fmt, va_list va);
-
             static void cb_writebyte(Writer* wr, int byte)
             {
-                String* ds;
                 if(wr->stringmode)
                 {
-                    ds = (String*)wr->uptr;
-                    stringAppend(ds, byte);        
+                    wr->buffer.append((char)byte);
                 }
                 else
                 {
                     fputc(byte, (FILE*)wr->uptr);
                 }
+                wr->m_written++;
             }
 
             static void cb_writestring(Writer* wr, const char* string, size_t len)
             {
-                String* ds;
                 if(wr->stringmode)
                 {
-                    ds = (String*)wr->uptr;
-                    stringAppend(ds, string, len);
+                    wr->buffer.append(string, len);
+                    wr->m_written += len;
                 }
                 else
                 {
-                    fwrite(string, sizeof(char), len, (FILE*)wr->uptr);
+                    wr->m_written += fwrite(string, sizeof(char), len, (FILE*)wr->uptr);
                 }
             }
 
             static void cb_writeformat(Writer* wr, const char* fmt, va_list va)
             {
-                String* ds;
+                int rc;
+                size_t before;
                 if(wr->stringmode)
                 {
-                    ds = (String*)wr->uptr;
-                    stringAppendFormat(ds, fmt, va);
+                    before = wr->buffer.length();
+                    wr->buffer.appendFormat(fmt, va);
+                    wr->m_written += wr->buffer.length() - before;
                 }
                 else
                 {
-                    vfprintf((FILE*)wr->uptr, fmt, va);
+                    rc = vfprintf((FILE*)wr->uptr, fmt, va);
+                    if(rc > 0)
+                    {
+                        wr->m_written += rc;
+                    }
                 }
             }
 
+            /* the callbacks of a Writer made by initBufferedFile() */
+            static void cb_bufwritebyte(Writer* wr, int byte);
+            static void cb_bufwritestring(Writer* wr, const char* string, size_t len);
+            static void cb_bufwriteformat(Writer* wr, const char* fmt, va_list va);
+
             static void initDefault(State* state, Writer* wr)
             {
                 wr->m_state = state;
                 wr->forceflush = false;
                 wr->stringmode = false;
+                wr->uptr = nullptr;
+                wr->m_written = 0;
+                wr->m_outbuf = nullptr;
+                wr->m_outlength = 0;
+                wr->m_outcapacity = 0;
+                wr->m_linebuffered = false;
                 wr->fnbyte = cb_writebyte;
                 wr->fnstring = cb_writestring;
                 wr->fnformat = cb_writeformat;
@@ -530,15 +742,29 @@ namespace lit
 
         public:
             State* m_state;
-            /* the main pointer, that either holds a pointer to a String, or a FILE */
+            /* the FILE this Writer writes to, if !stringmode */
             void* uptr;
 
-            /* if true, then uptr is a String, otherwise it's a FILE */
+            /* if stringmode, then output is collected here */
+            StringBuffer buffer;
+
+            /* if true, then output goes to buffer, otherwise to the FILE in uptr */
             bool stringmode;
 
             /* if true, and !stringmode, then calls fflush() after each i/o operations */
             bool forceflush;
 
+            /* bytes written so far */
+            size_t m_written;
+
+            /* output not yet handed to the FILE, if made by initBufferedFile(); nullptr otherwise */
+            char* m_outbuf;
+            size_t m_outlength;
+            size_t m_outcapacity;
+
+            /* if true, the buffer is flushed after every newline, like stdio does for terminals */
+            bool m_linebuffered;
+
             /* the callback that emits a single character */
             WriteByteFuncType fnbyte;
 
@@ -560,26 +786,53 @@ namespace lit
                 this->forceflush = forceflush;
             }
 
+            /*
+            * creates a Writer that writes to the given FILE through a buffer of LIT_WRITER_BUFFER_SIZE bytes.
+            * the buffer is handed over when it's full, on flush() and release(), and after each newline
+            * if $linebuffered is true.
+            */
+            void initBufferedFile(State* state, FILE* fh, bool linebuffered);
+
             /*
             * creates a Writer that writes to a buffer.
             */
             void initString(State* state);
 
+            /* hands buffered output over to the FILE, and flushes it */
+            void flush();
+
+            /* flushes, and frees the buffer of a Writer made by initBufferedFile() */
+            void release();
+
             /* emit a single byte */
             void put(int byte)
             {
+                if(m_outbuf != nullptr && m_outlength < m_outcapacity && (byte != '\n' || !m_linebuffered))
+                {
+                    m_outbuf[m_outlength++] = (char)byte;
+                    m_written++;
+                    return;
+                }
                 this->fnbyte(this, byte);
             }
 
             void put(const char* str, size_t len)
             {
+                /* the common case of a buffered Writer, without going through the callback */
+                if(m_outbuf != nullptr && len < (m_outcapacity - m_outlength) && !m_linebuffered)
+                {
+                    memcpy(m_outbuf + m_outlength, str, len);
+                    m_outlength += len;
+                    m_written += len;
+                    return;
+                }
                 this->fnstring(this, str, len);
             }
 
             /* emit a string */
             void put(std::string_view sv)
             {
-                this->fnstring(this, sv.data(), sv.size());
+                put(sv.data(), sv.size());
             }
 
             /* emit a printf-style formatted string */
@@ -592,16 +845,10 @@ namespace lit
             }
 
             /*
-            * returns a String* if this Writer was initiated via lit_writer_init_string, otherwise nullptr.
+            * returns the collected output as a String if this Writer was created via initString(), otherwise nullptr.
+            * the buffer is released afterwards.
             */
-            String* asString()
-            {
-                if(this->stringmode)
-                {
-                    return (String*)this->uptr;
-                }
-                return nullptr;
-            }
+            String* asString();
     };
 
 
@@ -921,28 +1168,18 @@ namespace lit
 
             static void printMap(State* state, Writer* wr, Map* map, size_t size);
 
+            static void printInstance(State* state, Writer* wr, Instance* inst);
+
             static void printObject(State* state, Writer* wr, Value value);
 
-            static void print(State* state, Writer* wr, Value value)
-            {
+            static void print(State* state, Writer* wr, Value value);
 
-                if(Object::isBool(value))
-                {
-                    wr->put(Object::asBool(value) ? "true" : "false");
-                }
-                else if(Object::isNull(value))
-                {
-                    wr->put("null");
-                }
-                else if(Object::isNumber(value))
-                {
-                    wr->format("%g", Object::toNumber(value));
-                }
-                else if(Object::isObject(value))
-                {
-                    printObject(state, wr, value);
-                }
-            }
+            /*
+            * writes the same text toString() gives for $value, but streams numbers, arrays and maps
+            * straight into $wr instead of building a String for every element.
+            * containers that (indirectly) contain themselves are written as "(recursion)".
+            */
+            static void writeValue(State* state, Writer* wr, Value value);
 
         public:
             State* m_state;
@@ -1015,9 +1252,105 @@ namespace lit
     class String: public Object
     {
         public:
+            /*
+            * a compiled regular expression (see regex.cpp for the syntax).
+            * patterns are compiled to a Pike VM program, so matching never backtracks.
+            * a DFA, built lazily from the same program, first checks whether there's a match at all,
+            * so that the Pike VM only runs where it has something to find.
+            */
             class Regex
             {
-                
+                public:
+                    enum class Op: uint8_t
+                    {
+                        Byte,
+                        Set,
+                        Split,
+                        Jmp,
+                        Save,
+                        Bol,
+                        Eol,
+                        WordBoundary,
+                        NotWordBoundary,
+                        Match,
+                    };
+
+                    struct Inst
+                    {
+                        Op op;
+                        /* the byte, set index, save slot, or jump target */
+                        int x;
+                        /* the second (lower priority) target of Split */
+                        int y;
+                    };
+
+                    struct ByteSet
+                    {
+                        uint8_t bits[32];
+                    };
+
+                    /* pike vm threads: a sparse set of pcs, in priority order, with their captures */
+                    struct ThreadList
+                    {
+                        int* dense;
+                        int* sparse;
+                        size_t count;
+                        int64_t* captures;
+                    };
+
+                    struct DfaState;
+
+                public:
+                    /* returns nullptr, and sets $error, if $pattern doesn't compile. */
+                    static Regex* make(State* state, const char* pattern, size_t length, const char** error);
+
+                    /* the compiled form of $pattern, from the state's cache if it was compiled before. */
+                    static Regex* fromCache(State* state, String* pattern, const char** error);
+
+                    static void destroy(State* state, Regex* regex);
+
+                public:
+                    State* m_state;
+                    PCGenericArray<Inst> m_program;
+                    PCGenericArray<ByteSet> m_sets;
+                    /* capture groups, including the whole match as group 0 */
+                    size_t m_groups;
+                    ThreadList m_clist;
+                    ThreadList m_nlist;
+                    int64_t* m_scratch;
+                    /* false if the pattern needs the pike vm alone (\b), or the dfa kept overflowing */
+                    bool m_dfaok;
+                    size_t m_dfaflushes;
+                    DfaState** m_dfastates;
+                    size_t m_dfacount;
+                    size_t m_dfacapacity;
+                    int* m_dfabuckets;
+                    size_t m_dfabucketcount;
+                    int m_dfastart[2];
+                    int* m_dfastack;
+
+                private:
+                    void addThread(ThreadList* list, int pc, int64_t* captures, const char* subject, size_t length, size_t pos);
+
+                    void closure(ThreadList* set, bool atstart, bool atend);
+
+                    int dfaIntern(ThreadList* set);
+
+                    int dfaNext(int from, uint8_t byte);
+
+                    void dfaFlush();
+
+                    /* 1 if there's a match at or after $start, 0 if not, -1 if the dfa couldn't tell */
+                    int dfaSearch(const char* subject, size_t length, size_t start);
+
+                    bool pikeSearch(const char* subject, size_t length, size_t start, int64_t* captures);
+
+                public:
+                    /*
+                    * finds the leftmost match at or after byte $start.
+                    * $captures receives a start and end offset for each group, -1 for groups that didn't participate.
+                    */
+                    bool search(const char* subject, size_t length, size_t start, int64_t* captures);
             };
 
         public:
@@ -1031,8 +1364,6 @@ namespace lit
                 return makeHash(std::string_view(str, length));
             }
 
-            static String* allocEmpty(State* state, size_t length);
-
             static String* allocate(State* state, const char* chars, size_t length, uint32_t hs, bool mustfree);
 
             static void statePutInterned(State* state, String* string);
@@ -1044,12 +1375,20 @@ namespace lit
             static String* stateFindInterned(State* state, const char* chars, size_t length, uint32_t hs);
 
             /*
-            * create a String by reusing $chars. ONLY use this if you're certain that $chars isn't being freed.
-            * if $wassds is true, then the sds instance is reused as-is.
+            * create a transient String from $chars, which must have been allocated via LIT_ALLOCATE,
+            * and is freed afterwards.
             */
-            /* todo: track if $chars is a sds instance - additional argument $fromsds? */
             static String* take(State* state, char* chars, size_t length);
 
+            /*
+            * create a String that is neither hashed nor interned yet. this is what library functions
+            * return; the string is interned (see intern(State*, String*)) once it's used as a key.
+            */
+            static String* makeTransient(State* state, const char* chars, size_t length);
+
+            /* returns the interned String equal to $string; interns $string itself if there is none yet. */
+            static String* intern(State* state, String* string);
+
             /* copy a string, creating a full newly allocated String. */
             static String* copy(State* state, const char* chars, size_t length);
 
@@ -1085,13 +1424,31 @@ namespace lit
 
             static Value stringNumberToString(State* state, double value);
 
+            /*
+            * writes the shortest text that reads back as exactly $value, and returns its length.
+            * plain notation between 1e-7 and 1e21, exponent notation outside of it.
+            * $dest must have room for LIT_NUMBER_BUFFER_SIZE bytes; the text is NUL-terminated.
+            */
+            static size_t formatNumber(char* dest, double value);
+
+            /*
+            * parses a decimal number at the start of $str, after optional whitespace and sign,
+            * and returns how many bytes it took (0 if there's no number there).
+            * sets $outofrange if the number doesn't fit in a double.
+            */
+            static size_t parseNumber(const char* str, size_t length, double* dest, bool* outofrange);
+
             static int decodeNumBytes(uint8_t byte);
 
             static int encodeNumBytes(int value);
 
             static String* fromCodePoint(State* state, int value);
 
-            static String* fromRange(State* state, String* source, int start, uint32_t count);
+            /*
+            * a new string holding $count bytes of $source, starting at byte $start.
+            * unless it's shorter than LIT_SLICE_MIN_LENGTH, the result is a slice that shares $source's bytes.
+            */
+            static String* fromRange(State* state, String* source, size_t start, size_t count);
 
             static int utfstringEncode(int value, uint8_t* bytes);
 
@@ -1119,75 +1476,136 @@ namespace lit
 
             static bool equal(State* state, String* a, String* b);
 
+            /*
+            * concatenates $left and $right. short results are built and interned right away;
+            * longer ones become a rope that is only flattened once its bytes are needed, so
+            * that building a string with repeated `s = s + piece` stays linear.
+            */
+            static String* concat(State* state, String* left, String* right);
 
         public:
             /* the hash of this string - note that it is only unique to the context! */
-            uint32_t m_hash = 0;
+            uint32_t m_hash;
+
+            /* the length in bytes, not counting the trailing NUL */
+            size_t m_length;
+
+            /* whether m_hash has been computed yet; transient strings and ropes hash lazily */
+            bool m_hashed;
+
+            /* whether this is the copy held by the VM's intern table */
+            bool m_interned;
+
+            /* whether m_ascii and m_utflength have been computed yet */
+            bool m_utfknown;
+
+            /* true if all bytes are < 0x80, so byte offsets and code point offsets are the same */
+            bool m_ascii;
+
+            /* the number of code points */
+            size_t m_utflength;
+
+            /*
+            * for non-ascii strings: the byte offset of every LIT_UTF_INDEX_STRIDE-th code point.
+            * built the first time a code point offset is asked for.
+            */
+            size_t* m_utfindex;
+
+            /*
+            * the bytes. for plain strings this points at the storage directly after this header;
+            * for a rope it is nullptr until flatten() fills in a separate buffer; for a slice it
+            * points into m_parent's bytes, and is only NUL-terminated if the slice runs to the end
+            * of its parent (see cstr()).
+            */
+            const char* m_chars;
 
-            /* this is handled by sds - use lit_string_length to get the length! */
-            std::string* m_chars = nullptr;
+            /* the operands of an unflattened rope; nullptr otherwise. m_right is never itself a rope. */
+            String* m_left;
+            String* m_right;
+
+            /* for a slice, the string that owns the bytes; never itself a slice. nullptr otherwise. */
+            String* m_parent;
 
         public:
-            inline const char* data() const
+            inline char* inlineChars()
             {
-                if(!m_chars)
-                {
-                    return nullptr;
-                }
-                return m_chars->data();
+                return ((char*)this) + sizeof(String);
             }
 
-            inline size_t size() const
+            inline bool isRope() const
             {
-                if(!m_chars)
-                {
-                    return 0;
-                }
-                return m_chars->size();
+                return (m_chars == nullptr);
             }
 
-            inline size_t length() const
-            {
-                if(!m_chars)
-                {
-                    return 0;
-                }
-                return m_chars->size();
-            }
+            /* copies the leaves of a rope into one buffer. never triggers the GC. */
+            void flatten() const;
 
-            inline int at(size_t i) const
+            inline bool isSlice() const
             {
-                return (*m_chars)[i];
+                return (m_parent != nullptr);
             }
 
-            void append(std::nullptr_t)
+            /*
+            * the string whose buffer holds these bytes. native code that keeps data() around while
+            * allocating roots this, so that the GC can't detach the slice and free the parent.
+            */
+            inline String* owner() const
             {
+                return isSlice() ? m_parent : const_cast<String*>(this);
             }
 
-            void append(const char* s, size_t len)
+            /* gives a slice its own copy of its bytes, and lets go of the parent. never triggers the GC. */
+            void detach() const;
+
+            /* like data(), but guaranteed to be NUL-terminated; for passing to C functions. */
+            inline const char* cstr() const
             {
-                if(len > 0)
+                if((m_parent != nullptr) && (m_chars[m_length] != '\0'))
                 {
-                    m_chars->append(s, len);
+                    detach();
                 }
+                return data();
             }
 
-            void append(std::string_view sv)
+            inline const char* data() const
             {
-                return append(sv.data(), sv.size());
+                if(m_chars == nullptr)
+                {
+                    flatten();
+                }
+                return m_chars;
             }
 
-            void append(String* other)
+            inline uint32_t hash() const
             {
-                if(other != nullptr)
+                if(!m_hashed)
                 {
-                    append(*(other->m_chars));
+                    String* self;
+                    self = const_cast<String*>(this);
+                    self->m_hash = String::makeHash(data(), m_length);
+                    self->m_hashed = true;
                 }
+                return m_hash;
             }
 
-            void append(char ch)
+            inline size_t size() const
             {
-                m_chars->append((const char*)&ch, 1);
+                return m_length;
+            }
+
+            inline size_t length() const
+            {
+                return m_length;
+            }
+
+            inline int at(size_t i) const
+            {
+                return data()[i];
+            }
+
+            inline std::string_view view() const
+            {
+                return std::string_view(data(), m_length);
             }
 
             bool contains(String* other, bool icase) const
@@ -1202,7 +1620,29 @@ namespace lit
 
             bool contains(const char* findme, size_t fmlen, bool icase) const;
 
-            size_t utfLength() const;
+            /* computes m_ascii and m_utflength. never triggers the GC. */
+            void scanUtf() const;
+
+            inline bool isAscii() const
+            {
+                if(!m_utfknown)
+                {
+                    scanUtf();
+                }
+                return m_ascii;
+            }
+
+            inline size_t utfLength() const
+            {
+                if(!m_utfknown)
+                {
+                    scanUtf();
+                }
+                return m_utflength;
+            }
+
+            /* the byte offset of code point $index, or length() if it's out of range */
+            size_t utfOffset(size_t index) const;
 
             String* codePointAt(uint32_t index) const;
 
@@ -1210,8 +1650,79 @@ namespace lit
 
             inline Array* split(String* sep, bool keepblanc) const
             {
-                return split(*(sep->m_chars), keepblanc);
+                return split(sep->view(), keepblanc);
+            }
+    };
+
+    /*
+    * per-site cache used by GET_FIELD, SET_FIELD, INVOKE and INVOKE_SUPER.
+    * an entry is keyed on the receiver's Shape (or its Class, for receivers
+    * without a shape) plus the Class::m_version it was resolved under, so
+    * any change to a class's method tables makes its entries miss. lookups
+    * in a class's static table key on Class::m_staticversion instead.
+    */
+    struct InlineCache
+    {
+        struct Entry
+        {
+            /* the Shape or Class this entry was resolved for; nullptr if unused */
+            const void* key;
+            /*
+            * Class::m_version of the class the lookup went through, at the time
+            * this entry was filled. versions are unique, so this also pins the class.
+            */
+            uint64_t version;
+            /* the field slot, or -1 when value holds the resolved class member */
+            int slot;
+            /* for SET_FIELD: the shape to move to when adding the field */
+            Shape* target;
+            /* the resolved method or member */
+            Value value;
+        };
+
+        Entry entries[LIT_INLINE_CACHE_ENTRIES];
+        /* the entry to evict next, once every entry is in use */
+        size_t next;
+
+        inline Entry* find(const void* key, uint64_t version)
+        {
+            size_t i;
+            for(i = 0; i < LIT_INLINE_CACHE_ENTRIES; i++)
+            {
+                if(entries[i].key == key && entries[i].version == version)
+                {
+                    return &entries[i];
+                }
+            }
+            return nullptr;
+        }
+
+        inline Entry* fill(const void* key, uint64_t version)
+        {
+            size_t i;
+            Entry* entry;
+            entry = nullptr;
+            for(i = 0; i < LIT_INLINE_CACHE_ENTRIES; i++)
+            {
+                /* reuse unused entries, and stale ones for the same key */
+                if(entries[i].key == nullptr || entries[i].key == key)
+                {
+                    entry = &entries[i];
+                    break;
+                }
+            }
+            if(entry == nullptr)
+            {
+                entry = &entries[next];
+                next = (next + 1) % LIT_INLINE_CACHE_ENTRIES;
             }
+            entry->key = key;
+            entry->version = version;
+            entry->slot = -1;
+            entry->target = nullptr;
+            entry->value = Object::NullVal;
+            return entry;
+        }
     };
 
     class Chunk
@@ -1227,6 +1738,11 @@ namespace lit
             size_t m_linecapacity;
             uint16_t* m_linedata;
             PCGenericArray<Value> m_constants;
+            /* number of inline cache sites; their caches are allocated on first use */
+            size_t m_cachecount;
+            InlineCache* m_caches;
+            /* code offsets of global slot operands, so stored bytecode can be relocated */
+            PCGenericArray<uint32_t> m_globalsites;
 
         public:
             void init(State* state)
@@ -1240,13 +1756,21 @@ namespace lit
                 m_linecapacity = 0;
                 m_linedata = nullptr;
                 m_constants.init(m_state);
+                m_cachecount = 0;
+                m_caches = nullptr;
+                m_globalsites.init(m_state);
             }
 
             void release()
             {
                 LIT_FREE_ARRAY(m_state, uint8_t, m_code, m_capacity);
                 LIT_FREE_ARRAY(m_state, uint16_t, m_linedata, m_linecapacity);
+                if(m_caches != nullptr)
+                {
+                    LIT_FREE_ARRAY(m_state, InlineCache, m_caches, m_cachecount);
+                }
                 m_constants.release();
+                m_globalsites.release();
                 init(m_state);
             }
 
@@ -1291,6 +1815,26 @@ namespace lit
 
             size_t addConstant(Value constant);
 
+            /* reserves a cache for one more site, returning its index */
+            size_t addCache()
+            {
+                return m_cachecount++;
+            }
+
+            inline InlineCache* cacheAt(size_t index)
+            {
+                if(m_caches == nullptr)
+                {
+                    allocCaches();
+                }
+                return &m_caches[index];
+            }
+
+            void allocCaches();
+
+            /* size of the instruction at $offset, operands included */
+            size_t instructionLength(size_t offset);
+
             size_t get_line(size_t offset)
             {
                 if(!m_haslineinfo)
@@ -1335,6 +1879,18 @@ namespace lit
             }
     };
 
+    /*
+    * one word of a function's threaded code. the words line up with the bytes of its chunk: the word
+    * of an opcode holds the address of its handler, and the word where an operand starts holds that
+    * operand decoded, with constants already taken from the pool.
+    */
+    union CodeWord
+    {
+        void* handler;
+        size_t operand;
+        Value value;
+    };
+
     class Function: public Object
     {
         public:
@@ -1348,6 +1904,12 @@ namespace lit
             size_t max_slots;
             bool vararg;
             Module* module;
+            /* calls and loop iterations so far, counted until the function gets threaded code */
+            size_t m_hotness;
+            /* one word per byte of chunk, or nullptr while the function still runs from its bytecode */
+            CodeWord* m_threaded;
+            /* registers a frame of its register code takes (see regopcode.inc), or 0 if it is bytecode */
+            size_t m_registers;
     };
 
     class Upvalue: public Object
@@ -1474,39 +2036,62 @@ namespace lit
 
         public:
             State* m_state = nullptr;
-            PCGenericArray<Entry*> m_inner;
+            /*
+            * open-addressing slots; capacity is always a power of two.
+            * an empty slot has key == nullptr and value == NullVal, a tombstone
+            * (left behind by remove()) has key == nullptr and value == TrueVal.
+            */
+            Entry* m_entries = nullptr;
+            /* number of slots in m_entries */
+            size_t m_capacity = 0;
+            /* number of live entries */
+            size_t m_count = 0;
+            /* number of live entries plus tombstones; drives the load factor */
+            size_t m_used = 0;
+
+        private:
+            Entry* findEntry(String* key) const;
+
+            void adjustCapacity(size_t newcap);
 
         public:
             void init(State* state)
             {
                 m_state = state;
-                m_inner.init(state);
+                m_entries = nullptr;
+                m_capacity = 0;
+                m_count = 0;
+                m_used = 0;
             }
 
             void release();
 
             void markForGC(VM* vm);
 
+            /* number of slots; valid indices for at() are [0, capacity()) */
             inline size_t capacity() const
             {
-                return m_inner.m_capacity;
+                return m_capacity;
             }
 
             inline size_t size() const
             {
-                return m_inner.size();
+                return m_count;
             }
 
+            /* slot i; key is nullptr for empty slots and tombstones */
             inline Entry* at(size_t i)
             {
-                return m_inner.at(i);
+                return &m_entries[i];
             }
 
-            inline Entry* at(size_t i) const
+            inline const Entry* at(size_t i) const
             {
-                return m_inner.at(i);
+                return &m_entries[i];
             }
 
+            void clear();
+
             void setField(const char* name, Value value)
             {
                 this->set(String::intern(m_state, name), value);
@@ -1549,6 +2134,64 @@ namespace lit
             Value iterKey(int64_t index) const;
     };
 
+    /*
+    * the set of interned strings, keyed by hash and length.
+    * entries are weak: they do not keep their string alive, and are cleared
+    * by removeWhite() during collection, before unmarked objects are swept.
+    */
+    class InternTable
+    {
+        public:
+            struct Entry
+            {
+                /* nullptr for empty slots and tombstones */
+                String* string;
+                uint32_t hash;
+                /* truncated length; only used to reject mismatches early */
+                uint32_t length;
+            };
+
+            /* marks a tombstone in Entry::length when Entry::string is nullptr */
+            static constexpr uint32_t TOMBSTONE = UINT32_MAX;
+
+        public:
+            State* m_state = nullptr;
+            Entry* m_entries = nullptr;
+            /* number of slots, always a power of two */
+            size_t m_capacity = 0;
+            /* number of live strings */
+            size_t m_count = 0;
+            /* live strings plus tombstones */
+            size_t m_used = 0;
+
+        private:
+            void adjustCapacity(size_t newcap);
+
+        public:
+            void init(State* state)
+            {
+                m_state = state;
+                m_entries = nullptr;
+                m_capacity = 0;
+                m_count = 0;
+                m_used = 0;
+            }
+
+            void release();
+
+            inline size_t size() const
+            {
+                return m_count;
+            }
+
+            String* find(const char* str, size_t length, uint32_t hs) const;
+
+            /* adds string, unless an equal string is already interned. returns true if it was added. */
+            bool add(String* string);
+
+            void removeWhite();
+    };
+
     struct Local
     {
         const char* name;
@@ -1614,17 +2257,22 @@ namespace lit
                         uint16_t i;
                         uint16_t length;
                         char* line;
+                        String* rt;
                         length = read_euint16_t();
                         if(length < 1)
                         {
-                            return nullptr;
+                            /* an empty constant, like the "" in 'var s = ""' */
+                            return String::copy(state, "", 0);
                         }
                         line = (char*)malloc(length + 1);
                         for(i = 0; i < length; i++)
                         {
                             line[i] = (char)read_euint8_t() ^ LIT_STRING_KEY;
                         }
-                        return String::take(state, line, length);
+                        /* these are names and constants, so they are interned, as the compiler's are */
+                        rt = String::copy(state, line, length);
+                        free(line);
+                        return rt;
                     }
             };
 
@@ -1891,6 +2539,86 @@ namespace lit
             }
     };
 
+    /*
+    * a pointer to values that may live on a fiber's stack.
+    * the stack moves when it grows, which any call into script code may cause;
+    * get() returns where the values are now.
+    */
+    struct StackRef
+    {
+        Fiber* fiber;
+        Value* values;
+        size_t offset;
+        bool onstack;
+
+        StackRef(Fiber* fib, Value* vals)
+        {
+            fiber = fib;
+            values = vals;
+            onstack = (fib != nullptr && vals >= fib->m_stackdata && vals < (fib->m_stackdata + fib->m_stackcapacity));
+            offset = onstack ? (size_t)(vals - fib->m_stackdata) : 0;
+        }
+
+        Value* get() const
+        {
+            if(onstack)
+            {
+                return fiber->m_stackdata + offset;
+            }
+            return values;
+        }
+    };
+
+    /*
+    * a hidden class: the field layout shared by all instances of a class that
+    * added the same fields in the same order.
+    * shapes form a tree per class, rooted at Class::m_rootshape; they are owned
+    * by (and released with) their class, and are not objects themselves.
+    */
+    class Shape
+    {
+        public:
+            static Shape* make(State* state, Shape* parent, String* key);
+
+            /* releases shape, and every shape reachable through its transitions */
+            static void release(State* state, Shape* shape);
+
+        public:
+            Shape* parent;
+            /* the field added by the transition from parent; nullptr for the root */
+            String* key;
+            /* number of fields (and thus slots) described by this shape */
+            size_t count;
+            /*
+            * field name -> slot index. the first shape to extend its parent shares the parent's table,
+            * so a chain of shapes has a single one; only entries below count belong to a shape.
+            */
+            Table* slots;
+            /* whether slots was allocated by this shape (rather than shared with its parent) */
+            bool ownstable;
+            /* shapes that add exactly one field to this one */
+            PCGenericArray<Shape*> transitions;
+
+        public:
+            inline int lookup(String* name) const
+            {
+                Value index;
+                if(slots->get(name, &index) && ((size_t)Object::toNumber(index) < count))
+                {
+                    return (int)Object::toNumber(index);
+                }
+                return -1;
+            }
+
+            /* the shape with key added; nullptr if this shape is megamorphic */
+            Shape* transition(State* state, String* key);
+
+            /* the key stored in slot */
+            String* keyAt(size_t slot) const;
+
+            void markForGC(VM* vm);
+    };
+
     class Class: public Object
     {
         private:
@@ -1901,7 +2629,7 @@ namespace lit
             {
                 Class* selfklass;
                 String* name;
-                String* rt;
+                StringBuffer rt;
                 const char* fmtpat;
                 (void)argc;
                 (void)argv;
@@ -1912,38 +2640,26 @@ namespace lit
                 {
                     if(Object::isClass(instance))
                     {
-                        selfklass = fromInstance(instance);
+                        selfklass = Object::as<Class>(instance);
                     }
                     else
                     {
-                        selfklass = Object::as<Class>(instance);
+                        selfklass = Class::getClassFor(Object::asState(vm), instance);
                         fmtpat = "[instance ";
                     }
                     name = selfklass->name;
                 }
                 //return String::format(Object::asState(vm), fmtpat, name->asValue())->asValue();
-                rt = String::make(Object::asState(vm));
-                rt->append(fmtpat);
-                rt->append(name);
-                rt->append("]");
-                return rt->asValue();
+                rt.init(Object::asState(vm));
+                rt.append(fmtpat);
+                rt.append(name);
+                rt.append("]");
+                return rt.toString()->asValue();
             }
 
             static Class* getClassFor(State* state, Value value);
 
-            static Class* make(State* state, String* name)
-            {
-                Class* klass;
-                klass = Object::make<Class>(state, Object::Type::Class);
-                klass->name = name;
-                klass->init_method = nullptr;
-                klass->super = nullptr;
-                klass->methods.init(state);
-                klass->static_fields.init(state);
-                klass->bindMethod("toString", defaultfn_tostring);
-                klass->setStaticMethod("toString", defaultfn_tostring);
-                return klass;
-            }
+            static Class* make(State* state, String* name);
 
             static Class* make(State* state, std::string_view name)
             {
@@ -1965,15 +2681,39 @@ namespace lit
             * that is, eg for String: String <- Object <- Class
             */
             Class* super = nullptr;
+            /* the empty shape new instances start out with */
+            Shape* m_rootshape = nullptr;
+            /* most fields seen on an instance so far; new instances reserve this many slots inline */
+            size_t m_fieldhint = 0;
+            /*
+            * changes whenever methods do, which invalidates inline caches.
+            * drawn from a global counter, so no two classes ever share a version.
+            */
+            uint64_t m_version = 0;
+            /*
+            * like m_version, but for static_fields. only the caches for lookups on
+            * the class itself key on this, so writing a static field leaves the
+            * caches of its instances alone.
+            */
+            uint64_t m_staticversion = 0;
 
         public:
+            /* gives this class a new m_version and m_staticversion; call after changing methods */
+            void invalidate();
 
-        public:
+            /* gives this class a new m_staticversion; call after changing static_fields */
+            void invalidateStatics();
+
+            /*
+            * flattens the method and static tables of superclass into this class.
+            * this runs once, before the class defines its own methods, so those
+            * override inherited ones, and every lookup is a single hashed probe.
+            * methods added to superclass later are not seen by this class.
+            */
             void inheritFrom(Class* superclass)
             {
                 if(superclass != nullptr)
                 {
-                    //fprintf(stderr, "Class(%s)::inheritFrom(%s)\n", name->data(), superclass->name->data());
                     this->super = superclass;
                     if(this->init_method == nullptr)
                     {
@@ -1982,10 +2722,12 @@ namespace lit
                     if(superclass->methods.size() > 0)
                     {
                         this->methods.addAll(superclass->methods);
+                        this->invalidate();
                     }
                     if(superclass->static_fields.size() > 0)
                     {
                         this->static_fields.addAll(superclass->static_fields);
+                        this->invalidateStatics();
                     }
                 }
             }
@@ -1996,11 +2738,13 @@ namespace lit
                 auto m = NativeMethod::make(m_state, method, nm);
                 this->init_method = (Object*)m;
                 this->methods.set(nm, m->asValue());
+                this->invalidate();
             }
 
             void setField(const char* name, Value val)
             {
                 this->static_fields.setField(name, val);
+                this->invalidateStatics();
             }
 
             void bindField(String* nm, NativeMethod::FuncType fnget, NativeMethod::FuncType fnset)
@@ -2009,6 +2753,7 @@ namespace lit
                     Field::make(m_state, nm,
                         (Object*)NativeMethod::make(m_state, fnget, nm),
                         (Object*)NativeMethod::make(m_state, fnset, nm))->asValue());
+                this->invalidate();
             }
 
             void bindField(std::string_view sv, NativeMethod::FuncType fnget, NativeMethod::FuncType fnset)
@@ -2020,6 +2765,7 @@ namespace lit
             void bindMethod(String* nm, NativeMethod::FuncType method)
             {
                 this->methods.set(nm, NativeMethod::make(m_state, method, name)->asValue());
+                this->invalidate();
             }
 
             void bindMethod(std::string_view sv, NativeMethod::FuncType method)
@@ -2032,6 +2778,7 @@ namespace lit
             void bindPrimitive(String* nm, PrimitiveMethod::FuncType method)
             {
                 this->methods.set(nm, PrimitiveMethod::make(m_state, method, nm)->asValue());
+                this->invalidate();
             }
 
             void bindPrimitive(std::string_view sv, PrimitiveMethod::FuncType method)
@@ -2046,6 +2793,7 @@ namespace lit
                     Field::make(m_state, nm,
                         (Object*)NativeMethod::make(m_state, fnget, nm),
                         (Object*)NativeMethod::make(m_state, fnset, nm))->asValue());
+                this->invalidateStatics();
             }
 
             void setStaticField(std::string_view sv, NativeMethod::FuncType fnget, NativeMethod::FuncType fnset)
@@ -2056,27 +2804,32 @@ namespace lit
             void setStaticMethod(String* nm, NativeMethod::FuncType fn)
             {
                 Table::setNativeMethod(this->static_fields, nm, fn);
+                this->invalidateStatics();
             }
 
             void setStaticMethod(std::string_view sv, NativeMethod::FuncType fn)
             {
                 Table::setNativeMethod(this->static_fields, sv, fn);
+                this->invalidateStatics();
             }
 
             void setStaticPrimitive(String* nm, PrimitiveMethod::FuncType fn)
             {
                 Table::setFunctionValue<PrimitiveMethod>(this->static_fields, nm, fn);
+                this->invalidateStatics();
             }
 
             void setStaticPrimitive(std::string_view sv, PrimitiveMethod::FuncType fn)
             {
                 Table::setFunctionValue<PrimitiveMethod>(this->static_fields, sv, fn);
+                this->invalidateStatics();
             }
 
             void setStaticSetter(String* nm, NativeMethod::FuncType fn)
             {
                 this->static_fields.set(nm,
                     Field::make(m_state, nm, nullptr, (Object*)NativeMethod::make(m_state, fn, nm))->asValue());
+                this->invalidateStatics();
             }
 
             void setStaticSetter(std::string_view sv, NativeMethod::FuncType fn)
@@ -2091,6 +2844,7 @@ namespace lit
                     Field::make(m_state, nm,
                         (Object*)NativeMethod::make(m_state, fn, nm),
                         nullptr)->asValue());
+                this->invalidateStatics();
             }
 
             void setStaticGetter(std::string_view sv, NativeMethod::FuncType fn)
@@ -2102,6 +2856,7 @@ namespace lit
             void setGetter(String* nm, NativeMethod::FuncType fn)
             {
                 this->methods.set(nm, Field::make(m_state, nm, NativeMethod::make(m_state, fn, nm), nullptr)->asValue());
+                this->invalidate();
             }
 
             void setGetter(std::string_view sv, NativeMethod::FuncType fn)
@@ -2113,6 +2868,7 @@ namespace lit
             void setSetter(String* nm, NativeMethod::FuncType fn)
             {
                 this->methods.set(nm, Field::make(m_state, nm, nullptr, NativeMethod::make(m_state, fn, nm))->asValue());
+                this->invalidate();
             }
 
             void setSetter(std::string_view sv, NativeMethod::FuncType fn)
@@ -2126,21 +2882,14 @@ namespace lit
     class Instance: public Object
     {
         public:
-            static Instance* make(State* state, Class* klass)
-            {
-                Instance* instance;
-                instance = Object::make<Instance>(state, Object::Type::Instance);
-                instance->klass = klass;
-                instance->fields.init(state);
-                return instance;
-            }
+            static Instance* make(State* state, Class* klass);
 
             static Value getMethod(State* state, Value callee, String* mthname)
             {
                 Value mthval;
                 Class* klass;
                 klass = Class::getClassFor(state, callee);
-                if((Object::isInstance(callee) && Object::as<Instance>(callee)->fields.get(mthname, &mthval)) || klass->methods.get(mthname, &mthval))
+                if((Object::isInstance(callee) && Object::as<Instance>(callee)->getField(mthname, &mthval)) || klass->methods.get(mthname, &mthval))
                 {
                     return mthval;
                 }
@@ -2152,7 +2901,101 @@ namespace lit
         public:
             /* the class that corresponds to this instance */
             Class* klass;
-            Table fields;
+            /* the layout of m_slots, or nullptr if this instance is in dictionary mode */
+            Shape* m_shape;
+            /* field values, indexed by the slot numbers in m_shape */
+            Value* m_slots;
+            /* number of values m_slots can hold */
+            size_t m_slotcapacity;
+            /* number of values allocated inline, right after this object */
+            size_t m_inlinecapacity;
+            /* the fields, once this instance is in dictionary mode */
+            Table m_dictionary;
+
+        private:
+            inline Value* inlineSlots()
+            {
+                return (Value*)(((char*)this) + sizeof(Instance));
+            }
+
+            void growSlots(size_t needed);
+
+            /*
+            * moves all fields into m_dictionary, and drops the shape. this is for fields that no longer
+            * fit a shape (see LIT_SHAPE_MAX_FIELDS and LIT_SHAPE_MAX_TRANSITIONS): such an instance
+            * stays in dictionary mode for good.
+            */
+            void toDictionary();
+
+        public:
+            inline bool isDictionary() const
+            {
+                return (m_shape == nullptr);
+            }
+
+            inline bool getField(String* name, Value* dest) const
+            {
+                int slot;
+                if(m_shape == nullptr)
+                {
+                    return m_dictionary.get(name, dest);
+                }
+                slot = m_shape->lookup(name);
+                if(slot == -1)
+                {
+                    return false;
+                }
+                *dest = m_slots[slot];
+                return true;
+            }
+
+            void setField(String* name, Value value);
+
+            /* stores value in a new slot, moving to next (a transition of m_shape) */
+            void addField(Shape* next, Value value);
+
+            /* in shape mode, moves to the shape the instance would have without the field */
+            bool removeField(String* name);
+
+            inline size_t fieldCount() const
+            {
+                if(m_shape == nullptr)
+                {
+                    return m_dictionary.size();
+                }
+                return m_shape->count;
+            }
+
+            /* same protocol as Table::iterator()/Table::iterKey() */
+            int64_t fieldIterator(int64_t index) const;
+
+            Value fieldIterKey(int64_t index) const;
+
+            template<typename FuncT>
+            void eachField(FuncT fn) const
+            {
+                size_t i;
+                const Shape* shape;
+                if(m_shape == nullptr)
+                {
+                    for(i = 0; i < m_dictionary.capacity(); i++)
+                    {
+                        if(m_dictionary.at(i)->key != nullptr)
+                        {
+                            fn(m_dictionary.at(i)->key, m_dictionary.at(i)->value);
+                        }
+                    }
+                    return;
+                }
+                for(shape = m_shape; shape->parent != nullptr; shape = shape->parent)
+                {
+                    fn(shape->key, m_slots[shape->count - 1]);
+                }
+            }
+
+            void markForGC(VM* vm);
+
+            void release();
     };
 
     class BoundMethod: public Object
@@ -2245,8 +3088,8 @@ namespace lit
         public:
             static void default_error(State* state, const char* message)
             {
-                (void)state;
-                fflush(stdout);
+                state->stdoutwriter.flush();
+                state->stderrwriter.flush();
                 fprintf(stderr, "%s%s%s\n", COLOR_RED, message, COLOR_RESET);
                 fflush(stderr);
             }
@@ -2266,6 +3109,8 @@ namespace lit
 
             static State* make();
 
+            static void init_symbols(State* state);
+
 
         public:
             /* how much was allocated in total? */
@@ -2288,14 +3133,20 @@ namespace lit
             */
             VM* vm;
             bool m_haderror;
-            
-            jmp_buf jump_buffer;
+            /*
+            * where lit_runtime_error_exiting() lands: set up once by each execFiber(), so the innermost
+            * running interpreter loop recovers; nullptr while no script code is running.
+            */
+            jmp_buf* m_nativejump;
 
             Function* api_function;
             Fiber* api_fiber;
             String* api_name;
             /* when using debug routines, this is the writer that output is called on */
             Writer debugwriter;
+            /* buffered writers behind print, printf, STDOUT and STDERR; flushed by State::release() */
+            Writer stdoutwriter;
+            Writer stderrwriter;
             // class class
             // Mental note:
             // When adding another class here, DO NOT forget to mark it in lit_mem.c or it will be GC-ed
@@ -2311,7 +3162,20 @@ namespace lit
             Class* arrayvalue_class = nullptr;
             Class* mapvalue_class = nullptr;
             Class* rangevalue_class = nullptr;
+            /* pre-interned names, indexed by SymbolID. marked as roots. */
+            String* symbols[LITSYM_TOTAL];
             Module* last_module;
+            /* compiled regular expressions by pattern, each wrapped in a Userdata. marked as roots. */
+            Table regexcache;
+            /* parsed format strings by format string, each wrapped in a Userdata. marked as roots. */
+            Table formatcache;
+            /*
+            * Class::m_version of Array and String at the time their native '[]' and '==' were last
+            * found in place. OP_ARRAY_GET, OP_ARRAY_SET and OP_EQUAL_STR skip the method lookup only
+            * while the class still has that version.
+            */
+            uint64_t m_quickarrayversion;
+            uint64_t m_quickstringversion;
 
         public:
             void init(VM* vm);
@@ -2319,18 +3183,22 @@ namespace lit
 
             Fiber* getVMFiber();
 
+            /* does not return if there's an interpreter loop to go back to */
             void native_exit_jump()
             {
-                longjmp(jump_buffer, 1);
+                if(m_nativejump != nullptr)
+                {
+                    longjmp(*m_nativejump, 1);
+                }
             }
 
-            bool set_native_exit_jump()
+            void showDecompiled();
+
+            inline String* symbol(SymbolID id) const
             {
-                return setjmp(jump_buffer);
+                return symbols[id];
             }
 
-            void showDecompiled();
-
             void raiseError(ErrorType type, const char* message, ...);
 
             void releaseAPI();
@@ -2370,6 +3238,16 @@ namespace lit
 
             Result execFiber(Fiber* fiber);
 
+            /* the interpreter loop itself; execFiber() wraps it with the native error landing pad */
+            Result runFiber(Fiber* fiber);
+
+            /* runFiber() over either bytecode (uint8_t) or threaded code (CodeWord) */
+            template<typename CodeT>
+            Result runCode(Fiber* fiber);
+
+            /* runFiber() over register code */
+            Result runRegisters(Fiber* fiber);
+
             Fiber::CallFrame* setupCall(Function* callee, Value* argv, size_t argc);
 
             Result execCall(Fiber::CallFrame* frame);
@@ -2427,22 +3305,32 @@ namespace lit
             State* m_state;
             /* currently held objects */
             Object* objects;
-            /* currently cached strings */
-            Table strings;
+            /* currently interned strings */
+            InternTable strings;
             /* currently loaded/defined modules */
             Map* modules;
-            /* currently defined globals */
-            Map* globals;
+            /* global names, mapped to their slot in globalvalues */
+            Table globalslots;
+            /* values of all globals, indexed by slot. slots are never reused */
+            PCGenericArray<Value> globalvalues;
+            /* the name of each slot */
+            PCGenericArray<String*> globalnames;
             Fiber* fiber;
             // For garbage collection
             size_t gray_count;
             size_t gray_capacity;
             Object** gray_stack;
+            /* slices reached during marking; their parents are marked (or let go) by settleSlices() */
+            PCGenericArray<String*> grayslices;
 
         public:
             void release()
             {
                 this->strings.release();
+                this->globalslots.release();
+                this->globalvalues.release();
+                this->globalnames.release();
+                this->grayslices.release();
                 m_state->releaseObjects(this->objects);
                 this->reset(m_state);
             }
@@ -2456,7 +3344,10 @@ namespace lit
                 this->gray_count = 0;
                 this->gray_capacity = 0;
                 this->strings.init(state);
-                this->globals = nullptr;
+                this->globalslots.init(state);
+                this->globalvalues.init(state);
+                this->globalnames.init(state);
+                this->grayslices.init(state);
                 this->modules = nullptr;
             }
 
@@ -2474,6 +3365,11 @@ namespace lit
                 return rt;
             }
 
+            /* returns the slot of the global name, adding an empty one if needed */
+            size_t globalSlot(String* name);
+
+            bool findGlobalSlot(String* name, size_t* dest);
+
             void closeUpvalues(const Value* last);
 
             bool dispatchCall(Function* function, Closure* closure, uint8_t arg_count);
@@ -2492,6 +3388,8 @@ namespace lit
 
             void traceReferences();
 
+            void settleSlices();
+
             void sweep();
 
             uint64_t collectGarbage();
@@ -2508,6 +3406,7 @@ namespace lit
                 FileIO::binwrite_uint16_t(file, function->upvalue_count);
                 FileIO::binwrite_uint8_t(file, (uint8_t)function->vararg);
                 FileIO::binwrite_uint16_t(file, (uint16_t)function->max_slots);
+                FileIO::binwrite_uint16_t(file, (uint16_t)function->m_registers);
             }
 
             static Function* loadFunction(State* state, FileIO::EmulatedFile* file, Module* module)
@@ -2519,6 +3418,7 @@ namespace lit
                 function->upvalue_count = file->read_euint16_t();
                 function->vararg = (bool)file->read_euint8_t();
                 function->max_slots = file->read_euint16_t();
+                function->m_registers = file->read_euint16_t();
                 return function;
             }
 
@@ -2531,6 +3431,15 @@ namespace lit
                 {
                     FileIO::binwrite_uint8_t(file, chunk->m_code[i]);
                 }
+                FileIO::binwrite_uint16_t(file, (uint16_t)chunk->m_cachecount);
+                /* global slots differ between runs, so they are stored by name */
+                FileIO::binwrite_uint32_t(file, chunk->m_globalsites.m_count);
+                for(i = 0; i < chunk->m_globalsites.m_count; i++)
+                {
+                    c = chunk->m_globalsites.m_values[i];
+                    FileIO::binwrite_uint32_t(file, c);
+                    FileIO::binwrite_string(file, chunk->m_state->vm->globalnames.m_values[(chunk->m_code[c] << 8) | chunk->m_code[c + 1]]);
+                }
                 if(chunk->m_haslineinfo)
                 {
                     c = chunk->m_linecount * 2 + 2;
@@ -2583,6 +3492,8 @@ namespace lit
             {
                 size_t i;
                 size_t count;
+                size_t slot;
+                uint32_t site;
                 uint8_t type;
                 chunk->init(state);
                 count = file->read_euint32_t();
@@ -2593,6 +3504,16 @@ namespace lit
                 {
                     chunk->m_code[i] = file->read_euint8_t();
                 }
+                chunk->m_cachecount = file->read_euint16_t();
+                count = file->read_euint32_t();
+                for(i = 0; i < count; i++)
+                {
+                    site = file->read_euint32_t();
+                    slot = state->vm->globalSlot(file->read_estring(state));
+                    chunk->m_code[site] = (uint8_t)((slot >> 8) & 0xff);
+                    chunk->m_code[site + 1] = (uint8_t)(slot & 0xff);
+                    chunk->m_globalsites.push(site);
+                }
                 count = file->read_euint32_t();
                 if(count > 0)
                 {
@@ -2665,7 +3586,7 @@ namespace lit
                     return nullptr;
                 }
                 bytecode_version = file.read_euint8_t();
-                if(bytecode_version > LIT_BYTECODE_VERSION)
+                if(bytecode_version != LIT_BYTECODE_VERSION)
                 {
                     state->raiseError(COMPILE_ERROR, "Failed to read compiled code, unknown bytecode version '%i'", (int)bytecode_version);
                     return nullptr;
@@ -2761,6 +3682,9 @@ namespace lit
     void lit_ensure_number(VM* vm, Value value, const char* error);
     void lit_ensure_object_type(VM* vm, Value value, Object::Type type, const char* error);
 
+    /* formats $argv by $fmt into $dest (see Format); raises a runtime error if they don't fit. */
+    void lit_format_into(VM* vm, StringBuffer* dest, String* fmt, Value* argv, size_t argc);
+
 
     void lit_trace_frame(Fiber* fiber, Writer* wr);
 
@@ -41,6 +41,7 @@ static int run_repl(lit::State* state)
         }
         add_history(line);
         lit::Result result = state->interpretSource("repl", line, strlen(line));
+        state->stdoutwriter.flush();
         if(result.type == lit::LITRESULT_OK && result.result != lit::Object::NullVal)
         {
             printf("%s%s%s\n", COLOR_GREEN, lit::Object::toString(state, result.result)->data(), COLOR_RESET);
@@ -36,15 +36,38 @@ namespace lit
             case Object::Type::String:
                 {
                     string = (String*)obj;
-                    //LIT_FREE_ARRAY(state, char, string->m_chars, string->length + 1);
-                    delete string->m_chars;
-                    LIT_FREE(state, String, obj);
+                    if(string->m_utfindex != nullptr)
+                    {
+                        Memory::reallocate(state, string->m_utfindex, sizeof(size_t) * ((string->m_utflength / LIT_UTF_INDEX_STRIDE) + 1), 0);
+                    }
+                    if(string->m_chars == string->inlineChars())
+                    {
+                        Memory::reallocate(state, obj, sizeof(String) + string->m_length + 1, 0);
+                    }
+                    else if(string->m_parent != nullptr)
+                    {
+                        /* a slice; the bytes belong to the parent */
+                        LIT_FREE(state, String, obj);
+                    }
+                    else
+                    {
+                        /* a rope or a detached slice; the buffer (if any) is separate */
+                        if(string->m_chars != nullptr)
+                        {
+                            Memory::reallocate(state, (void*)string->m_chars, string->m_length + 1, 0);
+                        }
+                        LIT_FREE(state, String, obj);
+                    }
                 }
                 break;
 
             case Object::Type::Function:
                 {
                     function = (Function*)obj;
+                    if(function->m_threaded != nullptr)
+                    {
+                        LIT_FREE_ARRAY(state, CodeWord, function->m_threaded, function->chunk.m_count);
+                    }
                     function->chunk.release();
                     LIT_FREE(state, Function, obj);
                 }
@@ -101,14 +124,14 @@ namespace lit
                     Class* klass = (Class*)obj;
                     klass->methods.release();
                     klass->static_fields.release();
+                    Shape::release(state, klass->m_rootshape);
                     LIT_FREE(state, Class, obj);
                 }
                 break;
 
             case Object::Type::Instance:
                 {
-                    ((Instance*)obj)->fields.release();
-                    LIT_FREE(state, Instance, obj);
+                    ((Instance*)obj)->release();
                 }
                 break;
             case Object::Type::BoundMethod:
@@ -176,7 +199,7 @@ namespace lit
         if(Object::isInstance(a))
         {
             args[0] = b;
-            inret = Instance::callMethod(state, a, String::intern(state, "=="), args, 1);
+            inret = Instance::callMethod(state, a, state->symbol(LITSYM_EQUAL), args, 1);
             if(inret.type == LITRESULT_OK)
             {
                 if(Object::fromBool(inret.result) == Object::TrueVal)
@@ -186,6 +209,11 @@ namespace lit
                 return false;
             }
         }
+        if(Object::isString(a) && Object::isString(b))
+        {
+            /* ropes are not interned, so identity alone is not enough */
+            return String::equal(state, Object::as<String>(a), Object::as<String>(b));
+        }
         return (a == b);
     }
 
@@ -258,6 +286,173 @@ namespace lit
         return String::format(vm->m_state, "[function $]", name->data());
     }
 
+    /* the containers writeValue() is inside of, innermost first. lives on the C stack. */
+    struct WriteVisit
+    {
+        Object* object;
+        WriteVisit* parent;
+    };
+
+    static bool object_isvisiting(WriteVisit* visit, Object* object)
+    {
+        for(; visit != nullptr; visit = visit->parent)
+        {
+            if(visit->object == object)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* whether $value's toString() is still the builtin one, which writeValue() can do by itself */
+    static bool object_hasbuiltintostring(State* state, Value value)
+    {
+        Value method;
+        if(!Class::getClassFor(state, value)->methods.get(state->symbol(LITSYM_TOSTRING), &method))
+        {
+            return false;
+        }
+        return Object::isNativeMethod(method);
+    }
+
+    static void object_writevalue(State* state, Writer* wr, Value value, WriteVisit* parent);
+
+    static void object_writearray(State* state, Writer* wr, Array* array, WriteVisit* parent)
+    {
+        size_t i;
+        Value element;
+        WriteVisit visit;
+        if(array->m_actualarray.m_count == 0)
+        {
+            wr->put("[]");
+            return;
+        }
+        visit.object = array;
+        visit.parent = parent;
+        wr->put("[");
+        /* an element's toString() may change the array, so its size is read on every step */
+        for(i = 0; i < array->m_actualarray.m_count; i++)
+        {
+            if(i > 0)
+            {
+                wr->put(", ");
+            }
+            element = array->m_actualarray.m_values[i];
+            if(Object::isArray(element) && object_isvisiting(&visit, Object::asObject(element)))
+            {
+                wr->put("(recursion)");
+            }
+            else
+            {
+                object_writevalue(state, wr, element, &visit);
+            }
+        }
+        wr->put(" ]");
+    }
+
+    static void object_writemap(State* state, Writer* wr, Map* map, WriteVisit* parent)
+    {
+        size_t index;
+        size_t count;
+        Value field;
+        String* key;
+        Table::Entry* entry;
+        WriteVisit visit;
+        if(map->size() == 0)
+        {
+            wr->put("{}");
+            return;
+        }
+        visit.object = map;
+        visit.parent = parent;
+        #ifdef SINGLE_LINE_MAPS
+        wr->put("{ ");
+        #else
+        wr->put("{\n");
+        #endif
+        count = 0;
+        index = 0;
+        while(count < LIT_CONTAINER_OUTPUT_MAX && index < map->capacity())
+        {
+            entry = map->at(index++);
+            if(entry->key == nullptr)
+            {
+                continue;
+            }
+            if(count > 0)
+            {
+                #ifdef SINGLE_LINE_MAPS
+                wr->put(", ");
+                #else
+                wr->put(",\n");
+                #endif
+            }
+            key = entry->key;
+            #ifndef SINGLE_LINE_MAPS
+            wr->put('\t');
+            #endif
+            wr->put(key->data(), key->length());
+            wr->put(": ");
+            /* maps behind an index function (such as Module.privates) are read through it */
+            field = (map->m_indexfn != nullptr) ? map->m_indexfn(state->vm, map, key, nullptr) : entry->value;
+            if(Object::isMap(field) && Object::as<Map>(field)->m_indexfn != nullptr)
+            {
+                wr->put("map");
+            }
+            else if(Object::isMap(field) && object_isvisiting(&visit, Object::asObject(field)))
+            {
+                wr->put("(recursion)");
+            }
+            else
+            {
+                object_writevalue(state, wr, field, &visit);
+            }
+            count++;
+        }
+        #ifdef SINGLE_LINE_MAPS
+        wr->put(" }");
+        #else
+        wr->put("\n}");
+        #endif
+    }
+
+    static void object_writevalue(State* state, Writer* wr, Value value, WriteVisit* parent)
+    {
+        size_t length;
+        String* string;
+        char buffer[LIT_NUMBER_BUFFER_SIZE];
+        if(Object::isString(value))
+        {
+            string = Object::as<String>(value);
+            wr->put(string->data(), string->length());
+        }
+        else if(Object::isNumber(value))
+        {
+            length = String::formatNumber(buffer, Object::toNumber(value));
+            wr->put(buffer, length);
+        }
+        else if(Object::isArray(value) && object_hasbuiltintostring(state, value))
+        {
+            object_writearray(state, wr, Object::as<Array>(value), parent);
+        }
+        else if(Object::isMap(value) && object_hasbuiltintostring(state, value))
+        {
+            object_writemap(state, wr, Object::as<Map>(value), parent);
+        }
+        else
+        {
+            /* everything else may have a toString() written in script */
+            string = Object::toString(state, value);
+            wr->put(string->data(), string->length());
+        }
+    }
+
+    void Object::writeValue(State* state, Writer* wr, Value value)
+    {
+        object_writevalue(state, wr, value, nullptr);
+    }
+
     String* Object::toString(State* state, Value valobj)
     {
         Value* slot;
@@ -267,6 +462,7 @@ namespace lit
         Chunk* chunk;
         Fiber::CallFrame* frame;
         Result result;
+        Writer wr;
         if(Object::isString(valobj))
         {
             return Object::as<String>(valobj);
@@ -296,6 +492,13 @@ namespace lit
             }
             return Object::toString(state, *slot);
         }
+        else if((Object::isArray(valobj) || Object::isMap(valobj)) && object_hasbuiltintostring(state, valobj))
+        {
+            /* no need to go through the interpreter for these */
+            wr.initString(state);
+            Object::writeValue(state, &wr, valobj);
+            return wr.asString();
+        }
         vm = state->vm;
         fiber = vm->fiber;
         if(Fiber::ensureFiber(vm, fiber))
@@ -314,7 +517,8 @@ namespace lit
             function->max_slots = 3;
             chunk->putChunk(OP_INVOKE, 1);
             chunk->emit_byte(0);
-            chunk->emit_short(chunk->addConstant(String::internValue(state, "toString")));
+            chunk->emit_short(chunk->addConstant(state->symbol(LITSYM_TOSTRING)->asValue()));
+            chunk->emit_short(chunk->addCache());
             chunk->emit_byte(OP_RETURN);
         }
         fiber->ensure_stack(function->max_slots + (int)(fiber->m_stacktop - fiber->m_stackdata));
@@ -374,7 +578,7 @@ namespace lit
         had_before = false;
         if(size > 0)
         {
-            for(i = 0; i < (size_t)map->size(); i++)
+            for(i = 0; i < (size_t)map->capacity(); i++)
             {
                 entry = map->at(i);
                 if(entry->key != nullptr)
@@ -410,6 +614,51 @@ namespace lit
         }
     }
 
+    void Object::printInstance(State* state, Writer* wr, Instance* inst)
+    {
+        bool had_before;
+        wr->format("(%u) {", (unsigned int)inst->fieldCount());
+        had_before = false;
+        inst->eachField([&](String* key, Value value)
+        {
+            wr->put(had_before ? ", " : " ");
+            wr->format("%s = ", key->data());
+            if(Object::isInstance(value) && (inst == Object::as<Instance>(value)))
+            {
+                wr->put("(recursion)");
+            }
+            else
+            {
+                Object::print(state, wr, value);
+            }
+            had_before = true;
+        });
+        wr->put(had_before ? " }" : "}");
+    }
+
+    void Object::print(State* state, Writer* wr, Value value)
+    {
+        size_t length;
+        char buffer[LIT_NUMBER_BUFFER_SIZE];
+        if(Object::isBool(value))
+        {
+            wr->put(Object::asBool(value) ? "true" : "false");
+        }
+        else if(Object::isNull(value))
+        {
+            wr->put("null");
+        }
+        else if(Object::isNumber(value))
+        {
+            length = String::formatNumber(buffer, Object::toNumber(value));
+            wr->put(buffer, length);
+        }
+        else if(Object::isObject(value))
+        {
+            printObject(state, wr, value);
+        }
+    }
+
     void Object::printObject(State* state, Writer* wr, Value value)
     {
         size_t size;
@@ -426,7 +675,7 @@ namespace lit
             {
                 case Object::Type::String:
                     {
-                        wr->format("%s", Object::asString(value)->data());
+                        wr->put(Object::asString(value)->data(), Object::asString(value)->length());
                     }
                     break;
                 case Object::Type::Function:
@@ -498,9 +747,7 @@ namespace lit
                         printf("%s instance", Object::as<Instance>(value)->klass->name->data());
                         */
                         wr->format("[instance '%s' ", Object::as<Instance>(value)->klass->name->data());
-                        map = Object::as<Map>(value);
-                        size = map->size();
-                        printMap(state, wr, map, size);
+                        printInstance(state, wr, Object::as<Instance>(value));
                         wr->put("]");
                     }
                     break;
@@ -540,7 +787,9 @@ namespace lit
                 case Object::Type::Range:
                     {
                         range = Object::as<Range>(value);
-                        wr->format("%g .. %g", range->from, range->to);
+                        Object::print(state, wr, Object::toValue(range->from));
+                        wr->put(" .. ");
+                        Object::print(state, wr, Object::toValue(range->to));
                     }
                     break;
                 case Object::Type::Field:
@@ -585,6 +834,9 @@ namespace lit
         function->max_slots = 0;
         function->module = mod;
         function->vararg = false;
+        function->m_hotness = 0;
+        function->m_threaded = nullptr;
+        function->m_registers = 0;
         return function;
     }
 
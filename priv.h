@@ -4,6 +4,14 @@
 
 #define LIT_LONGEST_OP_NAME 13
 
+/*
+* visual studio doesn't support computed gotos, so
+* the interpreters use a switch-case there instead.
+*/
+#if !defined(_MSC_VER)
+    #define LIT_USE_COMPUTEDGOTO
+#endif
+
 #define LIT_OPCODE_SIZE 0x3f
 #define LIT_A_ARG_SIZE 0xff
 #define LIT_B_ARG_SIZE 0x1ff
@@ -58,6 +66,12 @@
 	| ((abs((int) (sbx)) & LIT_SBX_ARG_SIZE) << LIT_SBX_ARG_POSITION)) \
 	| ((((sbx) < 0 ? 1 : 0) << LIT_SBX_FLAG_POSITION))
 
+/* a B or C operand of register code with this bit set is a constant index, not a register */
+#define LIT_RK_CONSTANT 0x100
+#define LIT_RK_MAX_INDEX 0xff
+/* slots a register frame keeps past its registers, for the receiver and argument of an operator method */
+#define LIT_REG_SCRATCH_SLOTS 2
+
 
 
 namespace lit
@@ -76,6 +90,13 @@ namespace lit
         #undef OPCODE
     };
 
+    enum RegOpCode
+    {
+        #define REGOP(name, type) ROP_##name,
+        #include "regopcode.inc"
+        #undef REGOP
+    };
+
     enum TokenType
     {
         LITTOK_NEW_LINE,
@@ -213,6 +234,8 @@ namespace lit
         LITOPTSTATE_LINE_INFO,
         LITOPTSTATE_PRIVATE_NAMES,
         LITOPTSTATE_C_FOR,
+        LITOPTSTATE_SUPERINSTRUCTIONS,
+        LITOPTSTATE_REGISTERS,
 
         LITOPTSTATE_TOTAL
     };
@@ -749,7 +772,8 @@ namespace lit
             public:
                 struct CCUpvalue
                 {
-                    uint8_t index;
+                    /* a local slot of the enclosing function, or one of its upvalues */
+                    uint16_t index;
                     bool isLocal;
                 };
 
@@ -759,6 +783,8 @@ namespace lit
                 Function* function;
                 FunctionType type;
                 CCUpvalue upvalues[UINT8_COUNT];
+                /* set once the upvalue limit has been reported, so that later captures don't report it again */
+                bool upvalues_full;
                 Compiler* enclosing;
                 bool skip_return;
                 size_t loop_depth;
@@ -978,6 +1004,8 @@ namespace lit
                 void emit_arged_op(uint16_t line, OpCode op, uint8_t arg);
                 void emit_short(uint16_t line, uint16_t value);
                 void emit_byte_or_short(uint16_t line, uint8_t a, uint8_t b, uint16_t index);
+                void emit_cache(uint16_t line);
+                void emit_global(uint16_t line, OpCode op, String* name);
                 const char* getStateScannerFilename();
                 void init_compiler(Compiler* compiler, FunctionType type);
                 void emit_return(size_t line);
@@ -990,7 +1018,7 @@ namespace lit
                 int resolve_private(const char* name, size_t length, size_t line);
                 int add_local(const char* name, size_t length, size_t line, bool constant);
                 int resolve_local(Compiler* compiler, const char* name, size_t length, size_t line);
-                int add_upvalue(Compiler* compiler, uint8_t index, size_t line, bool is_local);
+                int add_upvalue(Compiler* compiler, uint16_t index, size_t line, bool is_local);
                 int resolve_upvalue(Compiler* compiler, const char* name, size_t length, size_t line);
                 void mark_local_initialized(size_t index);
                 void mark_private_initialized(size_t index);
@@ -1005,6 +1033,68 @@ namespace lit
                 Module* run_emitter(Expression::List& statements, String* module_name);
 
         };
+
+        /*
+        * compiles a function to register code (see regopcode.inc) rather than bytecode.
+        * it covers locals, arithmetic, comparisons, control flow, and calls of named functions;
+        * anything else (upvalues, fields, methods, nested functions, ...) makes compile() return
+        * nullptr, and the function is left to the Emitter.
+        */
+        class RegEmitter
+        {
+            public:
+                State* m_state = nullptr;
+                Emitter* m_emitter = nullptr;
+                Function* m_function = nullptr;
+                Chunk* m_chunk = nullptr;
+                /* register i + 1 holds local i; register 0 holds the function itself */
+                PCGenericArray<Local> m_locals;
+                PCGenericArray<size_t> m_breaks;
+                PCGenericArray<size_t> m_continues;
+                size_t m_freereg = 0;
+                size_t m_maxreg = 0;
+                size_t m_lastline = 0;
+                int m_depth = 0;
+                int m_loopdepth = 0;
+
+            public:
+                void init(State* state, Emitter* emitter);
+                void release();
+                size_t here();
+                size_t emit(size_t line, uint32_t instruction);
+                size_t emit_abc(size_t line, RegOpCode op, int a, int b, int c);
+                size_t emit_abx(size_t line, RegOpCode op, int a, size_t bx);
+                size_t emit_jump(size_t line, RegOpCode op, int a);
+                bool emit_global(size_t line, RegOpCode op, int a, const char* name, size_t length);
+                bool patch_jump(size_t at, size_t target);
+                bool patch_jumps(PCGenericArray<size_t>* jumps, size_t from, size_t target);
+                int alloc_register();
+                size_t local_top();
+                bool is_scratch(int reg);
+                void begin_scope();
+                void end_scope();
+                int add_local(const char* name, size_t length, bool constant);
+                int resolve_local(const char* name, size_t length);
+                bool is_upvalue(const char* name, size_t length);
+                int resolve_private(const char* name, size_t length, bool assigning);
+                int constant_index(Value value);
+                int emit_rk(Expression* expression);
+                bool emit_operands(ExprBinary* expression, int* b, int* c);
+                int emit_variable(ExprVar* expression, int dest);
+                int emit_assign(ExprAssign* expression, int dest);
+                int emit_binary(ExprBinary* expression, int dest);
+                int emit_logical(ExprBinary* expression, int dest);
+                int emit_call(ExprCall* expression, int dest);
+                int emit_ternary(ExprIfClause* expression, int dest);
+                int emit_expression_inner(Expression* expression, int dest);
+                int emit_expression(Expression* expression, int dest);
+                long emit_condjump(Expression* condition, bool when);
+                bool emit_if(StmtIfClause* statement);
+                bool emit_while(StmtWhileLoop* statement);
+                bool emit_for(StmtForLoop* statement);
+                bool emit_statement(Expression* statement);
+                Function* compile(StmtFunction* statement, String* name);
+        };
     }
     // endast
 }
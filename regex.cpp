@@ -0,0 +1,1494 @@
+#include "lit.h"
+
+/*
+* supported syntax:
+*   literals (utf-8 is fine), .  [abc] [^a-z] [éü]  \d \w \s \D \W \S  \b \B  ^ $
+*   (group) (?:group)  a|b  * + ? {n} {n,} {n,m}, and their lazy forms *? +? ?? {n,m}?
+*   \n \t \r \f \v \0 \xHH, and escaped punctuation.
+*   a leading (?i) makes the whole pattern case-insensitive (ascii letters only).
+* ^ and $ match at the start and end of the subject only. there are no backreferences.
+*/
+
+/* limits that keep hostile patterns from exhausting memory or the C stack */
+#define LIT_REGEX_MAX_PROGRAM 20000
+#define LIT_REGEX_MAX_REPEAT 1000
+#define LIT_REGEX_MAX_NESTING 250
+/* dfa states kept per regex; past this the cache is flushed, and after enough flushes the dfa is given up */
+#define LIT_REGEX_DFA_MAX_STATES 1024
+#define LIT_REGEX_DFA_MAX_FLUSHES 8
+
+namespace lit
+{
+    using Regex = String::Regex;
+
+    struct String::Regex::DfaState
+    {
+        int* pcs;
+        size_t count;
+        uint32_t hash;
+        bool matching;
+        bool pendingeol;
+        int next[256];
+    };
+
+    enum class RegexNodeType
+    {
+        Empty,
+        Byte,
+        Set,
+        Cat,
+        Alt,
+        Repeat,
+        Group,
+        Bol,
+        Eol,
+        WordBoundary,
+        NotWordBoundary,
+    };
+
+    struct RegexNode
+    {
+        RegexNodeType type;
+        int left;
+        int right;
+        /* the byte, set index or group index */
+        int value;
+        int min;
+        /* -1 for no upper bound */
+        int max;
+        bool greedy;
+        /* for Set: also matches any non-ascii code point */
+        bool multibyte;
+    };
+
+    /* the predefined sets that describe utf-8 sequences */
+    enum
+    {
+        REGEX_SET_CONT,
+        REGEX_SET_LEAD2,
+        REGEX_SET_LEAD3,
+        REGEX_SET_LEAD4,
+    };
+
+    static void* regex_realloc(State* state, void* ptr, size_t oldsize, size_t newsize)
+    {
+        /* regex work happens in the middle of native calls holding unrooted values */
+        return Memory::reallocateNoCollect(state, ptr, oldsize, newsize);
+    }
+
+    static inline bool regex_setHas(const Regex::ByteSet& set, uint8_t byte)
+    {
+        return (set.bits[byte >> 3] & (1 << (byte & 7))) != 0;
+    }
+
+    static inline void regex_setAdd(Regex::ByteSet& set, uint8_t byte)
+    {
+        set.bits[byte >> 3] |= (1 << (byte & 7));
+    }
+
+    static void regex_setAddRange(Regex::ByteSet& set, int from, int to)
+    {
+        int i;
+        for(i = from; i <= to; i++)
+        {
+            regex_setAdd(set, (uint8_t)i);
+        }
+    }
+
+    static inline bool regex_isWord(uint8_t byte)
+    {
+        return (
+            (byte >= 'a' && byte <= 'z') ||
+            (byte >= 'A' && byte <= 'Z') ||
+            (byte >= '0' && byte <= '9') ||
+            (byte == '_')
+        );
+    }
+
+    static int regex_utfSequenceLength(uint8_t lead)
+    {
+        if((lead & 0xE0) == 0xC0)
+        {
+            return 2;
+        }
+        if((lead & 0xF0) == 0xE0)
+        {
+            return 3;
+        }
+        if((lead & 0xF8) == 0xF0)
+        {
+            return 4;
+        }
+        return 1;
+    }
+
+    class RegexCompiler
+    {
+        public:
+            State* m_state;
+            Regex* m_regex;
+            const char* m_pattern;
+            size_t m_length;
+            size_t m_pos;
+            size_t m_depth;
+            bool m_icase;
+            const char* m_error;
+            PCGenericArray<RegexNode> m_nodes;
+
+        public:
+            void init(State* state, Regex* regex, const char* pattern, size_t length)
+            {
+                m_state = state;
+                m_regex = regex;
+                m_pattern = pattern;
+                m_length = length;
+                m_pos = 0;
+                m_depth = 0;
+                m_icase = false;
+                m_error = nullptr;
+                m_nodes.init(state);
+            }
+
+            void release()
+            {
+                m_nodes.release();
+            }
+
+            bool fail(const char* message)
+            {
+                if(m_error == nullptr)
+                {
+                    m_error = message;
+                }
+                return false;
+            }
+
+            int node(RegexNodeType type, int left = -1, int right = -1, int value = 0)
+            {
+                RegexNode n;
+                n.type = type;
+                n.left = left;
+                n.right = right;
+                n.value = value;
+                n.min = 0;
+                n.max = 0;
+                n.greedy = true;
+                n.multibyte = false;
+                m_nodes.push(n);
+                return (int)m_nodes.size() - 1;
+            }
+
+            int addSet(const Regex::ByteSet& set)
+            {
+                m_regex->m_sets.push(set);
+                return (int)m_regex->m_sets.size() - 1;
+            }
+
+            int setNode(const Regex::ByteSet& set, bool multibyte)
+            {
+                int n;
+                n = node(RegexNodeType::Set, -1, -1, addSet(set));
+                m_nodes.at(n).multibyte = multibyte;
+                return n;
+            }
+
+            /* a literal byte; letters become a two-byte set when matching case-insensitively */
+            int byteNode(uint8_t byte)
+            {
+                Regex::ByteSet set;
+                if(m_icase && ((byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z')))
+                {
+                    memset(&set, 0, sizeof(set));
+                    regex_setAdd(set, byte | 0x20);
+                    regex_setAdd(set, byte & ~0x20);
+                    return setNode(set, false);
+                }
+                return node(RegexNodeType::Byte, -1, -1, byte);
+            }
+
+            int cat(int left, int right)
+            {
+                if(left < 0 || m_nodes.at(left).type == RegexNodeType::Empty)
+                {
+                    return right;
+                }
+                return node(RegexNodeType::Cat, left, right);
+            }
+
+            /* the bytes of the utf-8 sequence starting at the current position */
+            int sequenceNode()
+            {
+                int i;
+                int n;
+                int len;
+                len = regex_utfSequenceLength(m_pattern[m_pos]);
+                if(m_pos + len > m_length)
+                {
+                    len = m_length - m_pos;
+                }
+                n = -1;
+                for(i = 0; i < len; i++)
+                {
+                    n = cat(n, node(RegexNodeType::Byte, -1, -1, (uint8_t)m_pattern[m_pos + i]));
+                }
+                m_pos += len;
+                return n;
+            }
+
+            /* \d, \w, \s and their negations. returns false if $ch isn't one of them */
+            bool classEscape(char ch, Regex::ByteSet& set, bool* multibyte)
+            {
+                Regex::ByteSet tmp;
+                size_t i;
+                memset(&tmp, 0, sizeof(tmp));
+                switch(ch)
+                {
+                    case 'd':
+                    case 'D':
+                        regex_setAddRange(tmp, '0', '9');
+                        break;
+                    case 'w':
+                    case 'W':
+                        regex_setAddRange(tmp, 'a', 'z');
+                        regex_setAddRange(tmp, 'A', 'Z');
+                        regex_setAddRange(tmp, '0', '9');
+                        regex_setAdd(tmp, '_');
+                        break;
+                    case 's':
+                    case 'S':
+                        regex_setAdd(tmp, ' ');
+                        regex_setAddRange(tmp, '\t', '\r');
+                        break;
+                    default:
+                        return false;
+                }
+                if(ch == 'D' || ch == 'W' || ch == 'S')
+                {
+                    /* the negated classes include every non-ascii code point */
+                    for(i = 0; i < 16; i++)
+                    {
+                        tmp.bits[i] = ~tmp.bits[i];
+                    }
+                    *multibyte = true;
+                }
+                for(i = 0; i < 16; i++)
+                {
+                    set.bits[i] |= tmp.bits[i];
+                }
+                return true;
+            }
+
+            /* single-character escapes; returns -1 for an unknown letter */
+            int charEscape()
+            {
+                int i;
+                int digit;
+                int value;
+                char ch;
+                ch = m_pattern[m_pos++];
+                switch(ch)
+                {
+                    case 'n': return '\n';
+                    case 't': return '\t';
+                    case 'r': return '\r';
+                    case 'f': return '\f';
+                    case 'v': return '\v';
+                    case '0': return '\0';
+                    case 'x':
+                        {
+                            value = 0;
+                            for(i = 0; i < 2; i++)
+                            {
+                                if(m_pos >= m_length || !isxdigit((uint8_t)m_pattern[m_pos]))
+                                {
+                                    fail("\\x needs two hex digits");
+                                    return -1;
+                                }
+                                ch = m_pattern[m_pos++];
+                                digit = isdigit((uint8_t)ch) ? (ch - '0') : ((ch | 0x20) - 'a' + 10);
+                                value = (value * 16) + digit;
+                            }
+                            return value;
+                        }
+                    default:
+                        break;
+                }
+                if(ch >= '1' && ch <= '9')
+                {
+                    fail("backreferences are not supported");
+                    return -1;
+                }
+                if(isalnum((uint8_t)ch))
+                {
+                    fail("unknown escape sequence");
+                    return -1;
+                }
+                return (uint8_t)ch;
+            }
+
+            int parseClass()
+            {
+                int lo;
+                int hi;
+                int n;
+                int extra;
+                size_t i;
+                bool negate;
+                bool first;
+                bool multibyte;
+                Regex::ByteSet set;
+                memset(&set, 0, sizeof(set));
+                negate = false;
+                multibyte = false;
+                extra = -1;
+                if(m_pos < m_length && m_pattern[m_pos] == '^')
+                {
+                    negate = true;
+                    m_pos++;
+                }
+                first = true;
+                while(true)
+                {
+                    if(m_pos >= m_length)
+                    {
+                        fail("missing ]");
+                        return -1;
+                    }
+                    if(m_pattern[m_pos] == ']' && !first)
+                    {
+                        m_pos++;
+                        break;
+                    }
+                    first = false;
+                    if((uint8_t)m_pattern[m_pos] >= 0x80)
+                    {
+                        /* non-ascii members are matched as whole sequences, next to the set */
+                        n = sequenceNode();
+                        extra = (extra < 0) ? n : node(RegexNodeType::Alt, extra, n);
+                        if(m_pos < m_length && m_pattern[m_pos] == '-' && (m_pos + 1) < m_length && m_pattern[m_pos + 1] != ']')
+                        {
+                            fail("ranges of non-ascii characters are not supported");
+                            return -1;
+                        }
+                        continue;
+                    }
+                    if(m_pattern[m_pos] == '\\' && (m_pos + 1) < m_length)
+                    {
+                        m_pos++;
+                        if(classEscape(m_pattern[m_pos], set, &multibyte))
+                        {
+                            m_pos++;
+                            continue;
+                        }
+                        lo = charEscape();
+                        if(lo < 0)
+                        {
+                            return -1;
+                        }
+                    }
+                    else
+                    {
+                        lo = (uint8_t)m_pattern[m_pos++];
+                    }
+                    hi = lo;
+                    if((m_pos + 1) < m_length && m_pattern[m_pos] == '-' && m_pattern[m_pos + 1] != ']')
+                    {
+                        m_pos++;
+                        if(m_pattern[m_pos] == '\\' && (m_pos + 1) < m_length)
+                        {
+                            m_pos++;
+                            hi = charEscape();
+                            if(hi < 0)
+                            {
+                                return -1;
+                            }
+                        }
+                        else
+                        {
+                            hi = (uint8_t)m_pattern[m_pos++];
+                        }
+                        if(hi >= 0x80)
+                        {
+                            fail("ranges of non-ascii characters are not supported");
+                            return -1;
+                        }
+                        if(hi < lo)
+                        {
+                            fail("invalid range in character class");
+                            return -1;
+                        }
+                    }
+                    regex_setAddRange(set, lo, hi);
+                }
+                if(m_icase)
+                {
+                    for(lo = 'a'; lo <= 'z'; lo++)
+                    {
+                        if(regex_setHas(set, lo) || regex_setHas(set, lo & ~0x20))
+                        {
+                            regex_setAdd(set, lo);
+                            regex_setAdd(set, lo & ~0x20);
+                        }
+                    }
+                }
+                if(negate)
+                {
+                    if(extra >= 0)
+                    {
+                        fail("non-ascii characters in negated classes are not supported");
+                        return -1;
+                    }
+                    for(i = 0; i < 16; i++)
+                    {
+                        set.bits[i] = ~set.bits[i];
+                    }
+                    multibyte = !multibyte;
+                }
+                n = setNode(set, multibyte);
+                if(extra >= 0)
+                {
+                    n = node(RegexNodeType::Alt, n, extra);
+                }
+                return n;
+            }
+
+            bool parseNumber(int* dest)
+            {
+                int value;
+                if(m_pos >= m_length || !isdigit((uint8_t)m_pattern[m_pos]))
+                {
+                    return false;
+                }
+                value = 0;
+                while(m_pos < m_length && isdigit((uint8_t)m_pattern[m_pos]))
+                {
+                    value = (value * 10) + (m_pattern[m_pos++] - '0');
+                    if(value > LIT_REGEX_MAX_REPEAT)
+                    {
+                        value = LIT_REGEX_MAX_REPEAT + 1;
+                    }
+                }
+                *dest = value;
+                return true;
+            }
+
+            /* {n}, {n,} or {n,m}. anything else leaves the position alone, and '{' is a literal. */
+            bool parseBraces(int* min, int* max)
+            {
+                size_t start;
+                start = m_pos;
+                m_pos++;
+                if(!parseNumber(min))
+                {
+                    m_pos = start;
+                    return false;
+                }
+                *max = *min;
+                if(m_pos < m_length && m_pattern[m_pos] == ',')
+                {
+                    m_pos++;
+                    if(!parseNumber(max))
+                    {
+                        *max = -1;
+                    }
+                }
+                if(m_pos >= m_length || m_pattern[m_pos] != '}')
+                {
+                    m_pos = start;
+                    return false;
+                }
+                m_pos++;
+                return true;
+            }
+
+            int parseAtom()
+            {
+                int n;
+                int byte;
+                size_t group;
+                bool multibyte;
+                char ch;
+                Regex::ByteSet set;
+                ch = m_pattern[m_pos];
+                switch(ch)
+                {
+                    case '(':
+                        {
+                            m_pos++;
+                            if(++m_depth > LIT_REGEX_MAX_NESTING)
+                            {
+                                fail("pattern nests too deeply");
+                                return -1;
+                            }
+                            group = 0;
+                            if(m_pos < m_length && m_pattern[m_pos] == '?')
+                            {
+                                if((m_pos + 1) < m_length && m_pattern[m_pos + 1] == ':')
+                                {
+                                    m_pos += 2;
+                                }
+                                else
+                                {
+                                    fail("unsupported group syntax");
+                                    return -1;
+                                }
+                            }
+                            else
+                            {
+                                group = m_regex->m_groups++;
+                                if(group > LIT_REGEX_MAX_GROUPS)
+                                {
+                                    fail("too many capture groups");
+                                    return -1;
+                                }
+                            }
+                            n = parseAlternation();
+                            if(n < 0)
+                            {
+                                return -1;
+                            }
+                            if(m_pos >= m_length || m_pattern[m_pos] != ')')
+                            {
+                                fail("missing )");
+                                return -1;
+                            }
+                            m_pos++;
+                            m_depth--;
+                            if(group > 0)
+                            {
+                                n = node(RegexNodeType::Group, n, -1, group);
+                            }
+                            return n;
+                        }
+                    case '[':
+                        m_pos++;
+                        return parseClass();
+                    case '.':
+                        {
+                            m_pos++;
+                            memset(&set, 0, sizeof(set));
+                            regex_setAddRange(set, 0, 0x7F);
+                            set.bits['\n' >> 3] &= ~(1 << ('\n' & 7));
+                            return setNode(set, true);
+                        }
+                    case '^':
+                        m_pos++;
+                        return node(RegexNodeType::Bol);
+                    case '$':
+                        m_pos++;
+                        return node(RegexNodeType::Eol);
+                    case '*':
+                    case '+':
+                    case '?':
+                        fail("nothing to repeat");
+                        return -1;
+                    case '\\':
+                        {
+                            m_pos++;
+                            if(m_pos >= m_length)
+                            {
+                                fail("trailing backslash");
+                                return -1;
+                            }
+                            ch = m_pattern[m_pos];
+                            if(ch == 'b' || ch == 'B')
+                            {
+                                m_pos++;
+                                return node((ch == 'b') ? RegexNodeType::WordBoundary : RegexNodeType::NotWordBoundary);
+                            }
+                            memset(&set, 0, sizeof(set));
+                            multibyte = false;
+                            if(classEscape(ch, set, &multibyte))
+                            {
+                                m_pos++;
+                                return setNode(set, multibyte);
+                            }
+                            byte = charEscape();
+                            if(byte < 0)
+                            {
+                                return -1;
+                            }
+                            return byteNode(byte);
+                        }
+                    default:
+                        break;
+                }
+                if((uint8_t)ch >= 0x80)
+                {
+                    return sequenceNode();
+                }
+                m_pos++;
+                return byteNode(ch);
+            }
+
+            int parseRepeat()
+            {
+                int n;
+                int min;
+                int max;
+                char ch;
+                n = parseAtom();
+                while(n >= 0 && m_pos < m_length)
+                {
+                    ch = m_pattern[m_pos];
+                    if(ch == '*')
+                    {
+                        min = 0;
+                        max = -1;
+                        m_pos++;
+                    }
+                    else if(ch == '+')
+                    {
+                        min = 1;
+                        max = -1;
+                        m_pos++;
+                    }
+                    else if(ch == '?')
+                    {
+                        min = 0;
+                        max = 1;
+                        m_pos++;
+                    }
+                    else if(ch == '{' && parseBraces(&min, &max))
+                    {
+                        if(min > LIT_REGEX_MAX_REPEAT || max > LIT_REGEX_MAX_REPEAT)
+                        {
+                            fail("repetition count is too large");
+                            return -1;
+                        }
+                        if(max >= 0 && max < min)
+                        {
+                            fail("invalid repetition count");
+                            return -1;
+                        }
+                    }
+                    else
+                    {
+                        break;
+                    }
+                    n = node(RegexNodeType::Repeat, n);
+                    m_nodes.at(n).min = min;
+                    m_nodes.at(n).max = max;
+                    if(m_pos < m_length && m_pattern[m_pos] == '?')
+                    {
+                        m_nodes.at(n).greedy = false;
+                        m_pos++;
+                    }
+                }
+                return n;
+            }
+
+            int parseConcatenation()
+            {
+                int n;
+                int atom;
+                n = node(RegexNodeType::Empty);
+                while(m_pos < m_length && m_pattern[m_pos] != '|' && m_pattern[m_pos] != ')')
+                {
+                    atom = parseRepeat();
+                    if(atom < 0)
+                    {
+                        return -1;
+                    }
+                    n = cat(n, atom);
+                }
+                return n;
+            }
+
+            int parseAlternation()
+            {
+                int left;
+                int right;
+                left = parseConcatenation();
+                while(left >= 0 && m_pos < m_length && m_pattern[m_pos] == '|')
+                {
+                    m_pos++;
+                    right = parseConcatenation();
+                    if(right < 0)
+                    {
+                        return -1;
+                    }
+                    left = node(RegexNodeType::Alt, left, right);
+                }
+                return left;
+            }
+
+            int emit(Regex::Op op, int x = 0, int y = 0)
+            {
+                Regex::Inst inst;
+                if(m_regex->m_program.size() >= LIT_REGEX_MAX_PROGRAM)
+                {
+                    fail("pattern is too large");
+                    return 0;
+                }
+                inst.op = op;
+                inst.x = x;
+                inst.y = y;
+                m_regex->m_program.push(inst);
+                return (int)m_regex->m_program.size() - 1;
+            }
+
+            inline int here() const
+            {
+                return (int)m_regex->m_program.size();
+            }
+
+            inline Regex::Inst& inst(int pc)
+            {
+                return m_regex->m_program.at(pc);
+            }
+
+            /* the lead and continuation bytes of any 2, 3 or 4 byte utf-8 sequence */
+            void emitMultibyte()
+            {
+                int i;
+                int lead;
+                int split;
+                int jumps[3];
+                for(lead = 0; lead < 3; lead++)
+                {
+                    split = -1;
+                    if(lead < 2)
+                    {
+                        split = emit(Regex::Op::Split, here() + 1, 0);
+                    }
+                    emit(Regex::Op::Set, REGEX_SET_LEAD2 + lead);
+                    for(i = 0; i <= lead; i++)
+                    {
+                        emit(Regex::Op::Set, REGEX_SET_CONT);
+                    }
+                    if(lead < 2)
+                    {
+                        jumps[lead] = emit(Regex::Op::Jmp);
+                        inst(split).y = here();
+                    }
+                }
+                inst(jumps[0]).x = here();
+                inst(jumps[1]).x = here();
+            }
+
+            void compileNode(int n)
+            {
+                int i;
+                int pc;
+                int loop;
+                int split;
+                size_t first;
+                RegexNode nd;
+                PCGenericArray<int> pending;
+                if(m_error != nullptr)
+                {
+                    return;
+                }
+                nd = m_nodes.at(n);
+                switch(nd.type)
+                {
+                    case RegexNodeType::Empty:
+                        break;
+                    case RegexNodeType::Byte:
+                        emit(Regex::Op::Byte, nd.value);
+                        break;
+                    case RegexNodeType::Set:
+                        {
+                            if(!nd.multibyte)
+                            {
+                                emit(Regex::Op::Set, nd.value);
+                                break;
+                            }
+                            split = emit(Regex::Op::Split, here() + 1, 0);
+                            emit(Regex::Op::Set, nd.value);
+                            pc = emit(Regex::Op::Jmp);
+                            inst(split).y = here();
+                            emitMultibyte();
+                            inst(pc).x = here();
+                        }
+                        break;
+                    case RegexNodeType::Cat:
+                        compileNode(nd.left);
+                        compileNode(nd.right);
+                        break;
+                    case RegexNodeType::Alt:
+                        {
+                            split = emit(Regex::Op::Split, here() + 1, 0);
+                            compileNode(nd.left);
+                            pc = emit(Regex::Op::Jmp);
+                            inst(split).y = here();
+                            compileNode(nd.right);
+                            inst(pc).x = here();
+                        }
+                        break;
+                    case RegexNodeType::Group:
+                        emit(Regex::Op::Save, nd.value * 2);
+                        compileNode(nd.left);
+                        emit(Regex::Op::Save, (nd.value * 2) + 1);
+                        break;
+                    case RegexNodeType::Bol:
+                        emit(Regex::Op::Bol);
+                        break;
+                    case RegexNodeType::Eol:
+                        emit(Regex::Op::Eol);
+                        break;
+                    case RegexNodeType::WordBoundary:
+                        emit(Regex::Op::WordBoundary);
+                        break;
+                    case RegexNodeType::NotWordBoundary:
+                        emit(Regex::Op::NotWordBoundary);
+                        break;
+                    case RegexNodeType::Repeat:
+                        {
+                            /* the mandatory copies; an unbounded repeat keeps the last one to loop on */
+                            first = (nd.max < 0 && nd.min > 0) ? (nd.min - 1) : nd.min;
+                            for(i = 0; i < (int)first; i++)
+                            {
+                                compileNode(nd.left);
+                            }
+                            if(nd.max < 0)
+                            {
+                                if(nd.min > 0)
+                                {
+                                    loop = here();
+                                    compileNode(nd.left);
+                                    split = emit(Regex::Op::Split);
+                                    inst(split).x = nd.greedy ? loop : here();
+                                    inst(split).y = nd.greedy ? here() : loop;
+                                }
+                                else
+                                {
+                                    split = emit(Regex::Op::Split);
+                                    compileNode(nd.left);
+                                    emit(Regex::Op::Jmp, split);
+                                    inst(split).x = nd.greedy ? (split + 1) : here();
+                                    inst(split).y = nd.greedy ? here() : (split + 1);
+                                }
+                                break;
+                            }
+                            /* optional copies; each one may end the repeat early */
+                            pending.init(m_state);
+                            for(i = nd.min; i < nd.max && m_error == nullptr; i++)
+                            {
+                                pending.push(emit(Regex::Op::Split));
+                                compileNode(nd.left);
+                            }
+                            for(first = 0; first < pending.size(); first++)
+                            {
+                                split = pending.at(first);
+                                inst(split).x = nd.greedy ? (split + 1) : here();
+                                inst(split).y = nd.greedy ? here() : (split + 1);
+                            }
+                            pending.release();
+                        }
+                        break;
+                }
+            }
+
+            void addUtfSets()
+            {
+                Regex::ByteSet set;
+                memset(&set, 0, sizeof(set));
+                regex_setAddRange(set, 0x80, 0xBF);
+                addSet(set);
+                memset(&set, 0, sizeof(set));
+                regex_setAddRange(set, 0xC0, 0xDF);
+                addSet(set);
+                memset(&set, 0, sizeof(set));
+                regex_setAddRange(set, 0xE0, 0xEF);
+                addSet(set);
+                memset(&set, 0, sizeof(set));
+                regex_setAddRange(set, 0xF0, 0xF7);
+                addSet(set);
+            }
+
+            bool compile()
+            {
+                int root;
+                size_t i;
+                addUtfSets();
+                if(m_length >= 4 && memcmp(m_pattern, "(?i)", 4) == 0)
+                {
+                    m_icase = true;
+                    m_pos = 4;
+                }
+                root = parseAlternation();
+                if(root < 0)
+                {
+                    return fail("invalid pattern");
+                }
+                if(m_pos < m_length)
+                {
+                    return fail("unmatched )");
+                }
+                emit(Regex::Op::Save, 0);
+                compileNode(root);
+                emit(Regex::Op::Save, 1);
+                emit(Regex::Op::Match);
+                if(m_error != nullptr)
+                {
+                    return false;
+                }
+                for(i = 0; i < m_regex->m_program.size(); i++)
+                {
+                    if(inst(i).op == Regex::Op::WordBoundary || inst(i).op == Regex::Op::NotWordBoundary)
+                    {
+                        /* the dfa doesn't track the previous byte */
+                        m_regex->m_dfaok = false;
+                    }
+                }
+                return true;
+            }
+    };
+
+    Regex* String::Regex::make(State* state, const char* pattern, size_t length, const char** error)
+    {
+        Regex* regex;
+        RegexCompiler compiler;
+        regex = (Regex*)regex_realloc(state, nullptr, 0, sizeof(Regex));
+        regex->m_state = state;
+        regex->m_program.init(state);
+        regex->m_sets.init(state);
+        regex->m_groups = 1;
+        regex->m_clist.dense = nullptr;
+        regex->m_nlist.dense = nullptr;
+        regex->m_scratch = nullptr;
+        regex->m_dfaok = true;
+        regex->m_dfaflushes = 0;
+        regex->m_dfastates = nullptr;
+        regex->m_dfacount = 0;
+        regex->m_dfacapacity = 0;
+        regex->m_dfabuckets = nullptr;
+        regex->m_dfabucketcount = 0;
+        regex->m_dfastart[0] = -1;
+        regex->m_dfastart[1] = -1;
+        regex->m_dfastack = nullptr;
+        compiler.init(state, regex, pattern, length);
+        if(!compiler.compile())
+        {
+            *error = compiler.m_error;
+            compiler.release();
+            destroy(state, regex);
+            return nullptr;
+        }
+        compiler.release();
+        return regex;
+    }
+
+    static void regex_cleanup(State* state, Userdata* data, bool mark)
+    {
+        if(!mark)
+        {
+            Regex::destroy(state, (Regex*)data->data);
+        }
+    }
+
+    Regex* String::Regex::fromCache(State* state, String* pattern, const char** error)
+    {
+        Value value;
+        Regex* regex;
+        Userdata* userdata;
+        if(state->regexcache.get(pattern, &value))
+        {
+            return (Regex*)Object::as<Userdata>(value)->data;
+        }
+        regex = make(state, pattern->data(), pattern->length(), error);
+        if(regex == nullptr)
+        {
+            return nullptr;
+        }
+        if(state->regexcache.size() >= LIT_REGEX_CACHE_MAX)
+        {
+            /* the dropped programs are freed along with their Userdata */
+            state->regexcache.clear();
+        }
+        userdata = Userdata::make(state, 0, true);
+        userdata->data = regex;
+        userdata->cleanup_fn = regex_cleanup;
+        state->pushRoot((Object*)userdata);
+        state->regexcache.set(pattern, userdata->asValue());
+        state->popRoot();
+        return regex;
+    }
+
+    static void regex_freeList(State* state, Regex::ThreadList* list, size_t proglen, size_t slots)
+    {
+        if(list->dense != nullptr)
+        {
+            regex_realloc(state, list->dense, sizeof(int) * proglen, 0);
+            regex_realloc(state, list->sparse, sizeof(int) * proglen, 0);
+            regex_realloc(state, list->captures, sizeof(int64_t) * proglen * slots, 0);
+            list->dense = nullptr;
+        }
+    }
+
+    void String::Regex::destroy(State* state, Regex* regex)
+    {
+        size_t slots;
+        size_t proglen;
+        proglen = regex->m_program.size();
+        slots = regex->m_groups * 2;
+        regex->dfaFlush();
+        regex_realloc(state, regex->m_dfastates, sizeof(DfaState*) * regex->m_dfacapacity, 0);
+        regex_realloc(state, regex->m_dfabuckets, sizeof(int) * regex->m_dfabucketcount, 0);
+        if(regex->m_dfastack != nullptr)
+        {
+            regex_realloc(state, regex->m_dfastack, sizeof(int) * proglen * 3, 0);
+        }
+        regex_freeList(state, &regex->m_clist, proglen, slots);
+        regex_freeList(state, &regex->m_nlist, proglen, slots);
+        if(regex->m_scratch != nullptr)
+        {
+            regex_realloc(state, regex->m_scratch, sizeof(int64_t) * slots, 0);
+        }
+        regex->m_program.release();
+        regex->m_sets.release();
+        regex_realloc(state, regex, sizeof(Regex), 0);
+    }
+
+    static void regex_initList(State* state, Regex::ThreadList* list, size_t proglen, size_t slots)
+    {
+        list->dense = (int*)regex_realloc(state, nullptr, 0, sizeof(int) * proglen);
+        list->sparse = (int*)regex_realloc(state, nullptr, 0, sizeof(int) * proglen);
+        list->captures = (int64_t*)regex_realloc(state, nullptr, 0, sizeof(int64_t) * proglen * slots);
+        list->count = 0;
+        memset(list->sparse, 0, sizeof(int) * proglen);
+    }
+
+    static inline bool regex_listHas(const Regex::ThreadList* list, int pc)
+    {
+        size_t i;
+        i = (size_t)list->sparse[pc];
+        return (i < list->count) && (list->dense[i] == pc);
+    }
+
+    static inline void regex_listAdd(Regex::ThreadList* list, int pc)
+    {
+        list->sparse[pc] = (int)list->count;
+        list->dense[list->count++] = pc;
+    }
+
+    static inline bool regex_consumes(const Regex* regex, const Regex::Inst& inst, uint8_t byte)
+    {
+        if(inst.op == Regex::Op::Byte)
+        {
+            return inst.x == byte;
+        }
+        return (inst.op == Regex::Op::Set) && regex_setHas(regex->m_sets.at(inst.x), byte);
+    }
+
+    void String::Regex::addThread(ThreadList* list, int pc, int64_t* captures, const char* subject, size_t length, size_t pos)
+    {
+        bool before;
+        bool after;
+        int64_t old;
+        const Inst* inst;
+        if(regex_listHas(list, pc))
+        {
+            return;
+        }
+        regex_listAdd(list, pc);
+        inst = &m_program.at(pc);
+        switch(inst->op)
+        {
+            case Op::Jmp:
+                addThread(list, inst->x, captures, subject, length, pos);
+                break;
+            case Op::Split:
+                addThread(list, inst->x, captures, subject, length, pos);
+                addThread(list, inst->y, captures, subject, length, pos);
+                break;
+            case Op::Save:
+                old = captures[inst->x];
+                captures[inst->x] = pos;
+                addThread(list, pc + 1, captures, subject, length, pos);
+                captures[inst->x] = old;
+                break;
+            case Op::Bol:
+                if(pos == 0)
+                {
+                    addThread(list, pc + 1, captures, subject, length, pos);
+                }
+                break;
+            case Op::Eol:
+                if(pos == length)
+                {
+                    addThread(list, pc + 1, captures, subject, length, pos);
+                }
+                break;
+            case Op::WordBoundary:
+            case Op::NotWordBoundary:
+                before = (pos > 0) && regex_isWord(subject[pos - 1]);
+                after = (pos < length) && regex_isWord(subject[pos]);
+                if((before != after) == (inst->op == Op::WordBoundary))
+                {
+                    addThread(list, pc + 1, captures, subject, length, pos);
+                }
+                break;
+            default:
+                memcpy(list->captures + (pc * m_groups * 2), captures, sizeof(int64_t) * m_groups * 2);
+                break;
+        }
+    }
+
+    bool String::Regex::pikeSearch(const char* subject, size_t length, size_t start, int64_t* captures)
+    {
+        size_t i;
+        size_t pos;
+        size_t slots;
+        bool matched;
+        int pc;
+        const Inst* inst;
+        ThreadList* clist;
+        ThreadList* nlist;
+        ThreadList* tmp;
+        slots = m_groups * 2;
+        clist = &m_clist;
+        nlist = &m_nlist;
+        clist->count = 0;
+        nlist->count = 0;
+        matched = false;
+        for(pos = start; ; pos++)
+        {
+            if(!matched)
+            {
+                /* a new attempt starting here, behind every thread that started earlier */
+                for(i = 0; i < slots; i++)
+                {
+                    m_scratch[i] = -1;
+                }
+                addThread(clist, 0, m_scratch, subject, length, pos);
+            }
+            if(clist->count == 0)
+            {
+                break;
+            }
+            for(i = 0; i < clist->count; i++)
+            {
+                pc = clist->dense[i];
+                inst = &m_program.at(pc);
+                if(inst->op == Op::Match)
+                {
+                    memcpy(captures, clist->captures + (pc * slots), sizeof(int64_t) * slots);
+                    matched = true;
+                    /* the threads after this one have lower priority */
+                    break;
+                }
+                if(pos < length && regex_consumes(this, *inst, subject[pos]))
+                {
+                    addThread(nlist, pc + 1, clist->captures + (pc * slots), subject, length, pos + 1);
+                }
+            }
+            if(pos >= length)
+            {
+                break;
+            }
+            tmp = clist;
+            clist = nlist;
+            nlist = tmp;
+            nlist->count = 0;
+        }
+        return matched;
+    }
+
+    static int regex_comparePcs(const void* a, const void* b)
+    {
+        return *(const int*)a - *(const int*)b;
+    }
+
+    /* follows the empty transitions from the pcs in $set, adding everything reachable */
+    void String::Regex::closure(ThreadList* set, bool atstart, bool atend)
+    {
+        int pc;
+        size_t i;
+        size_t top;
+        const Inst* inst;
+        top = 0;
+        for(i = 0; i < set->count; i++)
+        {
+            m_dfastack[top++] = set->dense[i];
+        }
+        set->count = 0;
+        while(top > 0)
+        {
+            pc = m_dfastack[--top];
+            if(regex_listHas(set, pc))
+            {
+                continue;
+            }
+            regex_listAdd(set, pc);
+            inst = &m_program.at(pc);
+            switch(inst->op)
+            {
+                case Op::Jmp:
+                    m_dfastack[top++] = inst->x;
+                    break;
+                case Op::Split:
+                    m_dfastack[top++] = inst->y;
+                    m_dfastack[top++] = inst->x;
+                    break;
+                case Op::Save:
+                    m_dfastack[top++] = pc + 1;
+                    break;
+                case Op::Bol:
+                    if(atstart)
+                    {
+                        m_dfastack[top++] = pc + 1;
+                    }
+                    break;
+                case Op::Eol:
+                    if(atend)
+                    {
+                        m_dfastack[top++] = pc + 1;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    /* the index of the dfa state for the leaf pcs of $set, creating it if it's new. -1 if the cache overflowed. */
+    int String::Regex::dfaIntern(ThreadList* set)
+    {
+        int pc;
+        size_t i;
+        size_t count;
+        size_t slot;
+        size_t oldcap;
+        uint32_t hash;
+        Op op;
+        DfaState* st;
+        DfaState* other;
+        /* only the pcs that consume, match, or wait for the end tell states apart */
+        count = 0;
+        for(i = 0; i < set->count; i++)
+        {
+            pc = set->dense[i];
+            op = m_program.at(pc).op;
+            if(op == Op::Byte || op == Op::Set || op == Op::Match || op == Op::Eol)
+            {
+                m_dfastack[count++] = pc;
+            }
+        }
+        qsort(m_dfastack, count, sizeof(int), regex_comparePcs);
+        hash = 2166136261u;
+        for(i = 0; i < count; i++)
+        {
+            hash = (hash ^ (uint32_t)m_dfastack[i]) * 16777619u;
+        }
+        if(m_dfabucketcount > 0)
+        {
+            slot = hash & (m_dfabucketcount - 1);
+            while(m_dfabuckets[slot] >= 0)
+            {
+                other = m_dfastates[m_dfabuckets[slot]];
+                if(other->hash == hash && other->count == count && memcmp(other->pcs, m_dfastack, sizeof(int) * count) == 0)
+                {
+                    return m_dfabuckets[slot];
+                }
+                slot = (slot + 1) & (m_dfabucketcount - 1);
+            }
+        }
+        if(m_dfacount >= LIT_REGEX_DFA_MAX_STATES)
+        {
+            dfaFlush();
+            if(++m_dfaflushes > LIT_REGEX_DFA_MAX_FLUSHES)
+            {
+                m_dfaok = false;
+            }
+            return -1;
+        }
+        st = (DfaState*)regex_realloc(m_state, nullptr, 0, sizeof(DfaState));
+        st->pcs = (int*)regex_realloc(m_state, nullptr, 0, sizeof(int) * (count + 1));
+        memcpy(st->pcs, m_dfastack, sizeof(int) * count);
+        st->count = count;
+        st->hash = hash;
+        st->matching = false;
+        st->pendingeol = false;
+        for(i = 0; i < count; i++)
+        {
+            op = m_program.at(st->pcs[i]).op;
+            st->matching = st->matching || (op == Op::Match);
+            st->pendingeol = st->pendingeol || (op == Op::Eol);
+        }
+        for(i = 0; i < 256; i++)
+        {
+            st->next[i] = -1;
+        }
+        if(m_dfacount >= m_dfacapacity)
+        {
+            oldcap = m_dfacapacity;
+            m_dfacapacity = LIT_GROW_CAPACITY(oldcap);
+            m_dfastates = (DfaState**)regex_realloc(m_state, m_dfastates, sizeof(DfaState*) * oldcap, sizeof(DfaState*) * m_dfacapacity);
+        }
+        m_dfastates[m_dfacount++] = st;
+        if((m_dfacount * 2) > m_dfabucketcount)
+        {
+            /* rebuild the buckets at twice the size */
+            oldcap = m_dfabucketcount;
+            m_dfabucketcount = (oldcap == 0) ? 16 : (oldcap * 2);
+            m_dfabuckets = (int*)regex_realloc(m_state, m_dfabuckets, sizeof(int) * oldcap, sizeof(int) * m_dfabucketcount);
+            for(i = 0; i < m_dfabucketcount; i++)
+            {
+                m_dfabuckets[i] = -1;
+            }
+            for(i = 0; i < m_dfacount; i++)
+            {
+                slot = m_dfastates[i]->hash & (m_dfabucketcount - 1);
+                while(m_dfabuckets[slot] >= 0)
+                {
+                    slot = (slot + 1) & (m_dfabucketcount - 1);
+                }
+                m_dfabuckets[slot] = (int)i;
+            }
+        }
+        else
+        {
+            slot = hash & (m_dfabucketcount - 1);
+            while(m_dfabuckets[slot] >= 0)
+            {
+                slot = (slot + 1) & (m_dfabucketcount - 1);
+            }
+            m_dfabuckets[slot] = (int)(m_dfacount - 1);
+        }
+        return (int)(m_dfacount - 1);
+    }
+
+    void String::Regex::dfaFlush()
+    {
+        size_t i;
+        for(i = 0; i < m_dfacount; i++)
+        {
+            regex_realloc(m_state, m_dfastates[i]->pcs, sizeof(int) * (m_dfastates[i]->count + 1), 0);
+            regex_realloc(m_state, m_dfastates[i], sizeof(DfaState), 0);
+        }
+        m_dfacount = 0;
+        for(i = 0; i < m_dfabucketcount; i++)
+        {
+            m_dfabuckets[i] = -1;
+        }
+        m_dfastart[0] = -1;
+        m_dfastart[1] = -1;
+    }
+
+    int String::Regex::dfaNext(int from, uint8_t byte)
+    {
+        int pc;
+        int next;
+        size_t i;
+        DfaState* st;
+        st = m_dfastates[from];
+        m_nlist.count = 0;
+        for(i = 0; i < st->count; i++)
+        {
+            pc = st->pcs[i];
+            if(regex_consumes(this, m_program.at(pc), byte))
+            {
+                m_nlist.dense[m_nlist.count++] = pc + 1;
+            }
+        }
+        /* the search is unanchored: a new attempt starts after every byte */
+        m_nlist.dense[m_nlist.count++] = 0;
+        closure(&m_nlist, false, false);
+        next = dfaIntern(&m_nlist);
+        if(next >= 0)
+        {
+            m_dfastates[from]->next[byte] = next;
+        }
+        return next;
+    }
+
+    int String::Regex::dfaSearch(const char* subject, size_t length, size_t start)
+    {
+        int pc;
+        int cur;
+        int next;
+        int atstart;
+        size_t i;
+        size_t pos;
+        DfaState* st;
+        if(!m_dfaok)
+        {
+            return -1;
+        }
+        if(m_dfastack == nullptr)
+        {
+            /* closure() pushes the seeds, plus at most two targets per pc it visits */
+            m_dfastack = (int*)regex_realloc(m_state, nullptr, 0, sizeof(int) * m_program.size() * 3);
+        }
+        atstart = (start == 0) ? 1 : 0;
+        cur = m_dfastart[atstart];
+        if(cur < 0)
+        {
+            m_nlist.count = 0;
+            m_nlist.dense[m_nlist.count++] = 0;
+            closure(&m_nlist, atstart, false);
+            cur = dfaIntern(&m_nlist);
+            if(cur < 0)
+            {
+                return -1;
+            }
+            m_dfastart[atstart] = cur;
+        }
+        for(pos = start; pos < length; pos++)
+        {
+            if(m_dfastates[cur]->matching)
+            {
+                return 1;
+            }
+            next = m_dfastates[cur]->next[(uint8_t)subject[pos]];
+            if(next < 0)
+            {
+                next = dfaNext(cur, subject[pos]);
+                if(next < 0)
+                {
+                    return -1;
+                }
+            }
+            cur = next;
+        }
+        st = m_dfastates[cur];
+        if(st->matching)
+        {
+            return 1;
+        }
+        if(st->pendingeol)
+        {
+            /* at the end of the subject, a pending $ can finally be passed */
+            m_nlist.count = 0;
+            for(i = 0; i < st->count; i++)
+            {
+                pc = st->pcs[i];
+                if(m_program.at(pc).op == Op::Eol)
+                {
+                    m_nlist.dense[m_nlist.count++] = pc + 1;
+                }
+            }
+            closure(&m_nlist, length == 0, true);
+            for(i = 0; i < m_nlist.count; i++)
+            {
+                if(m_program.at(m_nlist.dense[i]).op == Op::Match)
+                {
+                    return 1;
+                }
+            }
+        }
+        return 0;
+    }
+
+    bool String::Regex::search(const char* subject, size_t length, size_t start, int64_t* captures)
+    {
+        if(start > length)
+        {
+            return false;
+        }
+        if(m_clist.dense == nullptr)
+        {
+            regex_initList(m_state, &m_clist, m_program.size(), m_groups * 2);
+            regex_initList(m_state, &m_nlist, m_program.size(), m_groups * 2);
+            m_scratch = (int64_t*)regex_realloc(m_state, nullptr, 0, sizeof(int64_t) * m_groups * 2);
+        }
+        if(dfaSearch(subject, length, start) == 0)
+        {
+            return false;
+        }
+        return pikeSearch(subject, length, start, captures);
+    }
+}
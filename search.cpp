@@ -0,0 +1,394 @@
+#include "lit.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define LIT_SEARCH_X86
+    #include <immintrin.h>
+#endif
+
+/* needles at least this long are searched with Two-Way instead of the byte filter */
+#define LIT_SEARCH_TWOWAY_MIN 64
+
+namespace lit
+{
+    typedef size_t (*SearchFunc)(const char*, size_t, const char*, size_t, bool);
+
+    static inline uint8_t search_fold(uint8_t ch)
+    {
+        if(ch >= 'A' && ch <= 'Z')
+        {
+            return ch + ('a' - 'A');
+        }
+        return ch;
+    }
+
+    static inline uint8_t search_upper(uint8_t ch)
+    {
+        if(ch >= 'a' && ch <= 'z')
+        {
+            return ch - ('a' - 'A');
+        }
+        return ch;
+    }
+
+    static inline bool search_matchat(const char* hay, const char* needle, size_t len, bool icase)
+    {
+        size_t i;
+        if(!icase)
+        {
+            return memcmp(hay, needle, len) == 0;
+        }
+        for(i = 0; i < len; i++)
+        {
+            if(search_fold(hay[i]) != search_fold(needle[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static size_t search_scalar(const char* hay, size_t haylen, const char* needle, size_t needlelen, bool icase)
+    {
+        size_t i;
+        size_t last;
+        uint8_t lower;
+        uint8_t upper;
+        const char* p;
+        /* the SIMD kernels hand their tail over here, which can be shorter than the needle */
+        if(haylen < needlelen)
+        {
+            return StringSearch::npos;
+        }
+        last = haylen - needlelen;
+        if(!icase)
+        {
+            /* memchr to each candidate first byte, then verify */
+            i = 0;
+            while(i <= last)
+            {
+                p = (const char*)memchr(hay + i, needle[0], (last - i) + 1);
+                if(p == nullptr)
+                {
+                    return StringSearch::npos;
+                }
+                i = p - hay;
+                if(memcmp(p + 1, needle + 1, needlelen - 1) == 0)
+                {
+                    return i;
+                }
+                i++;
+            }
+            return StringSearch::npos;
+        }
+        lower = search_fold(needle[0]);
+        upper = search_upper(needle[0]);
+        for(i = 0; i <= last; i++)
+        {
+            if(((uint8_t)hay[i] == lower || (uint8_t)hay[i] == upper) && search_matchat(hay + i + 1, needle + 1, needlelen - 1, true))
+            {
+                return i;
+            }
+        }
+        return StringSearch::npos;
+    }
+
+#ifdef LIT_SEARCH_X86
+    /*
+    * compares a block of candidate positions against the needle's first and last byte at once;
+    * only positions where both match get verified.
+    */
+    __attribute__((target("sse2")))
+    static size_t search_sse2(const char* hay, size_t haylen, const char* needle, size_t needlelen, bool icase)
+    {
+        size_t i;
+        size_t found;
+        unsigned int mask;
+        __m128i flo;
+        __m128i fup;
+        __m128i llo;
+        __m128i lup;
+        __m128i bfirst;
+        __m128i blast;
+        __m128i eq;
+        flo = _mm_set1_epi8((char)(icase ? search_fold(needle[0]) : needle[0]));
+        fup = _mm_set1_epi8((char)(icase ? search_upper(needle[0]) : needle[0]));
+        llo = _mm_set1_epi8((char)(icase ? search_fold(needle[needlelen - 1]) : needle[needlelen - 1]));
+        lup = _mm_set1_epi8((char)(icase ? search_upper(needle[needlelen - 1]) : needle[needlelen - 1]));
+        i = 0;
+        while((i + needlelen - 1 + 16) <= haylen)
+        {
+            bfirst = _mm_loadu_si128((const __m128i*)(hay + i));
+            blast = _mm_loadu_si128((const __m128i*)(hay + i + needlelen - 1));
+            eq = _mm_and_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(bfirst, flo), _mm_cmpeq_epi8(bfirst, fup)),
+                _mm_or_si128(_mm_cmpeq_epi8(blast, llo), _mm_cmpeq_epi8(blast, lup))
+            );
+            mask = (unsigned int)_mm_movemask_epi8(eq);
+            while(mask != 0)
+            {
+                found = i + __builtin_ctz(mask);
+                if(search_matchat(hay + found, needle, needlelen, icase))
+                {
+                    return found;
+                }
+                mask &= mask - 1;
+            }
+            i += 16;
+        }
+        found = search_scalar(hay + i, haylen - i, needle, needlelen, icase);
+        if(found == StringSearch::npos)
+        {
+            return found;
+        }
+        return i + found;
+    }
+
+    __attribute__((target("avx2")))
+    static size_t search_avx2(const char* hay, size_t haylen, const char* needle, size_t needlelen, bool icase)
+    {
+        size_t i;
+        size_t found;
+        unsigned int mask;
+        __m256i flo;
+        __m256i fup;
+        __m256i llo;
+        __m256i lup;
+        __m256i bfirst;
+        __m256i blast;
+        __m256i eq;
+        flo = _mm256_set1_epi8((char)(icase ? search_fold(needle[0]) : needle[0]));
+        fup = _mm256_set1_epi8((char)(icase ? search_upper(needle[0]) : needle[0]));
+        llo = _mm256_set1_epi8((char)(icase ? search_fold(needle[needlelen - 1]) : needle[needlelen - 1]));
+        lup = _mm256_set1_epi8((char)(icase ? search_upper(needle[needlelen - 1]) : needle[needlelen - 1]));
+        i = 0;
+        while((i + needlelen - 1 + 32) <= haylen)
+        {
+            bfirst = _mm256_loadu_si256((const __m256i*)(hay + i));
+            blast = _mm256_loadu_si256((const __m256i*)(hay + i + needlelen - 1));
+            eq = _mm256_and_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(bfirst, flo), _mm256_cmpeq_epi8(bfirst, fup)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(blast, llo), _mm256_cmpeq_epi8(blast, lup))
+            );
+            mask = (unsigned int)_mm256_movemask_epi8(eq);
+            while(mask != 0)
+            {
+                found = i + __builtin_ctz(mask);
+                if(search_matchat(hay + found, needle, needlelen, icase))
+                {
+                    return found;
+                }
+                mask &= mask - 1;
+            }
+            i += 32;
+        }
+        found = search_sse2(hay + i, haylen - i, needle, needlelen, icase);
+        if(found == StringSearch::npos)
+        {
+            return found;
+        }
+        return i + found;
+    }
+#endif
+
+    static SearchFunc search_resolve()
+    {
+#ifdef LIT_SEARCH_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+        {
+            return search_avx2;
+        }
+        if(__builtin_cpu_supports("sse2"))
+        {
+            return search_sse2;
+        }
+#endif
+        return search_scalar;
+    }
+
+    static inline uint8_t search_canon(const char* s, size_t i, bool icase)
+    {
+        if(icase)
+        {
+            return search_fold(s[i]);
+        }
+        return (uint8_t)s[i];
+    }
+
+    /*
+    * critical factorization of the needle: the split point, and the period of its right half.
+    * computed as the later of the maximal suffixes under both orderings (Crochemore-Perrin).
+    */
+    static size_t search_factorize(const char* needle, size_t needlelen, bool icase, size_t* period)
+    {
+        size_t j;
+        size_t k;
+        size_t p;
+        size_t ms;
+        size_t msrev;
+        uint8_t a;
+        uint8_t b;
+        ms = (size_t)-1;
+        j = 0;
+        k = 1;
+        p = 1;
+        while(j + k < needlelen)
+        {
+            a = search_canon(needle, j + k, icase);
+            b = search_canon(needle, ms + k, icase);
+            if(a < b)
+            {
+                j += k;
+                k = 1;
+                p = j - ms;
+            }
+            else if(a == b)
+            {
+                if(k != p)
+                {
+                    k++;
+                }
+                else
+                {
+                    j += p;
+                    k = 1;
+                }
+            }
+            else
+            {
+                ms = j++;
+                k = p = 1;
+            }
+        }
+        *period = p;
+        msrev = (size_t)-1;
+        j = 0;
+        k = 1;
+        p = 1;
+        while(j + k < needlelen)
+        {
+            a = search_canon(needle, j + k, icase);
+            b = search_canon(needle, msrev + k, icase);
+            if(b < a)
+            {
+                j += k;
+                k = 1;
+                p = j - msrev;
+            }
+            else if(a == b)
+            {
+                if(k != p)
+                {
+                    k++;
+                }
+                else
+                {
+                    j += p;
+                    k = 1;
+                }
+            }
+            else
+            {
+                msrev = j++;
+                k = p = 1;
+            }
+        }
+        if((msrev + 1) < (ms + 1))
+        {
+            return ms + 1;
+        }
+        *period = p;
+        return msrev + 1;
+    }
+
+    static size_t search_twoway(const char* hay, size_t haylen, const char* needle, size_t needlelen, bool icase)
+    {
+        size_t i;
+        size_t j;
+        size_t split;
+        size_t period;
+        size_t memory;
+        split = search_factorize(needle, needlelen, icase, &period);
+        if(search_matchat(needle, needle + period, split, icase))
+        {
+            /* periodic needle: remember how much of the right half already matched */
+            memory = 0;
+            j = 0;
+            while(j + needlelen <= haylen)
+            {
+                i = (split > memory) ? split : memory;
+                while(i < needlelen && search_canon(needle, i, icase) == search_canon(hay, i + j, icase))
+                {
+                    i++;
+                }
+                if(i >= needlelen)
+                {
+                    i = split - 1;
+                    while(memory < i + 1 && search_canon(needle, i, icase) == search_canon(hay, i + j, icase))
+                    {
+                        i--;
+                    }
+                    if(i + 1 < memory + 1)
+                    {
+                        return j;
+                    }
+                    j += period;
+                    memory = needlelen - period;
+                }
+                else
+                {
+                    j += i - split + 1;
+                    memory = 0;
+                }
+            }
+            return StringSearch::npos;
+        }
+        /* the halves differ, so any mismatch allows a maximal shift */
+        period = ((split > (needlelen - split)) ? split : (needlelen - split)) + 1;
+        j = 0;
+        while(j + needlelen <= haylen)
+        {
+            i = split;
+            while(i < needlelen && search_canon(needle, i, icase) == search_canon(hay, i + j, icase))
+            {
+                i++;
+            }
+            if(i >= needlelen)
+            {
+                i = split - 1;
+                while(i != (size_t)-1 && search_canon(needle, i, icase) == search_canon(hay, i + j, icase))
+                {
+                    i--;
+                }
+                if(i == (size_t)-1)
+                {
+                    return j;
+                }
+                j += period;
+            }
+            else
+            {
+                j += i - split + 1;
+            }
+        }
+        return StringSearch::npos;
+    }
+
+    size_t StringSearch::find(const char* hay, size_t haylen, const char* needle, size_t needlelen, bool icase)
+    {
+        static const SearchFunc bytefilter = search_resolve();
+        if(needlelen == 0)
+        {
+            return 0;
+        }
+        if(needlelen > haylen)
+        {
+            return npos;
+        }
+        if(needlelen >= LIT_SEARCH_TWOWAY_MIN)
+        {
+            return search_twoway(hay, haylen, needle, needlelen, icase);
+        }
+        return bytefilter(hay, haylen, needle, needlelen, icase);
+    }
+}
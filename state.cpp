@@ -1,13 +1,26 @@
 
 #include "lit.h"
 #include "priv.h"
+#if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+    #include <unistd.h>
+#endif
 
 namespace lit
 {
+    /* whether output to $fh should show up line by line, as stdio decides for stdout */
+    static bool state_isterminal(FILE* fh)
+    {
+        #if defined(__unix__) || defined(__linux__) || defined(__APPLE__)
+            return isatty(fileno(fh));
+        #else
+            (void)fh;
+            return true;
+        #endif
+    }
+
     void State::init(VM* vm)
     {
         vm->reset(this);
-        vm->globals = Map::make(this);
         vm->modules = Map::make(this);
     }
 
@@ -15,6 +28,9 @@ namespace lit
     {
         State* state;
         state = (State*)malloc(sizeof(State));
+        state->m_nativejump = nullptr;
+        state->m_quickarrayversion = UINT64_MAX;
+        state->m_quickstringversion = UINT64_MAX;
         state->kernelvalue_class = nullptr;
         state->classvalue_class = nullptr;
         state->objectvalue_class = nullptr;
@@ -37,7 +53,12 @@ namespace lit
         state->root_count = 0;
         state->root_capacity = 0;
         state->last_module = nullptr;
+        state->regexcache.init(state);
+        state->formatcache.init(state);
         state->debugwriter.initFile(state, stdout, true);
+        state->stdoutwriter.initBufferedFile(state, stdout, state_isterminal(stdout));
+        /* stderr is never held back for long: its users flush it after every call */
+        state->stderrwriter.initBufferedFile(state, stderr, true);
         state->preprocessor = (AST::Preprocessor*)malloc(sizeof(AST::Preprocessor));
         state->preprocessor->init(state);
         state->scanner = (AST::Scanner*)malloc(sizeof(AST::Scanner));
@@ -50,13 +71,34 @@ namespace lit
         state->vm = (VM*)malloc(sizeof(VM));
         state->init(state->vm);
         init_api(state);
+        init_symbols(state);
         Builtins::lit_open_core_library(state);
         return state;
     }
 
+    void State::init_symbols(State* state)
+    {
+        size_t i;
+        static const char* names[] = {
+            #define SYMBOL(name, str) str,
+            #include "symbol.inc"
+            #undef SYMBOL
+        };
+        for(i = 0; i < LITSYM_TOTAL; i++)
+        {
+            state->symbols[i] = nullptr;
+        }
+        for(i = 0; i < LITSYM_TOTAL; i++)
+        {
+            state->symbols[i] = String::copy(state, names[i], strlen(names[i]));
+        }
+    }
+
     int64_t State::release()
     {
         int64_t amount;
+        this->stdoutwriter.release();
+        this->stderrwriter.release();
         if(this->roots != nullptr)
         {
             free(this->roots);
@@ -71,6 +113,8 @@ namespace lit
         this->emitter->release();
         free(this->emitter);
         free(this->optimizer);
+        this->regexcache.release();
+        this->formatcache.release();
         this->vm->release();
         free(this->vm);
         amount = this->bytes_allocated;
@@ -283,7 +327,7 @@ namespace lit
             return Result{LITRESULT_RUNTIME_ERROR, Object::NullVal};
         }
         klass = Class::getClassFor(this, callee);
-        if((Object::isInstance(callee) && Object::as<Instance>(callee)->fields.get(method_name, &mthval)) || klass->methods.get(method_name, &mthval))
+        if((Object::isInstance(callee) && Object::as<Instance>(callee)->getField(method_name, &mthval)) || klass->methods.get(method_name, &mthval))
         {
             return this->callMethod(callee, mthval, argv, argc);
         }
@@ -310,6 +354,7 @@ namespace lit
     Result State::callMethod(Value instance, Value callee, Value* argv, size_t argc)
     {
         uint8_t i;
+        jmp_buf toplevel;
         VM* vm;
         Result lir;
         Object::Type type;
@@ -325,9 +370,18 @@ namespace lit
         vm = this->vm;
         if(Object::isObject(callee))
         {
-            if(this->set_native_exit_jump())
+            if(this->m_nativejump == nullptr)
             {
-                return Result{LITRESULT_RUNTIME_ERROR, Object::NullVal};
+                /* called from outside any interpreter loop, so nothing else would catch a native's error */
+                if(setjmp(toplevel))
+                {
+                    this->m_nativejump = nullptr;
+                    return Result{LITRESULT_RUNTIME_ERROR, Object::NullVal};
+                }
+                this->m_nativejump = &toplevel;
+                lir = this->callMethod(instance, callee, argv, argc);
+                this->m_nativejump = nullptr;
+                return lir;
             }
             type = Object::asObject(callee)->type;
 
@@ -432,7 +486,7 @@ namespace lit
         }
         if(Object::isNull(callee))
         {
-            lit_runtime_error(vm, "attempt to call a null value of a '%s'", Object::toString(this, instance)->data());
+            lit_runtime_error(vm, "attempt to call a null value of a '%s'", Object::toString(this, instance)->cstr());
         }
         else
         {
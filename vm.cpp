@@ -29,9 +29,43 @@ namespace lit
         this->markObject((Object*)state->api_name);
         this->markObject((Object*)state->api_function);
         this->markObject((Object*)state->api_fiber);
+        for(i = 0; i < LITSYM_TOTAL; i++)
+        {
+            this->markObject((Object*)state->symbols[i]);
+        }
         state->preprocessor->defined.markForGC(this);
+        state->regexcache.markForGC(this);
+        state->formatcache.markForGC(this);
         this->modules->m_values.markForGC(this);
-        this->globals->m_values.markForGC(this);
+        this->globalslots.markForGC(this);
+        this->markArray(&this->globalvalues);
+    }
+
+    size_t VM::globalSlot(String* name)
+    {
+        size_t slot;
+        if(this->findGlobalSlot(name, &slot))
+        {
+            return slot;
+        }
+        slot = this->globalvalues.m_count;
+        m_state->pushRoot((Object*)name);
+        this->globalvalues.push(Object::NullVal);
+        this->globalnames.push(name);
+        this->globalslots.set(name, Object::toValue(slot));
+        m_state->popRoot();
+        return slot;
+    }
+
+    bool VM::findGlobalSlot(String* name, size_t* dest)
+    {
+        Value slot;
+        if(!this->globalslots.get(name, &slot))
+        {
+            return false;
+        }
+        *dest = (size_t)Object::toNumber(slot);
+        return true;
     }
 
 
@@ -86,6 +120,7 @@ namespace lit
         frame = &fiber->m_allframes[fiber->m_framecount++];
         frame->function = function;
         frame->closure = closure;
+        function->m_hotness++;
         frame->ip = function->chunk.m_code;
         frame->slots = fiber->m_stacktop - arg_count - 1;
         frame->result_ignored = false;
@@ -186,6 +221,7 @@ namespace lit
         Class* klass;
         BoundMethod* bound_method;
         Field* field;
+        String* string;
 
     #ifdef LIT_LOG_BLACKING
         printf("%p blacken ", (void*)obj);
@@ -199,8 +235,22 @@ namespace lit
             case Object::Type::NativeMethod:
             case Object::Type::PrimitiveMethod:
             case Object::Type::Range:
+                {
+                }
+                break;
             case Object::Type::String:
                 {
+                    string = (String*)obj;
+                    if(string->isRope())
+                    {
+                        markObject((Object*)string->m_left);
+                        markObject((Object*)string->m_right);
+                    }
+                    else if(string->isSlice())
+                    {
+                        /* the parent is dealt with once marking is done; see settleSlices() */
+                        this->grayslices.push(string);
+                    }
                 }
                 break;
             case Object::Type::Userdata:
@@ -287,13 +337,15 @@ namespace lit
                     this->markObject((Object*)klass->super);
                     klass->methods.markForGC(this);
                     klass->static_fields.markForGC(this);
+                    if(klass->m_rootshape != nullptr)
+                    {
+                        klass->m_rootshape->markForGC(this);
+                    }
                 }
                 break;
             case Object::Type::Instance:
                 {
-                    Instance* instance = (Instance*)obj;
-                    this->markObject((Object*)instance->klass);
-                    instance->fields.markForGC(this);
+                    ((Instance*)obj)->markForGC(this);
                 }
                 break;
             case Object::Type::BoundMethod:
@@ -343,6 +395,33 @@ namespace lit
         }
     }
 
+    void VM::settleSlices()
+    {
+        size_t i;
+        String* slice;
+        String* parent;
+        /*
+        * a small slice that is the only thing left referencing a much larger
+        * string gets its own copy, so the larger string can be collected.
+        */
+        for(i = 0; i < this->grayslices.m_count; i++)
+        {
+            slice = this->grayslices.m_values[i];
+            parent = slice->m_parent;
+            if((parent != nullptr) && !parent->marked && ((slice->m_length * LIT_SLICE_DETACH_RATIO) < parent->m_length))
+            {
+                slice->detach();
+            }
+        }
+        for(i = 0; i < this->grayslices.m_count; i++)
+        {
+            this->markObject((Object*)this->grayslices.m_values[i]->m_parent);
+        }
+        this->grayslices.m_count = 0;
+        /* parents are never ropes or slices themselves, so this doesn't find any new slices */
+        this->traceReferences();
+    }
+
     void VM::sweep()
     {
         Object* unreached;
@@ -396,6 +475,7 @@ namespace lit
 
         markRoots();
         this->traceReferences();
+        this->settleSlices();
         this->strings.removeWhite();
         this->sweep();
         m_state->next_gc = m_state->bytes_allocated * LIT_GC_HEAP_GROW_FACTOR;